@@ -18,7 +18,8 @@
   seems to work best if you use an image of at least 200x200.  Smaller
   images give pretty approximate results.
 
-  The class handles resizing and normalizing the input image with the set_input function.
+  The class handles resizing and normalizing the input image with the set_input function,
+  in one pass that fills the input tensor.
 
   The function run_network applies the current input image to the
   network. The result is resized back to the specified image size.
@@ -32,8 +33,10 @@
 #include <cstring>
 #include <cmath>
 #include <array>
+#include <vector>
 #include <onnxruntime_cxx_api.h>
 #include <opencv2/opencv.hpp>
+#include "instrument.h"
 
 class DA2Network {
 public:
@@ -85,21 +88,26 @@ public:
   // Rescales and normalizes the image data appropriate for the network
   // scale_factor lets the user resize the image for application to the network
   // smaller images are faster to process, images smaller than 200x200 don't work as well
+  //
+  // Resizing, BGR to RGB, normalization and the split into color planes are
+  // one pass that writes straight into the input tensor.  Normalization is a
+  // table lookup per 8-bit value, and since it is affine, the resize
+  // interpolates normalized values rather than going through a resized image.
   int set_input( const cv::Mat &src, const float scale_factor = 1.0 ) {
-    cv::Mat tmp;
+    INSTRUMENT_SCOPE("da2/pre");
 
-    // check if we need to resize the input image before applying it to the network
+    // size of the image applied to the network, rounded as cv::resize rounds it
+    int rows = src.rows;
+    int cols = src.cols;
     if( scale_factor != 1.0 ) {
-      cv::resize( src, tmp, cv::Size(), scale_factor, scale_factor );
-    }
-    else {
-      tmp = src;
+      rows = (int)std::lround( src.rows * (double)scale_factor );
+      cols = (int)std::lround( src.cols * (double)scale_factor );
     }
 
     // check if we need to allocate memory for the input tensor
-    if( tmp.rows != this->height_ || tmp.cols != this->width_ ) {
-      this->height_ = tmp.rows; // tmp is the image being applied to the network
-      this->width_ = tmp.cols;
+    if( rows != this->height_ || cols != this->width_ ) {
+      this->height_ = rows;
+      this->width_ = cols;
 
       if(this->input_data != NULL) {
 	delete[] this->input_data;
@@ -122,18 +130,59 @@ public:
 							    this->input_shape_.size());
     }
 
-    // copy the data over to the input tensor data
     // remember, the input data uses a plane representation per color channel, not interleaved
     const int image_size = this->height_ * this->width_;
-    for(int i=0;i<tmp.rows;i++) {
-      cv::Vec3b *ptr = tmp.ptr<cv::Vec3b>(i);
-      float *fptrR = &(this->input_data[i*this->width_]);
-      float *fptrG = &(this->input_data[image_size + i*this->width_]);
-      float *fptrB = &(this->input_data[image_size*2 + i*this->width_]);
-      for(int j=0;j<tmp.cols;j++) {
-	fptrR[j] = ((ptr[j][2]/255.0) - 0.485) / 0.229;
-	fptrG[j] = ((ptr[j][1]/255.0) - 0.456) / 0.224;
-	fptrB[j] = ((ptr[j][0]/255.0) - 0.406) / 0.225;
+    const NormalizeTable &table = normalize_table();
+    const float *lutR = table.plane[0];
+    const float *lutG = table.plane[1];
+    const float *lutB = table.plane[2];
+
+    if( rows == src.rows && cols == src.cols ) {
+      for(int i=0;i<rows;i++) {
+	const unsigned char *ptr = src.ptr<unsigned char>(i);
+	float *fptrR = &(this->input_data[i*cols]);
+	float *fptrG = &(this->input_data[image_size + i*cols]);
+	float *fptrB = &(this->input_data[image_size*2 + i*cols]);
+	for(int j=0;j<cols;j++, ptr += 3) {
+	  fptrR[j] = lutR[ptr[2]];
+	  fptrG[j] = lutG[ptr[1]];
+	  fptrB[j] = lutB[ptr[0]];
+	}
+      }
+      return(0);
+    }
+
+    // bilinear weights, mapping pixel centers as cv::resize does for a scale factor
+    std::vector<int> left(cols), right(cols);
+    std::vector<float> weight(cols);
+    bilinear_taps( src.cols, cols, 1.0 / scale_factor, left.data(), right.data(), weight.data() );
+    for(int j=0;j<cols;j++) {
+      left[j] *= 3; // byte offsets of the BGR pixels
+      right[j] *= 3;
+    }
+    std::vector<int> top(rows), bottom(rows);
+    std::vector<float> row_weight(rows);
+    bilinear_taps( src.rows, rows, 1.0 / scale_factor, top.data(), bottom.data(), row_weight.data() );
+
+    for(int i=0;i<rows;i++) {
+      const unsigned char *a = src.ptr<unsigned char>(top[i]);
+      const unsigned char *b = src.ptr<unsigned char>(bottom[i]);
+      const float wy = row_weight[i];
+      float *fptrR = &(this->input_data[i*cols]);
+      float *fptrG = &(this->input_data[image_size + i*cols]);
+      float *fptrB = &(this->input_data[image_size*2 + i*cols]);
+      for(int j=0;j<cols;j++) {
+	const int l = left[j], r = right[j];
+	const float wx = weight[j];
+	float upper = lutR[a[l+2]] + wx * (lutR[a[r+2]] - lutR[a[l+2]]);
+	float lower = lutR[b[l+2]] + wx * (lutR[b[r+2]] - lutR[b[l+2]]);
+	fptrR[j] = upper + wy * (lower - upper);
+	upper = lutG[a[l+1]] + wx * (lutG[a[r+1]] - lutG[a[l+1]]);
+	lower = lutG[b[l+1]] + wx * (lutG[b[r+1]] - lutG[b[l+1]]);
+	fptrG[j] = upper + wy * (lower - upper);
+	upper = lutB[a[l]] + wx * (lutB[a[r]] - lutB[a[l]]);
+	lower = lutB[b[l]] + wx * (lutB[b[r]] - lutB[b[l]]);
+	fptrB[j] = upper + wy * (lower - upper);
       }
     }
 
@@ -154,7 +203,12 @@ public:
     // run the network, it will dynamically allocate the necessary output memory
     const char* input_names[] = { input_names_ };
     const char* output_names[] = { output_names_ };
-    auto outputTensor = session_->Run(run_options, input_names, &input_tensor_, 1, output_names, 1);
+    std::vector<Ort::Value> outputTensor;
+    {
+      INSTRUMENT_SCOPE("da2/infer");
+      outputTensor = session_->Run(run_options, input_names, &input_tensor_, 1, output_names, 1);
+    }
+    INSTRUMENT_SCOPE("da2/post");
 
     // get the output data size (not quite the same as the input size)
     auto outputInfo = outputTensor[0].GetTensorTypeAndShapeInfo();
@@ -241,6 +295,48 @@ public:
 
 
 private:
+  // normalized value of every 8-bit level, per tensor plane (R, G, B)
+  struct NormalizeTable {
+    float plane[3][256];
+  };
+
+  // computed once, with the same double-precision expression the per-pixel loop used
+  static const NormalizeTable &normalize_table() {
+    static const NormalizeTable table = [] {
+      const double mean[3] = { 0.485, 0.456, 0.406 };
+      const double stdev[3] = { 0.229, 0.224, 0.225 };
+      NormalizeTable t;
+      for(int c=0;c<3;c++) {
+	for(int v=0;v<256;v++) {
+	  t.plane[c][v] = ((v/255.0) - mean[c]) / stdev[c];
+	}
+      }
+      return t;
+    }();
+    return table;
+  }
+
+  // For each of n output positions, the two source positions it blends and the weight of the second,
+  // with the half-pixel center mapping and edge clamping of cv::resize's INTER_LINEAR
+  static void bilinear_taps( int src_n, int n, double inverse_scale, int *first, int *second, float *weight ) {
+    for(int k=0;k<n;k++) {
+      double pos = (k + 0.5) * inverse_scale - 0.5;
+      if( pos < 0 ) {
+	pos = 0;
+      }
+      int i = (int)pos;
+      if( i >= src_n - 1 ) {
+	first[k] = second[k] = src_n - 1;
+	weight[k] = 0.0f;
+      }
+      else {
+	first[k] = i;
+	second[k] = i + 1;
+	weight[k] = (float)(pos - i);
+      }
+    }
+  }
+
   // height and width of the most recent input
   int height_ = 0;
   int width_ = 0;
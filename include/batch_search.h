@@ -0,0 +1,75 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 10, 2025
+ * Purpose: Blocked query x database distance computation for many targets at once
+ */
+
+#ifndef PROJ2_BATCH_SEARCH_H
+#define PROJ2_BATCH_SEARCH_H
+
+#include "feature_matrix.h"
+#include <utility>
+#include <vector>
+
+// Distance families that have a blocked (GEMM-style) kernel
+enum class BatchMetric {
+    SSD,        // sqrt(|a|^2 + |b|^2 - 2ab), same ranking as calculate_ssd
+    COSINE,     // 1 - ab / (|a||b|), same as calculate_cosine_distance
+    HISTOGRAM   // mean over segments of (1 - histogram intersection)
+};
+
+/**
+ * @brief Finds the top N database rows for every query row.
+ *
+ * The database is swept in tiles that are packed dimension-major, and each
+ * tile is scored against a block of queries before moving on, so every
+ * database value is loaded once per query block instead of once per query.
+ * Query blocks are spread over worker threads.
+ *
+ * @param database Feature rows to search.
+ * @param queries Query feature vectors, same number of columns as the database.
+ * @param exclude For each query, a database row to skip (the target itself) or -1.
+ * @param metric Distance family to use.
+ * @param segments For HISTOGRAM, the number of equal-width histograms that are
+ *                 concatenated in each row (1 for rgb-hist, 2 for multi-hist, 9 for grid-3x3).
+ * @param N Number of matches to keep per query.
+ * @param results Output, one list of (distance, database row) per query, best first.
+ * @param num_threads Worker threads, 0 to use the hardware concurrency.
+ * @return non-zero failure.
+ */
+int batch_find_topN(const FeatureMatrix &database, const FeatureMatrix &queries,
+                    const std::vector<int> &exclude, BatchMetric metric, int segments, int N,
+                    std::vector<std::vector<std::pair<float, int>>> &results, int num_threads = 0);
+
+/**
+ * @brief Finds every pair of database rows whose distance is at most threshold.
+ *
+ * Same tiling as batch_find_topN with the database joined against itself;
+ * tiles entirely below the diagonal are skipped. The tiles only screen the
+ * pairs (with a margin for their rounding), and each pair is confirmed with
+ * batch_pair_distance, so the result does not depend on the tiling.
+ *
+ * @param database Feature rows to join with themselves.
+ * @param metric Distance family to use.
+ * @param segments For HISTOGRAM, the number of concatenated histograms.
+ * @param threshold Maximum distance for a pair to be reported.
+ * @param pairs Output pairs (i, j) with i < j, in no particular order.
+ * @param num_threads Worker threads, 0 to use the hardware concurrency.
+ * @return non-zero failure.
+ */
+int batch_find_pairs_within(const FeatureMatrix &database, BatchMetric metric, int segments, float threshold,
+                            std::vector<std::pair<int, int>> &pairs, int num_threads = 0);
+
+/**
+ * @brief Computes one distance with the same definition the blocked kernels use.
+ *
+ * @param metric Distance family.
+ * @param segments For HISTOGRAM, the number of concatenated histograms.
+ * @param a First vector.
+ * @param b Second vector.
+ * @param dims Length of both vectors.
+ * @return float Distance value.
+ */
+float batch_pair_distance(BatchMetric metric, int segments, const float *a, const float *b, int dims);
+
+#endif //PROJ2_BATCH_SEARCH_H
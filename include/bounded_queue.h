@@ -0,0 +1,63 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 20, 2025
+ * Purpose: Blocking FIFO with a fixed capacity, used between pipeline stages
+ */
+
+#ifndef PROJ2_BOUNDED_QUEUE_H
+#define PROJ2_BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+/**
+ * @brief Multi-producer, multi-consumer queue holding at most `capacity` items.
+ *
+ * push() blocks while the queue is full, which is what slows a fast stage down
+ * to the pace of the one after it. close() wakes everyone: later pushes fail and
+ * pop() fails once the remaining items are drained.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_) return false;
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    bool closed_ = false;
+    std::deque<T> items_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
+#endif //PROJ2_BOUNDED_QUEUE_H
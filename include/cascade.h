@@ -0,0 +1,93 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 25, 2025
+ * Purpose: Cascaded ranking. A cheap first stage scans every row and keeps the
+ * best M; later stages compute the full weighted metric on the survivors only.
+ */
+
+#ifndef PROJ2_CASCADE_H
+#define PROJ2_CASCADE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Where a term reads its values from
+enum class TermSource {
+    FEATURE,      // the row of the feature file
+    EMBEDDING,    // the ResNet18 row aligned with it
+    EMBEDDING_Q8  // the ResNet18 row quantized to 8 bits at load (see prepare_cascade)
+};
+
+// Distance a term computes on its slice
+enum class TermDistance {
+    COSINE,            // calculate_cosine_distance
+    FACE,              // face_distance, cosine that skips the face flag
+    HIST_INTERSECTION, // raw intersection, as the banana metric adds it
+    HIST_DISTANCE,     // 1 - intersection
+    TEXTURE_COLOR      // calculate_textureColor_distance
+};
+
+// One weighted distance of a stage score, computed on values [offset, offset + length) of the row
+struct CascadeTerm {
+    TermSource source = TermSource::FEATURE;
+    TermDistance distance = TermDistance::COSINE;
+    double weight = 1.0;
+    int offset = 0;
+    int length = -1; // -1 for the rest of the row
+};
+
+struct CascadeStage {
+    std::string name;
+    std::vector<CascadeTerm> terms; // score = sum of weight * distance
+    int keep = 0;                   // rows passed on to the next stage; ignored for the last stage, which keeps N
+};
+
+struct CascadePlan {
+    std::vector<CascadeStage> stages;
+    bool skip_zero_last = false; // skip rows whose last value is 0 (banana: no blob was accepted)
+};
+
+// Query-time settings shared by the fused metrics
+struct CascadeOptions {
+    int prefilter = 200;         // rows the first stage keeps, 0 to score every row with the full metric
+    std::vector<double> weights; // replaces the term weights of every stage with as many terms, in order
+    bool log_recall = false;     // also rank exhaustively and report the recall of the cascade
+};
+
+void set_cascade_options(const CascadeOptions &options);
+const CascadeOptions &get_cascade_options();
+
+/**
+ * @brief Builds the plan for a fused metric from its full-metric terms and the
+ *        cheaper terms of its prefilter, applying the current CascadeOptions.
+ *
+ * @param name Metric name, used in the recall log.
+ * @param prefilter Terms of the first stage.
+ * @param fused Terms of the final stage.
+ */
+CascadePlan make_cascade_plan(const std::string &name, const std::vector<CascadeTerm> &prefilter,
+                              const std::vector<CascadeTerm> &fused);
+
+/**
+ * @brief Ranks data against the target through the stages of a plan.
+ *
+ * Terms that read the embedding are left out when the target has none
+ * (target_rnn empty). A prefilter that loses a term that way is skipped, so
+ * every row reaches the full metric.
+ *
+ * @param result The N best (score, row) pairs, best first.
+ * @return non-zero if a term reads values the rows do not have.
+ */
+int run_cascade(const CascadePlan &plan, std::vector<float> &target, std::vector<float> &target_rnn,
+                int target_index, std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &rnnData,
+                int N, std::vector<std::pair<float, int>> &result);
+
+/**
+ * @brief Quantizes the ResNet18 rows for the EMBEDDING_Q8 terms. Registered as
+ *        the prepare step of the fused metrics; without it those terms fall
+ *        back to the float embedding.
+ */
+int prepare_cascade(std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &rnnData);
+
+#endif //PROJ2_CASCADE_H
@@ -0,0 +1,32 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 14, 2025
+ * Purpose: 64-bit content hashing for files and pixel buffers
+ */
+
+#ifndef PROJ2_CONTENT_HASH_H
+#define PROJ2_CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Hashes a block of bytes (MurmurHash64A).
+ *
+ * @param data Bytes to hash.
+ * @param len Number of bytes.
+ * @param seed Starting value; pass the previous hash to chain blocks.
+ * @return uint64_t Hash value.
+ */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed = 0x5330c0ffee5330ULL);
+
+/**
+ * @brief Hashes the contents of a file, read in fixed 1 MB blocks chained through the seed.
+ *
+ * @param filename Path of the file.
+ * @param hash Output hash value.
+ * @return non-zero if the file can not be read.
+ */
+int hash_file_contents(const char *filename, uint64_t &hash);
+
+#endif //PROJ2_CONTENT_HASH_H
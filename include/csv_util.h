@@ -29,6 +29,25 @@
 int append_image_data_csv( char *filename, char *image_filename, std::vector<float> &image_data, int reset_file = 0 );
 
 
+/*
+  Given a filename, a list of image filenames, and one feature vector
+  per image, writes the whole table to the CSV format file in a single
+  pass, replacing any existing contents. Rows use the same format as
+  append_image_data_csv.
+
+  The function returns a non-zero value in case of an error.
+ */
+int write_image_data_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<float>> &data );
+
+/*
+  Given an open file, an image filename, and the image features, writes
+  one row in the same format as append_image_data_csv without opening
+  or closing the file, for callers that stream many rows.
+
+  The function returns a non-zero value in case of an error.
+ */
+int write_image_data_row( FILE *fp, const char *image_filename, std::vector<float> &image_data );
+
 /*
   Given a file with the format of a string as the first column and
   floating point numbers as the remaining columns, this function
@@ -45,4 +64,15 @@ int append_image_data_csv( char *filename, char *image_filename, std::vector<flo
  */
 int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<float>> &data, int echo_file = 0 );
 
+/*
+  Given a file with the same format and a byte offset into it, reads
+  the rows that start at or after the offset, in file order, so rows
+  appended since an earlier read can be picked up without reading the
+  whole file again. Only complete lines are read; end_offset is set to
+  where the next call should start.
+
+  The function returns a non-zero value if something goes wrong.
+ */
+int read_image_data_csv_tail( char *filename, long long offset, std::vector<char *> &filenames, std::vector<std::vector<float>> &data, long long &end_offset );
+
 #endif
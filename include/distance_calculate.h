@@ -15,6 +15,22 @@
  * @return float SSD value.
  */
 float calculate_ssd(std::vector<float>& v1, std::vector<float>& v2);
+// Same as above on raw pointers to n values, so rows of a FeatureMatrix can be compared without copies
+float calculate_ssd(const float *v1, const float *v2, int n);
+/**
+ * @brief Squared SSD that gives up once it exceeds a bound.
+ *
+ * The running sum is checked against bound every SSD_ABANDON_BLOCK
+ * dimensions, so rows whose columns were put in decreasing variance order
+ * (prepare_ssd_order) abandon far rows early.
+ *
+ * @param v1 First feature vector.
+ * @param v2 Second feature vector.
+ * @param n Number of values.
+ * @param bound Squared distance to beat.
+ * @return the squared distance, or a partial sum greater than bound if the scan was abandoned.
+ */
+float calculate_ssd_squared_bounded(const float *v1, const float *v2, int n, float bound);
 /**
  * @brief Computes the histogram intersection between two normalized histograms.
  *
@@ -23,6 +39,7 @@ float calculate_ssd(std::vector<float>& v1, std::vector<float>& v2);
  * @return float Histogram intersection value.
  */
 float calculate_histogramIntersection(std::vector<float>& hist1, std::vector<float>& hist2);
+float calculate_histogramIntersection(const float *hist1, const float *hist2, int n);
 
 /**
  * @brief Computes the Cosine Distance between two feature vectors.
@@ -32,6 +49,7 @@ float calculate_histogramIntersection(std::vector<float>& hist1, std::vector<flo
  * @return Cosine Distance in the range [0, 1], where 0 means identical vectors.
  */
 float calculate_cosine_distance(std::vector<float>& vec1, std::vector<float>& vec2);
+float calculate_cosine_distance(const float *vec1, const float *vec2, int n);
 
 
 // Function to normalize a vector using L2 normalization (used in cosine distance)
@@ -44,12 +62,25 @@ float calculate_cosine_distance(std::vector<float>& vec1, std::vector<float>& ve
 //  * @param hist2 Second concatenated histogram.
 //  * @return float Distance value.
 float calculate_multiHist_distance(std::vector<float> &hist1, std::vector<float> &hist2);
+float calculate_multiHist_distance(const float *hist1, const float *hist2, int n);
+
+/**
+ * @brief Region-segmented histogram distance: the mean over regions of (1 - intersection).
+ *
+ * @param hist1 First row of concatenated region histograms.
+ * @param hist2 Second row, same layout.
+ * @param n Length of both rows.
+ * @param regions Number of equal-length histograms in a row.
+ * @return float Distance in [0, 1].
+ */
+float calculate_region_distance(const float *hist1, const float *hist2, int n, int regions);
 
 // Function to calculate distance between two texture-color histograms
 //  * @param hist1 First texture-color histogram.
 //  * @param hist2 Second texture-color histogram.
 //  * @return float Distance value.
 float calculate_textureColor_distance(std::vector<float>& hist1, std::vector<float>& hist2);
+float calculate_textureColor_distance(const float *hist1, const float *hist2, int n);
 
 #endif //PROJ2_DISTANCE_CALCULATE_H
 
@@ -0,0 +1,70 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 20, 2025
+ * Purpose: Staged feature extraction: enumerate, read, decode, extract and
+ * write in order, with bounded queues between the stages
+ */
+
+#ifndef PROJ2_EXTRACT_PIPELINE_H
+#define PROJ2_EXTRACT_PIPELINE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "feature_registry.h"
+
+// Thread counts and queue sizes for the pipeline stages
+struct PipelineOptions {
+    int io_threads = 4;      // blocking reads, several in flight to hide disk latency
+    int decode_threads = 0;  // 0: hardware concurrency
+    int feature_threads = 0; // 0: hardware concurrency
+    int queue_depth = 16;    // items between two stages
+    bool thumbnails = false; // also add a thumbnail of every image to the open thumbnail pack
+};
+
+// What one stage did over the run; times are summed over its threads
+struct StageStats {
+    std::string name;
+    int threads = 0;
+    long long items = 0;
+    double busy_seconds = 0;    // doing the stage's own work
+    double starved_seconds = 0; // waiting for input
+    double blocked_seconds = 0; // waiting for room in the next queue
+};
+
+// Produces the next image path, false when there are no more (runs on the enumerator thread)
+typedef std::function<bool(std::string &)> PathSource;
+
+// Receives each image in enumeration order; ok is false if it could not be read or extracted.
+// A non-zero return aborts the run.
+typedef std::function<int(const std::string &, bool, std::vector<float> &)> FeatureSink;
+
+/**
+ * @brief Extracts features for every path from a source, overlapping I/O, decode and compute.
+ *
+ * Stages: enumerator (issues a read-ahead hint per file), I/O pool (reads the
+ * whole file), decode pool (imdecode at the feature's DecodePolicy, plus the
+ * thumbnail when options.thumbnails is set), feature pool (Mat-based extractor)
+ * and a single writer that restores enumeration order, stores the thumbnail and
+ * calls the sink. The number of images in flight is bounded, so a slow
+ * stage holds the ones before it back instead of growing memory.
+ *
+ * @param next_path Source of image paths.
+ * @param feature Feature to extract.
+ * @param options Thread counts and queue depth.
+ * @param sink Called once per image, in order, from the writer thread.
+ * @param stats Output, one entry per stage.
+ * @return non-zero if the sink failed.
+ */
+int run_extraction_pipeline(PathSource next_path, const FeatureInfo &feature, const PipelineOptions &options,
+                            FeatureSink sink, std::vector<StageStats> &stats);
+
+/**
+ * @brief Prints per-stage utilization, so the bottleneck stage stands out.
+ *
+ * @param stats Stage stats from run_extraction_pipeline.
+ * @param wall_seconds Wall-clock time of the run.
+ */
+void print_pipeline_stats(const std::vector<StageStats> &stats, double wall_seconds);
+
+#endif //PROJ2_EXTRACT_PIPELINE_H
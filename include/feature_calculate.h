@@ -9,22 +9,11 @@
 
 #include <vector>
 #include <opencv2/opencv.hpp>
+#include "image_decode.h"
 // Feature extraction function type
 typedef int (*FeatureFunction)(char*, std::vector<float>&);
-
-// Different feature types
-enum class FeatureType {
-    SQUARE_7X7,
-    RGB_HISTOGRAM,
-    MULTI_HISTOGRAM,
-    TEXTURE_COLOR,
-    DEPTH,
-    BANANA,
-    FACE
-};
-
-// Helper function to get feature function based on type
-FeatureFunction getFeatureFunction(FeatureType type);
+// Feature extraction from an already decoded image
+typedef int (*ImageFeatureFunction)(cv::Mat&, std::vector<float>&);
 
 /*
   Given an image filename and a reference to a vector to store image features,
@@ -52,6 +41,9 @@ int calculateRGBHistogram(char *image_filename, std::vector<float>& hist);
  */
 int getMultiHistogramFeature(char *image_filename, std::vector<float> &image_data);
 
+// Center and surround RGB histograms: the middle half of each side, then the rest of the image
+int getCenterSurroundFeature(char *image_filename, std::vector<float> &image_data);
+
 int getTextureColorFeature(char* image_filename, std::vector<float>& feature);
 // Function to extract combined RGB and texture features using DA2 depth map
 // Compute mask based on depth closeness (50% range around median)
@@ -62,4 +54,18 @@ int getBananaFeature(char *image_filename, std::vector<float>& feature);
 
 int getTextureColorFeatureWithFaceMask(char* image_filename, std::vector<float>& feature);
 
+// The same extractors on an already decoded BGR image
+int get7x7squareFromImage(cv::Mat &image, std::vector<float> &image_data);
+int calculateRGBHistogramFromImage(cv::Mat &image, std::vector<float>& hist);
+int getMultiHistogramFeatureFromImage(cv::Mat &image, std::vector<float> &image_data);
+int getCenterSurroundFeatureFromImage(cv::Mat &image, std::vector<float> &image_data);
+int getTextureColorFeatureFromImage(cv::Mat &image, std::vector<float>& feature);
+int getTextureColorFeatureWithDepthFromImage(cv::Mat &image, std::vector<float>& feature);
+int getBananaFeatureFromImage(cv::Mat &image, std::vector<float>& feature);
+int getTextureColorFeatureWithFaceMaskFromImage(cv::Mat &image, std::vector<float>& feature);
+
+// Threads the region histogram features (multi-hist, grid-*, center-surround) bin one image with, 0 for all
+// cores. Defaults to 1 for the extraction pipeline, which already keeps every core busy.
+void setRegionHistogramThreads(int threads);
+
 #endif //PROJ2_FEATURE_CALCULATE_H
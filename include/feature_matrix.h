@@ -0,0 +1,49 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 10, 2025
+ * Purpose: Contiguous row-major storage for a table of feature vectors
+ */
+
+#ifndef PROJ2_FEATURE_MATRIX_H
+#define PROJ2_FEATURE_MATRIX_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief A table of equally sized feature vectors stored in one row-major block.
+ *
+ * The CSV reader hands out one std::vector per row, which scatters the data over
+ * the heap. Kernels that sweep the whole table (batch search, dedup, scans) pack
+ * it into this layout once so rows are adjacent in memory.
+ */
+struct FeatureMatrix {
+    int rows = 0;
+    int cols = 0;
+    std::vector<float> values; // rows * cols floats, row i starts at i * cols
+
+    const float *row(int i) const { return values.data() + static_cast<size_t>(i) * cols; }
+    float *row(int i) { return values.data() + static_cast<size_t>(i) * cols; }
+};
+
+/**
+ * @brief Copies a 2D vector of features into a contiguous FeatureMatrix.
+ *
+ * @param data Feature rows as returned by read_image_data_csv.
+ * @param matrix Output matrix, resized to data.size() x data[0].size().
+ * @return non-zero if the rows do not all have the same length.
+ */
+int pack_feature_matrix(const std::vector<std::vector<float>> &data, FeatureMatrix &matrix);
+
+/**
+ * @brief Copies the selected rows of a 2D vector of features into a FeatureMatrix.
+ *
+ * @param data Feature rows as returned by read_image_data_csv.
+ * @param indices Row indices to copy, in output order.
+ * @param matrix Output matrix with indices.size() rows.
+ * @return non-zero if an index is out of range or the rows differ in length.
+ */
+int pack_feature_rows(const std::vector<std::vector<float>> &data, const std::vector<int> &indices,
+                      FeatureMatrix &matrix);
+
+#endif //PROJ2_FEATURE_MATRIX_H
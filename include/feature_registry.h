@@ -0,0 +1,104 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 22, 2025
+ * Purpose: Registry of the features the tools can extract and the distance
+ * metrics they can rank with. Each entry registers itself from the file that
+ * implements it, so adding a feature or a metric does not touch the CLIs.
+ */
+
+#ifndef PROJ2_FEATURE_REGISTRY_H
+#define PROJ2_FEATURE_REGISTRY_H
+
+#include <string>
+#include <vector>
+#include "feature_calculate.h"
+#include "batch_search.h"
+
+// Rough cost of extracting one image
+enum class CostClass {
+    CHEAP,  // one pass over the pixels
+    FILTER, // convolutions or connected components
+    MODEL   // runs a network or a cascade classifier
+};
+
+struct FeatureInfo {
+    std::string name;           // e.g. "texture-color"
+    int id = 0;                 // number accepted by Proj2-offline_loading
+    std::string description;
+    std::vector<int> segments;  // lengths of the parts concatenated in a row, e.g. {512, 16}
+    std::string default_metric;
+    CostClass cost = CostClass::CHEAP;
+    DecodePolicy decode;        // how far the image may be reduced at decode time
+    FeatureFunction extract = nullptr;
+    ImageFeatureFunction extract_image = nullptr;
+    int (*warmup)() = nullptr;  // loads and runs once the models the extractor uses
+
+    // values per row
+    int dims() const;
+};
+
+/*
+  Ranks the database against a target. target_rnn is the target's ResNet18
+  embedding (empty if unknown) and rnnData the rows aligned with data; both are
+  only used by metrics fused with the ResNet18 embeddings. target_index is the
+  target's own row, -1 if it is not in the database.
+ */
+typedef int (*RankFunction)(std::vector<float> &target, std::vector<float> &target_rnn, int target_index,
+                            std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                            std::vector<std::vector<float>> &rnnData, int N, std::vector<char *> &output);
+
+// What a metric's prepare step derived from the loaded rows, kept and reloaded with them
+struct PreparedRows {
+    // the columns of data were permuted into this order, empty if they are as in the file;
+    // a target that is not one of the rows is permuted the same way before ranking
+    std::vector<int> column_order;
+};
+
+// Puts the values of row in column_order (row[d] = old row[column_order[d]]); rows of another length are left alone
+void permute_columns(const std::vector<int> &column_order, std::vector<float> &row);
+
+struct MetricInfo {
+    std::string name;          // e.g. "rgb-hist"
+    std::string feature;       // feature whose file it ranks, empty if the vectors are precomputed
+    std::string description;
+    bool resnet_names = false; // rows are keyed by the bare file names of ResNet18_olym.csv
+    bool fused_resnet = false; // combines its feature with the ResNet18 embedding
+    bool batch = false;        // has a blocked kernel (see metric_batch_kernel)
+    BatchMetric batch_metric = BatchMetric::SSD; // its distance family, when batch
+    RankFunction rank = nullptr;
+    // run once after the feature file (and the ResNet18 rows, if fused) are loaded
+    int (*prepare)(std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &rnnData,
+                   PreparedRows &prepared) = nullptr;
+};
+
+// Static instances of these add an entry before main() runs
+struct FeatureRegistrar {
+    explicit FeatureRegistrar(const FeatureInfo &info);
+};
+struct MetricRegistrar {
+    explicit MetricRegistrar(const MetricInfo &info);
+};
+
+// Lookups return nullptr for unknown names or ids
+const FeatureInfo *find_feature(const std::string &name);
+const FeatureInfo *find_feature(int id);
+const MetricInfo *find_metric(const std::string &name);
+
+// The feature a metric is computed from, nullptr if its vectors are precomputed
+const FeatureInfo *feature_for_metric(const MetricInfo &metric);
+
+/**
+ * @brief The blocked kernel a metric is ranked with.
+ *
+ * @param kernel Output distance family.
+ * @param segments Output histogram segment count: one per segment of the
+ *        metric's feature for HISTOGRAM, 1 otherwise.
+ * @return non-zero if the metric has no blocked kernel.
+ */
+int metric_batch_kernel(const MetricInfo &metric, BatchMetric &kernel, int &segments);
+
+// All entries, features sorted by id and metrics by name
+std::vector<const FeatureInfo *> list_features();
+std::vector<const MetricInfo *> list_metrics();
+
+#endif //PROJ2_FEATURE_REGISTRY_H
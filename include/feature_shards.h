@@ -0,0 +1,120 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 3, 2025
+ * Purpose: Feature files split into shards by file name, listed in a shard
+ * manifest, loaded and searched one thread per shard
+ */
+
+#ifndef PROJ2_FEATURE_SHARDS_H
+#define PROJ2_FEATURE_SHARDS_H
+
+#include "batch_search.h"
+#include "feature_matrix.h"
+#include <string>
+#include <vector>
+
+/*
+  A shard manifest is a small text file:
+    #proj2-shards,scheme=hash,count=4
+    0,feature_vector_4.0.csv
+    1,feature_vector_4.1.csv
+    ...
+  For the range scheme each line after the first also carries the smallest
+  file name of its shard: "1,feature_vector_4.1.csv,pic.0512.jpg".
+
+  Images are assigned by the file name without its directory, so a shard holds
+  the same images whichever directory prefix the feature file uses. Shard paths
+  are relative to the manifest's directory. Each shard is an ordinary feature
+  file (CSV or binary store) that can be rebuilt on its own.
+ */
+
+enum class ShardScheme {
+    HASH, // hash of the file name modulo the shard count
+    RANGE // contiguous ranges of file names
+};
+
+struct ShardManifest {
+    ShardScheme scheme = ShardScheme::HASH;
+    std::vector<std::string> paths;  // shard files, as written in the manifest
+    std::vector<std::string> firsts; // RANGE: smallest file name of each shard, "" for shard 0
+
+    int count() const { return static_cast<int>(paths.size()); }
+};
+
+// Whether a file starts with the shard manifest header
+bool is_shard_manifest(const char *path);
+
+/**
+ * @brief Reads a shard manifest.
+ *
+ * @return 0 on success, 1 if the file does not exist, -1 if it is malformed.
+ */
+int read_shard_manifest(const char *path, ShardManifest &manifest);
+
+/**
+ * @brief Writes a shard manifest atomically (temporary file, fsync, rename).
+ *
+ * @return non-zero failure.
+ */
+int write_shard_manifest(const char *path, const ShardManifest &manifest);
+
+/**
+ * @brief A hash manifest with count shards named after the manifest:
+ *        data/fv4.shards gets data/fv4.0.csv, data/fv4.1.csv, ...
+ *
+ * @param extension Extension of the shard files, e.g. ".csv" or ".bin".
+ */
+void make_hash_manifest(const char *manifest_path, int count, const char *extension, ShardManifest &manifest);
+
+// Path of a shard file, resolved against the manifest's directory
+std::string shard_file(const char *manifest_path, const ShardManifest &manifest, int shard);
+
+// The shard an image belongs to
+int shard_of(const ShardManifest &manifest, const char *filename);
+
+// Every shard of a manifest, loaded
+struct ShardedStore {
+    ShardManifest manifest;
+    std::vector<std::vector<char *>> filenames; // per shard, sorted like read_feature_file
+    std::vector<FeatureMatrix> stores;          // per shard, rows aligned with filenames
+
+    size_t rows() const;
+    int cols() const;
+};
+
+/**
+ * @brief Loads every shard of a manifest, one thread per shard.
+ *
+ * @return non-zero if a shard can not be read or the shards have different row lengths.
+ */
+int load_shards(const char *manifest_path, ShardedStore &store);
+
+// One merged match
+struct ShardMatch {
+    float distance;
+    int shard;
+    int row;
+};
+
+/**
+ * @brief Finds the top N rows over all shards.
+ *
+ * Each shard is scanned by its own thread with the blocked kernel and keeps its
+ * own top N; the per-shard lists are then merged. Ties are broken by shard,
+ * then by row.
+ *
+ * @param store Loaded shards.
+ * @param target Query vector, store.cols() values.
+ * @param exclude_shard,exclude_row Row of the target itself to skip, -1 for none.
+ * @param metric Distance family.
+ * @param segments For HISTOGRAM, the number of concatenated histograms.
+ * @param N Number of matches to keep.
+ * @param result Output, best first.
+ * @param num_threads Shards scanned at once, 0 for the hardware concurrency.
+ * @return non-zero failure.
+ */
+int sharded_find_topN(const ShardedStore &store, const float *target, int exclude_shard, int exclude_row,
+                      BatchMetric metric, int segments, int N, std::vector<ShardMatch> &result,
+                      int num_threads = 0);
+
+#endif //PROJ2_FEATURE_SHARDS_H
@@ -0,0 +1,115 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 28, 2025
+ * Purpose: Binary feature store, for catalogs too large to keep as CSV
+ */
+
+#ifndef PROJ2_FEATURE_STORE_H
+#define PROJ2_FEATURE_STORE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+  Layout of a store file:
+    header   64 bytes, FeatureStoreHeader
+    values   rows * cols float32, row-major, starting at byte 64
+    names    u64 offsets[rows + 1] into the string bytes that follow, then the
+             NUL-terminated file names themselves
+
+  Values come first so a scan can stream them in large sequential reads
+  without touching the names; row i starts at byte 64 + i * cols * 4.
+ */
+const char FEATURE_STORE_MAGIC[8] = {'P', '2', 'F', 'E', 'A', 'T', '0', '1'};
+const uint32_t FEATURE_STORE_VERSION = 1;
+const uint32_t FEATURE_STORE_SORTED = 1; // flag: rows are sorted by file name
+
+struct FeatureStoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t rows;
+    uint32_t cols;
+    uint32_t reserved;
+    uint64_t names_offset; // byte offset of the offsets table
+    uint64_t names_bytes;  // size of the string bytes after it
+    char padding[16];
+};
+static_assert(sizeof(FeatureStoreHeader) == 64, "the store header is 64 bytes");
+
+/**
+ * @brief Streams rows into a new store.
+ *
+ * Values go straight to the file; names and their offsets are spooled to
+ * temporary files and appended by close(), so memory use does not grow with
+ * the number of rows. The store is written under <path>.tmp and renamed into
+ * place by close().
+ */
+class FeatureStoreWriter {
+public:
+    FeatureStoreWriter() {}
+    ~FeatureStoreWriter();
+
+    FeatureStoreWriter(const FeatureStoreWriter &) = delete;
+    FeatureStoreWriter &operator=(const FeatureStoreWriter &) = delete;
+
+    /**
+     * @brief Starts a store.
+     *
+     * @param path Output path.
+     * @param cols Values per row.
+     * @param flags FEATURE_STORE_* flags describing the rows that will be appended.
+     * @return non-zero failure.
+     */
+    int open(const char *path, int cols, uint32_t flags);
+
+    // Appends one row of cols values; non-zero on a write error
+    int append(const char *name, const float *values);
+
+    // Writes the names and the header and renames the store into place
+    int close();
+
+    uint64_t rows() const { return rows_; }
+
+private:
+    std::string path_;
+    FILE *fp_ = nullptr;
+    FILE *names_fp_ = nullptr;
+    FILE *offsets_fp_ = nullptr;
+    int cols_ = 0;
+    uint32_t flags_ = 0;
+    uint64_t rows_ = 0;
+    uint64_t names_bytes_ = 0;
+};
+
+// Whether a file starts with the store magic
+bool is_feature_store(const char *path);
+
+/**
+ * @brief Reads and checks the header of a store without reading any rows.
+ *
+ * @return non-zero if the file is not a store of this version.
+ */
+int read_feature_store_header(const char *path, FeatureStoreHeader &header);
+
+/**
+ * @brief Reads a whole store, with the same output as read_image_data_csv.
+ *
+ * Rows are sorted by file name like the CSV reader does, unless the store is
+ * flagged as already sorted.
+ *
+ * @return non-zero failure.
+ */
+int read_feature_store(const char *path, std::vector<char *> &filenames, std::vector<std::vector<float>> &data);
+
+/**
+ * @brief Reads a feature file in any format: a binary store, a segment store
+ *        (see segment_store.h) or a CSV.
+ *
+ * @return non-zero failure.
+ */
+int read_feature_file(const char *path, std::vector<char *> &filenames, std::vector<std::vector<float>> &data);
+
+#endif //PROJ2_FEATURE_STORE_H
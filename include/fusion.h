@@ -0,0 +1,79 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 26, 2025
+ * Purpose: Weighted fusion of several (feature store, metric, weight) terms,
+ * each distance normalized with statistics precomputed at load
+ */
+
+#ifndef PROJ2_FUSION_H
+#define PROJ2_FUSION_H
+
+#include "batch_search.h"
+#include "feature_matrix.h"
+#include "topn_select.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+// How a term's raw distance is put on a common scale before weighting
+enum class FusionNorm {
+    RAW,    // as computed
+    ZSCORE, // (d - mean) / stddev of the sampled distances
+    RANK    // fraction of the sampled distances below d, in [0, 1]
+};
+
+struct FusionTerm {
+    std::string name;                     // for messages, e.g. "feature_vector_4.csv:texture-color"
+    const FeatureMatrix *store = nullptr; // rows aligned with the other terms' stores
+    BatchMetric metric = BatchMetric::COSINE;
+    int segments = 1;                     // histogram segments, see metric_batch_kernel
+    double weight = 1.0;
+    FusionNorm norm = FusionNorm::ZSCORE;
+
+    // filled by prepare_fusion_stats
+    float mean = 0.0f;
+    float stddev = 1.0f;
+    std::vector<float> quantiles; // sorted sample distances at FUSION_QUANTILES + 1 evenly spaced ranks
+};
+
+// Resolution of the rank normalization table
+const int FUSION_QUANTILES = 100;
+
+/**
+ * @brief Samples distances between rows of each term's store and records their
+ *        mean, standard deviation and quantiles for the normalization.
+ *
+ * @param terms Terms whose stores all have the same number of rows.
+ * @param max_pairs Upper bound on the distances sampled per term.
+ * @return non-zero if the stores are empty or do not line up.
+ */
+int prepare_fusion_stats(std::vector<FusionTerm> &terms, int max_pairs = 100000);
+
+// Buffers reused across queries, so a query allocates nothing once they have grown
+struct FusionScratch {
+    std::vector<float> distances;
+    std::vector<float> scores;
+    TopNSelector best;
+};
+
+/**
+ * @brief Ranks the rows by the weighted sum of normalized term distances.
+ *
+ * Rows are scored a block at a time: each term fills the block's distances
+ * from its contiguous store, then a normalize-and-accumulate loop adds them
+ * to the scores, so no row vector is ever copied.
+ *
+ * @param terms Prepared terms.
+ * @param targets For each term, the target vector (store->cols values).
+ * @param weights Query-time weights, one per term; empty for the terms' own weights.
+ * @param target_index Row of the target itself to skip, -1 for none.
+ * @param N Number of matches to keep.
+ * @param scratch Reusable buffers.
+ * @param result Output (score, row) pairs, best first.
+ * @return non-zero if the arguments do not match the terms.
+ */
+int fusion_find_topN(const std::vector<FusionTerm> &terms, const std::vector<const float *> &targets,
+                     const std::vector<double> &weights, int target_index, int N, FusionScratch &scratch,
+                     std::vector<std::pair<float, int>> &result);
+
+#endif //PROJ2_FUSION_H
@@ -0,0 +1,112 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 24, 2025
+ * Purpose: Histogram kernels specialized at compile time on channel and bin
+ * counts, so binning is a constant shift and loop bounds are known
+ */
+
+#ifndef PROJ2_HISTOGRAM_KERNELS_H
+#define PROJ2_HISTOGRAM_KERNELS_H
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Number of cells in a joint histogram with `bins` levels on each of `channels` channels
+constexpr int histogramSize(int channels, int bins) {
+    return channels == 0 ? 1 : bins * histogramSize(channels - 1, bins);
+}
+
+/*
+  Right shift that maps an 8-bit value onto one of Bins equal-width bins, the
+  same bin value / (256 / Bins) gives. Bins must be a power of two.
+ */
+template <int Bins>
+constexpr int binShift() {
+    static_assert(Bins > 0 && Bins <= 256 && (Bins & (Bins - 1)) == 0, "bins must be a power of two up to 256");
+    int shift = 0;
+    while ((256 >> shift) > Bins) shift++;
+    return shift;
+}
+
+/**
+ * @brief Joint histogram of an 8-bit image, normalized to sum to 1.
+ *
+ * For three channels the cell of a BGR pixel is binR * Bins * Bins + binG * Bins + binB,
+ * the layout the feature files have always used.
+ *
+ * @param image 8-bit image with Channels channels.
+ * @param mask Optional 8-bit mask; pixels where it is 0 are skipped. Pass an empty Mat for none.
+ * @param hist Output, histogramSize(Channels, Bins) values. All zero if no pixel was counted.
+ * @return number of pixels counted, -1 if the image is not 8-bit with Channels channels.
+ */
+template <int Channels, int Bins>
+int computeHistogram(const cv::Mat &image, const cv::Mat &mask, float *hist);
+
+/**
+ * @brief Spatial blob histogram: x position x y position x blob size class.
+ *
+ * One pass over a label image. Cell x_bin + y_bin * SpatialBins + size_bin * SpatialBins^2
+ * counts the pixels of each accepted blob. Pixels whose label has no size bin
+ * (size_bin_of_label < 0: the background or blobs outside the size range) are skipped.
+ *
+ * @param labels CV_32S labels from connectedComponents.
+ * @param size_bin_of_label Size bin of each label, -1 to skip the label.
+ * @param hist Output, SpatialBins * SpatialBins * SizeBins raw pixel counts.
+ * @return number of pixels counted.
+ */
+template <int SpatialBins, int SizeBins>
+int computeBlobHistogram(const cv::Mat &labels, const std::vector<int> &size_bin_of_label, float *hist);
+
+// Part of an image a region histogram covers: a rectangle, less an optional rectangle inside it
+struct HistogramRegion {
+    cv::Rect area;
+    cv::Rect hole; // empty for none
+};
+
+// The cells of a rows x cols grid over an image of the given size, row by row
+std::vector<HistogramRegion> gridRegions(cv::Size size, int rows, int cols);
+
+// The rectangle spanning the middle half of each side, then the rest of the image around it
+std::vector<HistogramRegion> centerSurroundRegions(cv::Size size);
+
+/**
+ * @brief Joint histograms of several regions of an 8-bit image, each normalized to sum to 1.
+ *
+ * The edges of all regions cut the image into tiles. Every pixel is binned
+ * once into its tile, and the tiles are summed into an integral histogram
+ * from which each region takes four lookups per cell (eight with a hole).
+ * Grids, center-surround and other layouts over the same image therefore
+ * cost one pass over the pixels however many regions they have. A region
+ * gives the same values computeHistogram gives on its pixels.
+ *
+ * @param image 8-bit image with Channels channels.
+ * @param regions Regions to histogram, clipped to the image.
+ * @param hist Output, one histogramSize(Channels, Bins) histogram per region, back to back.
+ *             All zero for a region with no pixels.
+ * @param threads Threads binning bands of rows, 0 for the hardware concurrency.
+ * @return -1 if the image is not 8-bit with Channels channels, otherwise 0.
+ */
+template <int Channels, int Bins>
+int computeRegionHistograms(const cv::Mat &image, const std::vector<HistogramRegion> &regions, float *hist,
+                            int threads = 1);
+
+// Sum of element-wise minimums of two N-value histograms
+template <int N>
+float histogramIntersectionFixed(const float *hist1, const float *hist2);
+
+// Runtime-bins front ends over the shipped instantiations; non-zero if bins is not one of them
+int colorHistogram(const cv::Mat &image, const cv::Mat &mask, std::vector<float> &hist, int bins);
+int grayHistogram(const cv::Mat &image, const cv::Mat &mask, std::vector<float> &hist, int bins);
+
+// The shipped configurations are compiled once, in histogram_kernels.cpp
+extern template int computeHistogram<3, 8>(const cv::Mat &, const cv::Mat &, float *);
+extern template int computeHistogram<3, 16>(const cv::Mat &, const cv::Mat &, float *);
+extern template int computeHistogram<1, 8>(const cv::Mat &, const cv::Mat &, float *);
+extern template int computeHistogram<1, 16>(const cv::Mat &, const cv::Mat &, float *);
+extern template int computeRegionHistograms<3, 8>(const cv::Mat &, const std::vector<HistogramRegion> &, float *, int);
+extern template int computeBlobHistogram<4, 4>(const cv::Mat &, const std::vector<int> &, float *);
+extern template float histogramIntersectionFixed<512>(const float *, const float *);
+extern template float histogramIntersectionFixed<16>(const float *, const float *);
+extern template float histogramIntersectionFixed<8>(const float *, const float *);
+
+#endif //PROJ2_HISTOGRAM_KERNELS_H
@@ -0,0 +1,75 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 18, 2025
+ * Purpose: Decode-policy layer: load images at the lowest resolution a feature
+ * can tolerate, using libjpeg DCT scaling (IMREAD_REDUCED_COLOR_2/4/8)
+ */
+
+#ifndef PROJ2_IMAGE_DECODE_H
+#define PROJ2_IMAGE_DECODE_H
+
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+// How far a feature allows its input to be reduced
+struct DecodePolicy {
+    int max_scale = 1; // largest downscale allowed: 1, 2, 4 or 8
+    int min_side = 0;  // never reduce the shorter image side below this many pixels
+};
+
+// REDUCED follows each feature's DecodePolicy, FULL decodes everything at full resolution
+enum class DecodeMode {
+    REDUCED,
+    FULL
+};
+
+void setDecodeMode(DecodeMode mode);
+DecodeMode getDecodeMode();
+
+/**
+ * @brief Names the resolution a policy decodes at in the current mode, e.g.
+ *        "full" or "1/4,min=120", so rows decoded differently are not mixed.
+ */
+std::string describeDecode(const DecodePolicy &policy);
+
+/**
+ * @brief Reads the pixel size from a JPEG or PNG header without decoding the image.
+ *
+ * @return non-zero if the header can not be parsed.
+ */
+int readImageSize(const char *filename, int &width, int &height);
+int readImageSize(const unsigned char *data, size_t length, int &width, int &height);
+
+/**
+ * @brief Picks the largest power-of-two scale (up to policy.max_scale) that keeps
+ *        the shorter side at or above policy.min_side. Returns 1 in FULL mode.
+ */
+int chooseDecodeScale(int width, int height, const DecodePolicy &policy);
+
+/**
+ * @brief Largest power-of-two scale (up to 8) at which an image still covers a
+ *        width x height box when fitted into it. Both orientations are
+ *        considered, since the decoder may rotate the image by its EXIF tag.
+ */
+int chooseThumbnailScale(int image_width, int image_height, int width, int height);
+
+// cv::imread / cv::imdecode flags for a 3-channel decode at 1/scale resolution
+int imreadFlagsForScale(int scale);
+
+/**
+ * @brief Loads a color image at the resolution allowed by a policy.
+ *
+ * @return the image, empty on failure.
+ */
+cv::Mat loadImage(const char *filename, const DecodePolicy &policy);
+
+/**
+ * @brief Decodes an in-memory encoded image at the resolution allowed by a policy.
+ *
+ * @return the image, empty on failure.
+ */
+cv::Mat decodeImage(const std::vector<unsigned char> &bytes, const DecodePolicy &policy);
+
+#endif //PROJ2_IMAGE_DECODE_H
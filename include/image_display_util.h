@@ -8,13 +8,70 @@
 #define IMAGE_DISPLAY_H
 
 #include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <string>
 #include <vector>
 #include <iostream>
 
-// Displays all images in a single gallery window
+// Displays all images in a single gallery window; a grid of thumbnails when a thumbnail pack is open
 void displayGallery(const std::vector<char*>& filenames);
 
 // Displays images one by one in a single window
 void displayOneByOne(const std::vector<char*>& filenames);
 
+// Layout of a result page rendered without a display
+struct GalleryOptions {
+    int thumb_width = 200;  // each image is fitted into thumb_width x thumb_height
+    int thumb_height = 150;
+    int columns = 6;        // thumbnails per row
+    bool captions = true;   // a caption line under each thumbnail
+    int threads = 0;        // decode threads, 0: hardware concurrency
+    int jpeg_quality = 90;
+};
+
+/**
+ * @brief Loads an image scaled to fit width x height, keeping its aspect ratio.
+ *
+ * An open thumbnail pack (thumbnail_pack.h) is used first, without touching the
+ * original. Otherwise JPEGs are decoded at 1/2, 1/4 or 1/8 scale when that
+ * still covers the box, and the result is kept in an in-memory LRU cache,
+ * checked against the file's size and mtime, so repeated results are not
+ * decoded again.
+ *
+ * @return non-zero if the image can not be read.
+ */
+int loadThumbnail(const char *filename, int width, int height, cv::Mat &thumb);
+
+// Bytes of thumbnail pixels the cache may hold (default 64 MB); 0 disables it
+void setThumbnailCacheBytes(size_t bytes);
+
+/**
+ * @brief Renders images as a grid of fixed-size thumbnails with captions,
+ *        decoding them in parallel. Unreadable images leave a grey cell.
+ *
+ * @param filenames Images, in page order.
+ * @param captions One caption per image, or empty for none.
+ * @param page Output 8-bit BGR image.
+ * @return non-zero if there is nothing to render.
+ */
+int renderGallery(const std::vector<std::string> &filenames, const std::vector<std::string> &captions,
+                  const GalleryOptions &options, cv::Mat &page);
+
+/**
+ * @brief Encodes a page in memory, for streaming it to a client.
+ *
+ * @param ext ".jpg" or ".png".
+ * @return non-zero failure.
+ */
+int encodeGallery(const cv::Mat &page, const char *ext, const GalleryOptions &options,
+                  std::vector<unsigned char> &bytes);
+
+/**
+ * @brief Renders a page and writes it to a .jpg or .png file.
+ *
+ * @return non-zero failure.
+ */
+int writeGallery(const char *path, const std::vector<std::string> &filenames,
+                 const std::vector<std::string> &captions, const GalleryOptions &options);
+
 #endif // IMAGE_DISPLAY_H
@@ -0,0 +1,124 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 1, 2025
+ * Purpose: Scoped timers, counters and value histograms for the CLIs, with a
+ * summary table (--stats) and Chrome trace-event output (--trace)
+ */
+
+#ifndef PROJ2_INSTRUMENT_H
+#define PROJ2_INSTRUMENT_H
+
+#include <cstdint>
+#include <cstdio>
+
+/*
+  Instrumentation is off unless a CLI turns it on. When it is off a scope costs
+  one branch on a global flag: the clock is not read and nothing is recorded.
+  When it is on, each thread records into its own buffers, so threads never
+  contend on the hot path; the buffers are merged when the report is written.
+
+  Names are interned once per call site by the macros below:
+    INSTRUMENT_SCOPE("decode");             // times the rest of the block
+    INSTRUMENT_COUNT("ssd_abandoned", 1);   // adds to a counter
+    INSTRUMENT_VALUE("cascade_keep", keep); // adds a sample to a histogram
+ */
+
+extern bool instrument_on;
+
+inline bool instrument_enabled() { return instrument_on; }
+
+/**
+ * @brief Returns the id of a name, registering it on first use.
+ *
+ * Ids are stable for the life of the process. At most 256 names exist; later
+ * names share one overflow id.
+ */
+int instrument_id(const char *name);
+
+// Timestamp in nanoseconds since instrumentation was enabled
+int64_t instrument_now();
+
+// Records a finished span of the current thread
+void instrument_span(int id, int64_t start_ns, int64_t end_ns);
+
+// Adds delta to a counter
+void instrument_count(int id, int64_t delta);
+
+// Adds one sample to a value histogram
+void instrument_value(int id, double value);
+
+// Names the current thread in the trace, e.g. "decode"
+void instrument_thread_name(const char *name);
+
+/**
+ * @brief Times the enclosing scope.
+ */
+class ScopedTimer {
+public:
+    explicit ScopedTimer(int id) : id_(id), start_(instrument_on ? instrument_now() : -1) {}
+    ~ScopedTimer() {
+        if (start_ >= 0) instrument_span(id_, start_, instrument_now());
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    int id_;
+    int64_t start_;
+};
+
+#define INSTRUMENT_CONCAT_(a, b) a##b
+#define INSTRUMENT_CONCAT(a, b) INSTRUMENT_CONCAT_(a, b)
+
+#define INSTRUMENT_SCOPE(name)                                                             \
+    static const int INSTRUMENT_CONCAT(instrument_id_, __LINE__) = instrument_id(name);    \
+    ScopedTimer INSTRUMENT_CONCAT(instrument_timer_, __LINE__)(INSTRUMENT_CONCAT(instrument_id_, __LINE__))
+
+#define INSTRUMENT_COUNT(name, delta)                              \
+    do {                                                           \
+        if (instrument_on) {                                       \
+            static const int instrument_id_ = instrument_id(name); \
+            instrument_count(instrument_id_, (delta));             \
+        }                                                          \
+    } while (0)
+
+#define INSTRUMENT_VALUE(name, value)                              \
+    do {                                                           \
+        if (instrument_on) {                                       \
+            static const int instrument_id_ = instrument_id(name); \
+            instrument_value(instrument_id_, (value));             \
+        }                                                          \
+    } while (0)
+
+/**
+ * @brief Turns instrumentation on.
+ *
+ * @param stats Print the summary table when the process exits.
+ * @param trace_path If not null, write Chrome trace events (chrome://tracing,
+ *        Perfetto) to this file when the process exits.
+ */
+void instrument_enable(bool stats, const char *trace_path);
+
+/**
+ * @brief Removes --stats and --trace <file> from argv, wherever they are, and
+ *        enables instrumentation if either is present.
+ *
+ * @return non-zero on a malformed option
+ */
+int parse_instrument_options(int &argc, char *argv[]);
+
+/**
+ * @brief Per-name summary: calls, total and mean time, p50/p90/p99 and max for
+ *        spans, totals for counters, count/mean/percentiles for values.
+ */
+void instrument_report(FILE *out);
+
+/**
+ * @brief Writes every recorded span as a Chrome trace-event JSON file.
+ *
+ * @return non-zero failure
+ */
+int instrument_write_trace(const char *path);
+
+#endif //PROJ2_INSTRUMENT_H
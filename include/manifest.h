@@ -0,0 +1,65 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 14, 2025
+ * Purpose: Per-image manifest (path, size, mtime, content hash) kept next to a
+ * feature file so the offline tool can skip images that have not changed
+ */
+
+#ifndef PROJ2_MANIFEST_H
+#define PROJ2_MANIFEST_H
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+
+struct ManifestEntry {
+    long long size = 0;   // bytes
+    long long mtime = 0;  // modification time in nanoseconds
+    uint64_t hash = 0;    // hash_file_contents of the image
+};
+
+// Keyed by image path exactly as written to the feature file
+typedef std::map<std::string, ManifestEntry> Manifest;
+
+/**
+ * @brief Reads a manifest file.
+ *
+ * @param filename Manifest path, usually "<feature file>.manifest".
+ * @param manifest Output entries.
+ * @param feature Output name of the feature the manifest was built for, empty if unknown.
+ * @param decode Output decode resolution of the rows (describeDecode), empty if unknown.
+ * @return 0 on success, 1 if the file does not exist, -1 if it is malformed.
+ */
+int read_manifest(const char *filename, Manifest &manifest, std::string &feature, std::string &decode);
+
+/**
+ * @brief Writes a manifest atomically (temporary file, fsync, rename).
+ *
+ * @param filename Manifest path.
+ * @param manifest Entries to write.
+ * @param feature Name of the feature the entries were extracted with.
+ * @param decode Decode resolution the entries were extracted at (describeDecode).
+ * @return non-zero failure.
+ */
+int write_manifest(const char *filename, const Manifest &manifest, const std::string &feature,
+                   const std::string &decode);
+
+/**
+ * @brief Gets the size and modification time of a file.
+ *
+ * @param path File path.
+ * @param size Output size in bytes.
+ * @param mtime Output modification time in nanoseconds.
+ * @return non-zero if the file can not be stat'ed.
+ */
+int stat_file(const char *path, long long &size, long long &mtime);
+
+/**
+ * @brief Flushes a stdio stream to disk and closes it.
+ *
+ * @return non-zero if any buffered data could not be written.
+ */
+int fsync_and_close(FILE *fp);
+
+#endif //PROJ2_MANIFEST_H
@@ -0,0 +1,70 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: January 26, 2025
+ * Purpose: Top-N ranking for each distance metric. The CLIs reach these
+ * through the metric registry (feature_registry.h).
+ */
+
+#ifndef PROJ2_MATCH_METRICS_H
+#define PROJ2_MATCH_METRICS_H
+
+#include <vector>
+
+/*
+  Each ranker scores every row of data against the target, skips the target's
+  own row (target_index, -1 for a target that is not in the file) and appends
+  the filenames of the N closest rows to output.
+
+  The functions return a non-zero value in case of an error.
+ */
+/*
+  SSD ranking abandons a row once its partial distance exceeds the current N-th
+  best, so it gains most when the columns were put in decreasing variance
+  order by prepare_ssd_order when the file was loaded.
+ */
+int find_topN_matches_ssd(std::vector<float> &target_vector, int target_index, std::vector<char *> &filenames,
+                          std::vector<std::vector<float>> &data, int N, std::vector<char *> &output);
+
+// Dimensions of data sorted by decreasing variance across the rows
+void ssd_dimension_order(const std::vector<std::vector<float>> &data, std::vector<int> &dim_order);
+/*
+  The ssd metric's prepare step: permutes the columns of data into decreasing
+  variance order, once, so the scan reads each row contiguously. column_order
+  maps them back to the file's columns; when it is already set (rows appended
+  after a refresh were permuted with it) the new order is composed with it.
+ */
+int prepare_ssd_order(std::vector<std::vector<float>> &data, std::vector<int> &column_order);
+int find_topN_matches_hist(std::vector<float> &target_vector, int target_index, std::vector<char *> &filenames,
+                           std::vector<std::vector<float>> &data, int N, std::vector<char *> &output);
+int find_topN_matches_multiHist(std::vector<float> &target_vector, int target_index, std::vector<char *> &filenames,
+                                std::vector<std::vector<float>> &data, int N, std::vector<char *> &output);
+// Rows of 512-value region histograms (grid-*, center-surround), ranked by calculate_region_distance
+int find_topN_matches_regionHist(std::vector<float> &target, int target_index, std::vector<char *> &filenames,
+                                 std::vector<std::vector<float>> &data, int N, std::vector<char *> &output);
+int find_topN_matches_textureColor(std::vector<float> &target, int target_index, std::vector<char *> &filenames,
+                                   std::vector<std::vector<float>> &data, int N, std::vector<char *> &output);
+int find_topN_matches_cosine(std::vector<float> &target, int target_index, std::vector<char *> &filenames,
+                             std::vector<std::vector<float>> &data, int N, std::vector<char *> &output);
+
+/*
+  The fused rankers add a weighted ResNet18 cosine term from rnnData (rows
+  aligned with data). targetRNN is empty for a target that has no embedding,
+  which leaves the hand-crafted term alone. They run as a cascade (cascade.h):
+  a cheap prefilter keeps the best rows and the full metric ranks those.
+ */
+int find_topN_matches_depthDNN(std::vector<float> &targetTexColor, std::vector<float> &targetRNN, int target_index,
+                               std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                               std::vector<std::vector<float>> &rnnData, int N, std::vector<char *> &output);
+int find_topN_matches_banana(std::vector<float> &target, std::vector<float> &targetRNN, int target_index,
+                             std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                             std::vector<std::vector<float>> &rnnData, int N, std::vector<char *> &output);
+int find_topN_matches_depthDNN_faces(std::vector<float> &targetTexColor, std::vector<float> &targetRNN,
+                                     int target_index, std::vector<char *> &filenames,
+                                     std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &rnnData,
+                                     int N, std::vector<char *> &output);
+
+// Cosine distance that ignores the leading face flag when both vectors have a face
+float face_distance(std::vector<float> &vec1, std::vector<float> &vec2);
+float face_distance(const float *vec1, const float *vec2, int n);
+
+#endif //PROJ2_MATCH_METRICS_H
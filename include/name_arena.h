@@ -0,0 +1,67 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 6, 2025
+ * Purpose: File names of a loaded feature file stored back to back in one
+ * block, addressed by 32-bit row ids
+ */
+
+#ifndef PROJ2_NAME_ARENA_H
+#define PROJ2_NAME_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+  The readers used to allocate every file name on its own, which at millions
+  of rows meant millions of small allocations. Names now go into one arena per
+  file read: the NUL-terminated strings back to back, plus a table of where
+  each starts. A row is its 32-bit id in the arena until a name is needed.
+
+  The readers still hand out std::vector<char *> rows, the type the metrics
+  and the output work with, but those point into an arena that is retained
+  for the rest of the process, as the individually allocated names were.
+  release_names() frees the arenas behind a set of rows once nothing uses them.
+ */
+class NameArena {
+public:
+    // Adds a name and returns its id
+    uint32_t add(const char *name, size_t length);
+
+    const char *name(uint32_t id) const { return bytes_.data() + offsets_[id]; }
+    uint32_t size() const { return static_cast<uint32_t>(offsets_.size()); }
+    size_t bytes() const { return bytes_.size(); }
+
+    void reserve(size_t names, size_t bytes);
+
+    // Ids sorted by name, ties in id order, the order the feature files are read in. Names
+    // already in order cost one pass; others get a radix sort on their bytes, in parallel
+    // when there are many
+    void sorted_ids(std::vector<uint32_t> &ids) const;
+
+private:
+    friend const NameArena &retain_name_arena(NameArena &&arena);
+    std::vector<char> bytes_;
+    std::vector<uint64_t> offsets_;
+};
+
+/**
+ * @brief Keeps an arena for the rest of the process, or until release_names().
+ *
+ * @return the retained arena, whose names no longer move.
+ */
+const NameArena &retain_name_arena(NameArena &&arena);
+
+/**
+ * @brief Retains an arena and lists its names as rows.
+ *
+ * @param arena Names, consumed.
+ * @param ids Ids of the rows to list, in row order; empty for every name in id order.
+ * @param filenames Output rows, pointing into the retained arena.
+ */
+void adopt_names(NameArena &&arena, const std::vector<uint32_t> &ids, std::vector<char *> &filenames);
+
+// Frees every retained arena that one of the rows points into; rows of those arenas must not be used after
+void release_names(const std::vector<char *> &filenames);
+
+#endif //PROJ2_NAME_ARENA_H
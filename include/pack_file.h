@@ -0,0 +1,109 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 16, 2025
+ * Purpose: Append-only key -> blob pack file, read through a memory mapping
+ */
+
+#ifndef PROJ2_PACK_FILE_H
+#define PROJ2_PACK_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+  A pack is two files:
+    <path>      the records, each [key_a u64][key_b u64][length u64][payload][pad to 8]
+                after an 8 byte header "P2PACK01"
+    <path>.idx  one fixed-size entry [key_a u64][key_b u64][offset u64][length u64]
+                per record, appended after the record itself is flushed
+
+  On open the index is loaded into a hash table (it is rebuilt from the records
+  if it is missing or shorter than the data). Reads go through a read-only
+  mmap of the record file, so looking up a blob costs no read() call and the
+  OS page cache is shared between processes. Appends go to the end of both
+  files; a later key overrides an earlier one.
+ */
+class PackFile {
+public:
+    PackFile() {}
+    ~PackFile() { close(); }
+
+    PackFile(const PackFile &) = delete;
+    PackFile &operator=(const PackFile &) = delete;
+
+    /**
+     * @brief Opens (and with writable, creates) a pack.
+     *
+     * @param path Record file path.
+     * @param writable Whether append() will be used.
+     * @return non-zero failure.
+     */
+    int open(const char *path, bool writable);
+
+    void close();
+
+    bool is_open() const { return fd_ >= 0; }
+
+    // number of distinct keys
+    size_t size() const;
+
+    bool contains(uint64_t key_a, uint64_t key_b) const;
+
+    /**
+     * @brief Copies the blob stored under a key.
+     *
+     * @return false if the key is not in the pack.
+     */
+    bool lookup(uint64_t key_a, uint64_t key_b, std::vector<unsigned char> &out);
+
+    /**
+     * @brief Points into the mapped blob stored under a key, without copying.
+     *
+     * The pointer stays valid until the next append() or close(); lookups
+     * never remap.
+     *
+     * @return false if the key is not in the pack.
+     */
+    bool lookup_view(uint64_t key_a, uint64_t key_b, const unsigned char *&data, size_t &length);
+
+    /**
+     * @brief Appends a blob under a key.
+     *
+     * @return non-zero failure.
+     */
+    int append(uint64_t key_a, uint64_t key_b, const void *data, size_t length);
+
+private:
+    struct Key {
+        uint64_t a, b;
+        bool operator==(const Key &o) const { return a == o.a && b == o.b; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &k) const { return static_cast<size_t>(k.a ^ (k.b * 0x9e3779b97f4a7c15ULL)); }
+    };
+    struct Location {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    int rebuild_index();
+    bool map_to(uint64_t end);
+    // close() with mutex_ held
+    void close_locked();
+
+    std::string path_;
+    int fd_ = -1;
+    int index_fd_ = -1;
+    bool writable_ = false;
+    uint64_t file_size_ = 0;
+    unsigned char *map_ = nullptr;
+    size_t map_size_ = 0;
+    std::unordered_map<Key, Location, KeyHash> index_;
+    mutable std::mutex mutex_;
+};
+
+#endif //PROJ2_PACK_FILE_H
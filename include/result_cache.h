@@ -0,0 +1,46 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 16, 2025
+ * Purpose: Content-addressed on-disk cache for expensive intermediate results
+ * (DA2 depth maps, face rectangles), keyed by image content and model version
+ */
+
+#ifndef PROJ2_RESULT_CACHE_H
+#define PROJ2_RESULT_CACHE_H
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief Enables the cache, stored as depth.pack and faces.pack in a directory.
+ *
+ * @param dir Cache directory, created if needed. nullptr disables the cache.
+ * @return non-zero if the packs can not be opened.
+ */
+int setResultCacheDir(const char *dir);
+
+// Whether setResultCacheDir has enabled the cache
+bool resultCacheEnabled();
+
+/**
+ * @brief Hashes the pixels of an image together with its size and type.
+ */
+uint64_t hashImageContent(const cv::Mat &image);
+
+/**
+ * @brief Identifies a model: the hash of the model file contents mixed with a
+ *        pipeline version that is bumped when pre/post processing changes.
+ *        The file is hashed once per process.
+ */
+uint64_t modelVersion(const char *model_path, int pipeline_version);
+
+// Depth maps are stored PNG compressed (lossless for the 8-bit DA2 output)
+bool lookupCachedDepth(uint64_t image_hash, uint64_t model_version, cv::Mat &depth);
+int storeCachedDepth(uint64_t image_hash, uint64_t model_version, const cv::Mat &depth);
+
+// Face rectangles are stored as x, y, width, height int32 quadruples
+bool lookupCachedFaces(uint64_t image_hash, uint64_t model_version, std::vector<cv::Rect> &faces);
+int storeCachedFaces(uint64_t image_hash, uint64_t model_version, const std::vector<cv::Rect> &faces);
+
+#endif //PROJ2_RESULT_CACHE_H
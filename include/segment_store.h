@@ -0,0 +1,158 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 5, 2025
+ * Purpose: Log-structured feature store: immutable sorted segments, a small
+ * mutable tail, tombstones for deleted images and a compactor that merges
+ * segments, listed in a versioned manifest
+ */
+
+#ifndef PROJ2_SEGMENT_STORE_H
+#define PROJ2_SEGMENT_STORE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+  A segment store is a manifest, e.g. fv4.lsm:
+    #proj2-segments,version=12,next=7,cols=528
+    segment,fv4.seg3.bin,fv4.seg3.del
+    segment,fv4.seg5.bin,-
+    tail,fv4.tail6.log
+  Segments are listed oldest first. Each is a sorted binary feature store plus
+  an optional tombstone file, the names it deletes from older segments, one
+  per line. The tail is a log of "+name,v1,...,vn" and "-name" lines that the
+  writer appends to; it is newer than every segment. A name's row is the one in
+  the newest layer that has it, unless a newer layer deletes it.
+
+  Segment and tombstone files are never modified. Flushing the tail or
+  compacting segments writes new files and then replaces the manifest
+  atomically with a higher version, so a reader that opened the files of one
+  version reads a consistent snapshot; if a file of its version has been
+  removed in the meantime it reads the manifest again. Paths are relative to
+  the manifest's directory.
+ */
+
+struct SegmentFiles {
+    std::string store;      // binary feature store, empty if the segment only deletes
+    std::string tombstones; // names deleted from older segments, empty for none
+};
+
+struct SegmentManifest {
+    uint64_t version = 0;
+    int next = 0; // number of the next file to create
+    int cols = 0; // values per row, 0 until the first segment
+    std::vector<SegmentFiles> segments; // oldest first
+    std::string tail;
+};
+
+struct SegmentStoreOptions {
+    size_t flush_rows = 4096; // the tail becomes a segment once it holds this many puts and deletes
+    int compact_segments = 4; // segments that start a compaction
+    bool background = true;   // compact on a thread of the writer instead of in sync()
+};
+
+// Whether a file starts with the segment manifest header
+bool is_segment_manifest(const char *path);
+
+// Whether a path names a segment store: an existing segment manifest, or a new one ending in ".lsm"
+bool is_segment_store_path(const char *path);
+
+/**
+ * @brief Reads a segment manifest.
+ *
+ * @return 0 on success, 1 if the file does not exist, -1 if it is malformed.
+ */
+int read_segment_manifest(const char *path, SegmentManifest &manifest);
+
+// Writes a segment manifest atomically; non-zero failure
+int write_segment_manifest(const char *path, const SegmentManifest &manifest);
+
+/**
+ * @brief Reads a snapshot of a segment store, with the same output as
+ *        read_image_data_csv: the live rows, sorted by file name.
+ *
+ * @return non-zero failure.
+ */
+int read_segment_store(const char *path, std::vector<char *> &filenames, std::vector<std::vector<float>> &data);
+
+/**
+ * @brief Merges every segment of a store into one, dropping overwritten rows
+ *        and tombstones.
+ *
+ * The segments are read and merged without holding any lock, so the writer
+ * and readers carry on meanwhile; the manifest is only locked to swap the
+ * merged segment in. A compaction that finds its segments already replaced
+ * gives up without changing anything.
+ *
+ * @param merged Output number of segments merged, 0 if there was nothing to do.
+ * @return non-zero failure.
+ */
+int compact_segment_store(const char *path, int &merged);
+
+/**
+ * @brief Single writer of a segment store.
+ *
+ * Puts and deletes are appended to the tail and become visible to readers at
+ * the next sync(). When the tail is large enough, sync() turns it into a
+ * segment; when there are enough segments it starts a compaction, on a
+ * background thread by default, so ingest does not wait for it.
+ */
+class SegmentStoreWriter {
+public:
+    SegmentStoreWriter() {}
+    ~SegmentStoreWriter();
+
+    SegmentStoreWriter(const SegmentStoreWriter &) = delete;
+    SegmentStoreWriter &operator=(const SegmentStoreWriter &) = delete;
+
+    /**
+     * @brief Opens a store for writing, creating it if needed, and replays its tail.
+     *
+     * @return non-zero failure, including another writer having the store open.
+     */
+    int open(const char *path, const SegmentStoreOptions &options = SegmentStoreOptions());
+
+    // Adds or replaces the row of a name; non-zero failure
+    int put(const char *name, const std::vector<float> &values);
+
+    // Deletes the row of a name; non-zero failure
+    int remove(const char *name);
+
+    // Makes the puts and deletes so far durable and visible, flushing and compacting as needed
+    int sync();
+
+    // Turns the tail into a segment now, if it is not empty
+    int flush();
+
+    // Syncs, waits for a running compaction and releases the store
+    int close();
+
+    bool is_open() const { return tail_fp_ != nullptr; }
+    const std::string &path() const { return path_; }
+
+private:
+    int start_compaction();
+    void join_compaction();
+
+    std::string path_;
+    SegmentStoreOptions options_;
+    int lock_fd_ = -1;
+    int cols_ = 0;
+    std::string tail_;
+    FILE *tail_fp_ = nullptr;
+    // the tail's contents, newest state per name
+    std::map<std::string, std::vector<float>> puts_;
+    std::set<std::string> deletes_;
+    std::thread compactor_;
+    std::atomic<bool> compacting_{false};
+    int compaction_status_ = 0;
+};
+
+#endif //PROJ2_SEGMENT_STORE_H
@@ -0,0 +1,75 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 4, 2025
+ * Purpose: Top-N search that streams a binary feature store from disk, for
+ * catalogs larger than memory
+ */
+
+#ifndef PROJ2_STREAM_SCAN_H
+#define PROJ2_STREAM_SCAN_H
+
+#include "batch_search.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+  A streaming scan never holds more than (read_ahead + 1) chunks of values and
+  one top-N selection per thread, whatever the size of the store. A reader
+  thread fills chunk buffers with large sequential preads, read_ahead chunks
+  ahead of the scoring threads; with the default of 1 this is double
+  buffering. Only the names of the matches are read, once the scan is done.
+ */
+
+struct StreamScanOptions {
+    size_t chunk_bytes = 64u << 20; // values read per chunk
+    int read_ahead = 1;             // chunks read while one is scored
+    int threads = 0;                // scoring threads, 0 for the hardware concurrency
+};
+
+struct StreamScanStats {
+    uint64_t rows = 0;
+    uint64_t bytes = 0;
+    double seconds = 0.0;
+    double read_wait_seconds = 0.0; // time the scoring threads waited for the reader
+};
+
+/**
+ * @brief Finds the row of a file name in a store without loading it.
+ *
+ * Stores flagged as sorted are binary searched through the names table;
+ * others have their names streamed once.
+ *
+ * @return 0 if found, 1 if the store has no such name, -1 on a read error.
+ */
+int find_store_row(const char *path, const char *name, int64_t &row);
+
+// Reads the values of one row of a store; non-zero failure
+int read_store_row(const char *path, int64_t row, std::vector<float> &values);
+
+// Reads the file names of the given rows of a store; non-zero failure
+int read_store_names(const char *path, const std::vector<int64_t> &rows, std::vector<std::string> &names);
+
+/**
+ * @brief Scores every row of a store against a target while streaming it from
+ *        disk, keeping only the best N.
+ *
+ * @param path Binary feature store.
+ * @param target Target vector, as many values as the store's rows.
+ * @param dims Number of values in target.
+ * @param exclude_row Row of the target itself to skip, -1 for none.
+ * @param metric Distance family, with the same definition as the blocked kernels.
+ * @param segments For HISTOGRAM, the number of concatenated histograms.
+ * @param N Number of matches to keep.
+ * @param options Chunk size, read-ahead depth and threads.
+ * @param result Output (distance, row) pairs, best first.
+ * @param stats Output rows and bytes scanned and where the time went.
+ * @return non-zero failure.
+ */
+int stream_find_topN(const char *path, const float *target, int dims, int64_t exclude_row, BatchMetric metric,
+                     int segments, int N, const StreamScanOptions &options,
+                     std::vector<std::pair<float, int64_t>> &result, StreamScanStats &stats);
+
+#endif //PROJ2_STREAM_SCAN_H
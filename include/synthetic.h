@@ -0,0 +1,60 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 28, 2025
+ * Purpose: Synthetic images and feature rows with realistic distributions, for
+ * benchmarking the loaders, indexes and matchers beyond the olympus set
+ */
+
+#ifndef PROJ2_SYNTHETIC_H
+#define PROJ2_SYNTHETIC_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief Smooth color noise with a few filled yellow and skin-toned circles,
+ *        so the blob and face paths have something to find.
+ */
+cv::Mat synthesize_image(int width, int height, uint64_t seed);
+
+/*
+  Describes how rows of one feature are drawn. Rows belong to clusters whose
+  centers are drawn once from the seed, so near neighbours exist like they do
+  in a real catalog:
+    histogram segments  Dirichlet around a sparse Dirichlet center
+    7x7-square          pixel values scattered around a center, clamped to [0, 255]
+    resnet              512 non-negative values around an exponential center (post-ReLU pooling)
+    face                a leading face flag (about 1 row in 5) before the histograms
+    banana              about 1 row in 10 has a blob histogram and a blob pixel total, the rest are 0
+ */
+struct SyntheticFeature {
+    std::string name;           // registered feature name, or "resnet"
+    std::vector<int> segments;  // lengths of the parts of a row
+    int clusters = 0;
+    uint64_t seed = 0;
+    std::vector<std::vector<float>> centers; // one row-sized center per cluster
+
+    int cols() const;
+};
+
+/**
+ * @brief Sets up the generator for a feature.
+ *
+ * @param name A registered feature name or "resnet".
+ * @param clusters Number of clusters rows are drawn around.
+ * @param seed Seed for the centers and the rows.
+ * @return non-zero if the feature is unknown.
+ */
+int init_synthetic_feature(SyntheticFeature &feature, const std::string &name, int clusters, uint64_t seed);
+
+/**
+ * @brief Draws row number `row`. The result depends only on the seed and the
+ *        row number, so rows can be generated in any order or in parallel.
+ *
+ * @param out cols() values.
+ */
+void synthesize_row(const SyntheticFeature &feature, uint64_t row, float *out);
+
+#endif //PROJ2_SYNTHETIC_H
@@ -0,0 +1,57 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 2, 2025
+ * Purpose: Thumbnails of a whole image directory in one memory-mapped pack,
+ * written by the offline tool and read by the result display
+ */
+
+#ifndef PROJ2_THUMBNAIL_PACK_H
+#define PROJ2_THUMBNAIL_PACK_H
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+/*
+  Thumbnails are stored as JPEGs (a few KB each) in a PackFile, keyed by a
+  128-bit hash of the image's file name without its directory, so the names
+  in every feature file (../olympus/pic.0164.jpg) and the bare ResNet18
+  names (pic.0164.jpg) find the same entry. Re-adding an image overrides its
+  old thumbnail. Key (0, 0) holds the thumbnail box size of the pack.
+ */
+
+/**
+ * @brief Opens the thumbnail pack.
+ *
+ * @param path Pack path; nullptr closes the pack.
+ * @param writable Create the pack if needed and allow storePackedThumbnail.
+ * @param width,height Thumbnail box of a new pack; an existing pack keeps its own.
+ * @return non-zero if the pack can not be opened.
+ */
+int setThumbnailPack(const char *path, bool writable, int width = 200, int height = 150);
+
+// Whether setThumbnailPack has opened a pack
+bool thumbnailPackEnabled();
+
+// Thumbnail box of the open pack
+void thumbnailPackSize(int &width, int &height);
+
+/**
+ * @brief Scales an image down to fit width x height and encodes it as JPEG.
+ *
+ * @return non-zero failure.
+ */
+int makeThumbnail(const cv::Mat &image, int width, int height, std::vector<unsigned char> &jpeg);
+
+// Whether the pack has a thumbnail for the image
+bool hasPackedThumbnail(const char *filename);
+
+// The encoded thumbnail of an image, ready to stream; false if it is not packed
+bool lookupPackedThumbnailBytes(const char *filename, std::vector<unsigned char> &jpeg);
+
+// The decoded thumbnail of an image; false if it is not packed
+bool lookupPackedThumbnail(const char *filename, cv::Mat &thumb);
+
+// Adds or replaces the thumbnail of an image; non-zero failure
+int storePackedThumbnail(const char *filename, const std::vector<unsigned char> &jpeg);
+
+#endif //PROJ2_THUMBNAIL_PACK_H
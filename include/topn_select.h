@@ -0,0 +1,68 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 10, 2025
+ * Purpose: Bounded selector that keeps the N smallest (distance, index) pairs
+ */
+
+#ifndef PROJ2_TOPN_SELECT_H
+#define PROJ2_TOPN_SELECT_H
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Keeps the N best matches seen so far in a max-heap of size N.
+ *
+ * Pairs are compared lexicographically, so ties on distance are broken by the
+ * smaller index, which gives the same answer as sorting every pair and taking
+ * the first N. Index is int for in-memory tables and int64_t for stores that
+ * are streamed from disk.
+ */
+template <typename Index>
+class BasicTopNSelector {
+public:
+    explicit BasicTopNSelector(int n = 0) { reset(n); }
+
+    void reset(int n) {
+        n_ = n > 0 ? n : 0;
+        heap_.clear();
+        heap_.reserve(n_);
+    }
+
+    bool full() const { return static_cast<int>(heap_.size()) >= n_; }
+
+    // distance a candidate has to beat to enter the selection
+    float threshold() const {
+        if (n_ == 0) return -std::numeric_limits<float>::infinity();
+        return full() ? heap_.front().first : std::numeric_limits<float>::infinity();
+    }
+
+    void push(float distance, Index index) {
+        if (n_ == 0) return;
+        std::pair<float, Index> candidate(distance, index);
+        if (!full()) {
+            heap_.push_back(candidate);
+            std::push_heap(heap_.begin(), heap_.end());
+        } else if (candidate < heap_.front()) {
+            std::pop_heap(heap_.begin(), heap_.end());
+            heap_.back() = candidate;
+            std::push_heap(heap_.begin(), heap_.end());
+        }
+    }
+
+    // the kept pairs, best first
+    void sorted(std::vector<std::pair<float, Index>> &out) const {
+        out = heap_;
+        std::sort(out.begin(), out.end());
+    }
+
+private:
+    int n_ = 0;
+    std::vector<std::pair<float, Index>> heap_;
+};
+
+typedef BasicTopNSelector<int> TopNSelector;
+
+#endif //PROJ2_TOPN_SELECT_H
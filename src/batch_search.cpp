@@ -0,0 +1,363 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 10, 2025
+ * Purpose: Blocked query x database distance computation for many targets at once
+ */
+
+#include "../include/batch_search.h"
+#include "../include/topn_select.h"
+#include "../include/distance_calculate.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+// Tile sizes: a database tile of DB_TILE rows is packed dimension-major so the
+// innermost loop runs over DB_TILE independent accumulators (vectorizes without
+// reassociating float sums), and QUERY_TILE queries reuse it while it is hot.
+static const int DB_TILE = 64;
+static const int QUERY_TILE = 16;
+
+/*
+  Packs rows [r0, r0 + DB_TILE) of the database into packed[k * DB_TILE + r].
+  Rows past the end of the database are zero filled.
+ */
+static void pack_db_tile(const FeatureMatrix &database, int r0, std::vector<float> &packed) {
+    const int dims = database.cols;
+    const int count = std::min(DB_TILE, database.rows - r0);
+    packed.assign(static_cast<size_t>(dims) * DB_TILE, 0.0f);
+    for (int r = 0; r < count; r++) {
+        const float *src = database.row(r0 + r);
+        for (int k = 0; k < dims; k++) {
+            packed[static_cast<size_t>(k) * DB_TILE + r] = src[k];
+        }
+    }
+}
+
+/*
+  acc[q][r] += sum over k in [k0, k1) of query[q][k] * tile[k][r]
+ */
+static void dot_block(const float *const *query, int nq, const float *packed, int k0, int k1,
+                      float acc[][DB_TILE]) {
+    for (int q = 0; q < nq; q++) {
+        const float *qv = query[q];
+        float *a = acc[q];
+        for (int k = k0; k < k1; k++) {
+            const float v = qv[k];
+            const float *b = packed + static_cast<size_t>(k) * DB_TILE;
+            for (int r = 0; r < DB_TILE; r++) {
+                a[r] += v * b[r];
+            }
+        }
+    }
+}
+
+/*
+  acc[q][r] += sum over k in [k0, k1) of min(query[q][k], tile[k][r])
+ */
+static void minsum_block(const float *const *query, int nq, const float *packed, int k0, int k1,
+                         float acc[][DB_TILE]) {
+    for (int q = 0; q < nq; q++) {
+        const float *qv = query[q];
+        float *a = acc[q];
+        for (int k = k0; k < k1; k++) {
+            const float v = qv[k];
+            const float *b = packed + static_cast<size_t>(k) * DB_TILE;
+            for (int r = 0; r < DB_TILE; r++) {
+                a[r] += std::min(v, b[r]);
+            }
+        }
+    }
+}
+
+static void squared_norms(const FeatureMatrix &m, std::vector<float> &norms) {
+    norms.assign(m.rows, 0.0f);
+    for (int i = 0; i < m.rows; i++) {
+        const float *v = m.row(i);
+        float s = 0.0f;
+        for (int k = 0; k < m.cols; k++) {
+            s += v[k] * v[k];
+        }
+        norms[i] = s;
+    }
+}
+
+/*
+  Fills dist[q][r] for a block of nq queries against one packed database tile of
+  rcount rows starting at r0. Entries past rcount are left undefined.
+ */
+static void score_tile(BatchMetric metric, int segments, int dims, const float *const *qptr, int nq,
+                       const float *query_norms, const float *packed, const float *db_norms, int rcount,
+                       float acc[][DB_TILE], float dist[][DB_TILE]) {
+    if (metric == BatchMetric::HISTOGRAM) {
+        // min-sum per segment, then average the per-segment distances
+        for (int q = 0; q < nq; q++) std::fill(dist[q], dist[q] + DB_TILE, 0.0f);
+        for (int s = 0; s < segments; s++) {
+            const int k0 = static_cast<int>(static_cast<size_t>(dims) * s / segments);
+            const int k1 = static_cast<int>(static_cast<size_t>(dims) * (s + 1) / segments);
+            for (int q = 0; q < nq; q++) std::fill(acc[q], acc[q] + DB_TILE, 0.0f);
+            minsum_block(qptr, nq, packed, k0, k1, acc);
+            for (int q = 0; q < nq; q++) {
+                for (int r = 0; r < rcount; r++) {
+                    dist[q][r] += (1.0f - acc[q][r]) / segments;
+                }
+            }
+        }
+        return;
+    }
+
+    for (int q = 0; q < nq; q++) std::fill(acc[q], acc[q] + DB_TILE, 0.0f);
+    dot_block(qptr, nq, packed, 0, dims, acc);
+    for (int q = 0; q < nq; q++) {
+        const float qn = query_norms[q];
+        for (int r = 0; r < rcount; r++) {
+            const float rn = db_norms[r];
+            if (metric == BatchMetric::SSD) {
+                dist[q][r] = std::sqrt(std::max(0.0f, qn + rn - 2.0f * acc[q][r]));
+            } else if (qn == 0.0f || rn == 0.0f) {
+                dist[q][r] = 1.0f;
+            } else {
+                dist[q][r] = 1.0f - acc[q][r] / (std::sqrt(qn) * std::sqrt(rn));
+            }
+        }
+    }
+}
+
+/*
+  Scores queries [q_begin, q_end) against the whole database and fills their results.
+ */
+static void batch_worker(const FeatureMatrix &database, const FeatureMatrix &queries,
+                         const std::vector<int> &exclude, BatchMetric metric, int segments, int N,
+                         const std::vector<float> &db_norms, const std::vector<float> &query_norms,
+                         int q_begin, int q_end,
+                         std::vector<std::vector<std::pair<float, int>>> &results) {
+    std::vector<TopNSelector> selectors(q_end - q_begin, TopNSelector(N));
+    std::vector<float> packed;
+    float acc[QUERY_TILE][DB_TILE];
+    float dist[QUERY_TILE][DB_TILE];
+    const float *qptr[QUERY_TILE];
+
+    for (int r0 = 0; r0 < database.rows; r0 += DB_TILE) {
+        const int rcount = std::min(DB_TILE, database.rows - r0);
+        pack_db_tile(database, r0, packed);
+
+        for (int q0 = q_begin; q0 < q_end; q0 += QUERY_TILE) {
+            const int nq = std::min(QUERY_TILE, q_end - q0);
+            for (int q = 0; q < nq; q++) {
+                qptr[q] = queries.row(q0 + q);
+            }
+            score_tile(metric, segments, database.cols, qptr, nq,
+                       query_norms.empty() ? nullptr : &query_norms[q0], packed.data(),
+                       db_norms.empty() ? nullptr : &db_norms[r0], rcount, acc, dist);
+
+            // Hand the tile to the per-query selectors
+            for (int q = 0; q < nq; q++) {
+                TopNSelector &selector = selectors[q0 + q - q_begin];
+                const int skip = exclude[q0 + q];
+                for (int r = 0; r < rcount; r++) {
+                    if (r0 + r == skip) continue;
+                    selector.push(dist[q][r], r0 + r);
+                }
+            }
+        }
+    }
+
+    for (int q = q_begin; q < q_end; q++) {
+        selectors[q - q_begin].sorted(results[q]);
+    }
+}
+
+/*
+  Self-join worker: for the rows of query tiles assigned to this thread (tile t
+  where t % num_threads == thread_id), collects every pair (q, r) with r > q whose
+  distance is at most threshold.
+
+  The tile scores only screen the pairs. |a|^2 + |b|^2 - 2ab cancels badly
+  for near-identical rows, exactly where duplicate thresholds sit, so the
+  screen is widened by the rounding error of a dims-long float sum and the
+  pairs it lets through are confirmed with batch_pair_distance.
+ */
+static void pairs_worker(const FeatureMatrix &database, BatchMetric metric, int segments, float threshold,
+                         const std::vector<float> &norms, int thread_id, int num_threads,
+                         std::vector<std::pair<int, int>> &pairs) {
+    const float rounding = 2.0f * database.cols * FLT_EPSILON;
+    const float screen = threshold + rounding;
+    const float screen_squared = threshold * threshold;
+    std::vector<float> packed;
+    float acc[QUERY_TILE][DB_TILE];
+    float dist[QUERY_TILE][DB_TILE];
+    const float *qptr[QUERY_TILE];
+    const int tiles = (database.rows + QUERY_TILE - 1) / QUERY_TILE;
+
+    for (int r0 = 0; r0 < database.rows; r0 += DB_TILE) {
+        const int rcount = std::min(DB_TILE, database.rows - r0);
+        bool packed_tile = false;
+
+        // interleave query tiles over threads so the triangular work is balanced
+        for (int t = thread_id; t < tiles; t += num_threads) {
+            const int q0 = t * QUERY_TILE;
+            if (q0 >= r0 + rcount) break; // every r in this tile is <= q
+            if (!packed_tile) {
+                pack_db_tile(database, r0, packed);
+                packed_tile = true;
+            }
+            const int nq = std::min(QUERY_TILE, database.rows - q0);
+            for (int q = 0; q < nq; q++) {
+                qptr[q] = database.row(q0 + q);
+            }
+            score_tile(metric, segments, database.cols, qptr, nq,
+                       norms.empty() ? nullptr : &norms[q0], packed.data(),
+                       norms.empty() ? nullptr : &norms[r0], rcount, acc, dist);
+
+            for (int q = 0; q < nq; q++) {
+                for (int r = 0; r < rcount; r++) {
+                    if (r0 + r <= q0 + q) continue;
+                    bool candidate = metric == BatchMetric::SSD
+                                     ? dist[q][r] * dist[q][r] <=
+                                       screen_squared + rounding * (norms[q0 + q] + norms[r0 + r])
+                                     : dist[q][r] <= screen;
+                    if (candidate && batch_pair_distance(metric, segments, database.row(q0 + q),
+                                                         database.row(r0 + r), database.cols) <= threshold) {
+                        pairs.push_back({q0 + q, r0 + r});
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Computes one distance with the same definition the blocked kernels use.
+ *
+ * @param metric Distance family.
+ * @param segments For HISTOGRAM, the number of concatenated histograms.
+ * @param a First vector.
+ * @param b Second vector.
+ * @param dims Length of both vectors.
+ * @return float Distance value.
+ */
+float batch_pair_distance(BatchMetric metric, int segments, const float *a, const float *b, int dims) {
+    if (metric == BatchMetric::SSD) {
+        return calculate_ssd(a, b, dims);
+    }
+    if (metric == BatchMetric::COSINE) {
+        return calculate_cosine_distance(a, b, dims);
+    }
+    float dist = 0.0f;
+    for (int s = 0; s < segments; s++) {
+        const int k0 = static_cast<int>(static_cast<size_t>(dims) * s / segments);
+        const int k1 = static_cast<int>(static_cast<size_t>(dims) * (s + 1) / segments);
+        dist += (1.0f - calculate_histogramIntersection(a + k0, b + k0, k1 - k0)) / segments;
+    }
+    return dist;
+}
+
+/**
+ * @brief Finds every pair of database rows whose distance is at most threshold.
+ *
+ * @param database Feature rows to join with themselves.
+ * @param metric Distance family to use.
+ * @param segments For HISTOGRAM, the number of concatenated histograms.
+ * @param threshold Maximum distance for a pair to be reported.
+ * @param pairs Output pairs (i, j) with i < j, in no particular order.
+ * @param num_threads Worker threads, 0 to use the hardware concurrency.
+ * @return non-zero failure.
+ */
+int batch_find_pairs_within(const FeatureMatrix &database, BatchMetric metric, int segments, float threshold,
+                            std::vector<std::pair<int, int>> &pairs, int num_threads) {
+    pairs.clear();
+    if (metric == BatchMetric::HISTOGRAM && (segments < 1 || segments > database.cols)) {
+        fprintf(stderr, "Error: invalid histogram segment count %d\n", segments);
+        return -1;
+    }
+    if (database.rows < 2) return 0;
+
+    std::vector<float> norms;
+    if (metric != BatchMetric::HISTOGRAM) {
+        squared_norms(database, norms);
+    }
+
+    if (num_threads <= 0) {
+        num_threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    int tiles = (database.rows + QUERY_TILE - 1) / QUERY_TILE;
+    num_threads = std::max(1, std::min(num_threads, tiles));
+
+    std::vector<std::vector<std::pair<int, int>>> per_thread(num_threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < num_threads; t++) {
+        workers.emplace_back(pairs_worker, std::cref(database), metric, segments, threshold,
+                             std::cref(norms), t, num_threads, std::ref(per_thread[t]));
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    for (const auto &found : per_thread) {
+        pairs.insert(pairs.end(), found.begin(), found.end());
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the top N database rows for every query row.
+ *
+ * @param database Feature rows to search.
+ * @param queries Query feature vectors, same number of columns as the database.
+ * @param exclude For each query, a database row to skip (the target itself) or -1.
+ * @param metric Distance family to use.
+ * @param segments For HISTOGRAM, the number of concatenated histograms per row.
+ * @param N Number of matches to keep per query.
+ * @param results Output, one list of (distance, database row) per query, best first.
+ * @param num_threads Worker threads, 0 to use the hardware concurrency.
+ * @return non-zero failure.
+ */
+int batch_find_topN(const FeatureMatrix &database, const FeatureMatrix &queries,
+                    const std::vector<int> &exclude, BatchMetric metric, int segments, int N,
+                    std::vector<std::vector<std::pair<float, int>>> &results, int num_threads) {
+    if (queries.rows > 0 && queries.cols != database.cols) {
+        fprintf(stderr, "Error: query vectors have %d values, database has %d\n", queries.cols, database.cols);
+        return -1;
+    }
+    if (static_cast<int>(exclude.size()) != queries.rows) {
+        fprintf(stderr, "Error: need one exclude entry per query\n");
+        return -1;
+    }
+    if (metric == BatchMetric::HISTOGRAM && (segments < 1 || segments > database.cols)) {
+        fprintf(stderr, "Error: invalid histogram segment count %d\n", segments);
+        return -1;
+    }
+
+    results.assign(queries.rows, std::vector<std::pair<float, int>>());
+    if (queries.rows == 0 || database.rows == 0) return 0;
+
+    std::vector<float> db_norms, query_norms;
+    if (metric != BatchMetric::HISTOGRAM) {
+        squared_norms(database, db_norms);
+        squared_norms(queries, query_norms);
+    }
+
+    if (num_threads <= 0) {
+        num_threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    // no point in splitting below one query tile per thread
+    int max_threads = (queries.rows + QUERY_TILE - 1) / QUERY_TILE;
+    num_threads = std::max(1, std::min(num_threads, max_threads));
+
+    std::vector<std::thread> workers;
+    int per_thread = (queries.rows + num_threads - 1) / num_threads;
+    for (int t = 0; t < num_threads; t++) {
+        int q_begin = t * per_thread;
+        int q_end = std::min(queries.rows, q_begin + per_thread);
+        if (q_begin >= q_end) break;
+        workers.emplace_back(batch_worker, std::cref(database), std::cref(queries), std::cref(exclude),
+                             metric, segments, N, std::cref(db_norms), std::cref(query_norms),
+                             q_begin, q_end, std::ref(results));
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    return 0;
+}
@@ -0,0 +1,461 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 27, 2025
+ * Purpose: Benchmarks for the feature extractors, the distance kernels, CSV
+ * loading and top-N selection. Each case reports throughput, per-call latency
+ * percentiles and heap allocations per call, and the whole run can be written
+ * as JSON so two builds can be compared.
+ */
+#include "../include/feature_registry.h"
+#include "../include/distance_calculate.h"
+#include "../include/batch_search.h"
+#include "../include/csv_util.h"
+#include "../include/match_metrics.h"
+#include "../include/topn_select.h"
+#include "../include/feature_store.h"
+#include "../include/name_arena.h"
+#include "../include/synthetic.h"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+  Heap allocations are counted by replacing the global operator new. Counting
+  is one relaxed atomic increment, so it is left on for the whole run.
+ */
+static atomic<long long> allocation_count(0);
+static atomic<long long> allocation_bytes(0);
+
+void *operator new(size_t size) {
+    allocation_count.fetch_add(1, memory_order_relaxed);
+    allocation_bytes.fetch_add(static_cast<long long>(size), memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) throw bad_alloc();
+    return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+// Minimum time spent measuring one case, and the number of latency samples to aim for
+static double min_case_seconds = 0.3;
+static const int TARGET_SAMPLES = 50;
+// Calls at least this long are timed one by one, shorter ones in batches
+static const double SINGLE_CALL_US = 1.0;
+
+struct BenchResult {
+    string group;    // feature, distance, csv-load, select
+    string name;     // function or kernel
+    string param;    // resolution, dimensions or rows
+    long long calls = 0;
+    long long calls_per_sample = 1; // above 1 the percentiles are of batch means, not single calls
+    double calls_per_second = 0;
+    double items_per_second = 0; // pixels, values or rows processed per second
+    double p50_us = 0, p90_us = 0, p99_us = 0, max_us = 0;
+    double allocs_per_call = 0;
+    double bytes_per_call = 0;
+};
+
+static vector<BenchResult> results;
+
+static double seconds_since(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/*
+  Runs fn in timed samples. Calls of SINGLE_CALL_US or more are timed one by
+  one, so the percentiles are of single calls. Shorter ones run in batches,
+  grown until one takes about min_case_seconds / TARGET_SAMPLES, so calls much
+  shorter than the clock resolution are still timed meaningfully; their
+  percentiles are of the batch means, which hide the spread between calls.
+ */
+static void run_case(const string &group, const string &name, const string &param, double items_per_call,
+                     const function<void()> &fn) {
+    // warm up once, then size the batches
+    fn();
+    double sample_target = min_case_seconds / TARGET_SAMPLES;
+    long long batch = 1;
+    double call_us;
+    for (;;) {
+        auto start = chrono::steady_clock::now();
+        for (long long i = 0; i < batch; i++) fn();
+        double t = seconds_since(start);
+        call_us = t * 1e6 / batch;
+        if (t >= sample_target || batch >= (1LL << 24)) break;
+        batch *= t > 0 ? max(2LL, min(16LL, static_cast<long long>(sample_target / t) + 1)) : 16;
+    }
+    if (call_us >= SINGLE_CALL_US) batch = 1;
+
+    // reserved up front, so the samples are not counted as the case's allocations
+    vector<double> per_call_us;
+    per_call_us.reserve(TARGET_SAMPLES + static_cast<size_t>(min_case_seconds * 1e6 / max(call_us, 1e-3) / batch));
+    long long calls = 0;
+    long long allocs_before = allocation_count.load(), bytes_before = allocation_bytes.load();
+    auto case_start = chrono::steady_clock::now();
+    while (per_call_us.size() < static_cast<size_t>(TARGET_SAMPLES) || seconds_since(case_start) < min_case_seconds) {
+        auto start = chrono::steady_clock::now();
+        for (long long i = 0; i < batch; i++) fn();
+        per_call_us.push_back(seconds_since(start) * 1e6 / batch);
+        calls += batch;
+        if (seconds_since(case_start) > 20 * min_case_seconds && per_call_us.size() >= 5) break;
+    }
+    double total = seconds_since(case_start);
+    long long allocs = allocation_count.load() - allocs_before, bytes = allocation_bytes.load() - bytes_before;
+
+    sort(per_call_us.begin(), per_call_us.end());
+    auto percentile = [&per_call_us](double p) {
+        return per_call_us[static_cast<size_t>(p * (per_call_us.size() - 1))];
+    };
+    BenchResult r;
+    r.group = group;
+    r.name = name;
+    r.param = param;
+    r.calls = calls;
+    r.calls_per_sample = batch;
+    r.calls_per_second = calls / total;
+    r.items_per_second = r.calls_per_second * items_per_call;
+    r.p50_us = percentile(0.5);
+    r.p90_us = percentile(0.9);
+    r.p99_us = percentile(0.99);
+    r.max_us = per_call_us.back();
+    r.allocs_per_call = static_cast<double>(allocs) / calls;
+    r.bytes_per_call = static_cast<double>(bytes) / calls;
+    results.push_back(r);
+    printf("%-10s %-22s %-12s %12.1f calls/s %14.4g items/s  p50 %10.2f us  p99 %10.2f us  %8.2f allocs/call\n",
+           group.c_str(), name.c_str(), param.c_str(), r.calls_per_second, r.items_per_second, r.p50_us, r.p99_us,
+           r.allocs_per_call);
+    fflush(stdout);
+}
+
+// Every .jpg/.png/.ppm/.tif in a directory, decoded at full size
+static void load_images(const char *dirname, vector<cv::Mat> &images) {
+    DIR *dirp = opendir(dirname);
+    if (dirp == NULL) {
+        printf("Cannot open directory %s, skipping the image benchmarks\n", dirname);
+        return;
+    }
+    struct dirent *dp;
+    while ((dp = readdir(dirp)) != NULL) {
+        if (strstr(dp->d_name, ".jpg") || strstr(dp->d_name, ".png") || strstr(dp->d_name, ".ppm") ||
+            strstr(dp->d_name, ".tif")) {
+            string path = string(dirname) + "/" + dp->d_name;
+            cv::Mat image = cv::imread(path);
+            if (!image.empty()) images.push_back(image);
+        }
+    }
+    closedir(dirp);
+}
+
+static void bench_features(const char *image_dir, bool with_models) {
+    vector<cv::Mat> real_images;
+    load_images(image_dir, real_images);
+
+    const int sizes[][2] = {{320, 240}, {640, 480}, {1280, 960}, {1920, 1080}};
+    vector<pair<string, vector<cv::Mat>>> sets;
+    if (!real_images.empty()) sets.push_back({string(image_dir), real_images});
+    for (const auto &size : sizes) {
+        vector<cv::Mat> images;
+        for (unsigned s = 0; s < 4; s++) images.push_back(synthesize_image(size[0], size[1], s + 1));
+        sets.push_back({to_string(size[0]) + "x" + to_string(size[1]), images});
+    }
+
+    for (const FeatureInfo *feature : list_features()) {
+        if (feature->extract_image == nullptr) continue;
+        if (feature->cost == CostClass::MODEL) {
+            if (!with_models) {
+                printf("%-10s %-22s skipped, runs a model (use --models)\n", "feature", feature->name.c_str());
+                continue;
+            }
+            if (feature->warmup && feature->warmup() != 0) {
+                printf("%-10s %-22s skipped, its model did not load\n", "feature", feature->name.c_str());
+                continue;
+            }
+        }
+        for (auto &set : sets) {
+            vector<cv::Mat> &images = set.second;
+            double pixels = 0;
+            for (const cv::Mat &image : images) pixels += static_cast<double>(image.total());
+            size_t next = 0;
+            vector<float> out;
+            // extract_image takes a non-const reference, so each call gets its own header of the pixels
+            run_case("feature", feature->name, set.first, pixels / images.size(), [&]() {
+                cv::Mat image = images[next++ % images.size()];
+                out.clear();
+                feature->extract_image(image, out);
+            });
+        }
+    }
+}
+
+static void bench_distances() {
+    mt19937 rng(42);
+    uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    const int dims_list[] = {147, 256, 512, 1024, 2048, 4096};
+    const int PAIRS = 64; // rotate over a few pairs so one pair is not always hot in L1
+
+    for (int dims : dims_list) {
+        vector<vector<float>> a(PAIRS, vector<float>(dims)), b(PAIRS, vector<float>(dims));
+        for (int p = 0; p < PAIRS; p++) {
+            float sum_a = 0, sum_b = 0;
+            for (int d = 0; d < dims; d++) {
+                a[p][d] = uniform(rng);
+                b[p][d] = uniform(rng);
+                sum_a += a[p][d];
+                sum_b += b[p][d];
+            }
+            // histogram kernels expect normalized rows
+            for (int d = 0; d < dims; d++) {
+                a[p][d] /= sum_a;
+                b[p][d] /= sum_b;
+            }
+        }
+        string param = to_string(dims);
+        volatile float sink = 0;
+        int p = 0;
+
+        run_case("distance", "ssd", param, dims, [&]() {
+            sink = calculate_ssd(a[p].data(), b[p].data(), dims);
+            p = (p + 1) % PAIRS;
+        });
+        run_case("distance", "ssd-bounded", param, dims, [&]() {
+            sink = calculate_ssd_squared_bounded(a[p].data(), b[p].data(), dims, 1e30f);
+            p = (p + 1) % PAIRS;
+        });
+        run_case("distance", "hist-intersection", param, dims, [&]() {
+            sink = calculate_histogramIntersection(a[p].data(), b[p].data(), dims);
+            p = (p + 1) % PAIRS;
+        });
+        run_case("distance", "cosine", param, dims, [&]() {
+            sink = calculate_cosine_distance(a[p].data(), b[p].data(), dims);
+            p = (p + 1) % PAIRS;
+        });
+        run_case("distance", "multi-hist", param, dims, [&]() {
+            sink = calculate_multiHist_distance(a[p].data(), b[p].data(), dims);
+            p = (p + 1) % PAIRS;
+        });
+        run_case("distance", "region-4", param, dims, [&]() {
+            sink = calculate_region_distance(a[p].data(), b[p].data(), dims, 4);
+            p = (p + 1) % PAIRS;
+        });
+        run_case("distance", "texture-color", param, dims, [&]() {
+            sink = calculate_textureColor_distance(a[p].data(), b[p].data(), dims);
+            p = (p + 1) % PAIRS;
+        });
+        run_case("distance", "face", param, dims, [&]() {
+            sink = face_distance(a[p].data(), b[p].data(), dims);
+            p = (p + 1) % PAIRS;
+        });
+        (void) sink;
+    }
+}
+
+// Writes a CSV of `rows` random rows with `dims` values, in the format the tools write
+static int write_synthetic_csv(const char *path, long rows, int dims) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        printf("Unable to open %s\n", path);
+        return -1;
+    }
+    mt19937 rng(7);
+    uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    vector<float> row(dims);
+    char name[64];
+    for (long r = 0; r < rows; r++) {
+        for (float &v : row) v = uniform(rng);
+        snprintf(name, sizeof(name), "../synthetic/img.%08ld.jpg", r);
+        write_image_data_row(fp, name, row);
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void free_filenames(vector<char *> &filenames) {
+    release_names(filenames);
+    filenames.clear();
+}
+
+static void bench_csv_and_select(const vector<long> &row_counts, int dims) {
+    char path[] = "/tmp/proj2-benchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Cannot create a temporary CSV, skipping the CSV benchmarks\n");
+        return;
+    }
+    close(fd);
+
+    for (long rows : row_counts) {
+        string param = to_string(rows) + "x" + to_string(dims);
+        if (write_synthetic_csv(path, rows, dims) != 0) break;
+
+        // one load per sample: loads of large files take seconds, so only a few samples are taken
+        vector<char *> filenames;
+        vector<vector<float>> data;
+        double saved = min_case_seconds;
+        min_case_seconds = min(min_case_seconds, 0.05);
+        run_case("csv-load", "read_image_data_csv", param, static_cast<double>(rows), [&]() {
+            free_filenames(filenames);
+            data.clear();
+            read_image_data_csv(path, filenames, data);
+        });
+
+        // the same rows as a binary store
+        string store_path = string(path) + ".bin";
+        FeatureStoreWriter store;
+        if (store.open(store_path.c_str(), dims, 0) == 0) {
+            int status = 0;
+            for (size_t r = 0; r < data.size() && status == 0; r++) status = store.append(filenames[r], data[r].data());
+            if (status == 0 && store.close() == 0) {
+                vector<char *> store_names;
+                vector<vector<float>> store_data;
+                run_case("csv-load", "read_feature_store", param, static_cast<double>(rows), [&]() {
+                    free_filenames(store_names);
+                    store_data.clear();
+                    read_feature_store(store_path.c_str(), store_names, store_data);
+                });
+                free_filenames(store_names);
+            }
+            unlink(store_path.c_str());
+        }
+        min_case_seconds = saved;
+
+        // selection of the 10 best of `rows` precomputed distances
+        vector<float> distances(rows);
+        mt19937 rng(3);
+        uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        for (float &d : distances) d = uniform(rng);
+        TopNSelector best(10);
+        vector<pair<float, int>> top;
+        run_case("select", "topn-selector", param, static_cast<double>(rows), [&]() {
+            best.reset(10);
+            for (long i = 0; i < rows; i++) best.push(distances[i], static_cast<int>(i));
+            best.sorted(top);
+        });
+
+        // full scan and selection, as a single ssd query does it on the prepared rows
+        vector<int> column_order;
+        prepare_ssd_order(data, column_order);
+        vector<float> target = data.empty() ? vector<float>(dims, 0.5f) : data[0];
+        vector<char *> output;
+        run_case("select", "ssd-scan-top10", param, static_cast<double>(rows), [&]() {
+            output.clear();
+            find_topN_matches_ssd(target, 0, filenames, data, 10, output);
+        });
+        free_filenames(filenames);
+    }
+    unlink(path);
+}
+
+// s as the body of a JSON string
+static string json_escape(const string &s) {
+    string escaped;
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += static_cast<char>(c);
+        }
+    }
+    return escaped;
+}
+
+static void write_json(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        printf("Unable to open output file %s\n", path);
+        return;
+    }
+    fprintf(fp, "{\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+        fprintf(fp,
+                "    {\"group\": \"%s\", \"name\": \"%s\", \"param\": \"%s\", \"calls\": %lld, "
+                "\"calls_per_sample\": %lld, \"calls_per_second\": %.6g, \"items_per_second\": %.6g, "
+                "\"p50_us\": %.6g, \"p90_us\": %.6g, \"p99_us\": %.6g, \"max_us\": %.6g, \"allocs_per_call\": %.6g, "
+                "\"bytes_per_call\": %.6g}%s\n",
+                json_escape(r.group).c_str(), json_escape(r.name).c_str(), json_escape(r.param).c_str(), r.calls,
+                r.calls_per_sample, r.calls_per_second, r.items_per_second,
+                r.p50_us, r.p90_us, r.p99_us, r.max_us, r.allocs_per_call, r.bytes_per_call,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+    printf("Wrote %zu results to %s\n", results.size(), path);
+}
+
+/**
+ * @brief Entry point: Proj2-benchmark [options]
+ *
+ * Options:
+ *   --images <dir>    real images for the feature cases (default ../olympus-test)
+ *   --rows <list>     comma separated row counts for CSV load and selection (default 1000,10000,100000)
+ *   --dims <n>        values per row in those cases (default 27, the 7x7-square feature)
+ *   --only <groups>   comma separated subset of feature, distance, csv
+ *   --models          also time the features that run DA2 or the face cascade
+ *   --time <seconds>  minimum time per case (default 0.3)
+ *   --json <file>     write every result as JSON
+ */
+int main(int argc, char *argv[]) {
+    const char *image_dir = "../olympus-test";
+    const char *json_path = nullptr;
+    string only = "feature,distance,csv";
+    vector<long> row_counts = {1000, 10000, 100000};
+    int dims = 27;
+    bool with_models = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--images") == 0 && i + 1 < argc) {
+            image_dir = argv[++i];
+        } else if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+            row_counts.clear();
+            for (char *tok = strtok(argv[++i], ","); tok; tok = strtok(NULL, ",")) {
+                long rows = atol(tok);
+                if (rows > 0) row_counts.push_back(rows);
+            }
+        } else if (strcmp(argv[i], "--dims") == 0 && i + 1 < argc) {
+            dims = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else if (strcmp(argv[i], "--models") == 0) {
+            with_models = true;
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            min_case_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else {
+            printf("usage: %s [--images dir] [--rows n,n,...] [--dims n] [--only feature,distance,csv] [--models]"
+                   " [--time seconds] [--json output.json]\n", argv[0]);
+            exit(-1);
+        }
+    }
+    if (dims <= 0 || min_case_seconds <= 0) {
+        printf("--dims and --time must be positive\n");
+        exit(-1);
+    }
+
+    if (only.find("feature") != string::npos) bench_features(image_dir, with_models);
+    if (only.find("distance") != string::npos) bench_distances();
+    if (only.find("csv") != string::npos) bench_csv_and_select(row_counts, dims);
+
+    if (json_path) write_json(json_path);
+    return 0;
+}
@@ -0,0 +1,304 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 25, 2025
+ * Purpose: Cascaded ranking: cheap prefilter over every row, full fused metric
+ * on the survivors
+ */
+
+#include "../include/cascade.h"
+#include "../include/distance_calculate.h"
+#include "../include/instrument.h"
+#include "../include/match_metrics.h"
+#include "../include/topn_select.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+using namespace std;
+
+static CascadeOptions cascade_options;
+
+void set_cascade_options(const CascadeOptions &options) {
+    cascade_options = options;
+}
+
+const CascadeOptions &get_cascade_options() {
+    return cascade_options;
+}
+
+/*
+  ResNet18 rows quantized to int8 with one scale per row. Cosine is scale
+  invariant, so the Q8 distance only needs the integer dot products and norms.
+ */
+struct QuantizedRows {
+    int rows = 0;
+    int cols = 0;
+    std::vector<int8_t> values; // rows * cols
+    std::vector<int32_t> norms; // squared norm of each row
+};
+
+static QuantizedRows embedding_q8;
+
+// Symmetric quantization of n values onto [-127, 127]; returns the squared norm of the result
+static int32_t quantize_row(const float *row, int n, int8_t *out) {
+    float max_abs = 0.0f;
+    for (int i = 0; i < n; i++) max_abs = std::max(max_abs, std::fabs(row[i]));
+    float scale = max_abs > 0.0f ? 127.0f / max_abs : 0.0f;
+    int32_t norm = 0;
+    for (int i = 0; i < n; i++) {
+        out[i] = static_cast<int8_t>(std::lround(row[i] * scale));
+        norm += out[i] * out[i];
+    }
+    return norm;
+}
+
+int prepare_cascade(std::vector<std::vector<float>> &, std::vector<std::vector<float>> &rnnData) {
+    embedding_q8 = QuantizedRows();
+    if (rnnData.empty()) return 0;
+    int cols = static_cast<int>(rnnData[0].size());
+    for (const auto &row : rnnData) {
+        if (static_cast<int>(row.size()) != cols) {
+            fprintf(stderr, "ResNet18 rows differ in length, not quantizing them\n");
+            return 0;
+        }
+    }
+    embedding_q8.rows = static_cast<int>(rnnData.size());
+    embedding_q8.cols = cols;
+    embedding_q8.values.resize(static_cast<size_t>(embedding_q8.rows) * cols);
+    embedding_q8.norms.resize(embedding_q8.rows);
+    for (int i = 0; i < embedding_q8.rows; i++) {
+        embedding_q8.norms[i] = quantize_row(rnnData[i].data(), cols,
+                                             embedding_q8.values.data() + static_cast<size_t>(i) * cols);
+    }
+    return 0;
+}
+
+// Cosine distance of two int8 vectors; a norm of -1 is computed here
+static float q8_cosine_distance(const int8_t *a, const int8_t *b, int n, int32_t norm_a, int32_t norm_b) {
+    int32_t dot = 0;
+    for (int i = 0; i < n; i++) {
+        dot += a[i] * b[i];
+    }
+    if (norm_a < 0) {
+        norm_a = 0;
+        for (int i = 0; i < n; i++) norm_a += a[i] * a[i];
+    }
+    if (norm_b < 0) {
+        norm_b = 0;
+        for (int i = 0; i < n; i++) norm_b += b[i] * b[i];
+    }
+    if (norm_a == 0 || norm_b == 0) return 1.0f;
+    return 1.0f - static_cast<float>(dot) / (std::sqrt(static_cast<float>(norm_a)) * std::sqrt(static_cast<float>(norm_b)));
+}
+
+static float term_distance(TermDistance distance, const float *a, const float *b, int n) {
+    switch (distance) {
+        case TermDistance::COSINE: return calculate_cosine_distance(a, b, n);
+        case TermDistance::FACE: return face_distance(a, b, n);
+        case TermDistance::HIST_INTERSECTION: return calculate_histogramIntersection(a, b, n);
+        case TermDistance::HIST_DISTANCE: return 1.0f - calculate_histogramIntersection(a, b, n);
+        case TermDistance::TEXTURE_COLOR: return calculate_textureColor_distance(a, b, n);
+    }
+    return 0.0f;
+}
+
+/*
+  A term resolved against one query: where its rows live, the target slice and
+  the quantized target for Q8 terms.
+ */
+struct BoundTerm {
+    CascadeTerm term;
+    std::vector<std::vector<float>> *rows = nullptr;
+    const float *target = nullptr;
+    int length = 0;
+    std::vector<int8_t> target_q8;
+    int32_t target_q8_norm = 0; // squared norm of the target slice
+    bool whole_row = false; // the term reads whole rows, so the stored norms apply
+};
+
+static int bind_terms(const CascadeStage &stage, std::vector<float> &target, std::vector<float> &target_rnn,
+                      std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &rnnData,
+                      std::vector<BoundTerm> &bound, bool &dropped) {
+    bound.clear();
+    dropped = false;
+    for (const CascadeTerm &term : stage.terms) {
+        bool embedding = term.source != TermSource::FEATURE;
+        // an unseen image has no ResNet18 embedding, the old rankers added 0 for it
+        if (embedding && target_rnn.empty()) {
+            dropped = true;
+            continue;
+        }
+        std::vector<float> &target_row = embedding ? target_rnn : target;
+        std::vector<std::vector<float>> &rows = embedding ? rnnData : data;
+        int width = static_cast<int>(target_row.size());
+        int length = term.length < 0 ? width - term.offset : term.length;
+        if (term.offset < 0 || length <= 0 || term.offset + length > width ||
+            (!rows.empty() && static_cast<int>(rows[0].size()) < term.offset + length)) {
+            fprintf(stderr, "Cascade stage %s reads values %d..%d, rows have %d\n", stage.name.c_str(), term.offset,
+                    term.offset + length, width);
+            return -1;
+        }
+        if (term.source == TermSource::EMBEDDING_Q8 && term.distance != TermDistance::COSINE) {
+            fprintf(stderr, "Cascade stage %s: quantized embeddings only support cosine\n", stage.name.c_str());
+            return -1;
+        }
+
+        BoundTerm b;
+        b.term = term;
+        b.rows = &rows;
+        b.target = target_row.data() + term.offset;
+        b.length = length;
+        b.whole_row = term.offset == 0 && length == width;
+        if (term.source == TermSource::EMBEDDING_Q8) {
+            if (embedding_q8.rows == static_cast<int>(rnnData.size()) && embedding_q8.cols == width) {
+                b.target_q8.resize(width);
+                quantize_row(target_row.data(), width, b.target_q8.data());
+                for (int i = term.offset; i < term.offset + length; i++) {
+                    b.target_q8_norm += b.target_q8[i] * b.target_q8[i];
+                }
+            } else {
+                // not prepared for these rows, use the float embedding
+                b.term.source = TermSource::EMBEDDING;
+            }
+        }
+        bound.push_back(std::move(b));
+    }
+    return 0;
+}
+
+static float stage_score(const std::vector<BoundTerm> &bound, int row) {
+    float score = 0.0f;
+    for (const BoundTerm &b : bound) {
+        float d;
+        if (b.term.source == TermSource::EMBEDDING_Q8) {
+            const int8_t *values = embedding_q8.values.data() + static_cast<size_t>(row) * embedding_q8.cols;
+            int32_t norm_row = b.whole_row ? embedding_q8.norms[row] : -1;
+            d = q8_cosine_distance(values + b.term.offset, b.target_q8.data() + b.term.offset, b.length, norm_row,
+                                   b.target_q8_norm);
+        } else {
+            d = term_distance(b.term.distance, (*b.rows)[row].data() + b.term.offset, b.target, b.length);
+        }
+        // weights are doubles so the products round like the old hard-coded "* 0.8"
+        score += static_cast<float>(d * b.term.weight);
+    }
+    return score;
+}
+
+// Runs the stages of a plan; stage_rows gets the number of rows each stage scored
+static int run_stages(const CascadePlan &plan, std::vector<float> &target, std::vector<float> &target_rnn,
+                      int target_index, std::vector<std::vector<float>> &data,
+                      std::vector<std::vector<float>> &rnnData, int N, std::vector<std::pair<float, int>> &result,
+                      std::vector<int> &stage_rows) {
+    result.clear();
+    stage_rows.clear();
+    if (plan.stages.empty()) return -1;
+
+    // rows every stage can read
+    size_t rows = data.size();
+    for (const CascadeStage &stage : plan.stages) {
+        for (const CascadeTerm &term : stage.terms) {
+            if (term.source != TermSource::FEATURE) rows = std::min(rows, rnnData.size());
+        }
+    }
+    std::vector<int> candidates;
+    candidates.reserve(rows);
+    for (size_t i = 0; i < rows; i++) {
+        if (static_cast<int>(i) == target_index) continue;
+        if (plan.skip_zero_last && (data[i].empty() || data[i].back() == 0)) continue;
+        candidates.push_back(static_cast<int>(i));
+    }
+
+    std::vector<BoundTerm> bound;
+    for (size_t s = 0; s < plan.stages.size(); s++) {
+        const CascadeStage &stage = plan.stages[s];
+        bool last = s + 1 == plan.stages.size();
+        int keep = last ? N : stage.keep;
+        // a prefilter that would keep every row does no filtering
+        if (!last && (keep <= 0 || keep >= static_cast<int>(candidates.size()))) continue;
+        bool dropped;
+        if (bind_terms(stage, target, target_rnn, data, rnnData, bound, dropped) != 0) return -1;
+        // without all of its terms a prefilter can not be trusted to keep the best rows
+        if (!last && dropped) continue;
+
+        TopNSelector best(keep);
+        {
+            // one span per stage, e.g. cascade/depth-prefilter
+            ScopedTimer timer(instrument_enabled() ? instrument_id(("cascade/" + stage.name).c_str()) : 0);
+            for (int row : candidates) {
+                best.push(stage_score(bound, row), row);
+            }
+        }
+        INSTRUMENT_VALUE("cascade_stage_rows", static_cast<double>(candidates.size()));
+        stage_rows.push_back(static_cast<int>(candidates.size()));
+        INSTRUMENT_SCOPE("select");
+        best.sorted(result);
+        candidates.clear();
+        for (const auto &match : result) candidates.push_back(match.second);
+    }
+    return 0;
+}
+
+int run_cascade(const CascadePlan &plan, std::vector<float> &target, std::vector<float> &target_rnn,
+                int target_index, std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &rnnData,
+                int N, std::vector<std::pair<float, int>> &result) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<int> stage_rows;
+    if (run_stages(plan, target, target_rnn, target_index, data, rnnData, N, result, stage_rows) != 0) {
+        return -1;
+    }
+    if (!cascade_options.log_recall || plan.stages.size() < 2) return 0;
+
+    // Recall against the full metric on every row
+    double cascade_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    CascadePlan exhaustive;
+    exhaustive.stages.push_back(plan.stages.back());
+    exhaustive.skip_zero_last = plan.skip_zero_last;
+    std::vector<std::pair<float, int>> expected;
+    std::vector<int> exhaustive_rows;
+    if (run_stages(exhaustive, target, target_rnn, target_index, data, rnnData, N, expected, exhaustive_rows) != 0) {
+        return -1;
+    }
+    double exhaustive_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    int found = 0;
+    for (const auto &match : expected) {
+        for (const auto &got : result) {
+            if (got.second == match.second) {
+                found++;
+                break;
+            }
+        }
+    }
+    fprintf(stderr, "cascade %s: rows", plan.stages.back().name.c_str());
+    for (int rows : stage_rows) fprintf(stderr, " %d ->", rows);
+    fprintf(stderr, " %zu, recall@%d %d/%zu (%.2f ms, exhaustive %.2f ms)\n", result.size(), N, found,
+            expected.size(), cascade_ms, exhaustive_ms);
+    return 0;
+}
+
+CascadePlan make_cascade_plan(const std::string &name, const std::vector<CascadeTerm> &prefilter,
+                              const std::vector<CascadeTerm> &fused) {
+    CascadePlan plan;
+    if (cascade_options.prefilter > 0) {
+        CascadeStage first;
+        first.name = name + "-prefilter";
+        first.terms = prefilter;
+        first.keep = cascade_options.prefilter;
+        plan.stages.push_back(first);
+    }
+    CascadeStage last;
+    last.name = name;
+    last.terms = fused;
+    plan.stages.push_back(last);
+
+    // query-time weights, matched to the terms by position
+    const std::vector<double> &weights = cascade_options.weights;
+    for (CascadeStage &stage : plan.stages) {
+        if (weights.empty() || weights.size() != stage.terms.size()) continue;
+        for (size_t t = 0; t < weights.size(); t++) stage.terms[t].weight = weights[t];
+    }
+    return plan;
+}
@@ -0,0 +1,76 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 14, 2025
+ * Purpose: 64-bit content hashing for files and pixel buffers
+ */
+
+#include "../include/content_hash.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+/**
+ * @brief Hashes a block of bytes (MurmurHash64A).
+ *
+ * @param data Bytes to hash.
+ * @param len Number of bytes.
+ * @param seed Starting value; pass the previous hash to chain blocks.
+ * @return uint64_t Hash value.
+ */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (len * m);
+
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    const unsigned char *end = p + (len / 8) * 8;
+    for (; p != end; p += 8) {
+        uint64_t k;
+        memcpy(&k, p, 8); // unaligned-safe load
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    // remaining 0..7 bytes
+    switch (len & 7) {
+        case 7: h ^= static_cast<uint64_t>(p[6]) << 48; // fall through
+        case 6: h ^= static_cast<uint64_t>(p[5]) << 40; // fall through
+        case 5: h ^= static_cast<uint64_t>(p[4]) << 32; // fall through
+        case 4: h ^= static_cast<uint64_t>(p[3]) << 24; // fall through
+        case 3: h ^= static_cast<uint64_t>(p[2]) << 16; // fall through
+        case 2: h ^= static_cast<uint64_t>(p[1]) << 8;  // fall through
+        case 1: h ^= static_cast<uint64_t>(p[0]);
+            h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+/**
+ * @brief Hashes the contents of a file, read in fixed 1 MB blocks chained through the seed.
+ *
+ * @param filename Path of the file.
+ * @param hash Output hash value.
+ * @return non-zero if the file can not be read.
+ */
+int hash_file_contents(const char *filename, uint64_t &hash) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return -1;
+    }
+    std::vector<unsigned char> block(1 << 20);
+    hash = hash_bytes(nullptr, 0);
+    size_t n;
+    while ((n = fread(block.data(), 1, block.size(), fp)) > 0) {
+        hash = hash_bytes(block.data(), n, hash);
+    }
+    int error = ferror(fp);
+    fclose(fp);
+    return error ? -1 : 0;
+}
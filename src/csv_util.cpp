@@ -15,6 +15,8 @@ The function returns a std::vector of char* for the filenames and a 2D std::vect
 #include <cstring>
 #include <vector>
 #include "opencv2/opencv.hpp"
+#include "../include/instrument.h"
+#include "../include/name_arena.h"
 
 /*
   reads a string from a CSV file. the 0-terminated string is returned in the char array os.
@@ -144,6 +146,57 @@ int append_image_data_csv(char *filename, char *image_filename, std::vector<floa
   return(0);
 }
 
+/*
+  Given an open file, an image filename, and the image features, writes
+  one row in the same format as append_image_data_csv.
+
+  The function returns a non-zero value in case of an error.
+ */
+int write_image_data_row(FILE *fp, const char *image_filename, std::vector<float> &image_data) {
+  fputs( image_filename, fp );
+  for(size_t j=0;j<image_data.size();j++) {
+    fprintf( fp, ",%.4f", image_data[j] );
+  }
+  fputc( '\n', fp ); // EOL
+
+  return( ferror(fp) ? -1 : 0 );
+}
+
+/*
+  Given a filename, a list of image filenames, and one feature vector
+  per image, writes the whole table to the CSV format file in a single
+  pass, replacing any existing contents. Rows use the same format as
+  append_image_data_csv.
+
+  The function returns a non-zero value in case of an error.
+ */
+int write_image_data_csv(char *filename, std::vector<char *> &filenames, std::vector<std::vector<float>> &data) {
+  FILE *fp;
+
+  if( filenames.size() != data.size() ) {
+    printf("Number of filenames and feature rows differ\n");
+    return(-1);
+  }
+
+  fp = fopen( filename, "w" );
+  if(!fp) {
+    printf("Unable to open output file %s\n", filename );
+    return(-1);
+  }
+
+  for(size_t i=0;i<data.size();i++) {
+    write_image_data_row( fp, filenames[i], data[i] );
+  }
+
+  int error = ferror(fp);
+  if( fclose(fp) != 0 || error ) {
+    printf("Error writing output file %s\n", filename );
+    return(-1);
+  }
+
+  return(0);
+}
+
 /*
   Given a file with the format of a string as the first column and
   floating point numbers as the remaining columns, this function
@@ -171,47 +224,48 @@ int read_image_data_csv(char *filename, std::vector<char *> &filenames, std::vec
 
     printf("Reading %s\n", filename);
 
-    // Temporary storage for sorting
-    std::vector<std::pair<std::string, std::vector<float>>> file_data_pairs;
+    // Names go into one arena, rows are sorted by their ids
+    NameArena names;
+    std::vector<std::vector<float>> rows;
 
-    for (;;) {
-        std::vector<float> dvec;
+    // Parse every row
+    {
+        INSTRUMENT_SCOPE("csv_parse");
+        for (;;) {
+            std::vector<float> dvec;
 
-        // Read the filename
-        if (getstring(fp, img_file)) {
-            break;
-        }
+            // Read the filename
+            if (getstring(fp, img_file)) {
+                break;
+            }
 
-        // Read feature data
-        for (;;) {
-            float eol = getfloat(fp, &fval);
-            dvec.push_back(fval);
-            if (eol) break;
-        }
+            // Read feature data
+            for (;;) {
+                float eol = getfloat(fp, &fval);
+                dvec.push_back(fval);
+                if (eol) break;
+            }
 
-        // Store as pair for sorting
-        file_data_pairs.push_back({std::string(img_file), dvec});
+            names.add(img_file, strlen(img_file));
+            rows.push_back(std::move(dvec));
+        }
     }
 
     fclose(fp);
     printf("Finished reading CSV file\n");
 
     // Sort based on filenames (alphabetical order)
-    std::sort(file_data_pairs.begin(), file_data_pairs.end(),
-              [](const std::pair<std::string, std::vector<float>> &a, const std::pair<std::string, std::vector<float>> &b) {
-                  return a.first < b.first;
-              });
+    INSTRUMENT_SCOPE("csv_sort");
+    std::vector<uint32_t> order;
+    names.sorted_ids(order);
 
-    // Transfer sorted data back to original vectors
-    filenames.clear();
+    // Move the rows over in that order; filenames point into the arena
     data.clear();
-    for (const auto &entry : file_data_pairs) {
-        // Allocate memory for filename
-        char *fname = new char[entry.first.length() + 1];
-        strcpy(fname, entry.first.c_str());
-        filenames.push_back(fname);
-        data.push_back(entry.second);
+    data.reserve(order.size());
+    for (uint32_t id : order) {
+        data.push_back(std::move(rows[id]));
     }
+    adopt_names(std::move(names), order, filenames);
 
     // Print data if echo_file is enabled
     if (echo_file) {
@@ -228,3 +282,65 @@ int read_image_data_csv(char *filename, std::vector<char *> &filenames, std::vec
     return 0;
 }
 
+
+/*
+  Given a file with the same format as read_image_data_csv and a byte
+  offset into it, reads the rows that start at or after the offset, in
+  file order, for picking up rows appended since an earlier read. Only
+  complete lines are read; end_offset is set to the byte after the
+  last one, which is where the next call should start.
+
+  The function returns a non-zero value if something goes wrong.
+ */
+int read_image_data_csv_tail(char *filename, long long offset, std::vector<char *> &filenames,
+                             std::vector<std::vector<float>> &data, long long &end_offset) {
+    filenames.clear();
+    data.clear();
+    end_offset = offset;
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        printf("Unable to open feature file\n");
+        return -1;
+    }
+    std::vector<char> tail;
+    char block[1 << 16];
+    size_t n;
+    if (fseeko(fp, static_cast<off_t>(offset), SEEK_SET) != 0) {
+        fclose(fp);
+        return -1;
+    }
+    while ((n = fread(block, 1, sizeof(block), fp)) > 0) {
+        tail.insert(tail.end(), block, block + n);
+    }
+    fclose(fp);
+
+    // a row that is still being appended is left for the next call
+    size_t complete = tail.size();
+    while (complete > 0 && tail[complete - 1] != '\n') complete--;
+    if (complete == 0) {
+        return 0;
+    }
+    FILE *rows = fmemopen(tail.data(), complete, "r");
+    if (!rows) {
+        return -1;
+    }
+    INSTRUMENT_SCOPE("csv_parse");
+    char img_file[256];
+    float fval;
+    NameArena names;
+    while (!getstring(rows, img_file)) {
+        std::vector<float> dvec;
+        for (;;) {
+            float eol = getfloat(rows, &fval);
+            dvec.push_back(fval);
+            if (eol) break;
+        }
+        names.add(img_file, strlen(img_file));
+        data.push_back(std::move(dvec));
+    }
+    fclose(rows);
+    adopt_names(std::move(names), std::vector<uint32_t>(), filenames);
+    end_offset = offset + static_cast<long long>(complete);
+    return 0;
+}
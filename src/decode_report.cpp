@@ -0,0 +1,206 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 18, 2025
+ * Purpose: Measure what reduced-resolution decoding costs and saves for a
+ * feature type. Every image in a directory is decoded at full size, at 1/2,
+ * 1/4 and 1/8 scale and with the feature's default policy. For each setting
+ * the report gives decode and extraction time, the distance between its
+ * features and the full-resolution features, and how many of the
+ * full-resolution top-N matches it still returns.
+ */
+#include "../include/feature_registry.h"
+#include "../include/feature_matrix.h"
+#include "../include/batch_search.h"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+#include <dirent.h>
+
+using namespace std;
+
+// Queries used for the top-N agreement, spread evenly over the directory
+static const int MAX_QUERIES = 200;
+
+// One decode setting: a fixed scale, or 0 for the feature's DecodePolicy
+struct DecodeSetting {
+    const char *name;
+    int scale;
+    double decode_ms = 0;
+    double extract_ms = 0;
+    vector<vector<float>> features;
+
+    DecodeSetting(const char *setting_name, int setting_scale) : name(setting_name), scale(setting_scale) {}
+};
+
+static double elapsed_ms(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+/*
+  Decodes and extracts every image with one setting. Images that fail under
+  any setting are reported by the caller, so a failure here just leaves an
+  empty row.
+ */
+static void run_setting(DecodeSetting &setting, vector<string> &images, const FeatureInfo &feature) {
+    ImageFeatureFunction extract = feature.extract_image;
+    DecodePolicy policy = feature.decode;
+    setting.features.assign(images.size(), vector<float>());
+    for (size_t i = 0; i < images.size(); i++) {
+        char *filename = const_cast<char *>(images[i].c_str());
+        auto start = chrono::steady_clock::now();
+        cv::Mat image = setting.scale > 0 ? cv::imread(filename, imreadFlagsForScale(setting.scale))
+                                          : loadImage(filename, policy);
+        setting.decode_ms += elapsed_ms(start);
+        if (image.empty()) continue;
+        start = chrono::steady_clock::now();
+        extract(image, setting.features[i]);
+        setting.extract_ms += elapsed_ms(start);
+    }
+}
+
+// Fraction of the reference top-N that the candidate top-N also contains
+static double topN_recall(const vector<vector<pair<float, int>>> &reference,
+                          const vector<vector<pair<float, int>>> &candidate) {
+    long long hits = 0, total = 0;
+    for (size_t q = 0; q < reference.size(); q++) {
+        set<int> expected;
+        for (const auto &match : reference[q]) expected.insert(match.second);
+        for (const auto &match : candidate[q]) hits += expected.count(match.second);
+        total += reference[q].size();
+    }
+    return total > 0 ? static_cast<double>(hits) / total : 1.0;
+}
+
+/**
+ * @brief Entry point: Proj2-decode_report <directory path> <feature type> [N] [output csv]
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("usage: %s <directory path> <feature type> [N] [output csv]\n", argv[0]);
+        printf("Feature types that allow reduced decoding:\n");
+        for (const FeatureInfo *info : list_features()) {
+            if (info->decode.max_scale > 1) printf("%d: %s\n", info->id, info->description.c_str());
+        }
+        exit(-1);
+    }
+    const FeatureInfo *feature = find_feature(atoi(argv[2]));
+    if (feature == nullptr || feature->decode.max_scale <= 1) {
+        printf("Feature %s is always decoded at full resolution\n", argv[2]);
+        exit(-1);
+    }
+    int N = argc > 3 ? atoi(argv[3]) : 5;
+    BatchMetric metric;
+    int segments;
+    const MetricInfo *default_metric = find_metric(feature->default_metric);
+    if (default_metric == nullptr || metric_batch_kernel(*default_metric, metric, segments) != 0) {
+        printf("The %s metric has no blocked kernel\n", feature->default_metric.c_str());
+        exit(-1);
+    }
+
+    // collect the image paths
+    string dirname = argv[1];
+    if (!dirname.empty() && dirname.back() != '/') dirname += '/';
+    DIR *dirp = opendir(dirname.c_str());
+    if (dirp == NULL) {
+        printf("Cannot open directory %s\n", dirname.c_str());
+        exit(-1);
+    }
+    vector<string> images;
+    struct dirent *dp;
+    while ((dp = readdir(dirp)) != NULL) {
+        if (strstr(dp->d_name, ".jpg") || strstr(dp->d_name, ".png") ||
+            strstr(dp->d_name, ".ppm") || strstr(dp->d_name, ".tif")) {
+            images.push_back(dirname + dp->d_name);
+        }
+    }
+    closedir(dirp);
+    sort(images.begin(), images.end());
+    if ((int) images.size() <= N) {
+        printf("Need more than %d images in %s\n", N, dirname.c_str());
+        exit(-1);
+    }
+
+    vector<DecodeSetting> settings = {{"full", 1}, {"1/2", 2}, {"1/4", 4}, {"1/8", 8}, {"policy", 0}};
+    for (DecodeSetting &setting : settings) {
+        printf("Decoding %zu images at %s\n", images.size(), setting.name);
+        run_setting(setting, images, *feature);
+    }
+
+    // keep only the images every setting could extract, so the matrices line up
+    vector<int> usable;
+    for (size_t i = 0; i < images.size(); i++) {
+        bool ok = true;
+        for (DecodeSetting &setting : settings) {
+            if (setting.features[i].empty()) ok = false;
+        }
+        if (ok) usable.push_back(i);
+        else printf("Skipping %s\n", images[i].c_str());
+    }
+    if ((int) usable.size() <= N) {
+        printf("Not enough images could be read\n");
+        exit(-1);
+    }
+
+    // the queries are a spread-out subset of the usable images
+    int num_queries = min((int) usable.size(), MAX_QUERIES);
+    vector<int> query_rows(num_queries), exclude(num_queries);
+    for (int q = 0; q < num_queries; q++) {
+        query_rows[q] = usable[(long long) q * usable.size() / num_queries];
+        exclude[q] = static_cast<int>((long long) q * usable.size() / num_queries);
+    }
+
+    vector<vector<pair<float, int>>> reference;
+    FILE *csv = NULL;
+    if (argc > 4) {
+        csv = fopen(argv[4], "w");
+        if (!csv) {
+            printf("Cannot write %s\n", argv[4]);
+            exit(-1);
+        }
+        fprintf(csv, "setting,decode_ms_per_image,extract_ms_per_image,mean_feature_distance,max_feature_distance,top%d_recall\n", N);
+    }
+
+    printf("\n%-8s %12s %12s %12s %12s %10s\n", "setting", "decode ms", "extract ms", "mean dist", "max dist", "recall");
+    const vector<vector<float>> &full = settings[0].features;
+    for (DecodeSetting &setting : settings) {
+        FeatureMatrix database, queries;
+        pack_feature_rows(setting.features, usable, database);
+        pack_feature_rows(setting.features, query_rows, queries);
+        vector<vector<pair<float, int>>> results;
+        if (batch_find_topN(database, queries, exclude, metric, segments, N, results) != 0) {
+            printf("Top-N search failed for %s\n", setting.name);
+            exit(-1);
+        }
+        if (setting.scale == 1) reference = results;
+
+        // how far each image's features moved from the full-resolution ones
+        double sum_distance = 0, max_distance = 0;
+        for (int i : usable) {
+            double d = batch_pair_distance(metric, segments, full[i].data(), setting.features[i].data(),
+                                           static_cast<int>(full[i].size()));
+            sum_distance += d;
+            max_distance = max(max_distance, d);
+        }
+        double mean_distance = sum_distance / usable.size();
+        double recall = topN_recall(reference, results);
+        double decode_ms = setting.decode_ms / images.size();
+        double extract_ms = setting.extract_ms / images.size();
+
+        printf("%-8s %12.3f %12.3f %12.5f %12.5f %10.3f\n", setting.name, decode_ms, extract_ms,
+               mean_distance, max_distance, recall);
+        if (csv) {
+            fprintf(csv, "%s,%.4f,%.4f,%.6f,%.6f,%.4f\n", setting.name, decode_ms, extract_ms,
+                    mean_distance, max_distance, recall);
+        }
+    }
+    if (csv) fclose(csv);
+    return 0;
+}
@@ -0,0 +1,350 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 12, 2025
+ * Purpose: Find clusters of near-duplicate images (re-encodes, crops) across a
+ * whole feature file. Small catalogs are joined exactly with the blocked
+ * all-pairs kernel; large ones use random-hyperplane LSH to generate candidate
+ * pairs that are then verified with the exact distance. Pairs under the
+ * threshold are merged with union-find and written out one cluster per line.
+ */
+#include "../include/csv_util.h"
+#include "../include/feature_store.h"
+#include "../include/batch_search.h"
+#include "../include/feature_registry.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+using namespace std;
+
+// Catalogs up to this many rows are joined exactly in auto mode
+static const int EXACT_MAX_ROWS = 20000;
+// LSH buckets larger than this are joined with the blocked kernel instead of pair by pair
+static const int MAX_BUCKET_PAIRWISE = 256;
+
+/*
+  Disjoint sets with union by size and path compression.
+  root() does not compress, so it can be called from several threads while no
+  thread is merging.
+ */
+class UnionFind {
+public:
+    explicit UnionFind(int n) : parent_(n), size_(n, 1) {
+        for (int i = 0; i < n; i++) parent_[i] = i;
+    }
+
+    int root(int x) const {
+        while (parent_[x] != x) x = parent_[x];
+        return x;
+    }
+
+    int find(int x) {
+        int r = root(x);
+        while (parent_[x] != r) {
+            int next = parent_[x];
+            parent_[x] = r;
+            x = next;
+        }
+        return r;
+    }
+
+    void merge(int a, int b) {
+        a = find(a);
+        b = find(b);
+        if (a == b) return;
+        if (size_[a] < size_[b]) std::swap(a, b);
+        parent_[b] = a;
+        size_[a] += size_[b];
+    }
+
+private:
+    std::vector<int> parent_;
+    std::vector<int> size_;
+};
+
+/*
+  Runs fn(thread_id, begin, end) over [0, n) split into contiguous chunks.
+ */
+static void parallel_for(int n, int num_threads, const std::function<void(int, int, int)> &fn) {
+    num_threads = std::max(1, std::min(num_threads, n));
+    std::vector<std::thread> workers;
+    int chunk = (n + num_threads - 1) / num_threads;
+    for (int t = 0; t < num_threads; t++) {
+        int begin = t * chunk;
+        int end = std::min(n, begin + chunk);
+        if (begin >= end) break;
+        workers.emplace_back(fn, t, begin, end);
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+/**
+ * @brief Candidate generation with random-hyperplane (SimHash) LSH, verified exactly.
+ *
+ * Each of `tables` hash tables signs `bits` random projections of every row;
+ * rows that share a signature in any table are candidates. Vectors are centered
+ * on the catalog mean first (except for cosine, which measures angle about the
+ * origin) so the hyperplanes split the data instead of all passing beside it.
+ *
+ * @param data Packed feature rows.
+ * @param metric Distance family used for verification.
+ * @param segments Histogram segment count for the HISTOGRAM family.
+ * @param threshold Maximum distance for a duplicate pair.
+ * @param tables Number of hash tables.
+ * @param bits Projections per table (at most 64).
+ * @param num_threads Worker threads.
+ * @param sets Union-find that receives the verified pairs.
+ * @return number of verified pairs.
+ */
+static long long lsh_join(const FeatureMatrix &data, BatchMetric metric, int segments, float threshold,
+                          int tables, int bits, int num_threads, UnionFind &sets) {
+    const int dims = data.cols;
+    const int rows = data.rows;
+
+    // Mean used to center the projections
+    std::vector<float> mean(dims, 0.0f);
+    if (metric != BatchMetric::COSINE) {
+        for (int i = 0; i < rows; i++) {
+            const float *v = data.row(i);
+            for (int k = 0; k < dims; k++) mean[k] += v[k];
+        }
+        for (int k = 0; k < dims; k++) mean[k] /= rows;
+    }
+
+    // Gaussian hyperplanes, fixed seed so runs are reproducible
+    std::mt19937 rng(5330);
+    std::normal_distribution<float> gauss(0.0f, 1.0f);
+    std::vector<float> planes(static_cast<size_t>(tables) * bits * dims);
+    for (float &p : planes) p = gauss(rng);
+
+    // signatures[t * rows + i] = bits of row i in table t
+    std::vector<uint64_t> signatures(static_cast<size_t>(tables) * rows);
+    parallel_for(rows, num_threads, [&](int, int begin, int end) {
+        std::vector<float> centered(dims);
+        for (int i = begin; i < end; i++) {
+            const float *v = data.row(i);
+            for (int k = 0; k < dims; k++) centered[k] = v[k] - mean[k];
+            for (int t = 0; t < tables; t++) {
+                uint64_t key = 0;
+                for (int b = 0; b < bits; b++) {
+                    const float *plane = &planes[(static_cast<size_t>(t) * bits + b) * dims];
+                    float dot = 0.0f;
+                    for (int k = 0; k < dims; k++) dot += plane[k] * centered[k];
+                    key = (key << 1) | (dot >= 0.0f ? 1u : 0u);
+                }
+                signatures[static_cast<size_t>(t) * rows + i] = key;
+            }
+        }
+    });
+
+    long long verified = 0;
+    std::vector<std::pair<uint64_t, int>> order(rows);
+    for (int t = 0; t < tables; t++) {
+        // Group rows by signature
+        for (int i = 0; i < rows; i++) {
+            order[i] = {signatures[static_cast<size_t>(t) * rows + i], i};
+        }
+        std::sort(order.begin(), order.end());
+        std::vector<std::pair<int, int>> buckets; // [begin, end) into order
+        for (int b = 0; b < rows;) {
+            int e = b + 1;
+            while (e < rows && order[e].first == order[b].first) e++;
+            if (e - b > 1) buckets.push_back({b, e});
+            b = e;
+        }
+
+        // Verify candidates in parallel; sets is only read here, merged afterwards
+        std::vector<std::vector<std::pair<int, int>>> found(std::max(1, num_threads));
+        parallel_for(static_cast<int>(buckets.size()), num_threads, [&](int tid, int begin, int end) {
+            for (int bi = begin; bi < end; bi++) {
+                const int b = buckets[bi].first;
+                const int count = buckets[bi].second - b;
+                if (count > MAX_BUCKET_PAIRWISE) {
+                    // Large bucket: blocked join on the gathered rows
+                    FeatureMatrix sub;
+                    sub.rows = count;
+                    sub.cols = dims;
+                    sub.values.resize(static_cast<size_t>(count) * dims);
+                    for (int m = 0; m < count; m++) {
+                        std::copy(data.row(order[b + m].second), data.row(order[b + m].second) + dims, sub.row(m));
+                    }
+                    std::vector<std::pair<int, int>> pairs;
+                    batch_find_pairs_within(sub, metric, segments, threshold, pairs, 1);
+                    for (const auto &p : pairs) {
+                        found[tid].push_back({order[b + p.first].second, order[b + p.second].second});
+                    }
+                    continue;
+                }
+                for (int m = 0; m < count; m++) {
+                    const int i = order[b + m].second;
+                    for (int n = m + 1; n < count; n++) {
+                        const int j = order[b + n].second;
+                        if (sets.root(i) == sets.root(j)) continue; // already clustered together
+                        float d = batch_pair_distance(metric, segments, data.row(i), data.row(j), dims);
+                        if (d <= threshold) found[tid].push_back({i, j});
+                    }
+                }
+            }
+        });
+
+        for (const auto &pairs : found) {
+            for (const auto &p : pairs) sets.merge(p.first, p.second);
+            verified += static_cast<long long>(pairs.size());
+        }
+        printf("LSH table %d/%d: %zu candidate buckets\n", t + 1, tables, buckets.size());
+    }
+    return verified;
+}
+
+/**
+ * @brief Main function that writes the near-duplicate clusters of a feature file.
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv argv[1] - feature file, argv[2] - distance metric, argv[3] - threshold,
+ *             argv[4] - optional output file (default stdout), followed by options
+ *             --method auto|exact|lsh, --threads T, --tables L, --bits B.
+ * @return int Returns 0 on success, or -1 on failure.
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        printf("usage: %s <feature_file> <distance_metric> <threshold> [output_file] [options]\n", argv[0]);
+        printf("distance_metric options:");
+        for (const MetricInfo *info : list_metrics()) {
+            if (info->batch) printf(" %s", info->name.c_str());
+        }
+        printf("\n");
+        printf("options: --method auto|exact|lsh  --threads T  --tables L  --bits B\n");
+        exit(-1);
+    }
+
+    char *feature_file = argv[1];
+    BatchMetric metric;
+    int segments = 1;
+    const MetricInfo *metric_info = find_metric(argv[2]);
+    if (metric_info == nullptr || metric_batch_kernel(*metric_info, metric, segments) != 0) {
+        printf("Invalid distance metric: %s\n", argv[2]);
+        exit(-1);
+    }
+    float threshold = static_cast<float>(atof(argv[3]));
+
+    char *output_file = nullptr;
+    std::string method = "auto";
+    int num_threads = static_cast<int>(std::thread::hardware_concurrency());
+    int tables = 20;
+    int bits = 16;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--method") == 0 && i + 1 < argc) {
+            method = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tables") == 0 && i + 1 < argc) {
+            tables = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bits") == 0 && i + 1 < argc) {
+            bits = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && output_file == nullptr) {
+            output_file = argv[i];
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            exit(-1);
+        }
+    }
+    // Clusters written to stdout keep it to themselves: everything else printed
+    // from here on, the feature file readers' progress too, goes to stderr
+    FILE *cluster_fp = nullptr;
+    if (output_file == nullptr) {
+        fflush(stdout);
+        int fd = dup(STDOUT_FILENO);
+        cluster_fp = fd >= 0 ? fdopen(fd, "w") : nullptr;
+        if (!cluster_fp || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "Can not separate the clusters from the progress output\n");
+            exit(-1);
+        }
+    }
+    if (num_threads <= 0) num_threads = 1;
+    if (tables <= 0 || bits <= 0 || bits > 64) {
+        printf("Invalid LSH parameters: %d tables of %d bits\n", tables, bits);
+        exit(-1);
+    }
+
+    std::vector<char *> filenames;
+    std::vector<std::vector<float>> data;
+    if (read_feature_file(feature_file, filenames, data) != 0) {
+        printf("Can not read the image csv file: %s\n", feature_file);
+        exit(-1);
+    }
+    FeatureMatrix matrix;
+    if (pack_feature_matrix(data, matrix) != 0) {
+        printf("Feature file %s has rows of different lengths\n", feature_file);
+        exit(-1);
+    }
+    data.clear();
+    data.shrink_to_fit(); // the packed copy is all we need from here on
+
+    if (method == "auto") {
+        method = matrix.rows <= EXACT_MAX_ROWS ? "exact" : "lsh";
+    }
+    printf("Finding duplicates among %d images with %s join, threshold %.4f\n",
+           matrix.rows, method.c_str(), threshold);
+
+    auto start = std::chrono::steady_clock::now();
+    UnionFind sets(matrix.rows);
+    long long pair_count = 0;
+    if (method == "exact") {
+        std::vector<std::pair<int, int>> pairs;
+        if (batch_find_pairs_within(matrix, metric, segments, threshold, pairs, num_threads) != 0) {
+            exit(-1);
+        }
+        for (const auto &p : pairs) sets.merge(p.first, p.second);
+        pair_count = static_cast<long long>(pairs.size());
+    } else if (method == "lsh") {
+        pair_count = lsh_join(matrix, metric, segments, threshold, tables, bits, num_threads, sets);
+    } else {
+        printf("Invalid method: %s. Must be 'auto', 'exact' or 'lsh'\n", method.c_str());
+        exit(-1);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Collect clusters with more than one member, largest first
+    std::vector<std::vector<int>> members(matrix.rows);
+    for (int i = 0; i < matrix.rows; i++) {
+        members[sets.find(i)].push_back(i);
+    }
+    std::vector<std::vector<int>> clusters;
+    for (auto &m : members) {
+        if (m.size() > 1) clusters.push_back(std::move(m));
+    }
+    std::sort(clusters.begin(), clusters.end(), [](const std::vector<int> &a, const std::vector<int> &b) {
+        return a.size() != b.size() ? a.size() > b.size() : a[0] < b[0];
+    });
+
+    FILE *fp = cluster_fp;
+    if (output_file) {
+        fp = fopen(output_file, "w");
+        if (!fp) {
+            printf("Unable to open output file %s\n", output_file);
+            exit(-1);
+        }
+    }
+    for (const auto &cluster : clusters) {
+        for (size_t m = 0; m < cluster.size(); m++) {
+            fprintf(fp, m == 0 ? "%s" : ",%s", filenames[cluster[m]]);
+        }
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+
+    printf("Found %zu duplicate clusters from %lld pairs in %.2f s\n", clusters.size(), pair_count, seconds);
+    return 0;
+}
@@ -5,6 +5,8 @@
  */
 
 #include "../include/distance_calculate.h"
+#include "../include/histogram_kernels.h"
+#include <algorithm>
 #include <cmath>
 
 using namespace std;
@@ -19,13 +21,33 @@ using namespace std;
  * @return float SSD value.
  */
 float calculate_ssd(std::vector<float>& v1, std::vector<float>& v2) {
+    return calculate_ssd(v1.data(), v2.data(), static_cast<int>(v1.size()));
+}
+
+float calculate_ssd(const float *v1, const float *v2, int n) {
     float distance = 0.0f;
-    for (int i = 0; i < v1.size(); i++) {
+    for (int i = 0; i < n; i++) {
         float diff = v1[i] - v2[i];
         distance += diff * diff;
     }
     return std::sqrt(distance);
 }
+
+// Dimensions summed between checks against the bound
+static const int SSD_ABANDON_BLOCK = 8;
+
+float calculate_ssd_squared_bounded(const float *v1, const float *v2, int n, float bound) {
+    float distance = 0.0f;
+    for (int start = 0; start < n; start += SSD_ABANDON_BLOCK) {
+        int end = std::min(start + SSD_ABANDON_BLOCK, n);
+        for (int i = start; i < end; i++) {
+            float diff = v1[i] - v2[i];
+            distance += diff * diff;
+        }
+        if (distance > bound) break;
+    }
+    return distance;
+}
 /**
  * @brief Computes the histogram intersection between two normalized histograms.
  *
@@ -34,15 +56,26 @@ float calculate_ssd(std::vector<float>& v1, std::vector<float>& v2) {
  * @return float Histogram intersection value.
  */
 float calculate_histogramIntersection(std::vector<float>& hist1, std::vector<float>& hist2) {
-    float intersection = 0.0f;
-
     // Ensure histograms are of same size
     if (hist1.size() != hist2.size()) {
         return 0.0f;  // Return 0 for no intersection if sizes differ
     }
+    return calculate_histogramIntersection(hist1.data(), hist2.data(), static_cast<int>(hist1.size()));
+}
+
+float calculate_histogramIntersection(const float *hist1, const float *hist2, int n) {
+    // The shipped histogram sizes run the fixed-length kernels
+    switch (n) {
+        case 512: return histogramIntersectionFixed<512>(hist1, hist2);
+        case 16: return histogramIntersectionFixed<16>(hist1, hist2);
+        case 8: return histogramIntersectionFixed<8>(hist1, hist2);
+        default: break;
+    }
+
+    float intersection = 0.0f;
 
     // Calculate histogram intersection
-    for (size_t i = 0; i < hist1.size(); i++) {
+    for (int i = 0; i < n; i++) {
         intersection += std::min(hist1[i], hist2[i]);
     }
 
@@ -64,13 +97,20 @@ float calculate_cosine_distance(std::vector<float>& vec1, std::vector<float>& ve
     if (vec1.size() != vec2.size() || vec1.empty()) {
         return 1.0f;  // Return maximum distance if vectors are invalid
     }
+    return calculate_cosine_distance(vec1.data(), vec2.data(), static_cast<int>(vec1.size()));
+}
+
+float calculate_cosine_distance(const float *vec1, const float *vec2, int n) {
+    if (n <= 0) {
+        return 1.0f;
+    }
 
     float dotProduct = 0.0f; // Sum of element-wise multiplication
     float norm1 = 0.0f;
     float norm2 = 0.0f;
 
     // Compute dot product and norms (L2 norm squared)
-    for (size_t i = 0; i < vec1.size(); i++) {
+    for (int i = 0; i < n; i++) {
         dotProduct += vec1[i] * vec2[i]; // a · b
         norm1 += vec1[i] * vec1[i];      // ||a||^2
         norm2 += vec2[i] * vec2[i];      // ||b||^2
@@ -94,42 +134,55 @@ float calculate_cosine_distance(std::vector<float>& vec1, std::vector<float>& ve
 //  * @return float Distance value.
 
 float calculate_multiHist_distance(std::vector<float> &hist1, std::vector<float> &hist2) {
-    // Split concatenated histograms
-    size_t mid = hist1.size()/2;
-    std::vector<float> top1(hist1.begin(), hist1.begin()+mid);
-    std::vector<float> bottom1(hist1.begin()+mid, hist1.end());
-    
-    std::vector<float> top2(hist2.begin(), hist2.begin()+mid);
-    std::vector<float> bottom2(hist2.begin()+mid, hist2.end());
-    
+    return calculate_multiHist_distance(hist1.data(), hist2.data(), static_cast<int>(hist1.size()));
+}
+
+float calculate_multiHist_distance(const float *hist1, const float *hist2, int n) {
+    // Split concatenated histograms into top and bottom halves
+    int mid = n / 2;
+
     // Calculate individual distances
-    float d_top = 1 - calculate_histogramIntersection(top1, top2);
-    float d_bottom = 1 - calculate_histogramIntersection(bottom1, bottom2);
+    float d_top = 1 - calculate_histogramIntersection(hist1, hist2, mid);
+    float d_bottom = 1 - calculate_histogramIntersection(hist1 + mid, hist2 + mid, n - mid);
     
     return 0.5 * d_top + 0.5 * d_bottom; // Equal weighting
 }
 
+// Mean over the regions of (1 - histogram intersection), for rows that concatenate one
+// histogram per image region; the last region takes any remainder of n
+
+float calculate_region_distance(const float *hist1, const float *hist2, int n, int regions) {
+    if (regions <= 0) {
+        return 1.0f;
+    }
+    int length = n / regions;
+    float distance = 0.0f;
+    for (int r = 0; r < regions; r++) {
+        int start = r * length;
+        int end = r == regions - 1 ? n : start + length;
+        distance += 1.0f - calculate_histogramIntersection(hist1 + start, hist2 + start, end - start);
+    }
+    return distance / regions;
+}
+
 // Function to calculate distance between two texture-color histograms
 //  * @param hist1 First texture-color histogram.
 //  * @param hist2 Second texture-color histogram.
 //  * @return float Distance value.
 
 float calculate_textureColor_distance(std::vector<float>& hist1, std::vector<float>& hist2) {
+    return calculate_textureColor_distance(hist1.data(), hist2.data(), static_cast<int>(hist1.size()));
+}
 
-    //Determine split point
-    size_t split_index = hist1.size() / 2;
+float calculate_textureColor_distance(const float *hist1, const float *hist2, int n) {
 
-    std::vector<float> color1(hist1.begin(), hist1.begin() + split_index);
-    std::vector<float> color2(hist2.begin(), hist2.begin() + split_index);
-    
-    std::vector<float> tex1(hist1.begin() + split_index, hist1.end());
-    std::vector<float> tex2(hist2.begin() + split_index, hist2.end());
+    //Determine split point
+    int split_index = n / 2;
 
     // Compute individual distances
-    float d_color = 1 - calculate_histogramIntersection(color1, color2);
-    float d_tex = 1 - calculate_histogramIntersection(tex1, tex2);
+    float d_color = 1 - calculate_histogramIntersection(hist1, hist2, split_index);
+    float d_tex = 1 - calculate_histogramIntersection(hist1 + split_index, hist2 + split_index, n - split_index);
 
     // Combine with equal weights
     return 0.5f * d_color + 0.5f * d_tex;
 }
-
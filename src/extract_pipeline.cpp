@@ -0,0 +1,344 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 20, 2025
+ * Purpose: Staged feature extraction: enumerate, read, decode, extract and
+ * write in order, with bounded queues between the stages
+ */
+
+#include "../include/extract_pipeline.h"
+#include "../include/bounded_queue.h"
+#include "../include/image_decode.h"
+#include "../include/instrument.h"
+#include "../include/thumbnail_pack.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// One image on its way through the stages
+struct PipelineItem {
+    size_t seq = 0;
+    string path;
+    bool ok = true;
+    vector<unsigned char> bytes;
+    cv::Mat image;
+    vector<float> features;
+    vector<unsigned char> thumbnail; // encoded, for the thumbnail pack
+};
+
+typedef BoundedQueue<PipelineItem> ItemQueue;
+
+// Per-thread timing of a stage, merged into StageStats when the thread ends
+struct StageTimer {
+    typedef chrono::steady_clock clock;
+    StageStats &stats;
+    mutex &lock;
+    long long items = 0;
+    double busy = 0, starved = 0, blocked = 0;
+    clock::time_point mark = clock::now();
+
+    StageTimer(StageStats &s, mutex &m) : stats(s), lock(m) {}
+
+    // seconds since the last lap
+    double lap() {
+        clock::time_point now = clock::now();
+        double seconds = chrono::duration<double>(now - mark).count();
+        mark = now;
+        return seconds;
+    }
+
+    ~StageTimer() {
+        lock_guard<mutex> guard(lock);
+        stats.items += items;
+        stats.busy_seconds += busy;
+        stats.starved_seconds += starved;
+        stats.blocked_seconds += blocked;
+    }
+};
+
+/*
+  Caps the number of images between the enumerator and the writer. The
+  enumerator waits for a slot before handing out sequence number seq; the
+  writer frees one each time it emits an image. Without this, one slow image
+  would let the reorder buffer grow without bound.
+ */
+class InFlightWindow {
+public:
+    explicit InFlightWindow(size_t size) : size_(size) {}
+
+    bool acquire(size_t seq) {
+        unique_lock<mutex> guard(lock_);
+        changed_.wait(guard, [&] { return aborted_ || seq < written_ + size_; });
+        return !aborted_;
+    }
+
+    void release() {
+        lock_guard<mutex> guard(lock_);
+        written_++;
+        changed_.notify_all();
+    }
+
+    void abort() {
+        lock_guard<mutex> guard(lock_);
+        aborted_ = true;
+        changed_.notify_all();
+    }
+
+private:
+    size_t size_;
+    size_t written_ = 0;
+    bool aborted_ = false;
+    mutex lock_;
+    condition_variable changed_;
+};
+
+// Asks the kernel to start reading a file into the page cache, without waiting for it
+static void prefetch_file(const string &path) {
+#if defined(POSIX_FADV_WILLNEED)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+#else
+    (void) path;
+#endif
+}
+
+// Reads a whole file into memory
+static int read_file(const string &path, vector<unsigned char> &bytes) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return -1;
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    bytes.resize(st.st_size);
+    size_t done = 0;
+    while (done < bytes.size()) {
+        ssize_t n = read(fd, bytes.data() + done, bytes.size() - done);
+        if (n <= 0) break;
+        done += n;
+    }
+    close(fd);
+    bytes.resize(done);
+    return done > 0 ? 0 : -1;
+}
+
+/*
+  Runs `threads` workers that pop from `in`, apply `work` and push to `out`.
+  Items that already failed are passed through untouched so the writer still
+  sees every sequence number. The last worker to finish closes `out`.
+ */
+template <typename Work>
+static void start_stage(vector<thread> &workers, int threads, ItemQueue &in, ItemQueue &out,
+                        StageStats &stats, mutex &stats_lock, atomic<int> &running, Work work) {
+    stats.threads = threads;
+    running = threads;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, work] {
+            instrument_thread_name(stats.name.c_str());
+            {
+                StageTimer timer(stats, stats_lock);
+                PipelineItem item;
+                while (true) {
+                    timer.lap();
+                    bool got = in.pop(item);
+                    timer.starved += timer.lap();
+                    if (!got) break;
+                    if (item.ok) {
+                        work(item);
+                        timer.items++;
+                    }
+                    timer.busy += timer.lap();
+                    bool pushed = out.push(std::move(item));
+                    timer.blocked += timer.lap();
+                    if (!pushed) break;
+                }
+            }
+            if (--running == 0) out.close();
+        });
+    }
+}
+
+/*
+  Thumbnail of an item for the pack. The image decoded for the feature is used
+  when it covers the thumbnail box; a feature that allows a 1/4 scale decode
+  may leave it smaller, and then the file is decoded again at a scale that does.
+ */
+static void make_item_thumbnail(PipelineItem &item, int width, int height) {
+    INSTRUMENT_SCOPE("thumbnail");
+    cv::Mat source = item.image;
+    if (source.cols < width && source.rows < height) {
+        int image_width, image_height, scale = 1;
+        if (readImageSize(item.bytes.data(), item.bytes.size(), image_width, image_height) == 0) {
+            scale = chooseThumbnailScale(image_width, image_height, width, height);
+        }
+        source = cv::imdecode(item.bytes, imreadFlagsForScale(scale));
+    }
+    if (makeThumbnail(source, width, height, item.thumbnail) != 0) {
+        fprintf(stderr, "Error: cannot make a thumbnail of '%s'\n", item.path.c_str());
+        item.thumbnail.clear();
+    }
+}
+
+static int resolve_threads(int requested) {
+    if (requested > 0) return requested;
+    int hw = static_cast<int>(thread::hardware_concurrency());
+    return hw > 0 ? hw : 1;
+}
+
+/**
+ * @brief Extracts features for every path from a source, overlapping I/O, decode and compute.
+ */
+int run_extraction_pipeline(PathSource next_path, const FeatureInfo &feature, const PipelineOptions &options,
+                            FeatureSink sink, vector<StageStats> &stats) {
+    int io_threads = resolve_threads(options.io_threads);
+    int decode_threads = resolve_threads(options.decode_threads);
+    int feature_threads = resolve_threads(options.feature_threads);
+    size_t depth = options.queue_depth > 0 ? options.queue_depth : 1;
+
+    ItemQueue to_read(depth), to_decode(depth), to_extract(depth), to_write(depth);
+    InFlightWindow window(4 * depth + io_threads + decode_threads + feature_threads);
+    DecodePolicy policy = feature.decode;
+    ImageFeatureFunction extract = feature.extract_image;
+    int thumb_width = 0, thumb_height = 0;
+    if (options.thumbnails && thumbnailPackEnabled()) {
+        thumbnailPackSize(thumb_width, thumb_height);
+    }
+
+    stats.assign(5, StageStats());
+    stats[0].name = "enumerate";
+    stats[1].name = "read";
+    stats[2].name = "decode";
+    stats[3].name = "extract";
+    stats[4].name = "write";
+    mutex stats_lock;
+    atomic<int> io_running(0), decode_running(0), feature_running(0);
+    vector<thread> workers;
+
+    // enumerator
+    stats[0].threads = 1;
+    workers.emplace_back([&] {
+        instrument_thread_name("enumerate");
+        StageTimer timer(stats[0], stats_lock);
+        string path;
+        for (size_t seq = 0;; seq++) {
+            timer.lap();
+            bool more = next_path(path);
+            if (more) prefetch_file(path);
+            timer.busy += timer.lap();
+            if (!more) break;
+            bool admitted = window.acquire(seq);
+            timer.blocked += timer.lap();
+            if (!admitted) break;
+            PipelineItem item;
+            item.seq = seq;
+            item.path = path;
+            bool pushed = to_read.push(std::move(item));
+            timer.blocked += timer.lap();
+            if (!pushed) break;
+            timer.items++;
+        }
+        to_read.close();
+    });
+
+    start_stage(workers, io_threads, to_read, to_decode, stats[1], stats_lock, io_running,
+                [](PipelineItem &item) {
+                    INSTRUMENT_SCOPE("read");
+                    if (read_file(item.path, item.bytes) != 0) {
+                        fprintf(stderr, "Error: cannot read '%s'\n", item.path.c_str());
+                        item.ok = false;
+                    }
+                });
+    start_stage(workers, decode_threads, to_decode, to_extract, stats[2], stats_lock, decode_running,
+                [policy, thumb_width, thumb_height](PipelineItem &item) {
+                    {
+                        INSTRUMENT_SCOPE("decode");
+                        item.image = decodeImage(item.bytes, policy);
+                    }
+                    if (item.image.empty()) {
+                        fprintf(stderr, "can not open image: %s\n", item.path.c_str());
+                        item.ok = false;
+                    } else if (thumb_width > 0) {
+                        make_item_thumbnail(item, thumb_width, thumb_height);
+                    }
+                    vector<unsigned char>().swap(item.bytes);
+                });
+    // one span name per feature, e.g. extract/texture-color
+    int extract_id = instrument_id(("extract/" + feature.name).c_str());
+    start_stage(workers, feature_threads, to_extract, to_write, stats[3], stats_lock, feature_running,
+                [extract, extract_id](PipelineItem &item) {
+                    ScopedTimer timer(extract_id);
+                    if (extract(item.image, item.features) != 0) {
+                        item.ok = false;
+                    }
+                    item.image.release();
+                });
+
+    // ordered writer, on this thread
+    int result = 0;
+    {
+        StageTimer timer(stats[4], stats_lock);
+        stats[4].threads = 1;
+        map<size_t, PipelineItem> pending;
+        size_t next_seq = 0;
+        PipelineItem item;
+        while (true) {
+            timer.lap();
+            bool got = to_write.pop(item);
+            timer.starved += timer.lap();
+            if (!got) break;
+            pending[item.seq] = std::move(item);
+            auto it = pending.find(next_seq);
+            while (it != pending.end()) {
+                if (result == 0 && it->second.ok && !it->second.thumbnail.empty() &&
+                    storePackedThumbnail(it->second.path.c_str(), it->second.thumbnail) != 0) {
+                    fprintf(stderr, "Error: cannot store the thumbnail of '%s'\n", it->second.path.c_str());
+                }
+                if (result == 0 && sink(it->second.path, it->second.ok, it->second.features) != 0) {
+                    result = -1;
+                    // stop feeding new images; the ones in flight drain out
+                    window.abort();
+                }
+                timer.items++;
+                pending.erase(it);
+                window.release();
+                it = pending.find(++next_seq);
+            }
+            timer.busy += timer.lap();
+        }
+    }
+
+    for (thread &worker : workers) {
+        worker.join();
+    }
+    return result;
+}
+
+/**
+ * @brief Prints per-stage utilization, so the bottleneck stage stands out.
+ */
+void print_pipeline_stats(const vector<StageStats> &stats, double wall_seconds) {
+    printf("%-10s %7s %8s %8s %8s %8s\n", "stage", "threads", "items", "busy%", "starved%", "blocked%");
+    for (const StageStats &s : stats) {
+        double capacity = wall_seconds * (s.threads > 0 ? s.threads : 1);
+        if (capacity <= 0) capacity = 1;
+        printf("%-10s %7d %8lld %7.1f%% %7.1f%% %7.1f%%\n", s.name.c_str(), s.threads, s.items,
+               100.0 * s.busy_seconds / capacity, 100.0 * s.starved_seconds / capacity,
+               100.0 * s.blocked_seconds / capacity);
+    }
+    printf("wall time: %.2f s\n", wall_seconds);
+}
@@ -9,58 +9,96 @@
 #include "../include/DA2Network.hpp"
 #include <opencv2/opencv.hpp>
 #include "../include/faceDetect.h"
+#include "../include/result_cache.h"
+#include "../include/image_decode.h"
+#include "../include/feature_registry.h"
+#include "../include/histogram_kernels.h"
+#include "../include/instrument.h"
+#include <mutex>
 
 using namespace cv;
 using namespace std;
 
-// Helper function to get the appropriate feature function
-FeatureFunction getFeatureFunction(FeatureType type) {
-    switch (type) {
-        case FeatureType::SQUARE_7X7:
-            return get7x7square;
-        case FeatureType::RGB_HISTOGRAM:
-            return calculateRGBHistogram;
-        case FeatureType::MULTI_HISTOGRAM:
-            return getMultiHistogramFeature;
-        case FeatureType::TEXTURE_COLOR:
-            return getTextureColorFeature;
-        case FeatureType::DEPTH:
-            return getTextureColorFeatureWithDepth;
-        case FeatureType::BANANA:
-            return getBananaFeature;
-        case FeatureType::FACE:
-            return getTextureColorFeatureWithFaceMask;
-        default:
-            return nullptr;
+// Depth Anything V2 model used for the depth features
+#define DA2_MODEL_FILE "../include/model_fp16.onnx"
+
+// Bump these when the pre/post processing around a model changes its output,
+// so results cached under the old pipeline are no longer used
+static const int DEPTH_PIPELINE_VERSION = 1;
+static const int FACE_PIPELINE_VERSION = 1;
+
+// Normalized color and texture histograms barely move when the image is
+// shrunk, so they let libjpeg decode at 1/2..1/4 scale. The texture histogram
+// looks at 3x3 gradients and keeps more pixels than the color ones. The 7x7
+// square, the blob-area thresholds of the banana feature, the DA2 input and the
+// face cascade's minimum window all depend on absolute pixels and stay at full size.
+static const DecodePolicy FULL_DECODE = {1, 0};
+static const DecodePolicy HISTOGRAM_DECODE = {4, 120};
+static const DecodePolicy TEXTURE_DECODE = {2, 200};
+
+// Decodes the image at the resolution a feature allows, then runs the Mat-based extractor
+static int extractFeatureFromFile(char *image_filename, ImageFeatureFunction extract, const DecodePolicy &policy,
+                                  std::vector<float> &feature) {
+    cv::Mat image = loadImage(image_filename, policy);
+    if (image.empty()) {
+        cerr << "can not open image: " << image_filename << endl;
+        return -1;
     }
+    return extract(image, feature);
+}
+
+int get7x7square(char *image_filename, std::vector<float> &image_data) {
+    return extractFeatureFromFile(image_filename, get7x7squareFromImage, FULL_DECODE, image_data);
+}
+
+int calculateRGBHistogram(char *image_filename, std::vector<float>& hist) {
+    return extractFeatureFromFile(image_filename, calculateRGBHistogramFromImage, HISTOGRAM_DECODE, hist);
+}
+
+int getMultiHistogramFeature(char *image_filename, std::vector<float> &image_data) {
+    return extractFeatureFromFile(image_filename, getMultiHistogramFeatureFromImage, HISTOGRAM_DECODE, image_data);
 }
 
+int getTextureColorFeature(char* image_filename, std::vector<float>& feature) {
+    return extractFeatureFromFile(image_filename, getTextureColorFeatureFromImage, TEXTURE_DECODE, feature);
+}
+
+int getTextureColorFeatureWithDepth(char* image_filename, std::vector<float>& feature) {
+    return extractFeatureFromFile(image_filename, getTextureColorFeatureWithDepthFromImage, FULL_DECODE, feature);
+}
+
+int getBananaFeature(char *image_filename, std::vector<float>& hist) {
+    return extractFeatureFromFile(image_filename, getBananaFeatureFromImage, FULL_DECODE, hist);
+}
+
+int getTextureColorFeatureWithFaceMask(char* image_filename, std::vector<float>& feature) {
+    return extractFeatureFromFile(image_filename, getTextureColorFeatureWithFaceMaskFromImage, FULL_DECODE, feature);
+}
+
+// DA2Network keeps its input tensor in the object and detectFaces works in a
+// static buffer, so extraction threads take turns on the models
+static std::mutex da2_mutex;
+static std::mutex face_mutex;
+
 static DA2Network& initializeDA2() {
-    static DA2Network da_net("../include/model_fp16.onnx");  // Static: Created only once
+    static DA2Network da_net(DA2_MODEL_FILE);  // Static: Created only once
     return da_net;  // Return reference to the same object
 }
 
-int get7x7square(char *image_filename, std::vector<float> &image_data) {
-    // Step 1: read the image
-    Mat image = imread(image_filename);
-    // check
-    if (image.empty()) {
-        cerr <<  "Error loading image!" << endl;
-        return -1; // Return non-zero in case of error
-    }
-    // Step 2: calculate the center
+int get7x7squareFromImage(cv::Mat &image, std::vector<float> &image_data) {
+    // Step 1: calculate the center
     int center_x = image.cols / 2;
     int center_y = image.rows / 2;
 
-    // Step 3: Define the size of the square (7x7)
+    // Step 2: Define the size of the square (7x7)
     int square_size = 7;
     int half_size = square_size / 2;
 
-    // Step 4: Get the cropped image
+    // Step 3: Get the cropped image
     Rect roi(center_x - half_size, center_y - half_size, half_size, half_size);
     Mat square = image(roi);
 
-    // Step 5: Get the feature vector
+    // Step 4: Get the feature vector
     for (int i = 0; i < square.rows; i++) {
         for (int j = 0; j < square.cols; j++) {
             Vec3b pixel = square.at<Vec3b>(i,j);
@@ -80,36 +118,15 @@ int get7x7square(char *image_filename, std::vector<float> &image_data) {
  * @param hist A 1D Vector representing the flattened 3D histogram (bins x bins*bins).
  * @return non-zero failure.
  */
-int calculateRGBHistogram(char *image_filename, std::vector<float>& hist) {
-    int bins = 8;
-    const int BIN_SIZE = 256 / bins;
-    // Step 1: read the image
-    Mat img = imread(image_filename);
-    if (img.empty()) {
-        cerr << "can not open image: " << image_filename << endl;
+int calculateRGBHistogramFromImage(cv::Mat &img, std::vector<float>& hist) {
+    INSTRUMENT_SCOPE("color_hist");
+    const int bins = 8;
+    // Flattened 3D histogram, binR * bins * bins + binG * bins + binB, normalized by the pixel count
+    hist.assign(histogramSize(3, bins), 0.0f);
+    if (computeHistogram<3, bins>(img, cv::Mat(), hist.data()) < 0) {
+        cerr << "expected an 8-bit color image" << endl;
         return -1;
     }
-    // Initiate the 3D histogram -> flatten 1D histogram for R, G, B bins
-    hist.clear();
-    hist.resize(bins * bins * bins, 0.0f);
-
-    // Step 2: calculate the frequency of each pixel
-    for (int i = 0; i < img.rows; i++) {
-        for (int j = 0; j < img.cols; j++) {
-            Vec3b color = img.at<Vec3b>(i, j);
-            int binB = color[0] / BIN_SIZE;
-            int binG = color[1] / BIN_SIZE;
-            int binR = color[2] / BIN_SIZE;
-            // mapping 3d index to the mat
-            int binIndex = binR * bins * bins + binG * bins + binB;
-            hist[binIndex]++;
-        }
-    }
-    // Step 3: Normalize the frequency
-    float total_pixels = static_cast<float>(img.rows * img.cols);
-    for (int i = 0; i < hist.size(); i++) {
-        hist[i] /= total_pixels;
-    }
     // Success!
     return 0;
 }
@@ -118,64 +135,58 @@ int calculateRGBHistogram(char *image_filename, std::vector<float>& hist) {
 // halves, calculating histograms for each half and concatenating them
 
 int computeMultiHistogram(const cv::Mat& image, std::vector<float>& hist, int bins) {
-    const int BIN_SIZE = 256 / bins;
-    
-    // Initialize the histogram
-    hist.clear();
-    hist.resize(bins * bins * bins, 0.0f);
-
-    // Calculate the frequency of each pixel
-    for (int i = 0; i < image.rows; i++) {
-        for (int j = 0; j < image.cols; j++) {
-            cv::Vec3b color = image.at<cv::Vec3b>(i, j);
-            int binB = color[0] / BIN_SIZE;
-            int binG = color[1] / BIN_SIZE;
-            int binR = color[2] / BIN_SIZE;
-            int binIndex = binR * bins * bins + binG * bins + binB;
-            hist[binIndex]++;
-        }
-    }
+    return colorHistogram(image, cv::Mat(), hist, bins);
+}
 
-    // Normalize the frequency
-    float total_pixels = static_cast<float>(image.rows * image.cols);
-    for (float& bin : hist) {
-        bin /= total_pixels;
-    }
+// Threads binning one image's region histograms; the extraction pipeline already runs images in parallel
+static int region_threads = 1;
 
-    return 0;
+void setRegionHistogramThreads(int threads) {
+    region_threads = threads;
+}
+
+// 8-bin RGB histograms of the regions, concatenated in region order
+static int regionHistogramFeature(const cv::Mat &image, const std::vector<HistogramRegion> &regions,
+                                  std::vector<float> &image_data) {
+    INSTRUMENT_SCOPE("region_hist");
+    image_data.assign(regions.size() * histogramSize(3, 8), 0.0f);
+    return computeRegionHistograms<3, 8>(image, regions, image_data.data(), region_threads);
 }
 
 // Function to get multi-histogram feature
 
-int getMultiHistogramFeature(char *image_filename, std::vector<float> &image_data) {
-    int bins = 8;
-    // Read the image
-    cv::Mat image = cv::imread(image_filename);
-    if (image.empty()) {
-        std::cerr << "Error loading image: " << image_filename << std::endl;
-        return -1;
-    }
+int getMultiHistogramFeatureFromImage(cv::Mat &image, std::vector<float> &image_data) {
+    // Top/bottom halves; an odd last row belongs to neither, as it always has
+    std::vector<HistogramRegion> halves = {
+        {cv::Rect(0, 0, image.cols, image.rows / 2), cv::Rect()},
+        {cv::Rect(0, image.rows / 2, image.cols, image.rows / 2), cv::Rect()}};
+    return regionHistogramFeature(image, halves, image_data);
+}
 
-    // Split image into top/bottom halves
-    cv::Mat top_half = image(cv::Rect(0, 0, image.cols, image.rows/2));
-    cv::Mat bottom_half = image(cv::Rect(0, image.rows/2, image.cols, image.rows/2));
+// Rows x Cols grid of 8-bin RGB histograms, cells row by row
+template <int Rows, int Cols>
+static int getGridHistogramFeatureFromImage(cv::Mat &image, std::vector<float> &image_data) {
+    return regionHistogramFeature(image, gridRegions(image.size(), Rows, Cols), image_data);
+}
 
-    // Calculate histograms for each region
-    std::vector<float> top_hist, bottom_hist;
-    computeMultiHistogram(top_half, top_hist, bins);
-    computeMultiHistogram(bottom_half, bottom_hist, bins);
+template <int Rows, int Cols>
+static int getGridHistogramFeature(char *image_filename, std::vector<float> &image_data) {
+    return extractFeatureFromFile(image_filename, getGridHistogramFeatureFromImage<Rows, Cols>, HISTOGRAM_DECODE,
+                                  image_data);
+}
 
-    // Concatenate histograms
-    image_data.clear();
-    image_data.insert(image_data.end(), top_hist.begin(), top_hist.end());
-    image_data.insert(image_data.end(), bottom_hist.begin(), bottom_hist.end());
+int getCenterSurroundFeatureFromImage(cv::Mat &image, std::vector<float> &image_data) {
+    return regionHistogramFeature(image, centerSurroundRegions(image.size()), image_data);
+}
 
-    return 0;
+int getCenterSurroundFeature(char *image_filename, std::vector<float> &image_data) {
+    return extractFeatureFromFile(image_filename, getCenterSurroundFeatureFromImage, HISTOGRAM_DECODE, image_data);
 }
 
 // Function to compute texture feature using Sobel gradients and histogram
 
 int computeTextureFeature(const cv::Mat& image, std::vector<float>& tex_hist, int bins) {
+    INSTRUMENT_SCOPE("texture_hist");
     // Convert to grayscale
     cv::Mat gray;
     cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
@@ -193,41 +204,19 @@ int computeTextureFeature(const cv::Mat& image, std::vector<float>& tex_hist, in
     normalize(gradient_mag, gradient_mag, 0, 255, NORM_MINMAX);
     gradient_mag.convertTo(gradient_mag, CV_8U);
 
-    // Initialize histogram
-    tex_hist.clear();
-    tex_hist.resize(bins, 0.0f);
-    int bin_size = 256 / bins;
-
-    // Compute histogram manually
-    for (int i = 0; i < gradient_mag.rows; i++) {
-        for (int j = 0; j < gradient_mag.cols; j++) {
-            int bin_idx = gradient_mag.at<uchar>(i, j) / bin_size;
-            tex_hist[bin_idx]++;
-        }
-    }
-
-    // Normalize histogram
-    float total_pixels = static_cast<float>(gradient_mag.rows * gradient_mag.cols);
-    for (float& bin : tex_hist) {
-        bin /= total_pixels;
-    }
-
-    return 0;
+    // Normalized histogram of the gradient magnitudes
+    return grayHistogram(gradient_mag, cv::Mat(), tex_hist, bins);
 }
 
 
 // Function to get texture-color feature by combining color and texture histograms
 
-int getTextureColorFeature(char* image_filename, std::vector<float>& feature) {
+int getTextureColorFeatureFromImage(cv::Mat &image, std::vector<float>& feature) {
     int bins = 16;
 
-    // Read image
-    cv::Mat image = cv::imread(image_filename);
-    if (image.empty()) return -1;
-
     // Get color histogram
     std::vector<float> color_hist;
-    calculateRGBHistogram(image_filename, color_hist);
+    calculateRGBHistogramFromImage(image, color_hist);
     // Get texture histogram
     std::vector<float> tex_hist;
     computeTextureFeature(image, tex_hist, bins);
@@ -244,30 +233,76 @@ int getTextureColorFeature(char* image_filename, std::vector<float>& feature) {
 
 
 void computeDepthMaskFromDA2(cv::Mat& src, cv::Mat& depth, cv::Mat& mask) {
-    // Flatten depth values into a vector
-    DA2Network& da2Network = initializeDA2();
-    da2Network.set_input(src, 1);
-    da2Network.run_network(depth, src.size());
-    std::vector<float> depth_values;  // DA2 depth may use 16-bit
+    INSTRUMENT_SCOPE("depth_mask");
+    // Reuse the depth map of identical pixels computed with the same model
+    uint64_t image_hash = 0, model_version = 0;
+    bool cached = false;
+    if (resultCacheEnabled()) {
+        image_hash = hashImageContent(src);
+        model_version = modelVersion(DA2_MODEL_FILE, DEPTH_PIPELINE_VERSION);
+        cached = lookupCachedDepth(image_hash, model_version, depth);
+        INSTRUMENT_COUNT(cached ? "depth_cache_hits" : "depth_cache_misses", 1);
+    }
+    if (!cached) {
+        std::lock_guard<std::mutex> lock(da2_mutex);
+        DA2Network& da2Network = initializeDA2();
+        da2Network.set_input(src, 1);
+        da2Network.run_network(depth, src.size());
+        if (resultCacheEnabled()) {
+            storeCachedDepth(image_hash, model_version, depth);
+        }
+    }
+
+    // run_network produces an 8-bit map, so the percentile comes straight
+    // from a 256-bin histogram instead of sorting every pixel
+    int counts[256] = {0};
     for (int i = 0; i < depth.rows; i++) {
+        const uchar *ptr = depth.ptr<uchar>(i);
         for (int j = 0; j < depth.cols; j++) {
-            depth_values.push_back(depth.at<float>(i, j));
+            counts[ptr[j]]++;
+        }
+    }
+
+    // Compute the depth at the 65th percentile
+    long long median_index = static_cast<long long>(depth.rows * depth.cols * 0.65);
+    long long seen = 0;
+    int median_value = 255;
+    for (int v = 0; v < 256; v++) {
+        seen += counts[v];
+        if (seen > median_index) {
+            median_value = v;
+            break;
         }
     }
-    // Sort depth values
-    std::sort(depth_values.begin(), depth_values.end());
-
-    // Compute median depth (50th percentile)
-    int median_index = depth_values.size() * 0.65;
-    float median_value = depth_values[median_index];
-//    // Define a depth range (50% close)
-//    ushort min_depth = median_depth * 0.5;
-//    ushort max_depth = median_depth * 1.5;
-
-    // Create a binary mask: Keep pixels where depth is within this range
-//    mask = (depth >= min_depth) & (depth <= max_depth);
+
+    // Create a binary mask: keep the nearer pixels
     mask = (depth <= median_value);
 }
+
+// detectFaces through the result cache, keyed by the greyscale pixels
+static int detectFacesCached(cv::Mat& grey, std::vector<cv::Rect>& faces) {
+    INSTRUMENT_SCOPE("face_detect");
+    if (!resultCacheEnabled()) {
+        std::lock_guard<std::mutex> lock(face_mutex);
+        return detectFaces(grey, faces);
+    }
+    uint64_t image_hash = hashImageContent(grey);
+    uint64_t model_version = modelVersion(FACE_CASCADE_FILE, FACE_PIPELINE_VERSION);
+    if (lookupCachedFaces(image_hash, model_version, faces)) {
+        INSTRUMENT_COUNT("face_cache_hits", 1);
+        return 0;
+    }
+    INSTRUMENT_COUNT("face_cache_misses", 1);
+    int result;
+    {
+        std::lock_guard<std::mutex> lock(face_mutex);
+        result = detectFaces(grey, faces);
+    }
+    if (result == 0) {
+        storeCachedFaces(image_hash, model_version, faces);
+    }
+    return result;
+}
 int computeGradientMagnitude(cv::Mat& gray, cv::Mat& gradient_mag) {
     // Compute Sobel gradients using manual functions
     cv::Mat sobelX, sobelY;
@@ -292,37 +327,13 @@ int computeGradientMagnitude(cv::Mat& gray, cv::Mat& gradient_mag) {
 }
 // Overloading Function to compute the RGB histogram for selected pixels
 int calculateRGBHistogram(const cv::Mat& image, const cv::Mat& mask, std::vector<float>& hist, int bins) {
-    const int BIN_SIZE = 256 / bins;
-
-    hist.clear();
-    hist.resize(bins * bins * bins, 0.0f);
-
-    int valid_pixel_count = 0;
-
-    for (int i = 0; i < image.rows; i++) {
-        for (int j = 0; j < image.cols; j++) {
-            if (mask.at<uchar>(i, j) == 0) continue; // Ignore pixels not in depth range
-
-            cv::Vec3b color = image.at<cv::Vec3b>(i, j);
-            int binB = color[0] / BIN_SIZE;
-            int binG = color[1] / BIN_SIZE;
-            int binR = color[2] / BIN_SIZE;
-            int binIndex = binR * bins * bins + binG * bins + binB;
-            hist[binIndex]++;
-            valid_pixel_count++;
-        }
-    }
-
-    // Normalize the histogram
-    if (valid_pixel_count > 0) {
-        for (float &val : hist) val /= valid_pixel_count;
-    }
-
-    return 0;
+    // Pixels outside the mask are ignored; normalized by the pixels kept
+    INSTRUMENT_SCOPE("color_hist");
+    return colorHistogram(image, mask, hist, bins);
 }
 
 int computeTextureFeature(cv::Mat& image, cv::Mat& mask, std::vector<float>& tex_hist, int bins) {
-    
+    INSTRUMENT_SCOPE("texture_hist");
     // Convert to grayscale
     cv::Mat gray;
     cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
@@ -340,37 +351,12 @@ int computeTextureFeature(cv::Mat& image, cv::Mat& mask, std::vector<float>& tex
     normalize(gradient_mag, gradient_mag, 0, 255, NORM_MINMAX);
     gradient_mag.convertTo(gradient_mag, CV_8U);
 
-    // Initialize histogram
-    tex_hist.clear();
-    tex_hist.resize(bins, 0.0f);
-    int bin_size = 256 / bins;
-    int valid_pixel_count = 0;
-
-    // Compute histogram manually
-    for (int i = 0; i < gradient_mag.rows; i++) {
-        for (int j = 0; j < gradient_mag.cols; j++) {
-            if (mask.at<uchar>(i, j) == 0) continue;
-            int bin_idx = gradient_mag.at<uchar>(i, j) / bin_size;
-            tex_hist[bin_idx]++;
-            valid_pixel_count++;
-        }
-    }
-
-
-    // Normalize histogram
-    if (valid_pixel_count > 0) {
-        for (float &val : tex_hist) val /= valid_pixel_count;
-    }
-
-    return 0;
+    // Histogram of the gradient magnitudes inside the mask
+    return grayHistogram(gradient_mag, mask, tex_hist, bins);
 }
 //Texture color with a mask based on depth closeness (50% range around median)
 
-int getTextureColorFeatureWithDepth(char* image_filename, std::vector<float>& feature) {
-    // Load RGB image
-    cv::Mat image = cv::imread(image_filename);
-    if (image.empty()) return -1;
-
+int getTextureColorFeatureWithDepthFromImage(cv::Mat &image, std::vector<float>& feature) {
     // Load DA2 depth map
     cv::Mat depth;
     // Compute mask based on depth closeness (50% range around median)
@@ -391,14 +377,7 @@ int getTextureColorFeatureWithDepth(char* image_filename, std::vector<float>& fe
     return 0;
 }
 
-int getBananaFeature(char *image_filename, std::vector<float>& hist) {
-    // Read and process image as before
-    cv::Mat image = cv::imread(image_filename);
-    if (image.empty()) {
-        std::cerr << "Error loading image: " << image_filename << std::endl;
-        return -1;
-    }
-
+int getBananaFeatureFromImage(cv::Mat &image, std::vector<float>& hist) {
     // HSV conversion and mask creation
     cv::Mat hsv, mask;
     cv::cvtColor(image, hsv, cv::COLOR_BGR2HSV);
@@ -410,48 +389,30 @@ int getBananaFeature(char *image_filename, std::vector<float>& hist) {
     cv::Mat labels, stats, centroids;
     const int MIN_AREA = 2000;
     const int MAX_AREA = 10000;
-    int nComponents = cv::connectedComponentsWithStats(mask, labels, stats, centroids);
+    int nComponents;
+    {
+        INSTRUMENT_SCOPE("blob_components");
+        nComponents = cv::connectedComponentsWithStats(mask, labels, stats, centroids);
+    }
 
     // Create 3D histogram: x-position (4 bins) × y-position (4 bins) × size (4 bins)
-    const int SPATIAL_BINS = 4;  // bins for each spatial dimension
-    const int SIZE_BINS = 4;     // bins for blob sizes
+    constexpr int SPATIAL_BINS = 4;  // bins for each spatial dimension
+    constexpr int SIZE_BINS = 4;     // bins for blob sizes
     const int TOTAL_BINS = SPATIAL_BINS * SPATIAL_BINS * SIZE_BINS;
     hist.assign(TOTAL_BINS, 0);
 
+    // Size bin of each blob, -1 for the background and blobs outside the area range
     float size_bin_width = (MAX_AREA - MIN_AREA) / static_cast<float>(SIZE_BINS);
-    float x_bin_width = static_cast<float>(image.cols) / SPATIAL_BINS;
-    float y_bin_width = static_cast<float>(image.rows) / SPATIAL_BINS;
-
-
-    // Process each blob
+    std::vector<int> size_bin_of_label(nComponents, -1);
     for (int i = 1; i < nComponents; i++) {
         int area = stats.at<int>(i, cv::CC_STAT_AREA);
         if (area >= MIN_AREA && area <= MAX_AREA) {
-            // Get size bin
-            int size_bin = std::min(static_cast<int>((area - MIN_AREA) / size_bin_width), SIZE_BINS - 1);
-
-            // Scan through the entire image to find pixels belonging to this blob
-            for (int y = 0; y < labels.rows; y++) {
-                for (int x = 0; x < labels.cols; x++) {
-                    // Check if this pixel belongs to the current blob
-                    if (labels.at<int>(y, x) == i) {
-                        // Calculate spatial bins for this pixel
-                        int x_bin = std::min(static_cast<int>(x / x_bin_width), SPATIAL_BINS - 1);
-                        int y_bin = std::min(static_cast<int>(y / y_bin_width), SPATIAL_BINS - 1);
-
-                        // Calculate flat index
-                        int flat_idx = x_bin + y_bin * SPATIAL_BINS + size_bin * SPATIAL_BINS * SPATIAL_BINS;
-                        hist[flat_idx] += 1.0f;
-                    }
-                }
-            }
+            size_bin_of_label[i] = std::min(static_cast<int>((area - MIN_AREA) / size_bin_width), SIZE_BINS - 1);
         }
     }
-    // Normalize histogram
-    float total = 0;
-    for (float count : hist) {
-        total += count;
-    }
+
+    // One pass over the label image bins every pixel of every accepted blob
+    float total = static_cast<float>(computeBlobHistogram<SPATIAL_BINS, SIZE_BINS>(labels, size_bin_of_label, hist.data()));
     // Normalize histogram
     if (total > 0) {
         for (float& count : hist) {
@@ -460,17 +421,15 @@ int getBananaFeature(char *image_filename, std::vector<float>& hist) {
     }
     hist.push_back(total);
 //     clog << "The valid total blobs are " << total << endl;
+    return 0;
 }
 //Texture color with a mask based on face detection
 
-int getTextureColorFeatureWithFaceMask(char* image_filename, std::vector<float>& feature) {
-    cv::Mat image = cv::imread(image_filename);
-    if (image.empty()) return -1;
-
+int getTextureColorFeatureWithFaceMaskFromImage(cv::Mat &image, std::vector<float>& feature) {
     std::vector<cv::Rect> faces;
     cv::Mat grey;
     cv::cvtColor(image, grey, cv::COLOR_BGR2GRAY);
-    detectFaces(grey, faces); //Face detection
+    detectFacesCached(grey, faces); //Face detection
     
     // Create face mask
     cv::Mat mask = cv::Mat::zeros(image.size(), CV_8U);
@@ -490,4 +449,171 @@ int getTextureColorFeatureWithFaceMask(char* image_filename, std::vector<float>&
     feature.insert(feature.end(), tex_hist.begin(), tex_hist.end());
   
     return 0;
-}
\ No newline at end of file
+}
+
+// Load the models an extractor depends on (the DA2 session, the face cascade)
+// and run them once on a blank image, so a long-running matcher pays for it at
+// startup instead of on its first unseen-image query.
+
+static int warmupDA2() {
+    cv::Mat blank(256, 256, CV_8UC3, cv::Scalar(128, 128, 128));
+    cv::Mat depth;
+    // straight through the network, so the blank image never lands in the result cache
+    std::lock_guard<std::mutex> lock(da2_mutex);
+    DA2Network &da2Network = initializeDA2();
+    da2Network.set_input(blank, 1);
+    da2Network.run_network(depth, blank.size());
+    return 0;
+}
+
+static int warmupFaceCascade() {
+    cv::Mat grey(64, 64, CV_8UC1, cv::Scalar(0));
+    std::vector<cv::Rect> faces;
+    std::lock_guard<std::mutex> lock(face_mutex);
+    return detectFaces(grey, faces);
+}
+
+// Feature registry entries; the ids are the numbers Proj2-offline_loading accepts
+
+static FeatureRegistrar square_feature([] {
+    FeatureInfo info;
+    info.name = "7x7-square";
+    info.id = 1;
+    info.description = "7x7 square";
+    info.segments = {27}; // the ROI is 3x3 pixels x 3 channels
+    info.default_metric = "ssd";
+    info.cost = CostClass::CHEAP;
+    info.decode = FULL_DECODE;
+    info.extract = get7x7square;
+    info.extract_image = get7x7squareFromImage;
+    return info;
+}());
+
+static FeatureRegistrar rgb_histogram_feature([] {
+    FeatureInfo info;
+    info.name = "rgb-hist";
+    info.id = 2;
+    info.description = "RGB histogram";
+    info.segments = {512};
+    info.default_metric = "rgb-hist";
+    info.cost = CostClass::CHEAP;
+    info.decode = HISTOGRAM_DECODE;
+    info.extract = calculateRGBHistogram;
+    info.extract_image = calculateRGBHistogramFromImage;
+    return info;
+}());
+
+static FeatureRegistrar multi_histogram_feature([] {
+    FeatureInfo info;
+    info.name = "multi-hist";
+    info.id = 3;
+    info.description = "Multi histogram";
+    info.segments = {512, 512};
+    info.default_metric = "multi-hist";
+    info.cost = CostClass::CHEAP;
+    info.decode = HISTOGRAM_DECODE;
+    info.extract = getMultiHistogramFeature;
+    info.extract_image = getMultiHistogramFeatureFromImage;
+    return info;
+}());
+
+// Region layouts beyond multi-hist's two halves; another grid is one more entry with its own Rows, Cols
+static FeatureRegistrar grid_2x2_feature([] {
+    FeatureInfo info;
+    info.name = "grid-2x2";
+    info.id = 10;
+    info.description = "2x2 grid of RGB histograms";
+    info.segments = {512, 512, 512, 512};
+    info.default_metric = "grid-2x2";
+    info.cost = CostClass::CHEAP;
+    info.decode = HISTOGRAM_DECODE;
+    info.extract = getGridHistogramFeature<2, 2>;
+    info.extract_image = getGridHistogramFeatureFromImage<2, 2>;
+    return info;
+}());
+
+static FeatureRegistrar grid_3x3_feature([] {
+    FeatureInfo info;
+    info.name = "grid-3x3";
+    info.id = 11;
+    info.description = "3x3 grid of RGB histograms";
+    info.segments = std::vector<int>(9, 512);
+    info.default_metric = "grid-3x3";
+    info.cost = CostClass::CHEAP;
+    info.decode = HISTOGRAM_DECODE;
+    info.extract = getGridHistogramFeature<3, 3>;
+    info.extract_image = getGridHistogramFeatureFromImage<3, 3>;
+    return info;
+}());
+
+static FeatureRegistrar center_surround_feature([] {
+    FeatureInfo info;
+    info.name = "center-surround";
+    info.id = 12;
+    info.description = "Center and surround RGB histograms";
+    info.segments = {512, 512}; // center, surround
+    info.default_metric = "center-surround";
+    info.cost = CostClass::CHEAP;
+    info.decode = HISTOGRAM_DECODE;
+    info.extract = getCenterSurroundFeature;
+    info.extract_image = getCenterSurroundFeatureFromImage;
+    return info;
+}());
+
+static FeatureRegistrar texture_color_feature([] {
+    FeatureInfo info;
+    info.name = "texture-color";
+    info.id = 4;
+    info.description = "Texture color";
+    info.segments = {512, 16};
+    info.default_metric = "texture-color";
+    info.cost = CostClass::FILTER;
+    info.decode = TEXTURE_DECODE;
+    info.extract = getTextureColorFeature;
+    info.extract_image = getTextureColorFeatureFromImage;
+    return info;
+}());
+
+static FeatureRegistrar depth_feature([] {
+    FeatureInfo info;
+    info.name = "depth";
+    info.id = 7;
+    info.description = "Depth value from DA2";
+    info.segments = {512, 8};
+    info.default_metric = "depth";
+    info.cost = CostClass::MODEL;
+    info.decode = FULL_DECODE;
+    info.extract = getTextureColorFeatureWithDepth;
+    info.extract_image = getTextureColorFeatureWithDepthFromImage;
+    info.warmup = warmupDA2;
+    return info;
+}());
+
+static FeatureRegistrar face_feature([] {
+    FeatureInfo info;
+    info.name = "face";
+    info.id = 8;
+    info.description = "Face mask from the Haar cascade";
+    info.segments = {1, 512, 16}; // face flag, color, texture
+    info.default_metric = "face";
+    info.cost = CostClass::MODEL;
+    info.decode = FULL_DECODE;
+    info.extract = getTextureColorFeatureWithFaceMask;
+    info.extract_image = getTextureColorFeatureWithFaceMaskFromImage;
+    info.warmup = warmupFaceCascade;
+    return info;
+}());
+
+static FeatureRegistrar banana_feature([] {
+    FeatureInfo info;
+    info.name = "banana";
+    info.id = 9;
+    info.description = "Banana";
+    info.segments = {64, 1}; // blob histogram, blob pixel count
+    info.default_metric = "banana";
+    info.cost = CostClass::FILTER;
+    info.decode = FULL_DECODE;
+    info.extract = getBananaFeature;
+    info.extract_image = getBananaFeatureFromImage;
+    return info;
+}());
@@ -0,0 +1,53 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 10, 2025
+ * Purpose: Packing helpers for the contiguous feature matrix
+ */
+
+#include "../include/feature_matrix.h"
+#include <algorithm>
+#include <cstdio>
+
+/**
+ * @brief Copies a 2D vector of features into a contiguous FeatureMatrix.
+ *
+ * @param data Feature rows as returned by read_image_data_csv.
+ * @param matrix Output matrix, resized to data.size() x data[0].size().
+ * @return non-zero if the rows do not all have the same length.
+ */
+int pack_feature_matrix(const std::vector<std::vector<float>> &data, FeatureMatrix &matrix) {
+    std::vector<int> indices(data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+        indices[i] = static_cast<int>(i);
+    }
+    return pack_feature_rows(data, indices, matrix);
+}
+
+/**
+ * @brief Copies the selected rows of a 2D vector of features into a FeatureMatrix.
+ *
+ * @param data Feature rows as returned by read_image_data_csv.
+ * @param indices Row indices to copy, in output order.
+ * @param matrix Output matrix with indices.size() rows.
+ * @return non-zero if an index is out of range or the rows differ in length.
+ */
+int pack_feature_rows(const std::vector<std::vector<float>> &data, const std::vector<int> &indices,
+                      FeatureMatrix &matrix) {
+    matrix.rows = static_cast<int>(indices.size());
+    matrix.cols = data.empty() ? 0 : static_cast<int>(data[0].size());
+    matrix.values.assign(static_cast<size_t>(matrix.rows) * matrix.cols, 0.0f);
+
+    for (int i = 0; i < matrix.rows; i++) {
+        int src = indices[i];
+        if (src < 0 || src >= static_cast<int>(data.size())) {
+            fprintf(stderr, "Error: row index %d out of range\n", src);
+            return -1;
+        }
+        if (static_cast<int>(data[src].size()) != matrix.cols) {
+            fprintf(stderr, "Error: row %d has %zu values, expected %d\n", src, data[src].size(), matrix.cols);
+            return -1;
+        }
+        std::copy(data[src].begin(), data[src].end(), matrix.row(i));
+    }
+    return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 22, 2025
+ * Purpose: Registry of the features the tools can extract and the distance
+ * metrics they can rank with
+ */
+
+#include "../include/feature_registry.h"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+// Function-local statics, so registrars in other files can run in any order.
+// std::map never moves its elements, so returned pointers stay valid.
+static std::map<std::string, FeatureInfo> &feature_table() {
+    static std::map<std::string, FeatureInfo> table;
+    return table;
+}
+
+static std::map<std::string, MetricInfo> &metric_table() {
+    static std::map<std::string, MetricInfo> table;
+    return table;
+}
+
+int FeatureInfo::dims() const {
+    int total = 0;
+    for (int length : segments) total += length;
+    return total;
+}
+
+void permute_columns(const std::vector<int> &column_order, std::vector<float> &row) {
+    if (column_order.empty() || row.size() != column_order.size()) return;
+    std::vector<float> permuted(row.size());
+    for (size_t d = 0; d < row.size(); d++) permuted[d] = row[column_order[d]];
+    row.swap(permuted);
+}
+
+FeatureRegistrar::FeatureRegistrar(const FeatureInfo &info) {
+    if (find_feature(info.name) || find_feature(info.id)) {
+        fprintf(stderr, "Feature %s (%d) is registered twice\n", info.name.c_str(), info.id);
+        return;
+    }
+    feature_table()[info.name] = info;
+}
+
+MetricRegistrar::MetricRegistrar(const MetricInfo &info) {
+    if (!metric_table().emplace(info.name, info).second) {
+        fprintf(stderr, "Metric %s is registered twice\n", info.name.c_str());
+    }
+}
+
+const FeatureInfo *find_feature(const std::string &name) {
+    auto it = feature_table().find(name);
+    return it == feature_table().end() ? nullptr : &it->second;
+}
+
+const FeatureInfo *find_feature(int id) {
+    for (auto &item : feature_table()) {
+        if (item.second.id == id) return &item.second;
+    }
+    return nullptr;
+}
+
+const MetricInfo *find_metric(const std::string &name) {
+    auto it = metric_table().find(name);
+    return it == metric_table().end() ? nullptr : &it->second;
+}
+
+const FeatureInfo *feature_for_metric(const MetricInfo &metric) {
+    return metric.feature.empty() ? nullptr : find_feature(metric.feature);
+}
+
+int metric_batch_kernel(const MetricInfo &metric, BatchMetric &kernel, int &segments) {
+    if (!metric.batch) return -1;
+    kernel = metric.batch_metric;
+    segments = 1;
+    if (kernel == BatchMetric::HISTOGRAM) {
+        // the kernel splits a row into equal parts, one per histogram of the feature
+        const FeatureInfo *feature = feature_for_metric(metric);
+        if (feature == nullptr || feature->segments.empty()) {
+            fprintf(stderr, "Metric %s has no feature to split its histograms by\n", metric.name.c_str());
+            return -1;
+        }
+        segments = static_cast<int>(feature->segments.size());
+    }
+    return 0;
+}
+
+std::vector<const FeatureInfo *> list_features() {
+    std::vector<const FeatureInfo *> features;
+    for (auto &item : feature_table()) features.push_back(&item.second);
+    std::sort(features.begin(), features.end(),
+              [](const FeatureInfo *a, const FeatureInfo *b) { return a->id < b->id; });
+    return features;
+}
+
+std::vector<const MetricInfo *> list_metrics() {
+    std::vector<const MetricInfo *> metrics;
+    for (auto &item : metric_table()) metrics.push_back(&item.second);
+    return metrics;
+}
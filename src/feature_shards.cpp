@@ -0,0 +1,263 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 3, 2025
+ * Purpose: Feature files split into shards by file name, listed in a shard
+ * manifest, loaded and searched one thread per shard
+ */
+
+#include "../include/feature_shards.h"
+#include "../include/content_hash.h"
+#include "../include/feature_store.h"
+#include "../include/instrument.h"
+#include "../include/manifest.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+
+static const char *SHARD_HEADER = "#proj2-shards,";
+
+// File name without its directory, the key images are assigned to shards by
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+bool is_shard_manifest(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return false;
+    char line[64] = {0};
+    bool match = fgets(line, sizeof(line), fp) && strncmp(line, SHARD_HEADER, strlen(SHARD_HEADER)) == 0;
+    fclose(fp);
+    return match;
+}
+
+int read_shard_manifest(const char *path, ShardManifest &manifest) {
+    manifest = ShardManifest();
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return 1;
+    }
+
+    char line[1024];
+    char scheme[16] = {0};
+    int count = -1;
+    if (!fgets(line, sizeof(line), fp) ||
+        sscanf(line, "#proj2-shards,scheme=%15[a-z],count=%d", scheme, &count) != 2 || count <= 0 ||
+        (strcmp(scheme, "hash") != 0 && strcmp(scheme, "range") != 0)) {
+        fprintf(stderr, "%s is not a shard manifest\n", path);
+        fclose(fp);
+        return -1;
+    }
+    manifest.scheme = strcmp(scheme, "range") == 0 ? ShardScheme::RANGE : ShardScheme::HASH;
+    manifest.paths.resize(count);
+    manifest.firsts.resize(count);
+
+    int status = 0;
+    std::vector<bool> seen(count, false);
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        // index,path[,first name]
+        char *index_end;
+        long index = strtol(line, &index_end, 10);
+        char *file = *index_end == ',' ? index_end + 1 : nullptr;
+        char *first = file ? strchr(file, ',') : nullptr;
+        if (first) *first++ = '\0';
+        if (file == nullptr || *file == '\0' || index < 0 || index >= count || seen[index]) {
+            fprintf(stderr, "Malformed shard manifest line in %s\n", path);
+            status = -1;
+            break;
+        }
+        seen[index] = true;
+        manifest.paths[index] = file;
+        manifest.firsts[index] = first ? first : "";
+    }
+    fclose(fp);
+    if (status == 0 && std::find(seen.begin(), seen.end(), false) != seen.end()) {
+        fprintf(stderr, "%s does not list all %d shards\n", path, count);
+        status = -1;
+    }
+    if (status == 0 && manifest.scheme == ShardScheme::RANGE) {
+        for (int s = 1; s < count; s++) {
+            if (manifest.firsts[s].empty() || manifest.firsts[s] < manifest.firsts[s - 1]) {
+                fprintf(stderr, "%s has shard ranges out of order\n", path);
+                status = -1;
+                break;
+            }
+        }
+    }
+    return status;
+}
+
+int write_shard_manifest(const char *path, const ShardManifest &manifest) {
+    // one temporary file per process, as shard builders may all create the manifest at once
+    std::string tmp_name = std::string(path) + "." + std::to_string(getpid()) + ".tmp";
+    FILE *fp = fopen(tmp_name.c_str(), "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to open shard manifest %s\n", tmp_name.c_str());
+        return -1;
+    }
+    bool range = manifest.scheme == ShardScheme::RANGE;
+    fprintf(fp, "%sscheme=%s,count=%d\n", SHARD_HEADER, range ? "range" : "hash", manifest.count());
+    for (int s = 0; s < manifest.count(); s++) {
+        if (range && s > 0) {
+            fprintf(fp, "%d,%s,%s\n", s, manifest.paths[s].c_str(), manifest.firsts[s].c_str());
+        } else {
+            fprintf(fp, "%d,%s\n", s, manifest.paths[s].c_str());
+        }
+    }
+    if (fsync_and_close(fp) != 0 || rename(tmp_name.c_str(), path) != 0) {
+        fprintf(stderr, "Unable to write shard manifest %s\n", path);
+        remove(tmp_name.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+void make_hash_manifest(const char *manifest_path, int count, const char *extension, ShardManifest &manifest) {
+    // data/fv4.shards -> fv4, the shards sit next to the manifest
+    std::string stem = base_name(manifest_path);
+    size_t dot = stem.rfind('.');
+    if (dot != std::string::npos && dot > 0) stem.resize(dot);
+
+    manifest = ShardManifest();
+    manifest.scheme = ShardScheme::HASH;
+    for (int s = 0; s < count; s++) {
+        manifest.paths.push_back(stem + "." + std::to_string(s) + extension);
+        manifest.firsts.push_back("");
+    }
+}
+
+std::string shard_file(const char *manifest_path, const ShardManifest &manifest, int shard) {
+    const std::string &path = manifest.paths[shard];
+    const char *slash = strrchr(manifest_path, '/');
+    if (path[0] == '/' || slash == nullptr) {
+        return path;
+    }
+    return std::string(manifest_path, slash + 1) + path;
+}
+
+int shard_of(const ShardManifest &manifest, const char *filename) {
+    const char *name = base_name(filename);
+    if (manifest.scheme == ShardScheme::RANGE) {
+        // the last shard whose first name is not after this one
+        int shard = 0;
+        for (int s = 1; s < manifest.count(); s++) {
+            if (strcmp(manifest.firsts[s].c_str(), name) <= 0) shard = s;
+            else break;
+        }
+        return shard;
+    }
+    return static_cast<int>(hash_bytes(name, strlen(name)) % static_cast<uint64_t>(manifest.count()));
+}
+
+size_t ShardedStore::rows() const {
+    size_t total = 0;
+    for (const FeatureMatrix &shard : stores) total += shard.rows;
+    return total;
+}
+
+int ShardedStore::cols() const {
+    for (const FeatureMatrix &shard : stores) {
+        if (shard.rows > 0) return shard.cols;
+    }
+    return 0;
+}
+
+// Runs work(shard) for every shard, at most threads at a time
+template <typename Work>
+static void for_each_shard(int count, int threads, Work work) {
+    if (threads <= 0) threads = static_cast<int>(std::thread::hardware_concurrency());
+    threads = std::max(1, std::min(threads, count));
+    std::atomic<int> next(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            for (int s = next++; s < count; s = next++) work(s);
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+int load_shards(const char *manifest_path, ShardedStore &store) {
+    if (read_shard_manifest(manifest_path, store.manifest) != 0) {
+        fprintf(stderr, "Can not read shard manifest %s\n", manifest_path);
+        return -1;
+    }
+    int count = store.manifest.count();
+    store.filenames.assign(count, std::vector<char *>());
+    store.stores.assign(count, FeatureMatrix());
+
+    std::vector<int> status(count, 0);
+    for_each_shard(count, 0, [&](int s) {
+        std::string path = shard_file(manifest_path, store.manifest, s);
+        std::vector<std::vector<float>> data;
+        if (read_feature_file(path.c_str(), store.filenames[s], data) != 0) {
+            fprintf(stderr, "Can not read shard %d: %s\n", s, path.c_str());
+            status[s] = -1;
+        } else if (pack_feature_matrix(data, store.stores[s]) != 0) {
+            fprintf(stderr, "Shard %s has rows of different lengths\n", path.c_str());
+            status[s] = -1;
+        }
+    });
+    if (std::count(status.begin(), status.end(), 0) != count) {
+        return -1;
+    }
+
+    int cols = store.cols();
+    for (int s = 0; s < count; s++) {
+        if (store.stores[s].rows > 0 && store.stores[s].cols != cols) {
+            fprintf(stderr, "Shard %d has %d values per row, shard 0 has %d\n", s, store.stores[s].cols, cols);
+            return -1;
+        }
+    }
+    printf("Loaded %zu rows from %d shards of %s\n", store.rows(), count, manifest_path);
+    return 0;
+}
+
+int sharded_find_topN(const ShardedStore &store, const float *target, int exclude_shard, int exclude_row,
+                      BatchMetric metric, int segments, int N, std::vector<ShardMatch> &result, int num_threads) {
+    result.clear();
+    int count = static_cast<int>(store.stores.size());
+    int cols = store.cols();
+    if (N <= 0 || cols == 0) {
+        return N <= 0 ? -1 : 0;
+    }
+    FeatureMatrix query;
+    query.rows = 1;
+    query.cols = cols;
+    query.values.assign(target, target + cols);
+
+    // scatter: every shard keeps its own top N, one thread per shard
+    std::vector<std::vector<std::pair<float, int>>> best(count);
+    std::vector<int> status(count, 0);
+    for_each_shard(count, num_threads, [&](int s) {
+        if (store.stores[s].rows == 0) return;
+        INSTRUMENT_SCOPE("shard_scan");
+        std::vector<int> exclude = {s == exclude_shard ? exclude_row : -1};
+        std::vector<std::vector<std::pair<float, int>>> found;
+        status[s] = batch_find_topN(store.stores[s], query, exclude, metric, segments, N, found, 1);
+        if (status[s] == 0) best[s] = std::move(found[0]);
+    });
+    if (std::count(status.begin(), status.end(), 0) != count) {
+        return -1;
+    }
+
+    // gather: the N best of the per-shard lists
+    INSTRUMENT_SCOPE("shard_merge");
+    for (int s = 0; s < count; s++) {
+        for (const auto &match : best[s]) result.push_back({match.first, s, match.second});
+    }
+    std::sort(result.begin(), result.end(), [](const ShardMatch &a, const ShardMatch &b) {
+        if (a.distance != b.distance) return a.distance < b.distance;
+        return a.shard != b.shard ? a.shard < b.shard : a.row < b.row;
+    });
+    if (static_cast<int>(result.size()) > N) result.resize(N);
+    return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 28, 2025
+ * Purpose: Binary feature store writer and reader
+ */
+
+#include "../include/feature_store.h"
+#include "../include/csv_util.h"
+#include "../include/instrument.h"
+#include "../include/manifest.h"
+#include "../include/name_arena.h"
+#include "../include/segment_store.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <sys/stat.h>
+
+FeatureStoreWriter::~FeatureStoreWriter() {
+    // a store that was never closed is abandoned, not left half written
+    if (fp_) {
+        fclose(fp_);
+        remove((path_ + ".tmp").c_str());
+    }
+    if (names_fp_) fclose(names_fp_);
+    if (offsets_fp_) fclose(offsets_fp_);
+}
+
+int FeatureStoreWriter::open(const char *path, int cols, uint32_t flags) {
+    if (fp_ || cols <= 0) return -1;
+    path_ = path;
+    cols_ = cols;
+    flags_ = flags;
+    rows_ = 0;
+    names_bytes_ = 0;
+    fp_ = fopen((path_ + ".tmp").c_str(), "wb");
+    names_fp_ = tmpfile();
+    offsets_fp_ = tmpfile();
+    if (!fp_ || !names_fp_ || !offsets_fp_) {
+        fprintf(stderr, "Unable to open feature store %s\n", path);
+        return -1;
+    }
+    // placeholder header, rewritten by close()
+    FeatureStoreHeader header;
+    memset(&header, 0, sizeof(header));
+    return fwrite(&header, sizeof(header), 1, fp_) == 1 ? 0 : -1;
+}
+
+int FeatureStoreWriter::append(const char *name, const float *values) {
+    if (!fp_) return -1;
+    size_t length = strlen(name) + 1;
+    if (fwrite(values, sizeof(float), cols_, fp_) != static_cast<size_t>(cols_) ||
+        fwrite(&names_bytes_, sizeof(names_bytes_), 1, offsets_fp_) != 1 ||
+        fwrite(name, 1, length, names_fp_) != length) {
+        fprintf(stderr, "Error writing feature store %s\n", path_.c_str());
+        return -1;
+    }
+    names_bytes_ += length;
+    rows_++;
+    return 0;
+}
+
+// Appends the contents of a spool file to out
+static int copy_spool(FILE *spool, FILE *out) {
+    char buffer[1 << 16];
+    rewind(spool);
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), spool)) > 0) {
+        if (fwrite(buffer, 1, n, out) != n) return -1;
+    }
+    return ferror(spool) ? -1 : 0;
+}
+
+int FeatureStoreWriter::close() {
+    if (!fp_) return -1;
+    FeatureStoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FEATURE_STORE_MAGIC, sizeof(header.magic));
+    header.version = FEATURE_STORE_VERSION;
+    header.flags = flags_;
+    header.rows = rows_;
+    header.cols = static_cast<uint32_t>(cols_);
+    header.names_offset = sizeof(header) + rows_ * cols_ * sizeof(float);
+    header.names_bytes = names_bytes_;
+
+    int status = 0;
+    if (copy_spool(offsets_fp_, fp_) != 0 || fwrite(&names_bytes_, sizeof(names_bytes_), 1, fp_) != 1 ||
+        copy_spool(names_fp_, fp_) != 0 || fseek(fp_, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, fp_) != 1) {
+        status = -1;
+    }
+    fclose(names_fp_);
+    fclose(offsets_fp_);
+    names_fp_ = offsets_fp_ = nullptr;
+
+    std::string tmp_name = path_ + ".tmp";
+    if (fsync_and_close(fp_) != 0) status = -1;
+    fp_ = nullptr;
+    if (status != 0 || rename(tmp_name.c_str(), path_.c_str()) != 0) {
+        fprintf(stderr, "Error writing feature store %s\n", path_.c_str());
+        remove(tmp_name.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+// Reads and checks the header of an open store
+static int read_store_header(FILE *fp, const char *path, FeatureStoreHeader &header) {
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, FEATURE_STORE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s is not a feature store\n", path);
+        return -1;
+    }
+    if (header.version != FEATURE_STORE_VERSION) {
+        fprintf(stderr, "%s has store version %u, expected %u\n", path, header.version, FEATURE_STORE_VERSION);
+        return -1;
+    }
+    // the sizes come from the file, so check them against its length before anything is allocated from them
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0) {
+        fprintf(stderr, "Unable to stat feature store %s\n", path);
+        return -1;
+    }
+    uint64_t file_size = static_cast<uint64_t>(st.st_size);
+    uint64_t row_bytes = static_cast<uint64_t>(header.cols) * sizeof(float) + sizeof(uint64_t);
+    if (header.rows > (file_size - sizeof(header)) / row_bytes || header.names_bytes > file_size ||
+        header.names_offset != sizeof(header) + header.rows * header.cols * sizeof(float) ||
+        header.names_offset + (header.rows + 1) * sizeof(uint64_t) + header.names_bytes != file_size) {
+        fprintf(stderr, "%s has an inconsistent header\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+bool is_feature_store(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+    char magic[sizeof(FEATURE_STORE_MAGIC)];
+    bool match = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+                 memcmp(magic, FEATURE_STORE_MAGIC, sizeof(magic)) == 0;
+    fclose(fp);
+    return match;
+}
+
+int read_feature_store_header(const char *path, FeatureStoreHeader &header) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Unable to open feature store %s\n", path);
+        return -1;
+    }
+    int status = read_store_header(fp, path, header);
+    fclose(fp);
+    return status;
+}
+
+int read_feature_store(const char *path, std::vector<char *> &filenames, std::vector<std::vector<float>> &data) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        printf("Unable to open feature file\n");
+        return -1;
+    }
+    printf("Reading %s\n", path);
+    FeatureStoreHeader header;
+    if (read_store_header(fp, path, header) != 0) {
+        fclose(fp);
+        return -1;
+    }
+    if (header.rows > UINT32_MAX) {
+        fprintf(stderr, "%s has more rows than fit 32-bit ids\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    INSTRUMENT_SCOPE("store_read");
+    std::vector<std::vector<float>> rows(header.rows, std::vector<float>(header.cols));
+    for (auto &row : rows) {
+        if (fread(row.data(), sizeof(float), header.cols, fp) != header.cols) {
+            fprintf(stderr, "%s is truncated\n", path);
+            fclose(fp);
+            return -1;
+        }
+    }
+    std::vector<uint64_t> offsets(header.rows + 1);
+    std::vector<char> names(header.names_bytes);
+    if (fread(offsets.data(), sizeof(uint64_t), offsets.size(), fp) != offsets.size() ||
+        fread(names.data(), 1, names.size(), fp) != names.size() || offsets.back() != header.names_bytes) {
+        fprintf(stderr, "%s is truncated\n", path);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    // every name must lie inside the names block and end in its NUL before the next one starts
+    for (uint64_t i = 0; i < header.rows; i++) {
+        if (offsets[i] >= offsets[i + 1] || offsets[i + 1] > header.names_bytes || names[offsets[i + 1] - 1] != '\0') {
+            fprintf(stderr, "%s has a corrupt names table\n", path);
+            return -1;
+        }
+    }
+    printf("Finished reading feature store\n");
+
+    // the names table becomes the arena; row ids are the stored row numbers
+    NameArena arena;
+    arena.reserve(header.rows, header.names_bytes);
+    for (uint64_t i = 0; i < header.rows; i++) {
+        arena.add(&names[offsets[i]], strlen(&names[offsets[i]]));
+    }
+    std::vector<char>().swap(names);
+
+    // the CSV reader sorts rows by file name so files line up; do the same unless the store says it is sorted
+    std::vector<uint32_t> ids(header.rows);
+    std::iota(ids.begin(), ids.end(), 0);
+    if (!(header.flags & FEATURE_STORE_SORTED)) {
+        INSTRUMENT_SCOPE("store_sort");
+        arena.sorted_ids(ids);
+    }
+    data.clear();
+    data.reserve(header.rows);
+    for (uint32_t id : ids) {
+        data.push_back(std::move(rows[id]));
+    }
+    adopt_names(std::move(arena), ids, filenames);
+    return 0;
+}
+
+int read_feature_file(const char *path, std::vector<char *> &filenames, std::vector<std::vector<float>> &data) {
+    INSTRUMENT_SCOPE("load");
+    if (is_feature_store(path)) {
+        return read_feature_store(path, filenames, data);
+    }
+    if (is_segment_manifest(path)) {
+        return read_segment_store(path, filenames, data);
+    }
+    return read_image_data_csv(const_cast<char *>(path), filenames, data);
+}
@@ -6,53 +6,562 @@
  * extraction method, and save the extracted features to a CSV file
  */
 #include <opencv2/opencv.hpp>
-#include "../include/feature_calculate.h"
+#include "../include/feature_registry.h"
 #include "../include/csv_util.h"
+#include "../include/content_hash.h"
+#include "../include/manifest.h"
+#include "../include/result_cache.h"
+#include "../include/extract_pipeline.h"
+#include "../include/instrument.h"
+#include "../include/thumbnail_pack.h"
+#include "../include/image_decode.h"
+#include "../include/feature_shards.h"
+#include "../include/feature_store.h"
+#include "../include/segment_store.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
 #include <vector>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
 #include <dirent.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 using namespace cv;
 using namespace std;
 
+// Returns true if the directory entry looks like an image file
+static bool is_image_file(const char *name) {
+    return strstr(name, ".jpg") || strstr(name, ".png") || strstr(name, ".ppm") || strstr(name, ".tif");
+}
+
+// Set by --shard: only the images of this shard are extracted
+static ShardManifest shard_manifest;
+static int selected_shard = -1;
+
+// Returns true if the image belongs to the shard being built, or if the output is not sharded
+static bool in_selected_shard(const char *path) {
+    return selected_shard < 0 || shard_of(shard_manifest, path) == selected_shard;
+}
+
 /**
-* @brief Extracts features from an image file and appends them to a CSV file.
-*
-* @param image_filename Path to the image file.
-* @param feature_function Pointer to a function that extracts features from the image.
-*                         The function takes an image filename and a reference to a
-*                         vector of floats and returns 0 on success.
-* @param output_filename Path to the output CSV file where features will be saved.
-* @return int Returns 0 on success, or -1 on failure.
-*/
-int extract_and_save_features(char* image_filename,
-                              int (*feature_function)(char *, std::vector<float> &),
-                              char* output_filename) {
-
-    
-    std::vector<float> features;
-    // Try to extract features
-    int result = feature_function(image_filename, features);
-    if (result != 0) {
-        fprintf(stderr, "Error: Failed to extract features from '%s'\n", image_filename);
+ * @brief Selects the shard to build from "<i>/<n>". The shard manifest is
+ *        created with n hash shards if it does not exist yet, so the shards can
+ *        be built by separate processes started at the same time.
+ *
+ * @param manifest_path Shard manifest, given in place of the output file.
+ * @param spec Shard index and shard count, e.g. "2/8".
+ * @param output_file Output path of the shard file.
+ * @return non-zero on a bad spec or a manifest with another shard count.
+ */
+static int select_shard(const char *manifest_path, const char *spec, std::string &output_file) {
+    int index, count;
+    if (sscanf(spec, "%d/%d", &index, &count) != 2 || count <= 0 || index < 0 || index >= count) {
+        printf("Invalid shard: %s, expected <index>/<count>\n", spec);
+        return -1;
+    }
+    int status = read_shard_manifest(manifest_path, shard_manifest);
+    if (status < 0) {
         return -1;
     }
-    // If this is the first file, reset the output file
-    static bool first_file = true;
-    int reset = first_file ? 1 : 0;
-    first_file = false;
+    if (status == 1) {
+        // every builder writes the same manifest, each through its own temporary file
+        make_hash_manifest(manifest_path, count, ".csv", shard_manifest);
+        if (write_shard_manifest(manifest_path, shard_manifest) != 0) {
+            return -1;
+        }
+    } else if (shard_manifest.count() != count) {
+        printf("%s has %d shards, not %d\n", manifest_path, shard_manifest.count(), count);
+        return -1;
+    }
+    selected_shard = index;
+    output_file = shard_file(manifest_path, shard_manifest, index);
+    printf("Building shard %d of %d: %s\n", index, count, output_file.c_str());
+    return 0;
+}
 
-    result = append_image_data_csv(output_filename, image_filename, features, reset);
-    if (result != 0) {
-        fprintf(stderr, "Error: Failed to save features to '%s'\n", output_filename);
+/**
+ * @brief Packs thumbnails of images that have none yet, e.g. images kept by an
+ *        incremental update that ran before the thumbnail pack existed.
+ *
+ * @return number of images that could not be read
+ */
+static int backfill_thumbnails(const std::vector<std::string> &paths) {
+    int width, height, failed = 0, added = 0;
+    thumbnailPackSize(width, height);
+    for (const std::string &path : paths) {
+        if (hasPackedThumbnail(path.c_str())) continue;
+        int image_width, image_height, scale = 1;
+        if (readImageSize(path.c_str(), image_width, image_height) == 0) {
+            scale = chooseThumbnailScale(image_width, image_height, width, height);
+        }
+        std::vector<unsigned char> jpeg;
+        cv::Mat image = cv::imread(path, imreadFlagsForScale(scale));
+        if (makeThumbnail(image, width, height, jpeg) != 0 || storePackedThumbnail(path.c_str(), jpeg) != 0) {
+            fprintf(stderr, "Error: cannot make a thumbnail of '%s'\n", path.c_str());
+            failed++;
+            continue;
+        }
+        added++;
+    }
+    if (added > 0) printf("Added thumbnails of %d kept images\n", added);
+    return failed;
+}
+
+// Whether an output is written as a binary feature store: a .bin name or an existing store
+static bool is_store_output(const char *path) {
+    size_t length = strlen(path);
+    return (length > 4 && strcmp(path + length - 4, ".bin") == 0) || is_feature_store(path);
+}
+
+// Writer of a segment store output, kept open across the batches of --watch so its compactions run in the background
+static SegmentStoreWriter segment_writer;
+
+// Opens segment_writer on first use; non-zero failure
+static int open_segment_writer(const char *output_filename) {
+    if (segment_writer.is_open()) return 0;
+    return segment_writer.open(output_filename);
+}
+
+/**
+ * @brief Brings an existing feature file up to date with a directory.
+ *
+ * A manifest of (path, size, mtime, content hash) is kept in
+ * "<output_filename>.manifest". Images whose size and mtime match keep their
+ * rows; when only the mtime moved, the content hash decides. New and changed
+ * images are extracted, and rows of images that left the directory are dropped.
+ * If the only change is new images, their rows are appended; otherwise the
+ * whole file is written to a temporary file and renamed over the old one. A
+ * segment store is never rewritten: new and changed rows are put and removed
+ * images deleted. The manifest is replaced last, so an interrupted run only
+ * costs re-extraction.
+ *
+ * @param dirname Directory of images, with a trailing slash.
+ * @param output_filename Feature CSV or segment store to update.
+ * @param feature Feature to extract; a manifest built for another feature is ignored.
+ * @param options Threads and queue depth of the extraction pipeline.
+ * @return int Returns 0 on success, or -1 on failure.
+ */
+int update_features_incremental(char *dirname, char *output_filename, const FeatureInfo &feature,
+                                const PipelineOptions &options) {
+    std::string manifest_file = std::string(output_filename) + ".manifest";
+    Manifest old_manifest;
+    std::string manifest_feature, manifest_decode;
+    int status = read_manifest(manifest_file.c_str(), old_manifest, manifest_feature, manifest_decode);
+    if (status < 0) {
         return -1;
     }
 
+    // Existing rows, keyed by image path
+    std::vector<char *> old_names;
+    std::vector<std::vector<float>> old_data;
+    bool segments = is_segment_store_path(output_filename);
+    bool binary = !segments && is_store_output(output_filename);
+    // rows of another feature, or decoded at another resolution, can not be mixed with new ones
+    bool usable = status == 0 && manifest_feature == feature.name &&
+                  manifest_decode == describeDecode(feature.decode);
+    if (segments) {
+        // rows of a segment store are replaced by puts, but its stale rows still need deleting
+        if (open_segment_writer(output_filename) != 0 || read_feature_file(output_filename, old_names, old_data) != 0) {
+            return -1;
+        }
+    } else if (usable) {
+        FILE *probe = fopen(output_filename, "r");
+        usable = probe != NULL;
+        if (probe) fclose(probe);
+    }
+    if (usable && !segments) {
+        INSTRUMENT_SCOPE("load");
+        usable = (binary ? read_feature_file(output_filename, old_names, old_data)
+                         : read_image_data_csv(output_filename, old_names, old_data)) == 0;
+    }
+    if (!usable) {
+        printf("No usable manifest for this feature type and decode resolution, extracting every image\n");
+        old_manifest.clear();
+        if (!segments) {
+            old_names.clear();
+            old_data.clear();
+        }
+    }
+    std::map<std::string, int> old_row;
+    for (size_t i = 0; i < old_names.size(); i++) {
+        old_row[old_names[i]] = static_cast<int>(i);
+    }
+
+    // List the images currently in the directory
+    DIR *dirp = opendir(dirname);
+    if (dirp == NULL) {
+        printf("Cannot open directory %s\n", dirname);
+        return -1;
+    }
+    std::vector<std::string> paths;
+    struct dirent *dp;
+    while ((dp = readdir(dirp)) != NULL) {
+        std::string path = std::string(dirname) + dp->d_name;
+        if (is_image_file(dp->d_name) && in_selected_shard(path.c_str())) {
+            paths.push_back(path);
+        }
+    }
+    closedir(dirp);
+    std::sort(paths.begin(), paths.end());
+
+    // Decide per image whether its row can be kept
+    Manifest new_manifest;
+    std::map<std::string, std::vector<float>> rows; // final table, sorted by path
+    std::vector<std::string> to_extract;
+    std::set<std::string> had_row;
+    int kept = 0, added = 0, changed = 0, failed = 0;
+    for (const std::string &path : paths) {
+        ManifestEntry entry;
+        if (stat_file(path.c_str(), entry.size, entry.mtime) != 0) {
+            fprintf(stderr, "Error: cannot stat '%s'\n", path.c_str());
+            failed++;
+            continue;
+        }
+        auto known = old_manifest.find(path);
+        auto row = old_row.find(path);
+        bool have_row = known != old_manifest.end() && row != old_row.end();
+
+        bool unchanged = false;
+        if (have_row && known->second.size == entry.size && known->second.mtime == entry.mtime) {
+            entry.hash = known->second.hash;
+            unchanged = true;
+        } else {
+            if (hash_file_contents(path.c_str(), entry.hash) != 0) {
+                fprintf(stderr, "Error: cannot read '%s'\n", path.c_str());
+                failed++;
+                continue;
+            }
+            unchanged = have_row && known->second.size == entry.size && known->second.hash == entry.hash;
+        }
+
+        if (unchanged) {
+            rows[path] = old_data[row->second];
+            kept++;
+        } else {
+            to_extract.push_back(path);
+            if (have_row) had_row.insert(path);
+        }
+        new_manifest[path] = entry;
+    }
+
+    // Extract the new and changed images
+    std::vector<std::string> appended;
+    size_t next = 0;
+    std::vector<StageStats> stats;
+    auto start = std::chrono::steady_clock::now();
+    run_extraction_pipeline(
+            [&](std::string &path) {
+                if (next >= to_extract.size()) return false;
+                path = to_extract[next++];
+                return true;
+            },
+            feature, options,
+            [&](const std::string &path, bool ok, std::vector<float> &features) {
+                if (!ok) {
+                    fprintf(stderr, "Error: Failed to extract features from '%s'\n", path.c_str());
+                    new_manifest.erase(path); // retried on the next run
+                    failed++;
+                    return 0;
+                }
+                printf("processing image file: %s\n", path.c_str());
+                rows[path] = std::move(features);
+                if (had_row.count(path)) {
+                    changed++;
+                } else {
+                    added++;
+                    appended.push_back(path);
+                }
+                return 0;
+            },
+            stats);
+    if (!to_extract.empty()) {
+        print_pipeline_stats(stats, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    int deleted = static_cast<int>(old_names.size()) - kept - changed;
+    if (options.thumbnails && thumbnailPackEnabled()) {
+        std::vector<std::string> kept_paths;
+        for (auto &item : rows) kept_paths.push_back(item.first);
+        backfill_thumbnails(kept_paths);
+    }
+
+    if (segments) {
+        // the extracted rows and the deletions go to the tail; nothing is rewritten
+        INSTRUMENT_SCOPE("segment_write");
+        for (const std::string &path : to_extract) {
+            auto row = rows.find(path);
+            if (row != rows.end() && segment_writer.put(path.c_str(), row->second) != 0) {
+                fprintf(stderr, "Error: Failed to save features to '%s'\n", output_filename);
+                return -1;
+            }
+        }
+        deleted = 0;
+        for (char *name : old_names) {
+            if (rows.count(name) == 0) {
+                if (segment_writer.remove(name) != 0) return -1;
+                deleted++;
+            }
+        }
+        if (segment_writer.sync() != 0) {
+            return -1;
+        }
+    } else if (changed == 0 && deleted == 0 && usable && !binary) {
+        INSTRUMENT_SCOPE("csv_write");
+        // Only new images: append their rows to the existing file
+        for (const std::string &path : appended) {
+            if (append_image_data_csv(output_filename, (char *) path.c_str(), rows[path], 0) != 0) {
+                fprintf(stderr, "Error: Failed to save features to '%s'\n", output_filename);
+                return -1;
+            }
+        }
+    } else if (binary) {
+        // rows is keyed by path, so the store is written sorted; close() renames it into place
+        INSTRUMENT_SCOPE("csv_write");
+        FeatureStoreWriter store;
+        int cols = rows.empty() ? 1 : static_cast<int>(rows.begin()->second.size());
+        if (store.open(output_filename, cols, FEATURE_STORE_SORTED) != 0) {
+            return -1;
+        }
+        for (auto &item : rows) {
+            if (static_cast<int>(item.second.size()) != cols || store.append(item.first.c_str(), item.second.data()) != 0) {
+                fprintf(stderr, "Error: Failed to save features to '%s'\n", output_filename);
+                return -1;
+            }
+        }
+        if (store.close() != 0) {
+            return -1;
+        }
+    } else {
+        // Rewrite the whole table next to the old one, then swap it in
+        INSTRUMENT_SCOPE("csv_write");
+        std::vector<char *> names;
+        std::vector<std::vector<float>> data;
+        for (auto &item : rows) {
+            names.push_back((char *) item.first.c_str());
+            data.push_back(item.second);
+        }
+        std::string tmp_name = std::string(output_filename) + ".tmp";
+        if (write_image_data_csv((char *) tmp_name.c_str(), names, data) != 0) {
+            return -1;
+        }
+        FILE *tmp_fp = fopen(tmp_name.c_str(), "r");
+        if (!tmp_fp || fsync_and_close(tmp_fp) != 0 || rename(tmp_name.c_str(), output_filename) != 0) {
+            fprintf(stderr, "Error: Failed to replace '%s'\n", output_filename);
+            remove(tmp_name.c_str());
+            return -1;
+        }
+    }
+
+    if (write_manifest(manifest_file.c_str(), new_manifest, feature.name, describeDecode(feature.decode)) != 0) {
+        return -1;
+    }
+    printf("Incremental update: %d kept, %d new, %d changed, %d removed, %d failed\n",
+           kept, added, changed, deleted > 0 ? deleted : 0, failed);
     return 0;
 }
 
+/**
+ * @brief Sends SIGHUP to the query server whose pid is in pid_file, so it picks
+ *        up the rows that were just written.
+ */
+static void notify_server(const char *pid_file) {
+    if (pid_file == nullptr) return;
+    FILE *fp = fopen(pid_file, "r");
+    int pid = 0;
+    if (!fp || fscanf(fp, "%d", &pid) != 1 || pid <= 0) {
+        if (fp) fclose(fp);
+        printf("No server to notify in %s\n", pid_file);
+        return;
+    }
+    fclose(fp);
+    if (kill(pid, SIGHUP) != 0) {
+        printf("Can not notify server %d\n", pid);
+    }
+}
+
+/**
+ * @brief Extracts images that are not in the feature file yet, appends their
+ *        rows and then records them in the manifest, which is replaced
+ *        atomically. Images that fail are left out of the manifest so the next
+ *        batch retries them.
+ *
+ * @param paths New images, none of them in the manifest.
+ * @param output_filename Feature CSV to append to.
+ * @param manifest The manifest of the feature file, updated in place.
+ * @return number of images that failed, or -1 if the feature file or the manifest can not be written.
+ */
+static int append_new_images(const std::vector<std::string> &paths, char *output_filename, const FeatureInfo &feature,
+                             const PipelineOptions &options, Manifest &manifest) {
+    std::map<std::string, ManifestEntry> entries;
+    std::vector<std::string> to_extract;
+    int failed = 0;
+    for (const std::string &path : paths) {
+        ManifestEntry entry;
+        if (stat_file(path.c_str(), entry.size, entry.mtime) != 0 || hash_file_contents(path.c_str(), entry.hash) != 0) {
+            fprintf(stderr, "Error: cannot read '%s'\n", path.c_str());
+            failed++;
+            continue;
+        }
+        entries[path] = entry;
+        to_extract.push_back(path);
+    }
+
+    size_t next = 0;
+    bool write_failed = false;
+    std::vector<StageStats> stats;
+    run_extraction_pipeline(
+            [&](std::string &path) {
+                if (next >= to_extract.size()) return false;
+                path = to_extract[next++];
+                return true;
+            },
+            feature, options,
+            [&](const std::string &path, bool ok, std::vector<float> &features) {
+                if (!ok) {
+                    fprintf(stderr, "Error: Failed to extract features from '%s'\n", path.c_str());
+                    failed++;
+                    return 0;
+                }
+                INSTRUMENT_SCOPE("csv_write");
+                if (segment_writer.is_open() ? segment_writer.put(path.c_str(), features) != 0
+                                             : append_image_data_csv(output_filename, (char *) path.c_str(), features, 0) != 0) {
+                    fprintf(stderr, "Error: Failed to save features to '%s'\n", output_filename);
+                    write_failed = true;
+                    return -1;
+                }
+                printf("processing image file: %s\n", path.c_str());
+                manifest[path] = entries[path];
+                return 0;
+            },
+            stats);
+
+    // the rows are in place before the manifest names them
+    if (segment_writer.is_open() && segment_writer.sync() != 0) {
+        write_failed = true;
+    }
+    std::string manifest_file = std::string(output_filename) + ".manifest";
+    if (write_manifest(manifest_file.c_str(), manifest, feature.name, describeDecode(feature.decode)) != 0 ||
+        write_failed) {
+        return -1;
+    }
+    return failed;
+}
+
+/**
+ * @brief Watch mode: brings the feature file up to date, then keeps it up to
+ *        date as images arrive.
+ *
+ * The directory is watched with inotify for files that are closed after
+ * writing or moved in, and for files that are deleted or moved out. Events are
+ * gathered until the directory has been quiet for batch_ms, so an upload of
+ * many files is handled as one batch. A batch of only new images is extracted
+ * and appended; anything else (a changed or deleted image, or a lost event)
+ * runs the full incremental update. After each batch the query server named
+ * by notify_pid_file, if any, is told to pick up the new rows.
+ *
+ * @return non-zero failure; on success it does not return.
+ */
+static int watch_directory(char *dirname, char *output_filename, const FeatureInfo &feature,
+                           const PipelineOptions &options, int batch_ms, const char *notify_pid_file) {
+#ifndef __linux__
+    printf("--watch needs inotify, which this system does not have\n");
+    return -1;
+#else
+    if (update_features_incremental(dirname, output_filename, feature, options) != 0) {
+        return -1;
+    }
+    notify_server(notify_pid_file);
+
+    std::string manifest_file = std::string(output_filename) + ".manifest";
+    Manifest manifest;
+    std::string manifest_feature, manifest_decode;
+    if (read_manifest(manifest_file.c_str(), manifest, manifest_feature, manifest_decode) != 0) {
+        return -1;
+    }
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dirname, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0) {
+        printf("Cannot watch directory %s: %s\n", dirname, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    printf("Watching %s for new images\n", dirname);
+    fflush(stdout);
+
+    alignas(struct inotify_event) char events[64 * 1024];
+    for (;;) {
+        // block for the first event, then gather more until the directory is quiet
+        std::set<std::string> touched;
+        bool overflow = false;
+        int timeout = -1;
+        for (;;) {
+            struct pollfd watch = {fd, POLLIN, 0};
+            int ready = poll(&watch, 1, timeout);
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready <= 0) break;
+            ssize_t length = read(fd, events, sizeof(events));
+            if (length <= 0) break;
+            for (char *p = events; p < events + length;) {
+                const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+                if (event->mask & IN_Q_OVERFLOW) {
+                    overflow = true;
+                } else if (event->len > 0 && is_image_file(event->name)) {
+                    std::string path = std::string(dirname) + event->name;
+                    if (in_selected_shard(path.c_str())) touched.insert(path);
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+            timeout = batch_ms;
+        }
+
+        // only new images can be appended, and not to a sorted binary store; anything else rewrites the file
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::string> added;
+        bool rewrite = overflow;
+        for (const std::string &path : touched) {
+            ManifestEntry entry;
+            auto known = manifest.find(path);
+            if (stat_file(path.c_str(), entry.size, entry.mtime) != 0) {
+                if (known != manifest.end()) rewrite = true;
+            } else if (known == manifest.end()) {
+                added.push_back(path);
+            } else if (known->second.size != entry.size || known->second.mtime != entry.mtime) {
+                rewrite = true;
+            }
+        }
+        if (!added.empty() && is_store_output(output_filename) && !segment_writer.is_open()) {
+            rewrite = true;
+        }
+        int status = 0;
+        if (rewrite) {
+            status = update_features_incremental(dirname, output_filename, feature, options);
+            if (status == 0) status = read_manifest(manifest_file.c_str(), manifest, manifest_feature, manifest_decode);
+        } else if (!added.empty()) {
+            status = append_new_images(added, output_filename, feature, options, manifest) < 0 ? -1 : 0;
+        } else {
+            continue;
+        }
+        if (status != 0) {
+            fprintf(stderr, "Error: Failed to update '%s'\n", output_filename);
+            close(fd);
+            return -1;
+        }
+        printf("Ingested a batch of %zu files in %.2f s\n", rewrite ? touched.size() : added.size(),
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        notify_server(notify_pid_file);
+        fflush(stdout);
+    }
+#endif
+}
 
 /**
  * @brief Main function to process a directory of image files and extract their features.
@@ -72,60 +581,129 @@ int main(int argc, char *argv[]) {
     FILE *fp;
     DIR *dirp;
     struct dirent *dp;
+    PipelineOptions options;
+
+    // --stats and --trace may appear anywhere
+    if (parse_instrument_options(argc, argv) != 0) {
+        exit(-1);
+    }
 
     // check for sufficient arguments
     if (argc < 4) {
-        printf("usage: %s <directory path> <output filename> <feature type>\n", argv[0]);
+        printf("usage: %s <directory path> <output filename> <feature type> [--incremental] [--cache <dir>] [--full-decode] [--threads <n>] [--io-threads <n>] [--queue-depth <n>] [--thumbnails <pack>] [--thumb <W>x<H>] [--shard <i>/<n>] [--watch] [--batch-ms <n>] [--notify <pid file>] [--stats] [--trace <file>]\n", argv[0]);
         printf("Feature types:\n");
-        printf("1: 7x7 square\n");
-        printf("2: RGB histogram\n");
-        printf("3: Multi histogram\n");
-        printf("4: Texture color\n");
-        printf("8: Face value from DA2\n");
-        printf("7: Depth value from DA2\n");
-        printf("9: Banana\n");
+        for (const FeatureInfo *info : list_features()) {
+            printf("%d (%s): %s\n", info->id, info->name.c_str(), info->description.c_str());
+        }
+        printf("--incremental: only extract new or changed images, using <output filename>.manifest\n");
+        printf("An output filename ending in .lsm is a segment store, always updated incrementally with puts and deletes\n");
+        printf("An output filename ending in .bin is a binary feature store, sorted by file name\n");
+        printf("--cache <dir>: reuse DA2 depth maps and face boxes cached in <dir>\n");
+        printf("--full-decode: decode every image at full resolution (histogram features use 1/2-1/4 scale by default)\n");
+        printf("--threads <n>: decode and feature threads each (default: all cores)\n");
+        printf("--io-threads <n>: concurrent file reads (default: 4)\n");
+        printf("--queue-depth <n>: images buffered between pipeline stages (default: 16)\n");
+        printf("--thumbnails <pack>: also pack a thumbnail of every image, for Proj2-TopN_finding --thumbnails\n");
+        printf("--thumb <W>x<H>: thumbnail box of a new pack (default: 200x150)\n");
+        printf("--watch: update incrementally, then keep watching the directory and add new images as they arrive\n");
+        printf("--batch-ms <n>: with --watch, wait until the directory is quiet this long before a batch (default: 500)\n");
+        printf("--notify <pid file>: after each update, send SIGHUP to the server started with --pid-file\n");
+        printf("--shard <i>/<n>: the output is a shard manifest; build only shard i of n (created with n hash shards if missing)\n");
+        printf("--stats: print time spent per stage (read, decode, extract, DA2, CSV write, ...) on exit\n");
+        printf("--trace <file>: write a Chrome trace-event JSON of every timed span\n");
         exit(-1);
     }
 
-    FeatureType feature_type;
-    switch (atoi(argv[3])) {
-        case 1:
-            feature_type = FeatureType::SQUARE_7X7;
-            printf("Using 7x7 square feature\n");
-            break;
-        case 2:
-            feature_type = FeatureType::RGB_HISTOGRAM;
-            printf("Using RGB histogram feature\n");
-            break;
-        case 3:
-            feature_type = FeatureType::MULTI_HISTOGRAM;
-            printf("Using multi histogram feature\n");
-            break;
-        case 4:
-            feature_type = FeatureType::TEXTURE_COLOR;
-            printf("Using texture color feature\n");
-            break;
-        case 7:
-            feature_type = FeatureType::DEPTH;
-            printf("Using Depth vector feature\n");
-            break;
-        case 8:
-            feature_type = FeatureType::FACE;
-            printf("Using Face vector feature\n");
-        case 9:
-            feature_type = FeatureType::BANANA;
-            printf("Using Banana feature\n");
-            break;
-        default:
-            printf("Invalid feature type. Please select 1, 2, 3 or 4, 7, 8, 9\n");
-            exit(-1);
+    // by number or by registry name, e.g. 4 or texture-color
+    const FeatureInfo *feature = isdigit((unsigned char) argv[3][0]) ? find_feature(atoi(argv[3]))
+                                                                     : find_feature(std::string(argv[3]));
+    if (feature == nullptr) {
+        printf("Invalid feature type %s. Please select one of:", argv[3]);
+        for (const FeatureInfo *info : list_features()) {
+            printf(" %d", info->id);
+        }
+        printf("\n");
+        exit(-1);
     }
-
+    printf("Using %s feature\n", feature->description.c_str());
 
     // get the directory path
     strcpy(dirname, argv[1]);
     printf("Processing directory %s\n", dirname );
 
+    // optional flags after the feature type
+    bool incremental = false;
+    const char *thumbnail_pack = nullptr;
+    const char *shard_spec = nullptr;
+    bool watch = false;
+    int batch_ms = 500;
+    const char *notify_pid_file = nullptr;
+    int thumb_width = 200, thumb_height = 150;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--incremental") == 0) {
+            incremental = true;
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            if (setResultCacheDir(argv[++i]) != 0) {
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--full-decode") == 0) {
+            setDecodeMode(DecodeMode::FULL);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.decode_threads = options.feature_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--io-threads") == 0 && i + 1 < argc) {
+            options.io_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--queue-depth") == 0 && i + 1 < argc) {
+            options.queue_depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--thumbnails") == 0 && i + 1 < argc) {
+            thumbnail_pack = argv[++i];
+        } else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+            shard_spec = argv[++i];
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch = true;
+        } else if (strcmp(argv[i], "--batch-ms") == 0 && i + 1 < argc) {
+            batch_ms = atoi(argv[++i]);
+            if (batch_ms < 0) {
+                printf("Invalid batch delay: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--notify") == 0 && i + 1 < argc) {
+            notify_pid_file = argv[++i];
+        } else if (strcmp(argv[i], "--thumb") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &thumb_width, &thumb_height) != 2 || thumb_width <= 0 ||
+                thumb_height <= 0) {
+                printf("Invalid thumbnail size: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            exit(-1);
+        }
+    }
+    if (thumbnail_pack) {
+        if (setThumbnailPack(thumbnail_pack, true, thumb_width, thumb_height) != 0) {
+            exit(-1);
+        }
+        options.thumbnails = true;
+    }
+    // with --shard, argv[2] names the shard manifest and the rows go to one shard file
+    std::string output_path = argv[2];
+    if (shard_spec && select_shard(argv[2], shard_spec, output_path) != 0) {
+        exit(-1);
+    }
+    if (watch) {
+        return watch_directory(dirname, (char *) output_path.c_str(), *feature, options, batch_ms, notify_pid_file) == 0
+               ? 0 : -1;
+    }
+    // a segment store is always updated in place
+    if (incremental || is_segment_store_path(output_path.c_str())) {
+        int status = update_features_incremental(dirname, (char *) output_path.c_str(), *feature, options);
+        if (segment_writer.is_open() && segment_writer.close() != 0) {
+            status = -1;
+        }
+        notify_server(notify_pid_file);
+        return status == 0 ? 0 : -1;
+    }
+
     // open the directory
     dirp = opendir( dirname );
     if( dirp == NULL) {
@@ -133,30 +711,78 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
     // Validate the output file name
-    char* output_file = argv[2];
+    char* output_file = (char *) output_path.c_str();
     if (strlen(output_file) == 0) {
         fprintf(stderr, "Error: Output CSV file name is invalid.\n");
         return -1;
     }
 
-    // loop over all the files in the image file listing
-    while( (dp = readdir(dirp)) != NULL ) {
+    // A .bin output is a binary feature store, flagged as sorted
+    bool binary = is_store_output(output_file);
+    FeatureStoreWriter store;
+    fp = binary ? nullptr : fopen(output_file, "w");
+    if (!binary && !fp) {
+        printf("Unable to open output file %s\n", output_file);
+        exit(-1);
+    }
 
+    // list the images in name order; the writer stage restores this order, so the rows come out sorted
+    std::vector<std::string> paths;
+    while ((dp = readdir(dirp)) != NULL) {
         // check if the file is an image
-        if( strstr(dp->d_name, ".jpg") ||
-            strstr(dp->d_name, ".png") ||
-            strstr(dp->d_name, ".ppm") ||
-            strstr(dp->d_name, ".tif") ) {
-
-            printf("processing image file: %s\n", dp->d_name);
-
+        if (is_image_file(dp->d_name)) {
             // build the overall filename
             strcpy(buffer, dirname);
             strcat(buffer, dp->d_name);
+            if (!in_selected_shard(buffer)) continue;
+            paths.push_back(buffer);
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    size_t next = 0;
+    PathSource next_image = [&](std::string &path) {
+        if (next >= paths.size()) return false;
+        path = paths[next++];
+        return true;
+    };
+    FeatureSink write_row = [&](const std::string &path, bool ok, std::vector<float> &features) {
+        if (!ok) {
+            fprintf(stderr, "Error: Failed to extract features from '%s'\n", path.c_str());
+            return 0;
+        }
+        printf("processing image file: %s\n", path.c_str());
+        INSTRUMENT_SCOPE("csv_write");
+        int status;
+        if (binary) {
+            // the store is opened with the length of the first row
+            status = store.rows() == 0 && store.open(output_file, static_cast<int>(features.size()),
+                                                     FEATURE_STORE_SORTED) != 0
+                     ? -1 : store.append(path.c_str(), features.data());
+        } else {
+            status = write_image_data_row(fp, path.c_str(), features);
+        }
+        if (status != 0) {
+            fprintf(stderr, "Error: Failed to save features to '%s'\n", output_file);
+            return -1;
+        }
+        return 0;
+    };
 
-            printf("full path name: %s\n", buffer);
-            extract_and_save_features(buffer, getFeatureFunction(feature_type), output_file);
+    std::vector<StageStats> stats;
+    auto start = std::chrono::steady_clock::now();
+    int result = run_extraction_pipeline(next_image, *feature, options, write_row, stats);
+    closedir(dirp);
+    if (binary) {
+        // an empty directory still gets a valid, empty store
+        if ((store.rows() == 0 && store.open(output_file, 1, FEATURE_STORE_SORTED) != 0) || store.close() != 0) {
+            result = -1;
         }
+    } else if (fclose(fp) != 0) {
+        result = -1;
+    }
+    print_pipeline_stats(stats, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    if (result != 0) {
+        exit(-1);
     }
 
     printf("Terminating\n");
@@ -0,0 +1,142 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 26, 2025
+ * Purpose: Weighted fusion of normalized distances over several feature stores
+ */
+
+#include "../include/fusion.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+// Rows scored per block; the block's distances and scores stay in L1
+static const int FUSION_BLOCK = 256;
+
+// Target rows sampled when estimating the distance distribution of a term
+static const int FUSION_SAMPLE_TARGETS = 32;
+
+/**
+ * @brief Samples distances between rows of each term's store and records their
+ *        mean, standard deviation and quantiles for the normalization.
+ */
+int prepare_fusion_stats(std::vector<FusionTerm> &terms, int max_pairs) {
+    if (terms.empty() || terms[0].store == nullptr || terms[0].store->rows < 2) {
+        fprintf(stderr, "Error: fusion needs at least two rows\n");
+        return -1;
+    }
+    const int rows = terms[0].store->rows;
+    for (FusionTerm &term : terms) {
+        if (term.store == nullptr || term.store->rows != rows) {
+            fprintf(stderr, "Error: %s does not line up with the other stores\n", term.name.c_str());
+            return -1;
+        }
+
+        // evenly spaced targets against a strided subset of the rows
+        int targets = std::min(rows, FUSION_SAMPLE_TARGETS);
+        long budget = std::max(max_pairs, targets);
+        int stride = static_cast<int>(std::max(1L, static_cast<long>(targets) * rows / budget));
+        std::vector<float> samples;
+        samples.reserve(static_cast<size_t>(targets) * (rows / stride + 1));
+        for (int t = 0; t < targets; t++) {
+            int target = static_cast<int>(static_cast<long>(t) * rows / targets);
+            for (int r = t % stride; r < rows; r += stride) {
+                if (r == target) continue;
+                samples.push_back(batch_pair_distance(term.metric, term.segments, term.store->row(r),
+                                                      term.store->row(target), term.store->cols));
+            }
+        }
+        if (samples.empty()) return -1;
+
+        double sum = 0.0, sum_sq = 0.0;
+        for (float d : samples) {
+            sum += d;
+            sum_sq += static_cast<double>(d) * d;
+        }
+        double mean = sum / samples.size();
+        double variance = std::max(0.0, sum_sq / samples.size() - mean * mean);
+        term.mean = static_cast<float>(mean);
+        term.stddev = variance > 0.0 ? static_cast<float>(std::sqrt(variance)) : 1.0f;
+
+        std::sort(samples.begin(), samples.end());
+        term.quantiles.resize(FUSION_QUANTILES + 1);
+        for (int k = 0; k <= FUSION_QUANTILES; k++) {
+            term.quantiles[k] = samples[static_cast<size_t>(k) * (samples.size() - 1) / FUSION_QUANTILES];
+        }
+    }
+    return 0;
+}
+
+// Fraction of the sampled distances below d, interpolated between quantiles
+static float rank_of(const std::vector<float> &quantiles, float d) {
+    auto it = std::upper_bound(quantiles.begin(), quantiles.end(), d);
+    if (it == quantiles.begin()) return 0.0f;
+    if (it == quantiles.end()) return 1.0f;
+    int k = static_cast<int>(it - quantiles.begin());
+    float lo = quantiles[k - 1], hi = quantiles[k];
+    float within = hi > lo ? (d - lo) / (hi - lo) : 0.0f;
+    return (k - 1 + within) / FUSION_QUANTILES;
+}
+
+/**
+ * @brief Ranks the rows by the weighted sum of normalized term distances.
+ */
+int fusion_find_topN(const std::vector<FusionTerm> &terms, const std::vector<const float *> &targets,
+                     const std::vector<double> &weights, int target_index, int N, FusionScratch &scratch,
+                     std::vector<std::pair<float, int>> &result) {
+    result.clear();
+    if (terms.empty() || targets.size() != terms.size() || (!weights.empty() && weights.size() != terms.size())) {
+        fprintf(stderr, "Error: fusion got %zu targets and %zu weights for %zu terms\n", targets.size(),
+                weights.size(), terms.size());
+        return -1;
+    }
+    for (const FusionTerm &term : terms) {
+        if (term.norm == FusionNorm::RANK && term.quantiles.empty()) {
+            fprintf(stderr, "Error: %s has no statistics, call prepare_fusion_stats\n", term.name.c_str());
+            return -1;
+        }
+    }
+    const int rows = terms[0].store->rows;
+    scratch.distances.resize(FUSION_BLOCK);
+    scratch.scores.resize(FUSION_BLOCK);
+    scratch.best.reset(N);
+    float *distances = scratch.distances.data();
+    float *scores = scratch.scores.data();
+
+    for (int r0 = 0; r0 < rows; r0 += FUSION_BLOCK) {
+        const int count = std::min(FUSION_BLOCK, rows - r0);
+        std::fill(scores, scores + count, 0.0f);
+
+        for (size_t t = 0; t < terms.size(); t++) {
+            const FusionTerm &term = terms[t];
+            const float weight = static_cast<float>(weights.empty() ? term.weight : weights[t]);
+            if (weight == 0.0f) continue;
+            for (int r = 0; r < count; r++) {
+                distances[r] = batch_pair_distance(term.metric, term.segments, term.store->row(r0 + r), targets[t],
+                                                   term.store->cols);
+            }
+            // straight-line loops over the block so the compiler can vectorize them
+            if (term.norm == FusionNorm::ZSCORE) {
+                const float scale = weight / term.stddev;
+                const float shift = term.mean;
+                for (int r = 0; r < count; r++) {
+                    scores[r] += (distances[r] - shift) * scale;
+                }
+            } else if (term.norm == FusionNorm::RANK) {
+                for (int r = 0; r < count; r++) {
+                    scores[r] += weight * rank_of(term.quantiles, distances[r]);
+                }
+            } else {
+                for (int r = 0; r < count; r++) {
+                    scores[r] += weight * distances[r];
+                }
+            }
+        }
+
+        for (int r = 0; r < count; r++) {
+            if (r0 + r == target_index) continue;
+            scratch.best.push(scores[r], r0 + r);
+        }
+    }
+    scratch.best.sorted(result);
+    return 0;
+}
@@ -0,0 +1,294 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 24, 2025
+ * Purpose: Histogram kernels specialized at compile time on channel and bin
+ * counts, so binning is a constant shift and loop bounds are known
+ */
+
+#include "../include/histogram_kernels.h"
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+
+// Cell of one pixel; the last channel (R for BGR) is the most significant digit
+template <int Channels, int Bins>
+static inline int cellOf(const uchar *pixel) {
+    constexpr int SHIFT = binShift<Bins>();
+    int cell = 0;
+    for (int c = Channels - 1; c >= 0; c--) {
+        cell = cell * Bins + (pixel[c] >> SHIFT);
+    }
+    return cell;
+}
+
+/**
+ * @brief Joint histogram of an 8-bit image, normalized to sum to 1.
+ *
+ * Counts go to integer cells and are scaled once at the end, so the inner loop
+ * is a shift, a multiply-add per channel and an increment.
+ */
+template <int Channels, int Bins>
+int computeHistogram(const cv::Mat &image, const cv::Mat &mask, float *hist) {
+    constexpr int CELLS = histogramSize(Channels, Bins);
+    if (image.depth() != CV_8U || image.channels() != Channels) {
+        return -1;
+    }
+    uint32_t counts[CELLS] = {0};
+    int total = 0;
+    for (int i = 0; i < image.rows; i++) {
+        const uchar *pixel = image.ptr<uchar>(i);
+        if (mask.empty()) {
+            for (int j = 0; j < image.cols; j++, pixel += Channels) {
+                counts[cellOf<Channels, Bins>(pixel)]++;
+            }
+            total += image.cols;
+        } else {
+            const uchar *keep = mask.ptr<uchar>(i);
+            for (int j = 0; j < image.cols; j++, pixel += Channels) {
+                if (keep[j] == 0) continue;
+                counts[cellOf<Channels, Bins>(pixel)]++;
+                total++;
+            }
+        }
+    }
+    if (total > 0) {
+        for (int k = 0; k < CELLS; k++) {
+            hist[k] = static_cast<float>(counts[k]) / static_cast<float>(total);
+        }
+    } else {
+        std::fill(hist, hist + CELLS, 0.0f);
+    }
+    return total;
+}
+
+std::vector<HistogramRegion> gridRegions(cv::Size size, int rows, int cols) {
+    std::vector<HistogramRegion> regions;
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            int x0 = size.width * c / cols, x1 = size.width * (c + 1) / cols;
+            int y0 = size.height * r / rows, y1 = size.height * (r + 1) / rows;
+            regions.push_back({cv::Rect(x0, y0, x1 - x0, y1 - y0), cv::Rect()});
+        }
+    }
+    return regions;
+}
+
+std::vector<HistogramRegion> centerSurroundRegions(cv::Size size) {
+    cv::Rect center(size.width / 4, size.height / 4, size.width * 3 / 4 - size.width / 4,
+                    size.height * 3 / 4 - size.height / 4);
+    return {{center, cv::Rect()}, {cv::Rect(0, 0, size.width, size.height), center}};
+}
+
+// Rows a band of computeRegionHistograms gets at the least; smaller bands cost more to merge than they save
+static const int MIN_BAND_ROWS = 64;
+
+/**
+ * @brief Region histograms from one pass over the pixels.
+ *
+ * Each thread bins a band of rows into its own tile counts, so no counter is
+ * shared. The bands are added up, then summed over the tiles into an integral
+ * histogram. Counts stay integers until a region is normalized, the same
+ * division computeHistogram does.
+ */
+template <int Channels, int Bins>
+int computeRegionHistograms(const cv::Mat &image, const std::vector<HistogramRegion> &regions, float *hist,
+                            int threads) {
+    constexpr int CELLS = histogramSize(Channels, Bins);
+    if (image.depth() != CV_8U || image.channels() != Channels) {
+        return -1;
+    }
+    std::fill(hist, hist + regions.size() * CELLS, 0.0f);
+    if (image.empty()) {
+        return 0;
+    }
+
+    // tile edges: the image border and the edges of every region and hole
+    cv::Rect bounds(0, 0, image.cols, image.rows);
+    std::vector<int> xs = {0, image.cols}, ys = {0, image.rows};
+    for (const HistogramRegion &region : regions) {
+        for (cv::Rect rect : {region.area & bounds, region.hole & region.area & bounds}) {
+            if (rect.empty()) continue;
+            xs.push_back(rect.x);
+            xs.push_back(rect.x + rect.width);
+            ys.push_back(rect.y);
+            ys.push_back(rect.y + rect.height);
+        }
+    }
+    std::sort(xs.begin(), xs.end());
+    xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+    std::sort(ys.begin(), ys.end());
+    ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+    int tiles_x = static_cast<int>(xs.size()) - 1, tiles_y = static_cast<int>(ys.size()) - 1;
+
+    // offset of each row's first tile in the tile counts
+    std::vector<int> y_offset(image.rows);
+    for (int t = 0; t < tiles_y; t++) {
+        std::fill(y_offset.begin() + ys[t], y_offset.begin() + ys[t + 1], t * tiles_x * CELLS);
+    }
+
+    size_t tile_cells = static_cast<size_t>(tiles_x) * tiles_y * CELLS;
+    if (threads <= 0) threads = static_cast<int>(std::thread::hardware_concurrency());
+    threads = std::max(1, std::min(threads, image.rows / MIN_BAND_ROWS));
+    std::vector<std::vector<uint32_t>> counts(threads, std::vector<uint32_t>(tile_cells, 0));
+    auto bin_band = [&](int band) {
+        uint32_t *band_counts = counts[band].data();
+        int end = static_cast<int>(static_cast<int64_t>(image.rows) * (band + 1) / threads);
+        for (int i = static_cast<int>(static_cast<int64_t>(image.rows) * band / threads); i < end; i++) {
+            const uchar *pixel = image.ptr<uchar>(i);
+            // a row crosses its tiles left to right, so each span bins into one tile
+            for (int t = 0; t < tiles_x; t++) {
+                uint32_t *tile_counts = band_counts + y_offset[i] + t * CELLS;
+                for (int j = xs[t]; j < xs[t + 1]; j++, pixel += Channels) {
+                    tile_counts[cellOf<Channels, Bins>(pixel)]++;
+                }
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int band = 1; band < threads; band++) {
+        workers.emplace_back(bin_band, band);
+    }
+    bin_band(0);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    std::vector<uint32_t> &tiles = counts[0];
+    for (int band = 1; band < threads; band++) {
+        for (size_t k = 0; k < tile_cells; k++) tiles[k] += counts[band][k];
+    }
+
+    // sums at corner (x, y) count every tile above and left of it
+    int stride = tiles_x + 1;
+    std::vector<uint32_t> sums(static_cast<size_t>(stride) * (tiles_y + 1) * CELLS, 0);
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            const uint32_t *tile = &tiles[(static_cast<size_t>(ty) * tiles_x + tx) * CELLS];
+            const uint32_t *up = &sums[(static_cast<size_t>(ty) * stride + tx + 1) * CELLS];
+            const uint32_t *left = &sums[(static_cast<size_t>(ty + 1) * stride + tx) * CELLS];
+            const uint32_t *diagonal = &sums[(static_cast<size_t>(ty) * stride + tx) * CELLS];
+            uint32_t *sum = &sums[(static_cast<size_t>(ty + 1) * stride + tx + 1) * CELLS];
+            for (int k = 0; k < CELLS; k++) {
+                sum[k] = tile[k] + up[k] + left[k] - diagonal[k];
+            }
+        }
+    }
+    auto corner = [&](int x, int y) {
+        size_t tx = std::lower_bound(xs.begin(), xs.end(), x) - xs.begin();
+        size_t ty = std::lower_bound(ys.begin(), ys.end(), y) - ys.begin();
+        return &sums[(ty * stride + tx) * CELLS];
+    };
+    // adds sign times the counts of rect; unsigned wraparound cancels out once the hole is taken away
+    auto add_rect = [&](const cv::Rect &rect, uint32_t sign, uint32_t *region_counts) {
+        if (rect.empty()) return;
+        const uint32_t *a = corner(rect.x, rect.y), *b = corner(rect.x + rect.width, rect.y);
+        const uint32_t *c = corner(rect.x, rect.y + rect.height);
+        const uint32_t *d = corner(rect.x + rect.width, rect.y + rect.height);
+        for (int k = 0; k < CELLS; k++) {
+            region_counts[k] += sign * (d[k] - b[k] - c[k] + a[k]);
+        }
+    };
+
+    for (size_t r = 0; r < regions.size(); r++) {
+        cv::Rect area = regions[r].area & bounds;
+        uint32_t region_counts[CELLS] = {0};
+        add_rect(area, 1u, region_counts);
+        add_rect(regions[r].hole & area, ~0u, region_counts);
+        int64_t total = 0;
+        for (int k = 0; k < CELLS; k++) total += region_counts[k];
+        if (total > 0) {
+            float *region_hist = hist + r * CELLS;
+            for (int k = 0; k < CELLS; k++) {
+                region_hist[k] = static_cast<float>(region_counts[k]) / static_cast<float>(total);
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Spatial blob histogram in one pass over the label image.
+ *
+ * Column and row bins come from small tables computed with the same float
+ * widths as before, so the cells match the old per-blob rescans exactly.
+ */
+template <int SpatialBins, int SizeBins>
+int computeBlobHistogram(const cv::Mat &labels, const std::vector<int> &size_bin_of_label, float *hist) {
+    constexpr int CELLS = SpatialBins * SpatialBins * SizeBins;
+    uint32_t counts[CELLS] = {0};
+
+    float x_bin_width = static_cast<float>(labels.cols) / SpatialBins;
+    float y_bin_width = static_cast<float>(labels.rows) / SpatialBins;
+    std::vector<int> x_bin(labels.cols);
+    for (int x = 0; x < labels.cols; x++) {
+        x_bin[x] = std::min(static_cast<int>(x / x_bin_width), SpatialBins - 1);
+    }
+    int labels_known = static_cast<int>(size_bin_of_label.size());
+
+    int total = 0;
+    for (int y = 0; y < labels.rows; y++) {
+        const int *label = labels.ptr<int>(y);
+        int row_offset = std::min(static_cast<int>(y / y_bin_width), SpatialBins - 1) * SpatialBins;
+        for (int x = 0; x < labels.cols; x++) {
+            int l = label[x];
+            if (l <= 0 || l >= labels_known) continue;
+            int size_bin = size_bin_of_label[l];
+            if (size_bin < 0) continue;
+            counts[x_bin[x] + row_offset + size_bin * SpatialBins * SpatialBins]++;
+            total++;
+        }
+    }
+    for (int k = 0; k < CELLS; k++) {
+        hist[k] = static_cast<float>(counts[k]);
+    }
+    return total;
+}
+
+// Sum of element-wise minimums of two N-value histograms
+template <int N>
+float histogramIntersectionFixed(const float *hist1, const float *hist2) {
+    float intersection = 0.0f;
+    for (int i = 0; i < N; i++) {
+        intersection += std::min(hist1[i], hist2[i]);
+    }
+    return intersection;
+}
+
+int colorHistogram(const cv::Mat &image, const cv::Mat &mask, std::vector<float> &hist, int bins) {
+    switch (bins) {
+        case 8:
+            hist.assign(histogramSize(3, 8), 0.0f);
+            return computeHistogram<3, 8>(image, mask, hist.data()) < 0 ? -1 : 0;
+        case 16:
+            hist.assign(histogramSize(3, 16), 0.0f);
+            return computeHistogram<3, 16>(image, mask, hist.data()) < 0 ? -1 : 0;
+        default:
+            return -1;
+    }
+}
+
+int grayHistogram(const cv::Mat &image, const cv::Mat &mask, std::vector<float> &hist, int bins) {
+    switch (bins) {
+        case 8:
+            hist.assign(8, 0.0f);
+            return computeHistogram<1, 8>(image, mask, hist.data()) < 0 ? -1 : 0;
+        case 16:
+            hist.assign(16, 0.0f);
+            return computeHistogram<1, 16>(image, mask, hist.data()) < 0 ? -1 : 0;
+        default:
+            return -1;
+    }
+}
+
+// Shipped configurations: 8-bin RGB (rgb-hist, multi-hist, texture-color, depth,
+// face), 16-bin RGB, 8- and 16-bin gradient magnitude, the 4x4x4 banana blobs,
+// and the intersection lengths those produce; 8-bin RGB region grids (multi-hist, grid-*,
+// center-surround)
+template int computeHistogram<3, 8>(const cv::Mat &, const cv::Mat &, float *);
+template int computeHistogram<3, 16>(const cv::Mat &, const cv::Mat &, float *);
+template int computeHistogram<1, 8>(const cv::Mat &, const cv::Mat &, float *);
+template int computeHistogram<1, 16>(const cv::Mat &, const cv::Mat &, float *);
+template int computeRegionHistograms<3, 8>(const cv::Mat &, const std::vector<HistogramRegion> &, float *, int);
+template int computeBlobHistogram<4, 4>(const cv::Mat &, const std::vector<int> &, float *);
+template float histogramIntersectionFixed<512>(const float *, const float *);
+template float histogramIntersectionFixed<16>(const float *, const float *);
+template float histogramIntersectionFixed<8>(const float *, const float *);
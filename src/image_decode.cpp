@@ -0,0 +1,148 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 18, 2025
+ * Purpose: Decode-policy layer: load images at the lowest resolution a feature
+ * can tolerate, using libjpeg DCT scaling (IMREAD_REDUCED_COLOR_2/4/8)
+ */
+
+#include "../include/image_decode.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+static DecodeMode decode_mode = DecodeMode::REDUCED;
+
+void setDecodeMode(DecodeMode mode) {
+    decode_mode = mode;
+}
+
+DecodeMode getDecodeMode() {
+    return decode_mode;
+}
+
+std::string describeDecode(const DecodePolicy &policy) {
+    if (decode_mode == DecodeMode::FULL || policy.max_scale <= 1) {
+        return "full";
+    }
+    return "1/" + std::to_string(policy.max_scale) + ",min=" + std::to_string(policy.min_side);
+}
+
+/*
+  Walks the JPEG marker segments up to the first start-of-frame marker, which
+  holds the image height and width. PNG keeps them in the IHDR chunk at a fixed
+  offset.
+ */
+int readImageSize(const unsigned char *data, size_t length, int &width, int &height) {
+    static const unsigned char png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    if (length >= 24 && memcmp(data, png_signature, 8) == 0) {
+        width = (data[16] << 24) | (data[17] << 16) | (data[18] << 8) | data[19];
+        height = (data[20] << 24) | (data[21] << 16) | (data[22] << 8) | data[23];
+        return 0;
+    }
+    if (length < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return -1;
+    }
+    size_t pos = 2;
+    while (pos + 4 <= length) {
+        if (data[pos] != 0xFF) return -1;
+        unsigned char marker = data[pos + 1];
+        if (marker == 0xFF) { // fill byte
+            pos++;
+            continue;
+        }
+        size_t segment = (data[pos + 2] << 8) | data[pos + 3];
+        // SOF0..SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (pos + 9 > length) return -1;
+            height = (data[pos + 5] << 8) | data[pos + 6];
+            width = (data[pos + 7] << 8) | data[pos + 8];
+            return 0;
+        }
+        if (marker == 0xDA) return -1; // start of scan without a frame header
+        pos += 2 + segment;
+    }
+    return -1;
+}
+
+int readImageSize(const char *filename, int &width, int &height) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return -1;
+    // EXIF blocks can be up to 64 KB, so read enough to get past one
+    std::vector<unsigned char> head(128 * 1024);
+    size_t n = fread(head.data(), 1, head.size(), fp);
+    fclose(fp);
+    return readImageSize(head.data(), n, width, height);
+}
+
+/**
+ * @brief Picks the largest power-of-two scale (up to policy.max_scale) that keeps
+ *        the shorter side at or above policy.min_side. Returns 1 in FULL mode.
+ */
+int chooseDecodeScale(int width, int height, const DecodePolicy &policy) {
+    if (decode_mode == DecodeMode::FULL || width <= 0 || height <= 0) {
+        return 1;
+    }
+    int shorter = std::min(width, height);
+    int scale = 1;
+    while (scale * 2 <= policy.max_scale && scale * 2 <= 8 && shorter / (scale * 2) >= policy.min_side) {
+        scale *= 2;
+    }
+    return scale;
+}
+
+int chooseThumbnailScale(int image_width, int image_height, int width, int height) {
+    if (image_width <= 0 || image_height <= 0) {
+        return 1;
+    }
+    double fit = std::max(std::min(width / (double) image_width, height / (double) image_height),
+                          std::min(width / (double) image_height, height / (double) image_width));
+    int scale = 1;
+    while (scale * 2 <= 8 && fit * scale * 2 <= 1.0) {
+        scale *= 2;
+    }
+    return scale;
+}
+
+// cv::imread / cv::imdecode flags for a 3-channel decode at 1/scale resolution
+int imreadFlagsForScale(int scale) {
+    switch (scale) {
+        case 2:
+            return cv::IMREAD_REDUCED_COLOR_2;
+        case 4:
+            return cv::IMREAD_REDUCED_COLOR_4;
+        case 8:
+            return cv::IMREAD_REDUCED_COLOR_8;
+        default:
+            return cv::IMREAD_COLOR;
+    }
+}
+
+/**
+ * @brief Loads a color image at the resolution allowed by a policy.
+ *
+ * @return the image, empty on failure.
+ */
+cv::Mat loadImage(const char *filename, const DecodePolicy &policy) {
+    int scale = 1;
+    int width, height;
+    if (policy.max_scale > 1 && decode_mode != DecodeMode::FULL &&
+        readImageSize(filename, width, height) == 0) {
+        scale = chooseDecodeScale(width, height, policy);
+    }
+    return cv::imread(filename, imreadFlagsForScale(scale));
+}
+
+/**
+ * @brief Decodes an in-memory encoded image at the resolution allowed by a policy.
+ *
+ * @return the image, empty on failure.
+ */
+cv::Mat decodeImage(const std::vector<unsigned char> &bytes, const DecodePolicy &policy) {
+    int scale = 1;
+    int width, height;
+    if (policy.max_scale > 1 && decode_mode != DecodeMode::FULL &&
+        readImageSize(bytes.data(), bytes.size(), width, height) == 0) {
+        scale = chooseDecodeScale(width, height, policy);
+    }
+    return cv::imdecode(bytes, imreadFlagsForScale(scale));
+}
@@ -1,13 +1,27 @@
 /*
  * Authors: Yuyang Tian and Arun Mekkad
  * Date: January 26, 2025
- * Purpose: Display the image given a list of vectors
+ * Purpose: Display the image given a list of vectors, or render it to a file
  */
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include <iostream>
-// Displays all images in a single gallery window
-void displayGallery(const std::vector<char*>& filenames) {
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "../include/image_display_util.h"
+#include "../include/image_decode.h"
+#include "../include/manifest.h"
+#include "../include/thumbnail_pack.h"
+#include "../include/instrument.h"
+// Loads the images and places them side by side on one canvas
+static cv::Mat composeGallery(const std::vector<char*>& filenames) {
+    INSTRUMENT_SCOPE("display");
     std::vector<cv::Mat> images;
     int total_width = 0, max_height = 0;
 
@@ -31,6 +45,29 @@ void displayGallery(const std::vector<char*>& filenames) {
         img.copyTo(roi);
         x_offset += img.cols;
     }
+    return gallery;
+}
+
+// Displays all images in a single gallery window
+void displayGallery(const std::vector<char*>& filenames) {
+    cv::Mat gallery;
+    if (thumbnailPackEnabled()) {
+        // a grid of the packed thumbnails, without reading the originals
+        GalleryOptions options;
+        thumbnailPackSize(options.thumb_width, options.thumb_height);
+        std::vector<std::string> images(filenames.begin(), filenames.end());
+        std::vector<std::string> captions;
+        for (size_t i = 0; i < images.size(); i++) {
+            size_t slash = images[i].rfind('/');
+            captions.push_back("#" + std::to_string(i + 1) + " " +
+                               (slash == std::string::npos ? images[i] : images[i].substr(slash + 1)));
+        }
+        if (renderGallery(images, captions, options, gallery) != 0) {
+            return;
+        }
+    } else {
+        gallery = composeGallery(filenames);
+    }
 
     // Display the gallery
     cv::imshow("Gallery", gallery);
@@ -49,4 +86,225 @@ void displayOneByOne(const std::vector<char*>& filenames) {
             break;
         }
     }
-}
\ No newline at end of file
+}
+
+// A cached thumbnail, valid while the file keeps its size and mtime
+struct ThumbnailEntry {
+    cv::Mat thumb;
+    long long size = 0;
+    long long mtime = 0;
+    std::list<std::string>::iterator lru;
+};
+
+static std::mutex thumbnail_lock;
+static std::list<std::string> thumbnail_lru; // most recently used first
+static std::unordered_map<std::string, ThumbnailEntry> thumbnail_cache;
+static size_t thumbnail_bytes = 0;
+static size_t thumbnail_capacity = 64 << 20;
+
+static size_t matBytes(const cv::Mat &m) {
+    return m.total() * m.elemSize();
+}
+
+// Drops least recently used thumbnails until the cache fits its capacity; needs thumbnail_lock
+static void trimThumbnailCache() {
+    while (thumbnail_bytes > thumbnail_capacity && !thumbnail_lru.empty()) {
+        auto it = thumbnail_cache.find(thumbnail_lru.back());
+        thumbnail_bytes -= matBytes(it->second.thumb);
+        thumbnail_cache.erase(it);
+        thumbnail_lru.pop_back();
+    }
+}
+
+void setThumbnailCacheBytes(size_t bytes) {
+    std::lock_guard<std::mutex> guard(thumbnail_lock);
+    thumbnail_capacity = bytes;
+    trimThumbnailCache();
+}
+
+// Fits an image into width x height if it is larger
+static void fitInto(const cv::Mat &image, int width, int height, cv::Mat &thumb) {
+    double fit = std::min(width / (double) image.cols, height / (double) image.rows);
+    if (fit < 1.0) {
+        cv::Size fitted(std::max(1, cvRound(image.cols * fit)), std::max(1, cvRound(image.rows * fit)));
+        cv::resize(image, thumb, fitted, 0, 0, cv::INTER_AREA);
+    } else {
+        thumb = image;
+    }
+}
+
+int loadThumbnail(const char *filename, int width, int height, cv::Mat &thumb) {
+    if (width <= 0 || height <= 0) {
+        return -1;
+    }
+    // The thumbnail pack is memory mapped, so a packed image costs no file access at all
+    cv::Mat packed;
+    if (thumbnailPackEnabled() && lookupPackedThumbnail(filename, packed)) {
+        INSTRUMENT_COUNT("thumbnail_pack_hits", 1);
+        fitInto(packed, width, height, thumb);
+        return 0;
+    }
+    long long size, mtime;
+    if (stat_file(filename, size, mtime) != 0) {
+        return -1;
+    }
+    std::string key = std::string(filename) + "|" + std::to_string(width) + "x" + std::to_string(height);
+    {
+        std::lock_guard<std::mutex> guard(thumbnail_lock);
+        auto it = thumbnail_cache.find(key);
+        if (it != thumbnail_cache.end() && it->second.size == size && it->second.mtime == mtime) {
+            thumbnail_lru.splice(thumbnail_lru.begin(), thumbnail_lru, it->second.lru);
+            thumb = it->second.thumb;
+            INSTRUMENT_COUNT("thumbnail_cache_hits", 1);
+            return 0;
+        }
+    }
+    INSTRUMENT_COUNT("thumbnail_cache_misses", 1);
+    INSTRUMENT_SCOPE("thumbnail_decode");
+
+    // Let libjpeg skip the detail the box can not show
+    int scale = 1;
+    int image_width, image_height;
+    if (readImageSize(filename, image_width, image_height) == 0) {
+        scale = chooseThumbnailScale(image_width, image_height, width, height);
+    }
+    cv::Mat image = cv::imread(filename, imreadFlagsForScale(scale));
+    if (image.empty()) {
+        return -1;
+    }
+    fitInto(image, width, height, thumb);
+
+    std::lock_guard<std::mutex> guard(thumbnail_lock);
+    if (matBytes(thumb) > thumbnail_capacity) {
+        return 0;
+    }
+    auto old = thumbnail_cache.find(key);
+    if (old != thumbnail_cache.end()) {
+        thumbnail_bytes -= matBytes(old->second.thumb);
+        thumbnail_lru.erase(old->second.lru);
+        thumbnail_cache.erase(old);
+    }
+    thumbnail_lru.push_front(key);
+    ThumbnailEntry &entry = thumbnail_cache[key];
+    entry.thumb = thumb;
+    entry.size = size;
+    entry.mtime = mtime;
+    entry.lru = thumbnail_lru.begin();
+    thumbnail_bytes += matBytes(thumb);
+    trimThumbnailCache();
+    return 0;
+}
+
+static const int CAPTION_HEIGHT = 18;
+static const int CELL_PADDING = 6;
+static const double CAPTION_SCALE = 0.4;
+
+// Shortens a caption from the front until it fits in width pixels
+static std::string fitCaption(const std::string &text, int width) {
+    int baseline = 0;
+    for (size_t skip = 0; skip < text.size(); skip++) {
+        std::string candidate = skip == 0 ? text : ".." + text.substr(skip);
+        if (cv::getTextSize(candidate, cv::FONT_HERSHEY_SIMPLEX, CAPTION_SCALE, 1, &baseline).width <= width) {
+            return candidate;
+        }
+    }
+    return "";
+}
+
+int renderGallery(const std::vector<std::string> &filenames, const std::vector<std::string> &captions,
+                  const GalleryOptions &options, cv::Mat &page) {
+    const int n = static_cast<int>(filenames.size());
+    const int thumb_width = options.thumb_width, thumb_height = options.thumb_height;
+    if (n == 0 || thumb_width <= 0 || thumb_height <= 0) {
+        return -1;
+    }
+    INSTRUMENT_SCOPE("gallery_render");
+
+    // Decode the thumbnails in parallel
+    std::vector<cv::Mat> thumbs(n);
+    std::vector<char> loaded(n, 0);
+    int threads = options.threads > 0 ? options.threads : static_cast<int>(std::thread::hardware_concurrency());
+    threads = std::max(1, std::min(threads, n));
+    std::atomic<int> next(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&] {
+            for (int i = next++; i < n; i = next++) {
+                loaded[i] = loadThumbnail(filenames[i].c_str(), thumb_width, thumb_height, thumbs[i]) == 0;
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    // Lay the cells out row by row, each thumbnail centered in its box
+    const bool with_captions = options.captions && !captions.empty();
+    const int columns = std::max(1, std::min(options.columns, n));
+    const int rows = (n + columns - 1) / columns;
+    const int cell_width = thumb_width + CELL_PADDING;
+    const int cell_height = thumb_height + (with_captions ? CAPTION_HEIGHT : 0) + CELL_PADDING;
+    page.create(rows * cell_height + CELL_PADDING, columns * cell_width + CELL_PADDING, CV_8UC3);
+    page.setTo(cv::Scalar(32, 32, 32));
+    for (int i = 0; i < n; i++) {
+        int x = CELL_PADDING + (i % columns) * cell_width;
+        int y = CELL_PADDING + (i / columns) * cell_height;
+        if (loaded[i]) {
+            const cv::Mat &thumb = thumbs[i];
+            cv::Rect box(x + (thumb_width - thumb.cols) / 2, y + (thumb_height - thumb.rows) / 2, thumb.cols,
+                         thumb.rows);
+            cv::Mat roi = page(box);
+            thumb.copyTo(roi);
+        } else {
+            std::cerr << "Could not read: " << filenames[i] << std::endl;
+            cv::rectangle(page, cv::Rect(x, y, thumb_width, thumb_height), cv::Scalar(90, 90, 90), cv::FILLED);
+        }
+        if (with_captions && i < static_cast<int>(captions.size())) {
+            cv::putText(page, fitCaption(captions[i], thumb_width), cv::Point(x, y + thumb_height + 13),
+                        cv::FONT_HERSHEY_SIMPLEX, CAPTION_SCALE, cv::Scalar(230, 230, 230), 1, cv::LINE_AA);
+        }
+    }
+    return 0;
+}
+
+int encodeGallery(const cv::Mat &page, const char *ext, const GalleryOptions &options,
+                  std::vector<unsigned char> &bytes) {
+    INSTRUMENT_SCOPE("gallery_encode");
+    std::vector<int> params;
+    if (strcmp(ext, ".png") == 0) {
+        // pages are rendered per query, so favor speed over size
+        params = {cv::IMWRITE_PNG_COMPRESSION, 1};
+    } else if (strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0) {
+        params = {cv::IMWRITE_JPEG_QUALITY, options.jpeg_quality};
+    } else {
+        std::cerr << "Unsupported gallery format: " << ext << std::endl;
+        return -1;
+    }
+    return cv::imencode(ext, page, bytes, params) ? 0 : -1;
+}
+
+int writeGallery(const char *path, const std::vector<std::string> &filenames,
+                 const std::vector<std::string> &captions, const GalleryOptions &options) {
+    const char *ext = strrchr(path, '.');
+    cv::Mat page;
+    std::vector<unsigned char> bytes;
+    if (ext == nullptr || renderGallery(filenames, captions, options, page) != 0 ||
+        encodeGallery(page, ext, options, bytes) != 0) {
+        std::cerr << "Could not render gallery " << path << std::endl;
+        return -1;
+    }
+    // written next to the target and renamed, so a reader never sees half a page
+    std::string tmp_name = std::string(path) + ".tmp";
+    FILE *fp = fopen(tmp_name.c_str(), "wb");
+    if (!fp) {
+        std::cerr << "Unable to open " << tmp_name << std::endl;
+        return -1;
+    }
+    bool written = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+    if (fsync_and_close(fp) != 0 || !written || rename(tmp_name.c_str(), path) != 0) {
+        std::cerr << "Error writing gallery " << path << std::endl;
+        remove(tmp_name.c_str());
+        return -1;
+    }
+    return 0;
+}
@@ -4,12 +4,28 @@
  * Purpose: Find and display the top N matching images based on feature vectors
  */
 #include "../include/csv_util.h"
-#include "../include/distance_calculate.h"
+#include "../include/feature_store.h"
+#include "../include/feature_shards.h"
+#include "../include/name_arena.h"
+#include "../include/segment_store.h"
+#include "../include/stream_scan.h"
 #include "../include/image_display_util.h"
+#include "../include/batch_search.h"
+#include "../include/cascade.h"
+#include "../include/fusion.h"
+#include "../include/instrument.h"
+#include "../include/thumbnail_pack.h"
+#include "../include/feature_registry.h"
+#include <chrono>
 #include <iostream>
+#include <csignal>
 #include <cstdlib> // for atoi
 #include <cstdio>
 #include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 using namespace cv;
@@ -31,317 +47,943 @@ int find_target_index(const char *target_image_filename, vector<char *> &filenam
 //Since cosine function is paired with ResNet18.csv, the file directory is hard-coded
 int find_target_index_cosine(const char *target_image_filename, std::vector<char *> &filenames) 
 {  
-    int target_index = -1;    
+    const string dirname = "../olympus/";
     for (size_t i = 0; i < filenames.size(); i++) 
     {        
-        string dirname = "../olympus/";
-        size_t len = dirname.length() + strlen(filenames[i]) + 1;
-        char *fullpath = new char[len];
-        strcpy(fullpath, dirname.c_str());
-        strcat(fullpath, filenames[i]);
-
-        if (strcmp(fullpath, target_image_filename) == 0)
+        if (dirname + filenames[i] == target_image_filename)
         {      
-            target_index = i;            
-        break;        
+            return i;
         }    
     }    
-        return target_index;
+    return -1;
 }
 
 /**
- * Function to find top N matches using SSD distance
+ * Finds the feature vector of the target image. When the target is not in the
+ * feature file (e.g. a new upload), its features are computed on the fly with
+ * the extractor the offline tool uses, and target_index is set to -1.
  * @return non-zero failure
  */
-int find_topN_matches_ssd(char *target_image_filename, std::vector<char *> &filenames,
-                          std::vector<std::vector<float>> &data, int N, std::vector<char *> &output) {
-    // data format is
-    //  The image filename is written to the first position in the row of data.
-    //  The values in image_data are all written to the file as floats.
-    // Step1: find the target
-    int target_index = find_target_index(target_image_filename, filenames);
-    // If the target image is not found, return an error
-    if (target_index == -1) {
+int resolve_target(char *target_image_filename, const MetricInfo &metric,
+                   std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                   std::vector<float> &target_vector, int &target_index) {
+    target_index = metric.resnet_names
+                   ? find_target_index_cosine(target_image_filename, filenames)
+                   : find_target_index(target_image_filename, filenames);
+    if (target_index != -1) {
+        target_vector = data[target_index];
+        return 0;
+    }
+
+    // the ResNet18 embeddings used by cosine are precomputed, so there is no extractor
+    const FeatureInfo *feature = feature_for_metric(metric);
+    if (feature == nullptr) {
         std::cerr << "Target image not found!" << std::endl;
         return -1;
     }
+    printf("Target not in the feature file, extracting its features\n");
+    target_vector.clear();
+    INSTRUMENT_SCOPE("extract_target");
+    if (feature->extract(target_image_filename, target_vector) != 0) {
+        std::cerr << "Target image not found!" << std::endl;
+        return -1;
+    }
+    if (!data.empty() && target_vector.size() != data[0].size()) {
+        std::cerr << "Extracted " << target_vector.size() << " values but the feature file has "
+                  << data[0].size() << " per row" << std::endl;
+        return -1;
+    }
+    return 0;
+}
 
-    // Step2: calculate the corresponding distance
-    std::vector<float> &target_vector = data[target_index];
-    vector<pair<float, int>> distances; // Pair of distance and index
-
-    for (size_t i = 0; i < data.size(); i++) {
-        if (i == target_index) {
-            continue;
-        }
-        float dist = calculate_ssd(data[i], target_vector);
-        distances.push_back({dist, static_cast<int>(i)});
+/**
+ * Runs one query: resolves the target (extracting its features if it is not in
+ * the feature file) and ranks the database with the chosen metric.
+ *
+ * @param rnnData ResNet18 rows aligned with data, only used by the fused metrics (depth, banana, face)
+ * @param prepared What the metric's prepare step derived from the rows
+ * @return non-zero failure
+ */
+int run_query(char *target_image, const MetricInfo &metric, std::vector<char *> &filenames,
+              std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &rnnData,
+              const PreparedRows &prepared, int N, std::vector<char *> &output) {
+    INSTRUMENT_SCOPE("query");
+    std::vector<float> target_vector;
+    int target_index;
+    if (resolve_target(target_image, metric, filenames, data, target_vector, target_index) != 0) {
+        return -1;
+    }
+    // an extracted target is in the file's column order, the rows may not be
+    if (target_index == -1) {
+        permute_columns(prepared.column_order, target_vector);
+    }
+    // an unseen image has no ResNet18 embedding
+    std::vector<float> target_rnn;
+    if (target_index != -1 && target_index < static_cast<int>(rnnData.size())) {
+        target_rnn = rnnData[target_index];
     }
 
-    // Step 3: Sort the pair
-    sort(distances.begin(), distances.end());
+    output.clear();
+    return metric.rank(target_vector, target_rnn, target_index, filenames, data, rnnData, N, output);
+}
 
-    // Step 4: get N of them and return
-    for (int i = 0; i < N && i < distances.size(); i++) {
-        int match_index = distances[i].second;
-        output.push_back(filenames[match_index]);
+/**
+ * Loads the feature file for a metric, plus the ResNet18 embeddings the fused
+ * metrics (depth, banana, face) combine it with, and runs the metric's prepare step.
+ * @return non-zero failure
+ */
+int load_feature_data(char *feature_file, const MetricInfo &metric, std::vector<char *> &filenames,
+                      std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &rnnData,
+                      PreparedRows &prepared) {
+    int result = read_feature_file(feature_file, filenames, data);
+    if (result != 0) {
+        printf("Can not read the image csv file: %s\n", feature_file);
+        return -1;
+    }
+    const FeatureInfo *feature = feature_for_metric(metric);
+    if (feature && !data.empty() && static_cast<int>(data[0].size()) != feature->dims()) {
+        printf("Warning: %s rows have %zu values, the %s feature has %d\n", feature_file, data[0].size(),
+               feature->name.c_str(), feature->dims());
+    }
+    if (metric.fused_resnet) {
+        // both files are sorted by name, so rows line up; filenames become the bare ResNet18 names
+        release_names(filenames);
+        result = read_feature_file("../olympus/ResNet18_olym.csv", filenames, rnnData);
+        if (result != 0) {
+            cerr << "Can not read the RNN image csv file: ../olympus/ResNet18_olym.csv\n";
+            return -1;
+        }
+    }
+    INSTRUMENT_SCOPE("prepare");
+    if (metric.prepare && metric.prepare(data, rnnData, prepared) != 0) {
+        printf("Can not prepare %s for the %s metric\n", feature_file, metric.name.c_str());
+        return -1;
     }
     return 0;
 }
 
 /**
- * Function to find top N matches using RGB histogram intersection
+ * Loads every shard listed in a shard manifest, in parallel. Shards are only
+ * searched with the blocked kernels, so the metric must have one.
  * @return non-zero failure
  */
-int find_topN_matches_hist(char *target_image_filename, std::vector<char *> &filenames,
-                               std::vector<std::vector<float>> &data, int N, std::vector<char *> &output) {
-    // Step1: find the target
-    int target_index = find_target_index(target_image_filename, filenames);
-    // If the target image is not found, return an error
-    if (target_index == -1) {
-        std::cerr << "Target image not found!" << std::endl;
+int load_sharded_data(char *manifest_file, const MetricInfo &metric, ShardedStore &shards) {
+    if (!metric.batch) {
+        printf("Distance metric %s can not search a sharded feature file\n", metric.name.c_str());
         return -1;
     }
+    return load_shards(manifest_file, shards);
+}
 
-    // Step2: calculate the corresponding distance
-    std::vector<float> &target_vector = data[target_index];
-    vector<pair<float, int>> distances; // Pair of distance and index
+/**
+ * Runs one query against sharded features: the target is looked up in the
+ * shard its name belongs to (or extracted on the fly), every shard is scanned
+ * in parallel and the per-shard top N lists are merged.
+ * @return non-zero failure
+ */
+int run_sharded_query(char *target_image, const MetricInfo &metric, ShardedStore &shards, int N,
+                      std::vector<char *> &output) {
+    INSTRUMENT_SCOPE("query");
+    BatchMetric batch_metric;
+    int segments = 1;
+    if (metric_batch_kernel(metric, batch_metric, segments) != 0) {
+        return -1;
+    }
 
-    for (size_t i = 0; i < data.size(); i++) {
-        if (i == target_index) {
-            continue;
+    int shard = shard_of(shards.manifest, target_image);
+    int row = metric.resnet_names ? find_target_index_cosine(target_image, shards.filenames[shard])
+                                  : find_target_index(target_image, shards.filenames[shard]);
+    std::vector<float> target_vector;
+    if (row != -1) {
+        const float *values = shards.stores[shard].row(row);
+        target_vector.assign(values, values + shards.stores[shard].cols);
+    } else {
+        const FeatureInfo *feature = feature_for_metric(metric);
+        if (feature == nullptr) {
+            std::cerr << "Target image not found!" << std::endl;
+            return -1;
+        }
+        printf("Target not in the feature file, extracting its features\n");
+        INSTRUMENT_SCOPE("extract_target");
+        if (feature->extract(target_image, target_vector) != 0) {
+            std::cerr << "Target image not found!" << std::endl;
+            return -1;
+        }
+        if (static_cast<int>(target_vector.size()) != shards.cols()) {
+            std::cerr << "Extracted " << target_vector.size() << " values but the shards have " << shards.cols()
+                      << " per row" << std::endl;
+            return -1;
         }
-        float dist = calculate_histogramIntersection(data[i], target_vector);
-        distances.push_back({dist, static_cast<int>(i)});
     }
 
-    // Step 3: Sort the pair,
-    sort(distances.rbegin(), distances.rend());
-
-    // Step 4: get N of them and return
-    for (int i = 0; i < N && i < distances.size(); i++) {
-        int match_index = distances[i].second;
-        output.push_back(filenames[match_index]);
+    std::vector<ShardMatch> matches;
+    if (sharded_find_topN(shards, target_vector.data(), row != -1 ? shard : -1, row, batch_metric, segments, N,
+                          matches) != 0) {
+        return -1;
+    }
+    output.clear();
+    for (const ShardMatch &match : matches) {
+        output.push_back(shards.filenames[match.shard][match.row]);
     }
     return 0;
 }
 
-// Function to find top N matches using multi histogram distance
+// Streaming scans, set by --stream
+static bool stream_mode = false;
+static StreamScanOptions stream_options;
 
-int find_topN_matches_multiHist(char *target_image_filename, std::vector<char *> &filenames,
-                                std::vector<std::vector<float>> &data, int N, std::vector<char *> &output) {
-    // Step1: find the target
-    int target_index = find_target_index(target_image_filename, filenames);
-    // If the target image is not found, return an error
-    if (target_index == -1) {
-        std::cerr << "Target image not found!" << std::endl;
+/**
+ * Runs one query by streaming a binary feature store from disk instead of
+ * loading it, so memory use does not depend on the size of the catalog. The
+ * target's row is found through the store's names table.
+ *
+ * @param names Storage for the names of the matches, which output points into
+ * @return non-zero failure
+ */
+int run_stream_query(char *target_image, const MetricInfo &metric, const char *store_file, int N,
+                     std::vector<std::string> &names, std::vector<char *> &output) {
+    INSTRUMENT_SCOPE("query");
+    BatchMetric batch_metric;
+    int segments = 1;
+    if (metric_batch_kernel(metric, batch_metric, segments) != 0) {
+        return -1;
+    }
+    FeatureStoreHeader header;
+    if (read_feature_store_header(store_file, header) != 0) {
         return -1;
     }
 
-    // Step2: calculate the corresponding distance
-    std::vector<float> &target_vector = data[target_index];
-    vector<pair<float, int>> distances; // Pair of distance and index
-
-    for (size_t i = 0; i < data.size(); i++) {
-        if (i == target_index) {
-            continue;
+    // ResNet18 rows are bare names of images in ../olympus/
+    const char *name = target_image;
+    if (metric.resnet_names && strncmp(name, "../olympus/", strlen("../olympus/")) == 0) {
+        name += strlen("../olympus/");
+    }
+    int64_t target_row = -1;
+    std::vector<float> target_vector;
+    int found = find_store_row(store_file, name, target_row);
+    if (found < 0 || (found == 0 && read_store_row(store_file, target_row, target_vector) != 0)) {
+        return -1;
+    }
+    if (found != 0) {
+        const FeatureInfo *feature = feature_for_metric(metric);
+        if (feature == nullptr) {
+            std::cerr << "Target image not found!" << std::endl;
+            return -1;
+        }
+        printf("Target not in the feature file, extracting its features\n");
+        INSTRUMENT_SCOPE("extract_target");
+        if (feature->extract(target_image, target_vector) != 0) {
+            std::cerr << "Target image not found!" << std::endl;
+            return -1;
         }
-        float dist = calculate_multiHist_distance(data[i], target_vector);
-        distances.push_back({dist, static_cast<int>(i)});
     }
 
-    // Step 3: Sort the pair,
-    sort(distances.begin(), distances.end());
-    // Step 4: get N of them and return
-    for (int i = 0; i < N && i < distances.size(); i++) {
-        int match_index = distances[i].second;
-        output.push_back(filenames[match_index]);
+    std::vector<std::pair<float, int64_t>> matches;
+    StreamScanStats stats;
+    if (stream_find_topN(store_file, target_vector.data(), static_cast<int>(target_vector.size()), target_row,
+                         batch_metric, segments, N, stream_options, matches, stats) != 0) {
+        return -1;
+    }
+    double mb = stats.bytes / 1048576.0;
+    printf("Streamed %llu rows (%.0f MB) in %.2f s: %.0f MB/s, %.2f s waiting on reads\n",
+           (unsigned long long) stats.rows, mb, stats.seconds, stats.seconds > 0 ? mb / stats.seconds : 0.0,
+           stats.read_wait_seconds);
+
+    std::vector<int64_t> rows;
+    for (const auto &match : matches) rows.push_back(match.second);
+    if (read_store_names(store_file, rows, names) != 0) {
+        return -1;
+    }
+    output.clear();
+    for (std::string &match_name : names) {
+        output.push_back(&match_name[0]);
     }
     return 0;
 }
 
 /**
- * Function to find top N matches using texture color distance
+ * Removes the streaming options from argv, wherever they are:
+ *   --stream           scan a binary feature store from disk instead of loading it
+ *   --chunk-mb <n>     values read per chunk (default 64)
+ *   --read-ahead <n>   chunks read while one is scored (default 1, double buffering)
+ * @return non-zero on a malformed option
  */
-int find_topN_matches_textureColor(char* target_image_filename, std::vector<char*>& filenames,
-                                   std::vector<std::vector<float>>& data, int N, std::vector<char*>& output) 
-{
-    int target_index = find_target_index(target_image_filename, filenames);
-    if (target_index == -1) return -1;
-
-    std::vector<float> &target = data[target_index];
-    std::vector<std::pair<float, int>> distances;
+static int parse_stream_options(int &argc, char *argv[]) {
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stream") == 0) {
+            stream_mode = true;
+        } else if (strcmp(argv[i], "--chunk-mb") == 0 && i + 1 < argc) {
+            int mb = atoi(argv[++i]);
+            if (mb <= 0) {
+                printf("Invalid chunk size: %s\n", argv[i]);
+                return -1;
+            }
+            stream_options.chunk_bytes = static_cast<size_t>(mb) << 20;
+        } else if (strcmp(argv[i], "--read-ahead") == 0 && i + 1 < argc) {
+            stream_options.read_ahead = atoi(argv[++i]);
+            if (stream_options.read_ahead <= 0) {
+                printf("Invalid read-ahead: %s\n", argv[i]);
+                return -1;
+            }
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+    return 0;
+}
 
-    for (size_t i = 0; i < data.size(); i++) {
-        if (i == target_index) continue;
-        float dist = calculate_textureColor_distance(data[i], target);
-        distances.push_back({dist, static_cast<int>(i)});
+// Checks that a feature file can be streamed with a metric
+static int check_stream_mode(const char *feature_file, const MetricInfo &metric) {
+    if (!metric.batch) {
+        printf("Distance metric %s can not stream a feature file\n", metric.name.c_str());
+        return -1;
+    }
+    if (!is_feature_store(feature_file)) {
+        printf("--stream needs a binary feature store, %s is not one\n", feature_file);
+        return -1;
     }
+    return 0;
+}
 
-    // Sort by ascending order
-    std::sort(distances.begin(), distances.end());
+// Prints the registered metric names, optionally only those with a blocked kernel
+static void print_metric_names(bool batch_only) {
+    printf("distance_metric options:");
+    for (const MetricInfo *info : list_metrics()) {
+        if (!batch_only || info->batch) printf(" %s", info->name.c_str());
+    }
+    printf("\n");
+}
 
-    // Clear output vector before inserting new values
-    output.clear();
-    for (int i = 0; i < N && i < distances.size(); i++) {
-        output.push_back(filenames[distances[i].second]);
+/**
+ * Removes the cascade options of the fused metrics from argv, wherever they are:
+ *   --prefilter M     rows the cheap first stage keeps (0 scores every row with the full metric)
+ *   --weights a,b     weights of the ResNet18 and hand-crafted terms
+ *   --recall          report the recall of the cascade against an exhaustive ranking
+ * @return non-zero on a malformed option
+ */
+static int parse_cascade_options(int &argc, char *argv[]) {
+    CascadeOptions options = get_cascade_options();
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--prefilter") == 0 && i + 1 < argc) {
+            options.prefilter = atoi(argv[++i]);
+            if (options.prefilter < 0) {
+                printf("Invalid prefilter size: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--weights") == 0 && i + 1 < argc) {
+            options.weights.clear();
+            char *end = argv[++i];
+            while (*end) {
+                char *start = end;
+                double weight = strtod(start, &end);
+                if (end == start || (*end != ',' && *end != '\0')) {
+                    printf("Invalid weights: %s\n", argv[i]);
+                    return -1;
+                }
+                options.weights.push_back(weight);
+                if (*end == ',') end++;
+            }
+        } else if (strcmp(argv[i], "--recall") == 0) {
+            options.log_recall = true;
+        } else {
+            argv[kept++] = argv[i];
+        }
     }
+    argc = kept;
+    argv[argc] = nullptr;
+    set_cascade_options(options);
     return 0;
 }
 
-// Function to find top N matches using cosine distance
+/**
+ * Batch mode: finds the top N matches for every target listed in a text file
+ * (one image path per line) with a single load of the feature file, and writes
+ * one CSV row per target: target,match_1,...,match_N.
+ *
+ * Supported metrics are the ones registered with a blocked kernel (ssd, cosine,
+ * rgb-hist, multi-hist, texture-color, grid-2x2, grid-3x3 and center-surround).
+ * Targets that are not in the feature file are extracted on the fly (except for
+ * cosine, whose embeddings are precomputed).
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv argv[2] - target list, argv[3] - feature file, argv[4] - N,
+ *             argv[5] - distance metric, argv[6] - optional output CSV (default stdout)
+ * @return 0 on success, non-zero on failure.
+ */
+int run_batch_mode(int argc, char *argv[]) {
+    if (argc < 6) {
+        printf("usage: %s --batch <target_list> <feature_file> <N> <distance_metric> [output_csv]\n", argv[0]);
+        print_metric_names(true);
+        return -1;
+    }
+    char *feature_file = argv[3];
+    int N = atoi(argv[4]);
+    std::string distance_metric = argv[5];
+    if (N <= 0) {
+        printf("Invalid value for N: %d. N must be a positive integer.\n", N);
+        return -1;
+    }
+
+    // Map the metric onto a blocked kernel
+    const MetricInfo *metric = find_metric(distance_metric);
+    BatchMetric batch_metric;
+    int segments = 1;
+    if (metric == nullptr || metric_batch_kernel(*metric, batch_metric, segments) != 0) {
+        printf("Distance metric %s is not supported in batch mode\n", distance_metric.c_str());
+        return -1;
+    }
 
-int find_topN_matches_cosine(char* target_image_filename, std::vector<char *> &filenames,
-                             std::vector<std::vector<float>> &data, int N,std::vector<char *> &output) 
-{
-    int target_index = find_target_index_cosine(target_image_filename, filenames);
-    if (target_index == -1) return -1;
+    // Read the target list
+    FILE *list_fp = fopen(argv[2], "r");
+    if (!list_fp) {
+        printf("Unable to open target list %s\n", argv[2]);
+        return -1;
+    }
+    std::vector<std::string> targets;
+    char line[512];
+    while (fgets(line, sizeof(line), list_fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        targets.push_back(line);
+    }
+    fclose(list_fp);
 
-    std::vector<float> target = data[target_index];
-    // l2_norm(target);
+    std::vector<char *> filenames;
+    std::vector<std::vector<float>> data;
+    if (read_feature_file(feature_file, filenames, data) != 0) {
+        printf("Can not read the image csv file: %s\n", feature_file);
+        return -1;
+    }
 
-    std::vector<std::pair<float, int>> distances;
+    // Index the database by name once instead of a linear scan per target.
+    // ResNet18 rows are bare file names, so cosine targets are matched the same
+    // way find_target_index_cosine does.
+    std::unordered_map<std::string, int> index_of;
+    for (size_t i = 0; i < filenames.size(); i++) {
+        std::string key = filenames[i];
+        if (metric->resnet_names) key = "../olympus/" + key;
+        index_of.emplace(key, static_cast<int>(i));
+    }
 
-    for(size_t i = 0; i < data.size(); i++) {
-        if(i == target_index) continue;
-        std::vector<float> vec = data[i];
-        // l2_norm(vec);
-        float dist = calculate_cosine_distance(vec, target);
-        distances.push_back({dist, static_cast<int>(i)});
+    // Targets missing from the feature file are extracted on the fly
+    const FeatureInfo *feature = feature_for_metric(*metric);
+    std::vector<std::vector<float>> query_vectors;
+    std::vector<int> exclude;
+    std::vector<std::string> found_targets;
+    for (const std::string &target : targets) {
+        auto it = index_of.find(target);
+        if (it != index_of.end()) {
+            query_vectors.push_back(data[it->second]);
+            exclude.push_back(it->second);
+        } else {
+            std::vector<float> features;
+            if (feature == nullptr || feature->extract((char *) target.c_str(), features) != 0 ||
+                (!data.empty() && features.size() != data[0].size())) {
+                fprintf(stderr, "Target image not found, skipping: %s\n", target.c_str());
+                continue;
+            }
+            query_vectors.push_back(features);
+            exclude.push_back(-1);
+        }
+        found_targets.push_back(target);
     }
 
-    std::sort(distances.begin(), distances.end());
-    
-    output.clear();
-    for(int i = 0; i < N && i < distances.size(); i++) {
-        output.push_back(filenames[distances[i].second]);
+    FeatureMatrix database, queries;
+    if (pack_feature_matrix(data, database) != 0 || pack_feature_matrix(query_vectors, queries) != 0) {
+        printf("Feature file %s has rows of different lengths\n", feature_file);
+        return -1;
+    }
+    std::vector<std::vector<std::pair<float, int>>> results;
+    if (batch_find_topN(database, queries, exclude, batch_metric, segments, N, results) != 0) {
+        printf("Can not process the files: ");
+        return -1;
     }
 
+    // Write the top-N table
+    FILE *out_fp = stdout;
+    if (argc > 6) {
+        out_fp = fopen(argv[6], "w");
+        if (!out_fp) {
+            printf("Unable to open output file %s\n", argv[6]);
+            return -1;
+        }
+    }
+    for (size_t q = 0; q < results.size(); q++) {
+        fprintf(out_fp, "%s", found_targets[q].c_str());
+        for (const auto &match : results[q]) {
+            fprintf(out_fp, ",%s", filenames[match.second]);
+        }
+        fprintf(out_fp, "\n");
+    }
+    if (out_fp != stdout) {
+        fclose(out_fp);
+        printf("Wrote top %d matches for %zu targets to %s\n", N, results.size(), argv[6]);
+    }
     return 0;
 }
 
-// Function to find top N matches using depth DNN distance
+// File name without its directory, the key rows of different feature files are matched on
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
 
-int find_topN_matches_depthDNN(char* target_image_filename, std::vector<char *> &filenames,
-                             std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &rnnData , int N,std::vector<char *> &output) {
+// Headless result pages, set by --gallery
+static std::string gallery_path;
+static GalleryOptions gallery_options;
 
-    int target_index = find_target_index_cosine(target_image_filename, filenames);
-    if (target_index == -1) return -1;
-    if (rnnData.size() != data.size()) {
-        cerr << "RNN data and data size is not the same! \n";
-        cerr << "rnn size is" << rnnData.size() << " And data size is " << data.size();
+/**
+ * Removes the headless gallery options from argv, wherever they are:
+ *   --gallery <file>   write the target and its matches as a page of thumbnails (.jpg or .png)
+ *                      instead of opening a window; with --serve, a directory that gets one page per query
+ *   --thumb <W>x<H>    thumbnail box (default 200x150)
+ *   --columns <n>      thumbnails per row (default 6)
+ *   --thumbnails <pack> show matches from the thumbnail pack written by Proj2-offline_loading,
+ *                      sized to the pack unless --thumb is given
+ * @return non-zero on a malformed option
+ */
+static int parse_gallery_options(int &argc, char *argv[]) {
+    int kept = 1;
+    bool thumb_set = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--gallery") == 0 && i + 1 < argc) {
+            gallery_path = argv[++i];
+        } else if (strcmp(argv[i], "--thumb") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &gallery_options.thumb_width, &gallery_options.thumb_height) != 2 ||
+                gallery_options.thumb_width <= 0 || gallery_options.thumb_height <= 0) {
+                printf("Invalid thumbnail size: %s\n", argv[i]);
+                return -1;
+            }
+            thumb_set = true;
+        } else if (strcmp(argv[i], "--thumbnails") == 0 && i + 1 < argc) {
+            if (setThumbnailPack(argv[++i], false) != 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--columns") == 0 && i + 1 < argc) {
+            gallery_options.columns = atoi(argv[++i]);
+            if (gallery_options.columns <= 0) {
+                printf("Invalid column count: %s\n", argv[i]);
+                return -1;
+            }
+        } else {
+            argv[kept++] = argv[i];
+        }
     }
-    std::vector<float> targetTexColor = data[target_index];
-    std::vector<float> targetRNN = rnnData[target_index];
-    // l2_norm(target);
-
-    std::vector<std::pair<float, int>> distances;
-
-    for(size_t i = 0; i < rnnData.size(); i++) {
-        if(i == target_index) continue;
-        std::vector<float> rnn = rnnData[i];
-        std::vector<float> vec = data[i];
-        // l2_norm(vec);
-        float dist1 = calculate_cosine_distance(rnn, targetRNN) * 0.8;
-        float dist2 = calculate_textureColor_distance(vec, targetTexColor) * 0.2;
-//        clog << "dist1-rnn is " << dist1 << ", dist2-texture-color is " << dist2 << endl;
-        distances.push_back({dist1 + dist2, static_cast<int>(i)});
+    argc = kept;
+    argv[argc] = nullptr;
+    if (thumbnailPackEnabled() && !thumb_set) {
+        thumbnailPackSize(gallery_options.thumb_width, gallery_options.thumb_height);
     }
+    return 0;
+}
 
-    std::sort(distances.begin(), distances.end());
+// Path of a match to load; the ResNet18 file only has bare names of images in ../olympus/
+static std::string match_path(const char *filename, const MetricInfo &metric) {
+    return metric.resnet_names ? "../olympus/" + std::string(filename) : std::string(filename);
+}
 
-    output.clear();
-    for(int i = 0; i < N && i < distances.size(); i++) {
-        output.push_back(filenames[distances[i].second]);
+/**
+ * Writes the target followed by its matches, in rank order, as a page of
+ * captioned thumbnails.
+ * @return non-zero failure
+ */
+static int write_result_page(const char *path, const char *target_image, const std::vector<char *> &output,
+                             const MetricInfo &metric) {
+    std::vector<std::string> images = {target_image};
+    std::vector<std::string> captions = {std::string("query ") + base_name(target_image)};
+    for (size_t i = 0; i < output.size(); i++) {
+        images.push_back(match_path(output[i], metric));
+        captions.push_back("#" + std::to_string(i + 1) + " " + base_name(output[i]));
     }
-
-    return 0;
+    return writeGallery(path, images, captions, gallery_options);
 }
 
-int find_topN_matches_banana(char* target_image_filename, std::vector<char *> &filenames,
-                               std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &rnnData , int N,std::vector<char *> &output) {
-
-    int target_index = find_target_index_cosine(target_image_filename, filenames);
-    if (target_index == -1) return -1;
-    if (rnnData.size() != data.size()) {
-        cerr << "RNN data and data size is not the same! \n";
-        cerr << "rnn size is" << rnnData.size() << " And data size is " << data.size();
+/**
+ * Fusion mode: ranks by a weighted sum of normalized distances from several
+ * feature files. Each term is given as <feature_file>:<metric>[:weight[:norm]],
+ * where metric has a blocked kernel (see batch mode) and norm is z (default),
+ * rank or raw. Rows are matched across the files by file name, and images
+ * missing from any file are left out.
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv argv[2] - target image, argv[3] - N, argv[4...] - terms
+ * @return 0 on success, non-zero on failure.
+ */
+int run_fusion_mode(int argc, char *argv[]) {
+    if (argc < 5) {
+        printf("usage: %s --fuse <target_image> <N> <feature_file>:<metric>[:weight[:z|rank|raw]] ...\n", argv[0]);
+        print_metric_names(true);
+        return -1;
+    }
+    char *target_image = argv[2];
+    int N = atoi(argv[3]);
+    if (N <= 0) {
+        printf("Invalid value for N: %d. N must be a positive integer.\n", N);
+        return -1;
     }
-    std::vector<float> target = data[target_index];
-    std::vector<float> targetRNN = rnnData[target_index];
 
-    std::vector<std::pair<float, int>> distances;
-    int col = data[0].size();
-    // 0.5 blob histogram intersection + 0.5 rnn
-    for(size_t i = 0; i < rnnData.size(); i++) {
-        if(i == target_index || data[i][col-1] == 0) continue;
-        std::vector<float> rnn = rnnData[i];
-        std::vector<float> vec = data[i];
-        // l2_norm(vec);
-        float dist1 = calculate_cosine_distance(rnn, targetRNN) * 0.5;
-        float dist2 = calculate_histogramIntersection(vec, target) * 0.5;
-//        clog << "dist1-rnn is " << dist1 << ", dist2-texture-color is " << dist2 << endl;
-        distances.push_back({dist1 + dist2, static_cast<int>(i)});
+    int num_terms = argc - 4;
+    std::vector<std::vector<char *>> names(num_terms);
+    std::vector<std::vector<std::vector<float>>> data(num_terms);
+    std::vector<FeatureMatrix> stores(num_terms);
+    std::vector<FusionTerm> terms(num_terms);
+    std::vector<std::string> metric_names(num_terms);
+    for (int t = 0; t < num_terms; t++) {
+        // <file>:<metric>[:weight[:norm]]
+        std::string spec = argv[4 + t];
+        std::vector<std::string> parts;
+        size_t start = 0, colon;
+        while ((colon = spec.find(':', start)) != std::string::npos) {
+            parts.push_back(spec.substr(start, colon - start));
+            start = colon + 1;
+        }
+        parts.push_back(spec.substr(start));
+        FusionTerm &term = terms[t];
+        const MetricInfo *term_metric = parts.size() < 2 ? nullptr : find_metric(parts[1]);
+        if (parts.size() > 4 || term_metric == nullptr ||
+            metric_batch_kernel(*term_metric, term.metric, term.segments) != 0) {
+            printf("Invalid fusion term %s\n", spec.c_str());
+            print_metric_names(true);
+            return -1;
+        }
+        term.name = spec;
+        metric_names[t] = parts[1];
+        if (parts.size() > 2) term.weight = atof(parts[2].c_str());
+        if (parts.size() > 3) {
+            if (parts[3] == "rank") term.norm = FusionNorm::RANK;
+            else if (parts[3] == "raw") term.norm = FusionNorm::RAW;
+            else if (parts[3] != "z") {
+                printf("Invalid normalization %s, expected z, rank or raw\n", parts[3].c_str());
+                return -1;
+            }
+        }
+        if (read_feature_file(parts[0].c_str(), names[t], data[t]) != 0) {
+            printf("Can not read the image csv file: %s\n", parts[0].c_str());
+            return -1;
+        }
     }
 
-    std::sort(distances.begin(), distances.end());
+    // Rows of the first file that every other file has too, in its order
+    std::vector<std::unordered_map<std::string, int>> row_of(num_terms);
+    for (int t = 1; t < num_terms; t++) {
+        for (size_t i = 0; i < names[t].size(); i++) row_of[t].emplace(base_name(names[t][i]), static_cast<int>(i));
+    }
+    std::vector<std::vector<int>> indices(num_terms);
+    for (size_t i = 0; i < names[0].size(); i++) {
+        std::string key = base_name(names[0][i]);
+        bool everywhere = true;
+        for (int t = 1; t < num_terms && everywhere; t++) everywhere = row_of[t].count(key) > 0;
+        if (!everywhere) continue;
+        indices[0].push_back(static_cast<int>(i));
+        for (int t = 1; t < num_terms; t++) indices[t].push_back(row_of[t][key]);
+    }
+    for (int t = 0; t < num_terms; t++) {
+        if (pack_feature_rows(data[t], indices[t], stores[t]) != 0) {
+            printf("Feature file of %s has rows of different lengths\n", terms[t].name.c_str());
+            return -1;
+        }
+        terms[t].store = &stores[t];
+    }
+    if (prepare_fusion_stats(terms) != 0) {
+        return -1;
+    }
+    printf("Fusing %zu images:", indices[0].size());
+    for (const FusionTerm &term : terms) {
+        printf(" %s (mean %.4f, sd %.4f)", term.name.c_str(), term.mean, term.stddev);
+    }
+    printf("\n");
 
-    output.clear();
-    for(int i = 0; i < N && i < distances.size(); i++) {
-        output.push_back(filenames[distances[i].second]);
+    // The target's row, or its features extracted on the fly
+    int target_index = -1;
+    for (size_t i = 0; i < indices[0].size(); i++) {
+        if (strcmp(base_name(names[0][indices[0][i]]), base_name(target_image)) == 0) {
+            target_index = static_cast<int>(i);
+            break;
+        }
+    }
+    std::vector<std::vector<float>> extracted(num_terms);
+    std::vector<const float *> targets(num_terms);
+    for (int t = 0; t < num_terms; t++) {
+        if (target_index != -1) {
+            targets[t] = stores[t].row(target_index);
+            continue;
+        }
+        const MetricInfo *metric = find_metric(metric_names[t]);
+        const FeatureInfo *feature = metric ? feature_for_metric(*metric) : nullptr;
+        if (feature == nullptr || feature->extract(target_image, extracted[t]) != 0 ||
+            static_cast<int>(extracted[t].size()) != stores[t].cols) {
+            std::cerr << "Target image not found in " << terms[t].name << " and its features can not be extracted"
+                      << std::endl;
+            return -1;
+        }
+        targets[t] = extracted[t].data();
     }
 
+    FusionScratch scratch;
+    std::vector<std::pair<float, int>> matches;
+    if (fusion_find_topN(terms, targets, std::vector<double>(), target_index, N, scratch, matches) != 0) {
+        printf("Can not process the files: ");
+        return -1;
+    }
+    std::cout << "Output filenames: ";
+    for (const auto &match : matches) {
+        printf("%s ", names[0][indices[0][match.second]]);
+    }
+    std::cout << std::endl;
     return 0;
 }
 
-// Function to calculate distance between two feature vectors, considering face detection
-
-float face_distance(std::vector<float>& vec1, std::vector<float>& vec2) {
-    // Check face flags
-    bool face1 = vec1[0] > 0.5f;
-    bool face2 = vec2[0] > 0.5f;
+// Written at startup for Proj2-offline_loading --notify, set by --pid-file
+static std::string pid_file_path;
+// Set by SIGHUP: the feature file changed and is re-read before the next query
+static volatile sig_atomic_t reload_requested = 0;
 
-    // If either lacks face, use full distance
-    if(!face1 || !face2) return calculate_cosine_distance(vec1, vec2);
+static void request_reload(int) {
+    reload_requested = 1;
+}
 
-    // If both have faces, compare only facial features
-    std::vector<float> subvec1(vec1.begin()+1, vec1.end());
-    std::vector<float> subvec2(vec2.begin()+1, vec2.end());
-    return calculate_cosine_distance(subvec1, subvec2);
+// Removes --pid-file <path> from argv, wherever it is; non-zero on a malformed option
+static int parse_server_options(int &argc, char *argv[]) {
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--pid-file") == 0) {
+            if (i + 1 >= argc) {
+                printf("--pid-file needs a path\n");
+                return -1;
+            }
+            pid_file_path = argv[++i];
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+    return 0;
 }
 
-// Function to find top N matches using depth DNN distance and face detection
+// What the server knows of the feature file it loaded
+struct LoadedFile {
+    dev_t device = 0;
+    ino_t inode = 0;
+    long long size = -1; // bytes already read, -1 to force a full reload
+};
+
+static void stat_loaded_file(const char *feature_file, LoadedFile &loaded) {
+    struct stat st;
+    if (stat(feature_file, &st) != 0) {
+        loaded = LoadedFile();
+        return;
+    }
+    loaded.device = st.st_dev;
+    loaded.inode = st.st_ino;
+    loaded.size = static_cast<long long>(st.st_size);
+}
 
-int find_topN_matches_depthDNN_faces(char* target_image_filename, std::vector<char *> &filenames,
-                             std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &rnnData , int N,std::vector<char *> &output) {
+/**
+ * Records what a full load read: the file as stat-ed before loading, if it is
+ * unchanged after. A file that grew (or was replaced) while it was read may have
+ * rows past the size taken before, or half of them read, so a full reload is
+ * forced before the next query instead of tailing from a guessed offset.
+ */
+static void finish_full_load(const char *feature_file, const LoadedFile &before, LoadedFile &loaded) {
+    LoadedFile after;
+    stat_loaded_file(feature_file, after);
+    loaded = before;
+    if (after.size != before.size || after.device != before.device || after.inode != before.inode) {
+        loaded.size = -1;
+        reload_requested = 1;
+    }
+    if (reload_requested) loaded.size = -1;
+}
 
-    int target_index = find_target_index_cosine(target_image_filename, filenames);
-    if (target_index == -1) return -1;
-    if (rnnData.size() != data.size()) {
-        cerr << "RNN data and data size is not the same! \n";
-        cerr << "rnn size is" << rnnData.size() << " And data size is " << data.size();
+/**
+ * Brings the loaded rows up to date with the feature file after a SIGHUP. A
+ * CSV file that was only appended to (same inode, larger) has just its new
+ * rows read and added; a file that was rewritten and renamed into place, a
+ * binary or segment store, or the fused metrics, whose rows must line up with the
+ * ResNet18 file, are loaded again.
+ * @return non-zero failure, in which case the previous rows are kept
+ */
+static int refresh_feature_data(char *feature_file, const MetricInfo &metric, LoadedFile &loaded,
+                                std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                                std::vector<std::vector<float>> &rnnData, PreparedRows &prepared) {
+    INSTRUMENT_SCOPE("refresh");
+    size_t before = data.size();
+    LoadedFile now;
+    stat_loaded_file(feature_file, now);
+    bool appended = loaded.size >= 0 && now.size >= loaded.size && now.device == loaded.device &&
+                    now.inode == loaded.inode && !metric.fused_resnet && !is_feature_store(feature_file) &&
+                    !is_segment_manifest(feature_file);
+    if (appended) {
+        if (now.size == loaded.size) {
+            return 0;
+        }
+        std::vector<char *> new_names;
+        std::vector<std::vector<float>> new_rows;
+        long long end_offset;
+        if (read_image_data_csv_tail(feature_file, loaded.size, new_names, new_rows, end_offset) != 0) {
+            return -1;
+        }
+        if (!new_rows.empty() && !data.empty() && new_rows[0].size() != data[0].size()) {
+            printf("New rows of %s have %zu values, the loaded ones %zu\n", feature_file, new_rows[0].size(),
+                   data[0].size());
+            return -1;
+        }
+        // the new rows are in the file's column order, the loaded ones may not be
+        for (auto &row : new_rows) permute_columns(prepared.column_order, row);
+        filenames.insert(filenames.end(), new_names.begin(), new_names.end());
+        data.insert(data.end(), std::make_move_iterator(new_rows.begin()), std::make_move_iterator(new_rows.end()));
+        // a partly written last line is read once it is complete
+        loaded.size = end_offset;
+        if (metric.prepare && metric.prepare(data, rnnData, prepared) != 0) {
+            printf("Can not prepare %s for the %s metric\n", feature_file, metric.name.c_str());
+            return -1;
+        }
+    } else {
+        std::vector<char *> new_names;
+        std::vector<std::vector<float>> new_data, new_rnn;
+        PreparedRows new_prepared;
+        LoadedFile before;
+        stat_loaded_file(feature_file, before);
+        if (load_feature_data(feature_file, metric, new_names, new_data, new_rnn, new_prepared) != 0) {
+            return -1;
+        }
+        filenames.swap(new_names);
+        data.swap(new_data);
+        rnnData.swap(new_rnn);
+        std::swap(prepared, new_prepared);
+        release_names(new_names);
+        finish_full_load(feature_file, before, loaded);
     }
-    std::vector<float> targetTexColor = data[target_index];
-    std::vector<float> targetRNN = rnnData[target_index];
+    printf("Updated: %zu images (%+lld)\n", data.size(), static_cast<long long>(data.size()) -
+                                                        static_cast<long long>(before));
+    return 0;
+}
 
-    std::vector<std::pair<float, int>> distances;
+/**
+ * Server mode: loads the feature file once, warms up the models the extractor
+ * needs (DA2 session, face cascade), then answers queries read from stdin, one
+ * per line as "<target_image> [N]". Targets that are not in the feature file
+ * are extracted with the already loaded models. Each answer is one line:
+ * "<target_image>: match_1 ... match_N (x.x ms)".
+ *
+ * A loaded (not sharded, not streamed) feature file is re-read before the next
+ * query after a SIGHUP, which Proj2-offline_loading --notify sends through the
+ * pid file written with --pid-file <path>.
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv argv[2] - feature file, argv[3] - distance metric, argv[4] - optional default N
+ * @return 0 on success, non-zero on failure.
+ */
+int run_server_mode(int argc, char *argv[]) {
+    if (argc < 4) {
+        printf("usage: %s --serve <feature_file> <distance_metric> [N] [--gallery <dir>] [--pid-file <path>]\n",
+               argv[0]);
+        print_metric_names(false);
+        return -1;
+    }
+    char *feature_file = argv[2];
+    const MetricInfo *metric = find_metric(argv[3]);
+    int default_N = argc > 4 ? atoi(argv[4]) : 5;
+    if (metric == nullptr) {
+        printf("Invalid distance metric: %s\n", argv[3]);
+        print_metric_names(false);
+        return -1;
+    }
 
-    for(size_t i = 0; i < rnnData.size(); i++) {
-        if(i == target_index) continue;
-        std::vector<float> rnn = rnnData[i];
-        std::vector<float> vec = data[i];
-        float dist1 = face_distance(rnn, targetRNN) * 0.3;
-        float dist2 = face_distance(vec, targetTexColor) * 0.7;
-        distances.push_back({dist1 + dist2, static_cast<int>(i)});
+    std::vector<char *> filenames;
+    std::vector<std::vector<float>> data;
+    std::vector<std::vector<float>> RNNdata;
+    PreparedRows prepared;
+    ShardedStore shards;
+    bool sharded = is_shard_manifest(feature_file);
+    LoadedFile loaded, before;
+    // a SIGHUP that arrives while loading forces a full reload, as rows may have been missed
+    reload_requested = 0;
+    signal(SIGHUP, request_reload);
+    stat_loaded_file(feature_file, before);
+    if (stream_mode) {
+        // nothing is loaded, every query streams the store
+        if (check_stream_mode(feature_file, *metric) != 0) {
+            return -1;
+        }
+    } else if (sharded ? load_sharded_data(feature_file, *metric, shards) != 0
+                       : load_feature_data(feature_file, *metric, filenames, data, RNNdata, prepared) != 0) {
+        return -1;
     }
+    if (!stream_mode && !sharded) {
+        finish_full_load(feature_file, before, loaded);
+    }
+    const FeatureInfo *feature = feature_for_metric(*metric);
+    if (feature && feature->warmup) {
+        feature->warmup();
+    }
+    if (stream_mode) {
+        printf("Ready: streaming %s, metric %s\n", feature_file, metric->name.c_str());
+    } else {
+        printf("Ready: %zu images, metric %s\n", sharded ? shards.rows() : data.size(), metric->name.c_str());
+    }
+    if (!pid_file_path.empty()) {
+        FILE *fp = fopen(pid_file_path.c_str(), "w");
+        if (!fp) {
+            printf("Unable to write pid file %s\n", pid_file_path.c_str());
+            return -1;
+        }
+        fprintf(fp, "%d\n", static_cast<int>(getpid()));
+        fclose(fp);
+    }
+    fflush(stdout);
+
+    char line[512];
+    while (fgets(line, sizeof(line), stdin)) {
+        char target_image[256];
+        int N = default_N;
+        if (sscanf(line, "%255s %d", target_image, &N) < 1) continue;
+        if (N <= 0) N = default_N;
+
+        // streamed stores are read afresh by every query, shards are not reloaded
+        if (reload_requested && !stream_mode && !sharded) {
+            reload_requested = 0;
+            if (refresh_feature_data(feature_file, *metric, loaded, filenames, data, RNNdata, prepared) != 0) {
+                printf("Can not refresh %s, answering from the rows already loaded\n", feature_file);
+            }
+        }
 
-    std::sort(distances.begin(), distances.end());
+        auto start = std::chrono::steady_clock::now();
+        std::vector<char *> output;
+        std::vector<std::string> streamed_names;
+        int result = stream_mode ? run_stream_query(target_image, *metric, feature_file, N, streamed_names, output)
+                     : sharded   ? run_sharded_query(target_image, *metric, shards, N, output)
+                                 : run_query(target_image, *metric, filenames, data, RNNdata, prepared, N, output);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-    output.clear();
-    for(int i = 0; i < N && i < distances.size(); i++) {
-        output.push_back(filenames[distances[i].second]);
+        if (result != 0) {
+            printf("%s: error\n", target_image);
+        } else {
+            printf("%s:", target_image);
+            for (const char *filename : output) {
+                printf(" %s", filename);
+            }
+            printf(" (%.1f ms)", ms);
+            if (!gallery_path.empty()) {
+                // one page per query, named after the target
+                std::string page = gallery_path + "/" + base_name(target_image);
+                page = page.substr(0, page.rfind('.')) + ".jpg";
+                if (write_result_page(page.c_str(), target_image, output, *metric) == 0) {
+                    printf(" -> %s", page.c_str());
+                }
+            }
+            printf("\n");
+        }
+        fflush(stdout);
+    }
+    if (!pid_file_path.empty()) {
+        remove(pid_file_path.c_str());
     }
-
     return 0;
 }
 
@@ -365,12 +1007,42 @@ int main(int argc, char *argv[]) {
     char target_image[256];
     char feature_file[256];
     int N;
-    std::string distance_metric;
+
+    // Options of the fused metrics' cascade, the gallery, streaming, the server and --stats/--trace may appear anywhere
+    if (parse_instrument_options(argc, argv) != 0 || parse_cascade_options(argc, argv) != 0 ||
+        parse_gallery_options(argc, argv) != 0 || parse_stream_options(argc, argv) != 0 ||
+        parse_server_options(argc, argv) != 0) {
+        exit(-1);
+    }
+
+    // Targets are extracted one at a time here, so the region histograms may bin on every core
+    setRegionHistogramThreads(0);
+
+    // Batch mode: many targets against one load of the feature file
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        return run_batch_mode(argc, argv) == 0 ? 0 : -1;
+    }
+    // Fusion mode: weighted sum of normalized distances from several feature files
+    if (argc > 1 && strcmp(argv[1], "--fuse") == 0) {
+        return run_fusion_mode(argc, argv) == 0 ? 0 : -1;
+    }
+    // Server mode: keep the features and models loaded and answer queries from stdin
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+        return run_server_mode(argc, argv) == 0 ? 0 : -1;
+    }
 
     // Step 1: check for sufficient arguments
     if (argc < 5) {
-        printf("usage: %s <target_image> <feature_file> <N> <distance_metric>\n", argv[0]);
-        printf("distance_metric options: ssd, rgb-hist, multi-hist, texture-color, cosine, depth, banana or face\n");
+        printf("usage: %s <target_image> <feature_file|shard_manifest> <N> <distance_metric>\n", argv[0]);
+        printf("       %s --batch <target_list> <feature_file> <N> <distance_metric> [output_csv]\n", argv[0]);
+        printf("       %s --serve <feature_file|shard_manifest> <distance_metric> [N] [--gallery <dir>] "
+               "[--pid-file <path>]\n", argv[0]);
+        printf("       %s --fuse <target_image> <N> <feature_file>:<metric>[:weight[:z|rank|raw]] ...\n", argv[0]);
+        printf("options for depth, banana and face: --prefilter <M> --weights <resnet,feature> --recall\n");
+        printf("stores larger than memory: --stream [--chunk-mb <n>] [--read-ahead <n>] (binary store, blocked-kernel metrics)\n");
+        printf("headless output: --gallery <page.jpg|page.png> --thumb <W>x<H> --columns <n> --thumbnails <pack>\n");
+        printf("instrumentation: --stats (per-stage time table on exit) --trace <out.json> (Chrome trace events)\n");
+        print_metric_names(false);
         exit(-1);
     }
 
@@ -390,64 +1062,38 @@ int main(int argc, char *argv[]) {
     }
 
     // Step 5: Get distance metric
-    distance_metric = argv[4];
-    // TODO: Add other metrics here
-
-    if (distance_metric != "ssd" && distance_metric != "rgb-hist" && distance_metric != "multi-hist" && distance_metric != "texture-color" && distance_metric != "cosine" && distance_metric != "depth" && distance_metric != "banana" && distance_metric != "face" ) {
-        printf("Invalid distance metric: %s. Must be 'ssd', 'intersection', 'multi-hist' , 'texture-color', 'cosine' or 'depth' or 'banana' or 'face'\n", argv[4]);
+    const MetricInfo *metric = find_metric(argv[4]);
+    if (metric == nullptr) {
+        printf("Invalid distance metric: %s\n", argv[4]);
+        print_metric_names(false);
         exit(-1);
     }
-    printf("Using distance metric: %s\n", distance_metric.c_str());
+    printf("Using distance metric: %s\n", metric->name.c_str());
 
     std::vector<char *> filenames;
     std::vector<std::vector<float>> data;
-    int result = read_image_data_csv(feature_file, filenames, data);
-
-    if (result != 0) {
-        printf("Can not read the image csv file: %s\n", argv[2]);
+    std::vector<std::vector<float>> RNNdata;
+    PreparedRows prepared;
+    ShardedStore shards;
+    // A shard manifest in place of the feature file: the shards are searched in parallel
+    bool sharded = is_shard_manifest(feature_file);
+    if (stream_mode) {
+        // the store is streamed from disk by the query itself
+        if (check_stream_mode(feature_file, *metric) != 0) {
+            exit(-1);
+        }
+    } else if (sharded ? load_sharded_data(feature_file, *metric, shards) != 0
+                       : load_feature_data(feature_file, *metric, filenames, data, RNNdata, prepared) != 0) {
         exit(-1);
     }
     // Step 6: process and sort the feature
     std::vector<char *> output;
     std::vector<char *> cosine_output;
-    result = -1;
-    // TODO: Add other metrics here
-    if (distance_metric == "ssd") {
-        result = find_topN_matches_ssd(target_image, filenames, data, N, output);
-    } else if (distance_metric == "rgb-hist") {
-        result = find_topN_matches_hist(target_image, filenames, data, N, output);
-    } else if (distance_metric == "multi-hist") {
-        result = find_topN_matches_multiHist(target_image, filenames, data, N, output);
-    } else if (distance_metric == "texture-color") {
-        result = find_topN_matches_textureColor(target_image, filenames, data, N, output);
-    } else if (distance_metric == "depth") { // texture-color with a depth mask
-        std::vector<std::vector<float>> RNNdata;
-        result = read_image_data_csv("../olympus/ResNet18_olym.csv", filenames, RNNdata);
-        if (result != 0) {
-            cerr << "Can not read the RNN image csv file: %s\n";
-            exit(-1);
-        }
-        result = find_topN_matches_depthDNN(target_image, filenames, data, RNNdata,N, output);
-    } else if (distance_metric == "cosine") {
-        result = find_topN_matches_cosine(target_image, filenames, data, N, output);
-    } else if (distance_metric == "banana") { // just use ssd
-        std::vector<std::vector<float>> RNNdata;
-        result = read_image_data_csv("../olympus/ResNet18_olym.csv", filenames, RNNdata);
-        if (result != 0) {
-            cerr << "Can not read the RNN image csv file: %s\n";
-            exit(-1);
-        }
-        result = find_topN_matches_banana(target_image, filenames, data, RNNdata,N, output);
-    }
-    else if (distance_metric == "face") {
-        std::vector<std::vector<float>> RNNdata;
-        result = read_image_data_csv("../olympus/ResNet18_olym.csv", filenames, RNNdata);
-        if (result != 0) {
-            cerr << "Can not read the RNN image csv file: %s\n";
-            exit(-1);
-        }
-        result = find_topN_matches_depthDNN_faces(target_image, filenames, data, RNNdata,N, output);
-    }
+    std::vector<std::string> cosine_paths;
+    std::vector<std::string> streamed_names;
+    int result = stream_mode ? run_stream_query(target_image, *metric, feature_file, N, streamed_names, output)
+                 : sharded   ? run_sharded_query(target_image, *metric, shards, N, output)
+                             : run_query(target_image, *metric, filenames, data, RNNdata, prepared, N, output);
 
     // Step 7: verify the output
     if (result != 0) {
@@ -457,22 +1103,38 @@ int main(int argc, char *argv[]) {
 
     std::cout << "Output filenames: ";
     for (const char* filename : output) {
-        if(distance_metric == "cosine" || distance_metric == "depth" || distance_metric == "banana" || distance_metric == "face")
+        if(metric->resnet_names)
         {
-            std::string fullpath = "../olympus/" + std::string(filename);
-            cosine_output.push_back(strdup(fullpath.c_str()));  // Add the path to the image since only name is provided in ResNet18.csv
+            cosine_paths.push_back(match_path(filename, *metric));  // Add the path to the image since only name is provided in ResNet18.csv
         }
         printf("%s ", filename);
     }
     std::cout << std::endl;
+    for (std::string &path : cosine_paths) {
+        cosine_output.push_back(&path[0]);
+    }
+    // Headless: render the page to a file instead of opening windows
+    if (!gallery_path.empty()) {
+        auto start = std::chrono::steady_clock::now();
+        if (write_result_page(gallery_path.c_str(), target_image, output, *metric) != 0) {
+            exit(-1);
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("Gallery written to %s (%.1f ms)\n", gallery_path.c_str(), ms);
+        return 0;
+    }
     // Display target and result image
-    cv::Mat target = cv::imread(target_image);
+    cv::Mat target;
+    {
+        INSTRUMENT_SCOPE("display");
+        target = cv::imread(target_image);
+    }
     if (target.empty()) {
         printf("Target image empty!\n");
         exit(-1);
     }
     cv::imshow("target", target);
-    if(distance_metric == "cosine" || distance_metric == "depth" || distance_metric == "banana" || distance_metric == "face")
+    if(metric->resnet_names)
     {
         displayGallery(cosine_output); //Display for cosine since different format for image directory
     }
@@ -0,0 +1,324 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 1, 2025
+ * Purpose: Scoped timers, counters and value histograms for the CLIs, with a
+ * summary table (--stats) and Chrome trace-event output (--trace)
+ */
+
+#include "../include/instrument.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+bool instrument_on = false;
+
+static const int MAX_NAMES = 256;
+static const int OVERFLOW_ID = MAX_NAMES - 1;
+// 4 buckets per power of two from 2^-17 to 2^47, so percentiles are within about 12%: spans,
+// in nanoseconds, up to about 39 hours, and values (counts, ratios) down to about 1e-5
+static const int BUCKETS_PER_OCTAVE = 4;
+static const int MIN_EXPONENT = -16;
+static const int HIST_BUCKETS = 64 * BUCKETS_PER_OCTAVE;
+// Spans kept for the trace over all threads; later spans are only summarized
+static const long TRACE_EVENT_LIMIT = 4000000;
+
+enum class NameKind : uint8_t { UNUSED, SPAN, COUNTER, VALUE };
+
+// Samples of one name on one thread; spans are in nanoseconds
+struct Stat {
+    int64_t count = 0;
+    double sum = 0;
+    double min = 0;
+    double max = 0;
+    uint32_t buckets[HIST_BUCKETS] = {0};
+};
+
+struct TraceEvent {
+    int id;
+    int64_t start_ns;
+    int64_t end_ns;
+};
+
+// Everything one thread recorded; owned by the registry so it outlives the thread
+struct ThreadRecord {
+    int tid = 0;
+    std::string name;
+    std::unique_ptr<Stat> stats[MAX_NAMES];
+    std::vector<TraceEvent> events;
+};
+
+static std::mutex registry_lock;
+static std::vector<std::string> names;
+static std::map<std::string, int> name_ids;
+static std::atomic<uint8_t> name_kind[MAX_NAMES];
+static std::vector<std::unique_ptr<ThreadRecord>> threads;
+static std::chrono::steady_clock::time_point epoch;
+static bool print_stats = false;
+static bool keep_trace = false;
+static std::string trace_path;
+static std::atomic<long> trace_events(0);
+static std::atomic<long> trace_dropped(0);
+
+static thread_local ThreadRecord *this_thread = nullptr;
+
+static ThreadRecord &thread_record() {
+    if (this_thread == nullptr) {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        threads.emplace_back(new ThreadRecord());
+        this_thread = threads.back().get();
+        this_thread->tid = static_cast<int>(threads.size());
+    }
+    return *this_thread;
+}
+
+int instrument_id(const char *name) {
+    std::lock_guard<std::mutex> guard(registry_lock);
+    auto it = name_ids.find(name);
+    if (it != name_ids.end()) return it->second;
+    if (names.empty()) names.push_back("(other)"); // id 0 is never handed out
+    if (static_cast<int>(names.size()) >= OVERFLOW_ID) return OVERFLOW_ID;
+    int id = static_cast<int>(names.size());
+    names.push_back(name);
+    name_ids[name] = id;
+    return id;
+}
+
+int64_t instrument_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+static int bucket_of(double value) {
+    if (!(value > 0)) return 0;
+    int exponent;
+    double fraction = std::frexp(value, &exponent); // value = fraction * 2^exponent, fraction in [0.5, 1)
+    int sub = static_cast<int>((fraction * 2 - 1) * BUCKETS_PER_OCTAVE);
+    int bucket = (exponent - MIN_EXPONENT) * BUCKETS_PER_OCTAVE + sub;
+    return std::min(std::max(bucket, 0), HIST_BUCKETS - 1);
+}
+
+// Middle of a bucket's range
+static double bucket_value(int bucket) {
+    int exponent = bucket / BUCKETS_PER_OCTAVE + MIN_EXPONENT;
+    int sub = bucket % BUCKETS_PER_OCTAVE;
+    return std::ldexp(1.0 + (sub + 0.5) / BUCKETS_PER_OCTAVE, exponent - 1);
+}
+
+static void add_sample(Stat &stat, double value) {
+    if (stat.count == 0 || value < stat.min) stat.min = value;
+    if (stat.count == 0 || value > stat.max) stat.max = value;
+    stat.count++;
+    stat.sum += value;
+    stat.buckets[bucket_of(value)]++;
+}
+
+static Stat &stat_for(ThreadRecord &record, int id, NameKind kind) {
+    if (id <= 0 || id >= MAX_NAMES) id = OVERFLOW_ID;
+    if (!record.stats[id]) {
+        record.stats[id].reset(new Stat());
+        uint8_t unused = static_cast<uint8_t>(NameKind::UNUSED);
+        name_kind[id].compare_exchange_strong(unused, static_cast<uint8_t>(kind));
+    }
+    return *record.stats[id];
+}
+
+void instrument_span(int id, int64_t start_ns, int64_t end_ns) {
+    ThreadRecord &record = thread_record();
+    add_sample(stat_for(record, id, NameKind::SPAN), static_cast<double>(end_ns - start_ns));
+    if (keep_trace) {
+        if (trace_events.fetch_add(1, std::memory_order_relaxed) < TRACE_EVENT_LIMIT) {
+            record.events.push_back({id, start_ns, end_ns});
+        } else {
+            trace_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+void instrument_count(int id, int64_t delta) {
+    Stat &stat = stat_for(thread_record(), id, NameKind::COUNTER);
+    stat.count++;
+    stat.sum += static_cast<double>(delta);
+}
+
+void instrument_value(int id, double value) {
+    add_sample(stat_for(thread_record(), id, NameKind::VALUE), value);
+}
+
+void instrument_thread_name(const char *name) {
+    if (!instrument_on) return;
+    thread_record().name = name;
+}
+
+// Writes the report and the trace; registered with atexit so exit(-1) paths report too
+static void instrument_finish() {
+    if (!instrument_on) return;
+    if (print_stats) {
+        fflush(stdout);
+        instrument_report(stdout);
+    }
+    if (!trace_path.empty() && instrument_write_trace(trace_path.c_str()) == 0) {
+        printf("Trace written to %s\n", trace_path.c_str());
+    }
+}
+
+void instrument_enable(bool stats, const char *path) {
+    if (instrument_on) return;
+    epoch = std::chrono::steady_clock::now();
+    print_stats = stats;
+    trace_path = path ? path : "";
+    keep_trace = !trace_path.empty();
+    instrument_on = true;
+    instrument_thread_name("main");
+    atexit(instrument_finish);
+}
+
+int parse_instrument_options(int &argc, char *argv[]) {
+    bool stats = false;
+    const char *path = nullptr;
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            if (i + 1 >= argc) {
+                printf("--trace needs an output file\n");
+                return -1;
+            }
+            path = argv[++i];
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+    if (stats || path) instrument_enable(stats, path);
+    return 0;
+}
+
+// Value below which a fraction q of the merged samples fall
+static double percentile(const Stat &stat, double q) {
+    int64_t rank = static_cast<int64_t>(std::ceil(q * stat.count));
+    int64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += stat.buckets[b];
+        if (seen >= rank && seen > 0) {
+            return std::min(stat.max, std::max(stat.min, bucket_value(b)));
+        }
+    }
+    return stat.max;
+}
+
+// Sums every thread's samples per name
+static void merge_stats(std::vector<Stat> &merged) {
+    merged.assign(MAX_NAMES, Stat());
+    for (const auto &record : threads) {
+        for (int id = 0; id < MAX_NAMES; id++) {
+            const Stat *stat = record->stats[id].get();
+            if (stat == nullptr || stat->count == 0) continue;
+            Stat &total = merged[id];
+            if (total.count == 0 || stat->min < total.min) total.min = stat->min;
+            if (total.count == 0 || stat->max > total.max) total.max = stat->max;
+            total.count += stat->count;
+            total.sum += stat->sum;
+            for (int b = 0; b < HIST_BUCKETS; b++) total.buckets[b] += stat->buckets[b];
+        }
+    }
+}
+
+void instrument_report(FILE *out) {
+    std::lock_guard<std::mutex> guard(registry_lock);
+    std::vector<Stat> merged;
+    merge_stats(merged);
+    auto name_of = [](int id) { return id < static_cast<int>(names.size()) ? names[id].c_str() : "(other)"; };
+
+    std::vector<int> spans, counters, values;
+    for (int id = 0; id < MAX_NAMES; id++) {
+        if (merged[id].count == 0) continue;
+        NameKind kind = static_cast<NameKind>(name_kind[id].load());
+        if (kind == NameKind::SPAN) spans.push_back(id);
+        else if (kind == NameKind::COUNTER) counters.push_back(id);
+        else if (kind == NameKind::VALUE) values.push_back(id);
+    }
+    std::sort(spans.begin(), spans.end(), [&](int a, int b) { return merged[a].sum > merged[b].sum; });
+
+    if (!spans.empty()) {
+        fprintf(out, "%-24s %9s %11s %10s %10s %10s %10s %10s\n", "span", "calls", "total ms", "mean us", "p50 us",
+                "p90 us", "p99 us", "max us");
+        for (int id : spans) {
+            const Stat &s = merged[id];
+            fprintf(out, "%-24s %9lld %11.2f %10.1f %10.1f %10.1f %10.1f %10.1f\n", name_of(id),
+                    static_cast<long long>(s.count), s.sum / 1e6, s.sum / s.count / 1e3, percentile(s, 0.5) / 1e3,
+                    percentile(s, 0.9) / 1e3, percentile(s, 0.99) / 1e3, s.max / 1e3);
+        }
+    }
+    if (!counters.empty()) {
+        fprintf(out, "%-24s %9s %14s\n", "counter", "updates", "total");
+        for (int id : counters) {
+            fprintf(out, "%-24s %9lld %14.0f\n", name_of(id), static_cast<long long>(merged[id].count),
+                    merged[id].sum);
+        }
+    }
+    if (!values.empty()) {
+        fprintf(out, "%-24s %9s %11s %10s %10s %10s %10s\n", "value", "count", "mean", "p50", "p90", "p99", "max");
+        for (int id : values) {
+            const Stat &s = merged[id];
+            fprintf(out, "%-24s %9lld %11.4g %10.4g %10.4g %10.4g %10.4g\n", name_of(id),
+                    static_cast<long long>(s.count), s.sum / s.count, percentile(s, 0.5), percentile(s, 0.9),
+                    percentile(s, 0.99), s.max);
+        }
+    }
+    if (trace_dropped > 0) {
+        fprintf(out, "%ld spans were not kept for the trace (limit %ld)\n", trace_dropped.load(), TRACE_EVENT_LIMIT);
+    }
+}
+
+// Writes s as a JSON string
+static void write_json_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', fp);
+        if (static_cast<unsigned char>(*s) >= 0x20) fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+int instrument_write_trace(const char *path) {
+    std::lock_guard<std::mutex> guard(registry_lock);
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to open trace file %s\n", path);
+        return -1;
+    }
+    // complete ("X") events in microseconds, plus one thread_name record per thread
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (const auto &record : threads) {
+        if (!record->name.empty()) {
+            fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+                    first ? "" : ",\n", record->tid);
+            write_json_string(fp, record->name.c_str());
+            fprintf(fp, "}}");
+            first = false;
+        }
+        for (const TraceEvent &event : record->events) {
+            fprintf(fp, "%s{\"name\":", first ? "" : ",\n");
+            write_json_string(fp, event.id < static_cast<int>(names.size()) ? names[event.id].c_str() : "(other)");
+            fprintf(fp, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", record->tid,
+                    event.start_ns / 1e3, (event.end_ns - event.start_ns) / 1e3);
+            first = false;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error writing trace file %s\n", path);
+        return -1;
+    }
+    return 0;
+}
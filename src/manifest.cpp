@@ -0,0 +1,150 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 14, 2025
+ * Purpose: Per-image manifest (path, size, mtime, content hash) kept next to a
+ * feature file so the offline tool can skip images that have not changed
+ */
+
+#include "../include/manifest.h"
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Reads a manifest file.
+ *
+ * Format: a header line "#proj2-manifest,feature=<name>,decode=<resolution>"
+ * followed by one "path,size,mtime,hash" line per image, with the hash in hex.
+ *
+ * @param filename Manifest path, usually "<feature file>.manifest".
+ * @param manifest Output entries.
+ * @param feature Output name of the feature the manifest was built for, empty if unknown.
+ * @param decode Output decode resolution of the rows (describeDecode), empty if unknown.
+ * @return 0 on success, 1 if the file does not exist, -1 if it is malformed.
+ */
+int read_manifest(const char *filename, Manifest &manifest, std::string &feature, std::string &decode) {
+    manifest.clear();
+    feature.clear();
+    decode.clear();
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        return 1;
+    }
+
+    char line[1024];
+    int status = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') continue;
+        if (line[0] == '#') {
+            // manifests from before the feature registry carry a number instead and are not reused
+            const char *header = "#proj2-manifest,feature=";
+            if (strncmp(line, header, strlen(header)) == 0) {
+                feature = line + strlen(header);
+                // manifests from before decode policies leave decode empty, which matches nothing
+                size_t decode_at = feature.find(",decode=");
+                if (decode_at != std::string::npos) {
+                    decode = feature.substr(decode_at + strlen(",decode="));
+                    feature.erase(decode_at);
+                }
+            }
+            continue;
+        }
+        // the path may contain commas, so split on the last three
+        char *fields[3];
+        char *cut = line + strlen(line);
+        int found = 0;
+        while (found < 3 && cut > line) {
+            cut--;
+            if (*cut == ',') {
+                fields[2 - found] = cut + 1;
+                *cut = '\0';
+                found++;
+            }
+        }
+        if (found < 3) {
+            fprintf(stderr, "Malformed manifest line in %s\n", filename);
+            status = -1;
+            break;
+        }
+        ManifestEntry entry;
+        entry.size = strtoll(fields[0], nullptr, 10);
+        entry.mtime = strtoll(fields[1], nullptr, 10);
+        entry.hash = strtoull(fields[2], nullptr, 16);
+        manifest[line] = entry;
+    }
+    fclose(fp);
+    return status;
+}
+
+/**
+ * @brief Flushes a stdio stream to disk and closes it.
+ *
+ * @return non-zero if any buffered data could not be written.
+ */
+int fsync_and_close(FILE *fp) {
+    int status = fflush(fp);
+    if (status == 0) {
+        status = fsync(fileno(fp));
+    }
+    if (fclose(fp) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+/**
+ * @brief Writes a manifest atomically (temporary file, fsync, rename).
+ *
+ * @param filename Manifest path.
+ * @param manifest Entries to write.
+ * @param feature Name of the feature the entries were extracted with.
+ * @param decode Decode resolution the entries were extracted at (describeDecode).
+ * @return non-zero failure.
+ */
+int write_manifest(const char *filename, const Manifest &manifest, const std::string &feature,
+                   const std::string &decode) {
+    std::string tmp_name = std::string(filename) + ".tmp";
+    FILE *fp = fopen(tmp_name.c_str(), "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to open manifest file %s\n", tmp_name.c_str());
+        return -1;
+    }
+    fprintf(fp, "#proj2-manifest,feature=%s,decode=%s\n", feature.c_str(), decode.c_str());
+    for (const auto &item : manifest) {
+        fprintf(fp, "%s,%lld,%lld,%016" PRIx64 "\n", item.first.c_str(),
+                item.second.size, item.second.mtime, item.second.hash);
+    }
+    if (fsync_and_close(fp) != 0 || rename(tmp_name.c_str(), filename) != 0) {
+        fprintf(stderr, "Unable to write manifest file %s\n", filename);
+        remove(tmp_name.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Gets the size and modification time of a file.
+ *
+ * @param path File path.
+ * @param size Output size in bytes.
+ * @param mtime Output modification time in nanoseconds.
+ * @return non-zero if the file can not be stat'ed.
+ */
+int stat_file(const char *path, long long &size, long long &mtime) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+    size = static_cast<long long>(st.st_size);
+#ifdef __APPLE__
+    mtime = static_cast<long long>(st.st_mtimespec.tv_sec) * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    mtime = static_cast<long long>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    return 0;
+}
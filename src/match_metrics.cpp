@@ -0,0 +1,552 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: January 26, 2025
+ * Purpose: Top-N ranking for each distance metric, registered with the feature registry
+ */
+#include "../include/match_metrics.h"
+#include "../include/cascade.h"
+#include "../include/distance_calculate.h"
+#include "../include/feature_registry.h"
+#include "../include/instrument.h"
+#include "../include/topn_select.h"
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+using namespace std;
+
+/*
+  Rows are abandoned against the squared N-th best distance, widened by this
+  relative margin: the partial sums are added in a different order than
+  calculate_ssd, so they may round slightly differently.
+ */
+static const float SSD_ABANDON_MARGIN = 1e-4f;
+
+/**
+ * Function to find top N matches using SSD distance
+ * @return non-zero failure
+ */
+int find_topN_matches_ssd(std::vector<float> &target_vector, int target_index, std::vector<char *> &filenames,
+                          std::vector<std::vector<float>> &data, int N, std::vector<char *> &output) {
+    // data format is
+    //  The image filename is written to the first position in the row of data.
+    //  The values in image_data are all written to the file as floats.
+    int dims = static_cast<int>(target_vector.size());
+
+    // Step1: scan the rows, keeping the N best (target_index is -1 for an external target)
+    TopNSelector best(N);
+    long abandoned = 0;
+    {
+        INSTRUMENT_SCOPE("scan");
+        for (size_t i = 0; i < data.size(); i++) {
+            if (i == target_index) {
+                continue;
+            }
+            if (static_cast<int>(data[i].size()) != dims) {
+                continue;
+            }
+            if (best.full()) {
+                // Step 2: give up on the row as soon as it cannot beat the N-th best
+                float bound = best.threshold() * best.threshold() * (1.0f + SSD_ABANDON_MARGIN);
+                if (calculate_ssd_squared_bounded(data[i].data(), target_vector.data(), dims, bound) > bound) {
+                    abandoned++;
+                    continue;
+                }
+            }
+            // survivors get the exact distance, so the ranking matches a full scan
+            best.push(calculate_ssd(data[i], target_vector), static_cast<int>(i));
+        }
+    }
+    INSTRUMENT_COUNT("rows_scanned", static_cast<int64_t>(data.size()));
+    INSTRUMENT_COUNT("ssd_rows_abandoned", abandoned);
+
+    // Step 3: get N of them and return
+    INSTRUMENT_SCOPE("select");
+    vector<pair<float, int>> distances;
+    best.sorted(distances);
+    for (const auto &match : distances) {
+        output.push_back(filenames[match.second]);
+    }
+    return 0;
+}
+
+/**
+ * Orders the dimensions by decreasing variance across the rows, so the
+ * early-abandoning SSD scan sums the largest expected differences first.
+ */
+void ssd_dimension_order(const std::vector<std::vector<float>> &data, std::vector<int> &dim_order) {
+    dim_order.clear();
+    if (data.empty()) return;
+    size_t dims = data[0].size();
+    vector<double> mean(dims, 0.0), m2(dims, 0.0);
+    long count = 0;
+    for (const auto &row : data) {
+        if (row.size() != dims) continue;
+        count++;
+        for (size_t d = 0; d < dims; d++) {
+            // Welford's update keeps the variance accurate for large files
+            double delta = row[d] - mean[d];
+            mean[d] += delta / count;
+            m2[d] += delta * (row[d] - mean[d]);
+        }
+    }
+    dim_order.resize(dims);
+    for (size_t d = 0; d < dims; d++) dim_order[d] = static_cast<int>(d);
+    std::stable_sort(dim_order.begin(), dim_order.end(), [&m2](int a, int b) { return m2[a] > m2[b]; });
+}
+
+int prepare_ssd_order(std::vector<std::vector<float>> &data, std::vector<int> &column_order) {
+    // the order of the columns as they are now, which already follow column_order after a refresh
+    std::vector<int> dim_order;
+    ssd_dimension_order(data, dim_order);
+    if (dim_order.empty()) return 0;
+    for (auto &row : data) permute_columns(dim_order, row);
+    if (column_order.size() == dim_order.size()) {
+        std::vector<int> composed(dim_order.size());
+        for (size_t d = 0; d < dim_order.size(); d++) composed[d] = column_order[dim_order[d]];
+        column_order.swap(composed);
+    } else {
+        column_order.swap(dim_order);
+    }
+    return 0;
+}
+
+/**
+ * Function to find top N matches using RGB histogram intersection
+ * @return non-zero failure
+ */
+int find_topN_matches_hist(std::vector<float> &target_vector, int target_index, std::vector<char *> &filenames,
+                               std::vector<std::vector<float>> &data, int N, std::vector<char *> &output) {
+    // Step1: calculate the corresponding distance
+    vector<pair<float, int>> distances; // Pair of distance and index
+    {
+        INSTRUMENT_SCOPE("scan");
+        for (size_t i = 0; i < data.size(); i++) {
+            if (i == target_index) {
+                continue;
+            }
+            float dist = calculate_histogramIntersection(data[i], target_vector);
+            distances.push_back({dist, static_cast<int>(i)});
+        }
+    }
+    INSTRUMENT_COUNT("rows_scanned", static_cast<int64_t>(data.size()));
+
+    // Step 2: Sort the pair,
+    INSTRUMENT_SCOPE("select");
+    sort(distances.rbegin(), distances.rend());
+
+    // Step 3: get N of them and return
+    for (int i = 0; i < N && i < distances.size(); i++) {
+        int match_index = distances[i].second;
+        output.push_back(filenames[match_index]);
+    }
+    return 0;
+}
+
+// Function to find top N matches using multi histogram distance
+
+int find_topN_matches_multiHist(std::vector<float> &target_vector, int target_index, std::vector<char *> &filenames,
+                                std::vector<std::vector<float>> &data, int N, std::vector<char *> &output) {
+    // Step1: calculate the corresponding distance
+    vector<pair<float, int>> distances; // Pair of distance and index
+    {
+        INSTRUMENT_SCOPE("scan");
+        for (size_t i = 0; i < data.size(); i++) {
+            if (i == target_index) {
+                continue;
+            }
+            float dist = calculate_multiHist_distance(data[i], target_vector);
+            distances.push_back({dist, static_cast<int>(i)});
+        }
+    }
+    INSTRUMENT_COUNT("rows_scanned", static_cast<int64_t>(data.size()));
+
+    // Step 2: Sort the pair,
+    INSTRUMENT_SCOPE("select");
+    sort(distances.begin(), distances.end());
+    // Step 3: get N of them and return
+    for (int i = 0; i < N && i < distances.size(); i++) {
+        int match_index = distances[i].second;
+        output.push_back(filenames[match_index]);
+    }
+    return 0;
+}
+
+// Values in the 8-bin RGB histogram of one region
+static const int REGION_HISTOGRAM_CELLS = 512;
+
+int find_topN_matches_regionHist(std::vector<float> &target, int target_index, std::vector<char *> &filenames,
+                                 std::vector<std::vector<float>> &data, int N, std::vector<char *> &output) {
+    int dims = static_cast<int>(target.size());
+    int regions = dims / REGION_HISTOGRAM_CELLS;
+    if (regions == 0 || dims % REGION_HISTOGRAM_CELLS != 0) {
+        cerr << "Region histogram rows have a multiple of " << REGION_HISTOGRAM_CELLS << " values, the target has "
+             << dims << endl;
+        return -1;
+    }
+    TopNSelector best(N);
+    {
+        INSTRUMENT_SCOPE("scan");
+        for (size_t i = 0; i < data.size(); i++) {
+            if (static_cast<int>(i) == target_index || static_cast<int>(data[i].size()) != dims) continue;
+            best.push(calculate_region_distance(data[i].data(), target.data(), dims, regions), static_cast<int>(i));
+        }
+    }
+    INSTRUMENT_COUNT("rows_scanned", static_cast<int64_t>(data.size()));
+
+    std::vector<std::pair<float, int>> matches;
+    best.sorted(matches);
+    for (const auto &match : matches) {
+        output.push_back(filenames[match.second]);
+    }
+    return 0;
+}
+
+/**
+ * Function to find top N matches using texture color distance
+ */
+int find_topN_matches_textureColor(std::vector<float> &target, int target_index, std::vector<char*>& filenames,
+                                   std::vector<std::vector<float>>& data, int N, std::vector<char*>& output) 
+{
+    std::vector<std::pair<float, int>> distances;
+    {
+        INSTRUMENT_SCOPE("scan");
+        for (size_t i = 0; i < data.size(); i++) {
+            if (i == target_index) continue;
+            float dist = calculate_textureColor_distance(data[i], target);
+            distances.push_back({dist, static_cast<int>(i)});
+        }
+    }
+    INSTRUMENT_COUNT("rows_scanned", static_cast<int64_t>(data.size()));
+
+    // Sort by ascending order
+    INSTRUMENT_SCOPE("select");
+    std::sort(distances.begin(), distances.end());
+
+    // Clear output vector before inserting new values
+    output.clear();
+    for (int i = 0; i < N && i < distances.size(); i++) {
+        output.push_back(filenames[distances[i].second]);
+    }
+    return 0;
+}
+
+// Function to find top N matches using cosine distance
+
+int find_topN_matches_cosine(std::vector<float> &target, int target_index, std::vector<char *> &filenames,
+                             std::vector<std::vector<float>> &data, int N,std::vector<char *> &output) 
+{
+    std::vector<std::pair<float, int>> distances;
+    {
+        INSTRUMENT_SCOPE("scan");
+        for (size_t i = 0; i < data.size(); i++) {
+            if (i == target_index) continue;
+            float dist = calculate_cosine_distance(data[i], target);
+            distances.push_back({dist, static_cast<int>(i)});
+        }
+    }
+    INSTRUMENT_COUNT("rows_scanned", static_cast<int64_t>(data.size()));
+
+    INSTRUMENT_SCOPE("select");
+    std::sort(distances.begin(), distances.end());
+    
+    output.clear();
+    for(int i = 0; i < N && i < distances.size(); i++) {
+        output.push_back(filenames[distances[i].second]);
+    }
+
+    return 0;
+}
+
+// Copies the row names of ranked (score, row) pairs to output
+static void output_matches(const std::vector<std::pair<float, int>> &matches, std::vector<char *> &filenames,
+                           std::vector<char *> &output) {
+    output.clear();
+    for (const auto &match : matches) {
+        output.push_back(filenames[match.second]);
+    }
+}
+
+static CascadeTerm make_term(TermSource source, TermDistance distance, double weight, int offset = 0) {
+    CascadeTerm term;
+    term.source = source;
+    term.distance = distance;
+    term.weight = weight;
+    term.offset = offset;
+    return term;
+}
+
+// Function to find top N matches using depth DNN distance.
+// targetRNN is empty for an external target, which has no ResNet18 embedding;
+// the ranking then uses the texture-color term alone.
+
+int find_topN_matches_depthDNN(std::vector<float> &targetTexColor, std::vector<float> &targetRNN, int target_index,
+                               std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                               std::vector<std::vector<float>> &rnnData, int N, std::vector<char *> &output) {
+
+    if (rnnData.size() != data.size()) {
+        cerr << "RNN data and data size is not the same! \n";
+        cerr << "rnn size is" << rnnData.size() << " And data size is " << data.size();
+    }
+
+    // 0.8 rnn + 0.2 texture-color; the prefilter uses the 8-bit embedding and the texture part (after 512 color bins)
+    CascadePlan plan = make_cascade_plan(
+            "depth",
+            {make_term(TermSource::EMBEDDING_Q8, TermDistance::COSINE, 0.8),
+             make_term(TermSource::FEATURE, TermDistance::HIST_DISTANCE, 0.2, 512)},
+            {make_term(TermSource::EMBEDDING, TermDistance::COSINE, 0.8),
+             make_term(TermSource::FEATURE, TermDistance::TEXTURE_COLOR, 0.2)});
+
+    std::vector<std::pair<float, int>> distances;
+    if (run_cascade(plan, targetTexColor, targetRNN, target_index, data, rnnData, N, distances) != 0) {
+        return -1;
+    }
+    output_matches(distances, filenames, output);
+    return 0;
+}
+
+int find_topN_matches_banana(std::vector<float> &target, std::vector<float> &targetRNN, int target_index,
+                             std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                             std::vector<std::vector<float>> &rnnData, int N, std::vector<char *> &output) {
+
+    if (rnnData.size() != data.size()) {
+        cerr << "RNN data and data size is not the same! \n";
+        cerr << "rnn size is" << rnnData.size() << " And data size is " << data.size();
+    }
+
+    // 0.5 blob histogram intersection + 0.5 rnn, over the rows that have a blob (last value is the blob total)
+    CascadePlan plan = make_cascade_plan(
+            "banana",
+            {make_term(TermSource::EMBEDDING_Q8, TermDistance::COSINE, 0.5),
+             make_term(TermSource::FEATURE, TermDistance::HIST_INTERSECTION, 0.5)},
+            {make_term(TermSource::EMBEDDING, TermDistance::COSINE, 0.5),
+             make_term(TermSource::FEATURE, TermDistance::HIST_INTERSECTION, 0.5)});
+    plan.skip_zero_last = true;
+
+    std::vector<std::pair<float, int>> distances;
+    if (run_cascade(plan, target, targetRNN, target_index, data, rnnData, N, distances) != 0) {
+        return -1;
+    }
+    output_matches(distances, filenames, output);
+    return 0;
+}
+
+// Function to calculate distance between two feature vectors, considering face detection
+
+float face_distance(std::vector<float>& vec1, std::vector<float>& vec2) {
+    return face_distance(vec1.data(), vec2.data(), static_cast<int>(vec1.size()));
+}
+
+float face_distance(const float *vec1, const float *vec2, int n) {
+    // Check face flags
+    bool face1 = vec1[0] > 0.5f;
+    bool face2 = vec2[0] > 0.5f;
+
+    // If either lacks face, use full distance
+    if(!face1 || !face2) return calculate_cosine_distance(vec1, vec2, n);
+
+    // If both have faces, compare only facial features
+    return calculate_cosine_distance(vec1 + 1, vec2 + 1, n - 1);
+}
+
+// Function to find top N matches using depth DNN distance and face detection
+
+int find_topN_matches_depthDNN_faces(std::vector<float> &targetTexColor, std::vector<float> &targetRNN, int target_index,
+                                     std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                                     std::vector<std::vector<float>> &rnnData, int N, std::vector<char *> &output) {
+
+    if (rnnData.size() != data.size()) {
+        cerr << "RNN data and data size is not the same! \n";
+        cerr << "rnn size is" << rnnData.size() << " And data size is " << data.size();
+    }
+
+    // 0.3 rnn + 0.7 face-masked texture-color; the prefilter compares the texture part (after the flag and 512 color bins)
+    CascadePlan plan = make_cascade_plan(
+            "face",
+            {make_term(TermSource::EMBEDDING_Q8, TermDistance::COSINE, 0.3),
+             make_term(TermSource::FEATURE, TermDistance::COSINE, 0.7, 513)},
+            {make_term(TermSource::EMBEDDING, TermDistance::FACE, 0.3),
+             make_term(TermSource::FEATURE, TermDistance::FACE, 0.7)});
+
+    std::vector<std::pair<float, int>> distances;
+    if (run_cascade(plan, targetTexColor, targetRNN, target_index, data, rnnData, N, distances) != 0) {
+        return -1;
+    }
+    output_matches(distances, filenames, output);
+    return 0;
+}
+
+// Adapters from the single-feature rankers to RankFunction
+
+static int rank_ssd(std::vector<float> &target, std::vector<float> &, int target_index, std::vector<char *> &filenames,
+                    std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &, int N,
+                    std::vector<char *> &output) {
+    return find_topN_matches_ssd(target, target_index, filenames, data, N, output);
+}
+
+static int rank_hist(std::vector<float> &target, std::vector<float> &, int target_index, std::vector<char *> &filenames,
+                     std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &, int N,
+                     std::vector<char *> &output) {
+    return find_topN_matches_hist(target, target_index, filenames, data, N, output);
+}
+
+static int rank_multiHist(std::vector<float> &target, std::vector<float> &, int target_index,
+                          std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                          std::vector<std::vector<float>> &, int N, std::vector<char *> &output) {
+    return find_topN_matches_multiHist(target, target_index, filenames, data, N, output);
+}
+
+static int rank_regionHist(std::vector<float> &target, std::vector<float> &, int target_index,
+                           std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                           std::vector<std::vector<float>> &, int N, std::vector<char *> &output) {
+    return find_topN_matches_regionHist(target, target_index, filenames, data, N, output);
+}
+
+static int rank_textureColor(std::vector<float> &target, std::vector<float> &, int target_index,
+                             std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                             std::vector<std::vector<float>> &, int N, std::vector<char *> &output) {
+    return find_topN_matches_textureColor(target, target_index, filenames, data, N, output);
+}
+
+static int rank_cosine(std::vector<float> &target, std::vector<float> &, int target_index,
+                       std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                       std::vector<std::vector<float>> &, int N, std::vector<char *> &output) {
+    return find_topN_matches_cosine(target, target_index, filenames, data, N, output);
+}
+
+static int prepare_ssd(std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &,
+                       PreparedRows &prepared) {
+    return prepare_ssd_order(data, prepared.column_order);
+}
+
+static int prepare_fused(std::vector<std::vector<float>> &data, std::vector<std::vector<float>> &rnnData,
+                         PreparedRows &) {
+    return prepare_cascade(data, rnnData);
+}
+
+// Metric registry entries
+
+static MetricRegistrar ssd_metric([] {
+    MetricInfo info;
+    info.name = "ssd";
+    info.feature = "7x7-square";
+    info.description = "sum of squared differences";
+    info.batch = true;
+    info.batch_metric = BatchMetric::SSD;
+    info.rank = rank_ssd;
+    info.prepare = prepare_ssd;
+    return info;
+}());
+
+static MetricRegistrar rgb_histogram_metric([] {
+    MetricInfo info;
+    info.name = "rgb-hist";
+    info.feature = "rgb-hist";
+    info.description = "RGB histogram intersection";
+    info.batch = true;
+    info.batch_metric = BatchMetric::HISTOGRAM;
+    info.rank = rank_hist;
+    return info;
+}());
+
+static MetricRegistrar multi_histogram_metric([] {
+    MetricInfo info;
+    info.name = "multi-hist";
+    info.feature = "multi-hist";
+    info.description = "top/bottom histogram intersection";
+    info.batch = true;
+    info.batch_metric = BatchMetric::HISTOGRAM;
+    info.rank = rank_multiHist;
+    return info;
+}());
+
+static MetricRegistrar grid_2x2_metric([] {
+    MetricInfo info;
+    info.name = "grid-2x2";
+    info.feature = "grid-2x2";
+    info.description = "mean histogram intersection over a 2x2 grid";
+    info.batch = true;
+    info.batch_metric = BatchMetric::HISTOGRAM;
+    info.rank = rank_regionHist;
+    return info;
+}());
+
+static MetricRegistrar grid_3x3_metric([] {
+    MetricInfo info;
+    info.name = "grid-3x3";
+    info.feature = "grid-3x3";
+    info.description = "mean histogram intersection over a 3x3 grid";
+    info.batch = true;
+    info.batch_metric = BatchMetric::HISTOGRAM;
+    info.rank = rank_regionHist;
+    return info;
+}());
+
+static MetricRegistrar center_surround_metric([] {
+    MetricInfo info;
+    info.name = "center-surround";
+    info.feature = "center-surround";
+    info.description = "center and surround histogram intersection";
+    info.batch = true;
+    info.batch_metric = BatchMetric::HISTOGRAM;
+    info.rank = rank_regionHist;
+    return info;
+}());
+
+static MetricRegistrar texture_color_metric([] {
+    MetricInfo info;
+    info.name = "texture-color";
+    info.feature = "texture-color";
+    info.description = "color and gradient histogram intersection";
+    info.batch = true;
+    info.batch_metric = BatchMetric::HISTOGRAM;
+    info.rank = rank_textureColor;
+    return info;
+}());
+
+static MetricRegistrar cosine_metric([] {
+    MetricInfo info;
+    info.name = "cosine";
+    info.description = "cosine distance of the precomputed ResNet18 embeddings";
+    info.resnet_names = true;
+    info.batch = true;
+    info.batch_metric = BatchMetric::COSINE;
+    info.rank = rank_cosine;
+    return info;
+}());
+
+static MetricRegistrar depth_metric([] {
+    MetricInfo info;
+    info.name = "depth";
+    info.feature = "depth";
+    info.description = "0.8 ResNet18 cosine + 0.2 depth-masked texture-color";
+    info.resnet_names = true;
+    info.fused_resnet = true;
+    info.rank = find_topN_matches_depthDNN;
+    info.prepare = prepare_fused;
+    return info;
+}());
+
+static MetricRegistrar banana_metric([] {
+    MetricInfo info;
+    info.name = "banana";
+    info.feature = "banana";
+    info.description = "0.5 ResNet18 cosine + 0.5 yellow blob histogram";
+    info.resnet_names = true;
+    info.fused_resnet = true;
+    info.rank = find_topN_matches_banana;
+    info.prepare = prepare_fused;
+    return info;
+}());
+
+static MetricRegistrar face_metric([] {
+    MetricInfo info;
+    info.name = "face";
+    info.feature = "face";
+    info.description = "0.3 ResNet18 cosine + 0.7 face-masked texture-color";
+    info.resnet_names = true;
+    info.fused_resnet = true;
+    info.rank = find_topN_matches_depthDNN_faces;
+    info.prepare = prepare_fused;
+    return info;
+}());
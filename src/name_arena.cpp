@@ -0,0 +1,161 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 6, 2025
+ * Purpose: File names of a loaded feature file stored back to back in one
+ * block, addressed by 32-bit row ids
+ */
+
+#include "../include/name_arena.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+
+uint32_t NameArena::add(const char *name, size_t length) {
+    offsets_.push_back(bytes_.size());
+    bytes_.insert(bytes_.end(), name, name + length);
+    bytes_.push_back('\0');
+    return static_cast<uint32_t>(offsets_.size() - 1);
+}
+
+void NameArena::reserve(size_t names, size_t bytes) {
+    offsets_.reserve(names);
+    bytes_.reserve(bytes);
+}
+
+// Buckets smaller than this are sorted by comparing names
+static const size_t RADIX_CUTOFF = 64;
+// Sorts of at least this many names spread their first-level buckets over threads
+static const size_t PARALLEL_RADIX_MIN = 1 << 16;
+
+/*
+  Spreads ids, whose names agree on their first depth bytes, into buckets by
+  the byte at depth, keeping id order within a bucket. Bucket 0 holds the
+  names that end there. Bytes every name shares are skipped, so depth may
+  come back larger. Returns false when the names are all equal.
+ */
+static bool partition_names(const NameArena &arena, uint32_t *ids, uint32_t *scratch, size_t count, size_t &depth,
+                            size_t bounds[257]) {
+    size_t counts[256];
+    for (;;) {
+        memset(counts, 0, sizeof(counts));
+        for (size_t i = 0; i < count; i++) {
+            counts[static_cast<unsigned char>(arena.name(ids[i])[depth])]++;
+        }
+        if (counts[0] == count) return false;
+        bool shared = false;
+        for (int b = 1; b < 256; b++) {
+            if (counts[b] == count) shared = true;
+        }
+        if (!shared) break;
+        depth++;
+    }
+    bounds[0] = 0;
+    for (int b = 0; b < 256; b++) bounds[b + 1] = bounds[b] + counts[b];
+    size_t next[256];
+    memcpy(next, bounds, sizeof(next));
+    for (size_t i = 0; i < count; i++) {
+        scratch[next[static_cast<unsigned char>(arena.name(ids[i])[depth])]++] = ids[i];
+    }
+    memcpy(ids, scratch, count * sizeof(uint32_t));
+    return true;
+}
+
+// Stable MSD radix sort of ids whose names agree on their first depth bytes
+static void radix_sort_names(const NameArena &arena, uint32_t *ids, uint32_t *scratch, size_t count, size_t depth) {
+    if (count < RADIX_CUTOFF) {
+        std::stable_sort(ids, ids + count, [&arena, depth](uint32_t a, uint32_t b) {
+            return strcmp(arena.name(a) + depth, arena.name(b) + depth) < 0;
+        });
+        return;
+    }
+    size_t bounds[257];
+    if (!partition_names(arena, ids, scratch, count, depth, bounds)) return;
+    for (int b = 1; b < 256; b++) {
+        radix_sort_names(arena, ids + bounds[b], scratch + bounds[b], bounds[b + 1] - bounds[b], depth + 1);
+    }
+}
+
+void NameArena::sorted_ids(std::vector<uint32_t> &ids) const {
+    ids.resize(offsets_.size());
+    for (uint32_t i = 0; i < ids.size(); i++) ids[i] = i;
+    // files written by this project come out sorted; one pass confirms it
+    bool sorted = true;
+    for (uint32_t i = 1; i < ids.size() && sorted; i++) {
+        sorted = strcmp(name(i - 1), name(i)) <= 0;
+    }
+    if (sorted) return;
+
+    std::vector<uint32_t> scratch(ids.size());
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    if (ids.size() < PARALLEL_RADIX_MIN || threads < 2) {
+        radix_sort_names(*this, ids.data(), scratch.data(), ids.size(), 0);
+        return;
+    }
+    // split once here, then sort the buckets on every core
+    size_t depth = 0;
+    size_t bounds[257];
+    if (!partition_names(*this, ids.data(), scratch.data(), ids.size(), depth, bounds)) return;
+    std::atomic<int> next(1);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            for (int b = next++; b < 256; b = next++) {
+                radix_sort_names(*this, ids.data() + bounds[b], scratch.data() + bounds[b], bounds[b + 1] - bounds[b],
+                                 depth + 1);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+// Retained arenas, keyed by the address of their first byte; loaders run on several threads
+static std::mutex arenas_mutex;
+static std::list<NameArena> arenas;
+static std::map<const char *, std::list<NameArena>::iterator> arena_starts;
+
+const NameArena &retain_name_arena(NameArena &&arena) {
+    std::lock_guard<std::mutex> lock(arenas_mutex);
+    arenas.push_back(std::move(arena));
+    auto retained = std::prev(arenas.end());
+    retained->bytes_.shrink_to_fit();
+    if (!retained->bytes_.empty()) {
+        arena_starts[retained->bytes_.data()] = retained;
+    }
+    return *retained;
+}
+
+void adopt_names(NameArena &&arena, const std::vector<uint32_t> &ids, std::vector<char *> &filenames) {
+    const NameArena &retained = retain_name_arena(std::move(arena));
+    filenames.clear();
+    if (ids.empty()) {
+        filenames.reserve(retained.size());
+        for (uint32_t id = 0; id < retained.size(); id++) {
+            filenames.push_back(const_cast<char *>(retained.name(id)));
+        }
+        return;
+    }
+    filenames.reserve(ids.size());
+    for (uint32_t id : ids) {
+        filenames.push_back(const_cast<char *>(retained.name(id)));
+    }
+}
+
+void release_names(const std::vector<char *> &filenames) {
+    std::lock_guard<std::mutex> lock(arenas_mutex);
+    for (const char *name : filenames) {
+        // the arena that starts at or before the name, if the name is inside it
+        auto start = arena_starts.upper_bound(name);
+        if (start == arena_starts.begin()) continue;
+        --start;
+        const NameArena &arena = *start->second;
+        if (name >= start->first + arena.bytes()) continue;
+        arenas.erase(start->second);
+        arena_starts.erase(start);
+    }
+}
@@ -0,0 +1,254 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 16, 2025
+ * Purpose: Append-only key -> blob pack file, read through a memory mapping
+ */
+
+#include "../include/pack_file.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char PACK_MAGIC[8] = {'P', '2', 'P', 'A', 'C', 'K', '0', '1'};
+static const uint64_t RECORD_HEADER = 3 * sizeof(uint64_t);
+
+static uint64_t pad8(uint64_t n) {
+    return (n + 7) & ~static_cast<uint64_t>(7);
+}
+
+// pwrite the whole buffer, retrying short writes
+static int write_all(int fd, const void *data, size_t length, uint64_t offset) {
+    const char *p = static_cast<const char *>(data);
+    while (length > 0) {
+        ssize_t n = pwrite(fd, p, length, static_cast<off_t>(offset));
+        if (n <= 0) return -1;
+        p += n;
+        length -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return 0;
+}
+
+/**
+ * @brief Opens (and with writable, creates) a pack.
+ *
+ * @param path Record file path.
+ * @param writable Whether append() will be used.
+ * @return non-zero failure.
+ */
+int PackFile::open(const char *path, bool writable) {
+    close();
+    std::lock_guard<std::mutex> lock(mutex_);
+    path_ = path;
+    writable_ = writable;
+
+    fd_ = ::open(path, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if (fd_ < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        fprintf(stderr, "Can not stat %s\n", path);
+        close_locked();
+        return -1;
+    }
+    file_size_ = static_cast<uint64_t>(st.st_size);
+
+    if (file_size_ == 0 && writable) {
+        if (write_all(fd_, PACK_MAGIC, sizeof(PACK_MAGIC), 0) != 0) {
+            fprintf(stderr, "Can not write %s\n", path);
+            close_locked();
+            return -1;
+        }
+        file_size_ = sizeof(PACK_MAGIC);
+    }
+    char magic[8];
+    if (file_size_ < sizeof(magic) || pread(fd_, magic, sizeof(magic), 0) != sizeof(magic) ||
+        memcmp(magic, PACK_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s is not a pack file\n", path);
+        close_locked();
+        return -1;
+    }
+
+    // Load the index; fall back to scanning the records if it is behind
+    std::string index_path = path_ + ".idx";
+    index_fd_ = ::open(index_path.c_str(), writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    uint64_t covered = sizeof(PACK_MAGIC);
+    if (index_fd_ >= 0) {
+        if (fstat(index_fd_, &st) != 0) {
+            fprintf(stderr, "Can not stat %s\n", index_path.c_str());
+            close_locked();
+            return -1;
+        }
+        size_t entries = static_cast<size_t>(st.st_size) / (4 * sizeof(uint64_t));
+        std::vector<uint64_t> raw(entries * 4);
+        if (entries > 0 && pread(index_fd_, raw.data(), raw.size() * sizeof(uint64_t), 0) ==
+                           static_cast<ssize_t>(raw.size() * sizeof(uint64_t))) {
+            for (size_t i = 0; i < entries; i++) {
+                const uint64_t *e = &raw[i * 4];
+                if (e[2] + e[3] > file_size_) break; // index points past the data, stop trusting it
+                index_[{e[0], e[1]}] = {e[2], e[3]};
+                covered = std::max(covered, pad8(e[2] + e[3]));
+            }
+        }
+    }
+    if (covered != file_size_ && rebuild_index() != 0) {
+        fprintf(stderr, "Can not rebuild the index of %s\n", path);
+        close_locked();
+        return -1;
+    }
+    map_to(file_size_);
+    return 0;
+}
+
+/*
+  Scans every record and rewrites the index. Used when the index is missing or
+  when a run was interrupted between writing a record and its index entry.
+ */
+int PackFile::rebuild_index() {
+    index_.clear();
+    uint64_t offset = sizeof(PACK_MAGIC);
+    std::vector<uint64_t> raw;
+    while (offset + RECORD_HEADER <= file_size_) {
+        uint64_t header[3];
+        if (pread(fd_, header, sizeof(header), static_cast<off_t>(offset)) != sizeof(header)) break;
+        uint64_t payload = offset + RECORD_HEADER;
+        if (payload + header[2] > file_size_) break; // truncated record at the tail
+        index_[{header[0], header[1]}] = {payload, header[2]};
+        raw.insert(raw.end(), {header[0], header[1], payload, header[2]});
+        offset = pad8(payload + header[2]);
+    }
+    if (offset != file_size_ && writable_) {
+        // drop a partially written tail record
+        if (ftruncate(fd_, static_cast<off_t>(offset)) != 0) return -1;
+        file_size_ = offset;
+    }
+    if (writable_ && index_fd_ >= 0) {
+        if (ftruncate(index_fd_, 0) != 0) return -1;
+        if (!raw.empty() && write_all(index_fd_, raw.data(), raw.size() * sizeof(uint64_t), 0) != 0) return -1;
+    }
+    return 0;
+}
+
+/*
+  Makes sure the mapping covers [0, end) of the record file. It grows to at
+  least twice its size, past the end of the file, so appends seldom remap; the
+  old mapping is kept if a new one can not be made.
+ */
+bool PackFile::map_to(uint64_t end) {
+    if (map_ && map_size_ >= end) return true;
+    if (end == 0) return false;
+    size_t size = std::max(static_cast<size_t>(end), 2 * map_size_);
+    void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) return false;
+    if (map_) munmap(map_, map_size_);
+    map_ = static_cast<unsigned char *>(p);
+    map_size_ = size;
+    return true;
+}
+
+void PackFile::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    close_locked();
+}
+
+void PackFile::close_locked() {
+    if (map_) munmap(map_, map_size_);
+    map_ = nullptr;
+    map_size_ = 0;
+    if (fd_ >= 0) ::close(fd_);
+    if (index_fd_ >= 0) ::close(index_fd_);
+    fd_ = -1;
+    index_fd_ = -1;
+    file_size_ = 0;
+    index_.clear();
+}
+
+size_t PackFile::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.size();
+}
+
+bool PackFile::contains(uint64_t key_a, uint64_t key_b) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.count({key_a, key_b}) > 0;
+}
+
+/**
+ * @brief Points into the mapped blob stored under a key, without copying.
+ *
+ * @return false if the key is not in the pack.
+ */
+bool PackFile::lookup_view(uint64_t key_a, uint64_t key_b, const unsigned char *&data, size_t &length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find({key_a, key_b});
+    if (it == index_.end()) return false;
+    if (!map_ || it->second.offset + it->second.length > map_size_) return false;
+    data = map_ + it->second.offset;
+    length = static_cast<size_t>(it->second.length);
+    return true;
+}
+
+/**
+ * @brief Copies the blob stored under a key.
+ *
+ * @return false if the key is not in the pack.
+ */
+bool PackFile::lookup(uint64_t key_a, uint64_t key_b, std::vector<unsigned char> &out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find({key_a, key_b});
+    if (it == index_.end()) return false;
+    if (!map_ || it->second.offset + it->second.length > map_size_) return false;
+    const unsigned char *p = map_ + it->second.offset;
+    out.assign(p, p + it->second.length);
+    return true;
+}
+
+/**
+ * @brief Appends a blob under a key.
+ *
+ * A record whose index entry can not be written is still readable, but the
+ * index is then behind and is rebuilt by the next open().
+ *
+ * @return non-zero failure.
+ */
+int PackFile::append(uint64_t key_a, uint64_t key_b, const void *data, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!writable_ || fd_ < 0) return -1;
+
+    uint64_t header[3] = {key_a, key_b, static_cast<uint64_t>(length)};
+    uint64_t offset = file_size_;
+    uint64_t payload = offset + RECORD_HEADER;
+    uint64_t end = pad8(payload + length);
+    static const char zeros[8] = {0};
+    if (write_all(fd_, header, sizeof(header), offset) != 0 ||
+        write_all(fd_, data, length, payload) != 0 ||
+        write_all(fd_, zeros, static_cast<size_t>(end - payload - length), payload + length) != 0) {
+        return -1;
+    }
+    file_size_ = end;
+    // only append remaps, so a lookup never moves the blobs earlier lookups point into
+    if (!map_to(end)) return -1;
+    index_[{key_a, key_b}] = {payload, static_cast<uint64_t>(length)};
+
+    // the index entry goes last, so a crash never indexes a half-written record
+    if (index_fd_ < 0) return 0;
+    uint64_t entry[4] = {key_a, key_b, payload, static_cast<uint64_t>(length)};
+    struct stat st;
+    if (fstat(index_fd_, &st) != 0) {
+        return -1;
+    }
+    // after the last whole entry, so an earlier short write does not shift every later one
+    uint64_t index_end = static_cast<uint64_t>(st.st_size) - static_cast<uint64_t>(st.st_size) % sizeof(entry);
+    if (write_all(index_fd_, entry, sizeof(entry), index_end) != 0) {
+        if (ftruncate(index_fd_, static_cast<off_t>(index_end)) != 0) {
+            fprintf(stderr, "Can not truncate the index of %s\n", path_.c_str());
+        }
+        return -1;
+    }
+    return 0;
+}
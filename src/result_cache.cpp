@@ -0,0 +1,131 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 16, 2025
+ * Purpose: Content-addressed on-disk cache for expensive intermediate results
+ * (DA2 depth maps, face rectangles), keyed by image content and model version
+ */
+
+#include "../include/result_cache.h"
+#include "../include/content_hash.h"
+#include "../include/pack_file.h"
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+
+static PackFile depth_pack;
+static PackFile face_pack;
+static bool cache_enabled = false;
+
+/**
+ * @brief Enables the cache, stored as depth.pack and faces.pack in a directory.
+ *
+ * @param dir Cache directory, created if needed. nullptr disables the cache.
+ * @return non-zero if the packs can not be opened.
+ */
+int setResultCacheDir(const char *dir) {
+    depth_pack.close();
+    face_pack.close();
+    cache_enabled = false;
+    if (dir == nullptr) {
+        return 0;
+    }
+
+    mkdir(dir, 0755); // fine if it already exists
+    std::string base(dir);
+    if (!base.empty() && base.back() != '/') base += '/';
+    if (depth_pack.open((base + "depth.pack").c_str(), true) != 0 ||
+        face_pack.open((base + "faces.pack").c_str(), true) != 0) {
+        fprintf(stderr, "Unable to open result cache in %s\n", dir);
+        depth_pack.close();
+        face_pack.close();
+        return -1;
+    }
+    cache_enabled = true;
+    printf("Result cache %s: %zu depth maps, %zu face lists\n", dir, depth_pack.size(), face_pack.size());
+    return 0;
+}
+
+bool resultCacheEnabled() {
+    return cache_enabled;
+}
+
+/**
+ * @brief Hashes the pixels of an image together with its size and type.
+ */
+uint64_t hashImageContent(const cv::Mat &image) {
+    int shape[3] = {image.rows, image.cols, image.type()};
+    uint64_t hash = hash_bytes(shape, sizeof(shape));
+    const size_t row_bytes = image.cols * image.elemSize();
+    for (int i = 0; i < image.rows; i++) {
+        hash = hash_bytes(image.ptr<uchar>(i), row_bytes, hash);
+    }
+    return hash;
+}
+
+/**
+ * @brief Identifies a model: the hash of the model file contents mixed with a
+ *        pipeline version that is bumped when pre/post processing changes.
+ *        The file is hashed once per process.
+ */
+uint64_t modelVersion(const char *model_path, int pipeline_version) {
+    static std::mutex mutex;
+    static std::map<std::string, uint64_t> file_hashes;
+
+    uint64_t file_hash;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = file_hashes.find(model_path);
+        if (it == file_hashes.end()) {
+            if (hash_file_contents(model_path, file_hash) != 0) {
+                file_hash = hash_bytes(model_path, strlen(model_path)); // fall back to the path
+            }
+            file_hashes[model_path] = file_hash;
+        } else {
+            file_hash = it->second;
+        }
+    }
+    return hash_bytes(&pipeline_version, sizeof(pipeline_version), file_hash);
+}
+
+bool lookupCachedDepth(uint64_t image_hash, uint64_t model_version, cv::Mat &depth) {
+    if (!cache_enabled) return false;
+    std::vector<unsigned char> png;
+    if (!depth_pack.lookup(image_hash, model_version, png)) return false;
+    depth = cv::imdecode(png, cv::IMREAD_UNCHANGED);
+    return !depth.empty();
+}
+
+int storeCachedDepth(uint64_t image_hash, uint64_t model_version, const cv::Mat &depth) {
+    if (!cache_enabled) return -1;
+    std::vector<unsigned char> png;
+    if (!cv::imencode(".png", depth, png)) return -1;
+    return depth_pack.append(image_hash, model_version, png.data(), png.size());
+}
+
+bool lookupCachedFaces(uint64_t image_hash, uint64_t model_version, std::vector<cv::Rect> &faces) {
+    if (!cache_enabled) return false;
+    std::vector<unsigned char> raw;
+    if (!face_pack.lookup(image_hash, model_version, raw) || raw.size() % (4 * sizeof(int32_t)) != 0) {
+        return false;
+    }
+    faces.clear();
+    for (size_t off = 0; off < raw.size(); off += 4 * sizeof(int32_t)) {
+        int32_t r[4];
+        memcpy(r, &raw[off], sizeof(r));
+        faces.push_back(cv::Rect(r[0], r[1], r[2], r[3]));
+    }
+    return true;
+}
+
+int storeCachedFaces(uint64_t image_hash, uint64_t model_version, const std::vector<cv::Rect> &faces) {
+    if (!cache_enabled) return -1;
+    std::vector<int32_t> raw;
+    for (const cv::Rect &face : faces) {
+        raw.insert(raw.end(), {face.x, face.y, face.width, face.height});
+    }
+    // an empty list is a valid result ("no faces") and is cached too
+    return face_pack.append(image_hash, model_version, raw.data(), raw.size() * sizeof(int32_t));
+}
@@ -0,0 +1,689 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 5, 2025
+ * Purpose: Log-structured feature store: immutable sorted segments, a small
+ * mutable tail, tombstones for deleted images and a compactor that merges
+ * segments, listed in a versioned manifest
+ */
+
+#include "../include/segment_store.h"
+#include "../include/feature_store.h"
+#include "../include/instrument.h"
+#include "../include/manifest.h"
+#include "../include/name_arena.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+static const char *SEGMENT_HEADER = "#proj2-segments,";
+// A reader that keeps losing its snapshot to compactions gives up after this many tries
+static const int SNAPSHOT_ATTEMPTS = 8;
+
+bool is_segment_manifest(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return false;
+    char line[64] = {0};
+    bool match = fgets(line, sizeof(line), fp) && strncmp(line, SEGMENT_HEADER, strlen(SEGMENT_HEADER)) == 0;
+    fclose(fp);
+    return match;
+}
+
+bool is_segment_store_path(const char *path) {
+    size_t length = strlen(path);
+    if (length > 4 && strcmp(path + length - 4, ".lsm") == 0) {
+        return true;
+    }
+    return is_segment_manifest(path);
+}
+
+// Path of a file listed in the manifest, which is relative to the manifest's directory
+static std::string store_file(const char *manifest_path, const std::string &name) {
+    const char *slash = strrchr(manifest_path, '/');
+    if (name[0] == '/' || slash == nullptr) {
+        return name;
+    }
+    return std::string(manifest_path, slash + 1) + name;
+}
+
+// data/fv4.lsm -> fv4.<kind><number><extension>, next to the manifest
+static std::string new_file_name(const char *manifest_path, const char *kind, int number, const char *extension) {
+    const char *slash = strrchr(manifest_path, '/');
+    std::string stem = slash ? slash + 1 : manifest_path;
+    size_t dot = stem.rfind('.');
+    if (dot != std::string::npos && dot > 0) stem.resize(dot);
+    return stem + "." + kind + std::to_string(number) + extension;
+}
+
+int read_segment_manifest(const char *path, SegmentManifest &manifest) {
+    manifest = SegmentManifest();
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return 1;
+    }
+
+    char line[1024];
+    unsigned long long version = 0;
+    if (!fgets(line, sizeof(line), fp) ||
+        sscanf(line, "#proj2-segments,version=%llu,next=%d,cols=%d", &version, &manifest.next, &manifest.cols) != 3 ||
+        manifest.next < 0 || manifest.cols < 0) {
+        fprintf(stderr, "%s is not a segment manifest\n", path);
+        fclose(fp);
+        return -1;
+    }
+    manifest.version = version;
+
+    int status = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        // segment,store,tombstones or tail,log; "-" for a missing file
+        char *kind = line;
+        char *first = strchr(line, ',');
+        if (first) *first++ = '\0';
+        char *second = first ? strchr(first, ',') : nullptr;
+        if (second) *second++ = '\0';
+        if (strcmp(kind, "segment") == 0 && first && second) {
+            SegmentFiles segment;
+            segment.store = strcmp(first, "-") == 0 ? "" : first;
+            segment.tombstones = strcmp(second, "-") == 0 ? "" : second;
+            manifest.segments.push_back(segment);
+        } else if (strcmp(kind, "tail") == 0 && first && *first && !second && manifest.tail.empty()) {
+            manifest.tail = first;
+        } else {
+            fprintf(stderr, "Malformed segment manifest line in %s\n", path);
+            status = -1;
+            break;
+        }
+    }
+    fclose(fp);
+    if (status == 0 && manifest.tail.empty()) {
+        fprintf(stderr, "%s has no tail\n", path);
+        status = -1;
+    }
+    return status;
+}
+
+int write_segment_manifest(const char *path, const SegmentManifest &manifest) {
+    // the writer and a compactor may both replace the manifest, under the manifest lock
+    std::string tmp_name = std::string(path) + "." + std::to_string(getpid()) + ".tmp";
+    FILE *fp = fopen(tmp_name.c_str(), "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to open segment manifest %s\n", tmp_name.c_str());
+        return -1;
+    }
+    fprintf(fp, "%sversion=%llu,next=%d,cols=%d\n", SEGMENT_HEADER, (unsigned long long) manifest.version,
+            manifest.next, manifest.cols);
+    for (const SegmentFiles &segment : manifest.segments) {
+        fprintf(fp, "segment,%s,%s\n", segment.store.empty() ? "-" : segment.store.c_str(),
+                segment.tombstones.empty() ? "-" : segment.tombstones.c_str());
+    }
+    fprintf(fp, "tail,%s\n", manifest.tail.c_str());
+    if (fsync_and_close(fp) != 0 || rename(tmp_name.c_str(), path) != 0) {
+        fprintf(stderr, "Unable to write segment manifest %s\n", path);
+        remove(tmp_name.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+// Exclusive flock on <manifest>.lock, held while the manifest is read, changed and replaced
+class ManifestLock {
+public:
+    explicit ManifestLock(const char *manifest_path) {
+        std::string lock_path = std::string(manifest_path) + ".lock";
+        fd_ = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ >= 0 && flock(fd_, LOCK_EX) != 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        if (fd_ < 0) fprintf(stderr, "Unable to lock %s\n", lock_path.c_str());
+    }
+    ~ManifestLock() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+    bool ok() const { return fd_ >= 0; }
+
+private:
+    int fd_ = -1;
+};
+
+// Removes the files of a manifest version that a newer version no longer lists
+static void remove_files(const char *manifest_path, const std::vector<std::string> &files) {
+    for (const std::string &file : files) {
+        if (!file.empty()) ::remove(store_file(manifest_path, file).c_str());
+    }
+}
+
+/*
+  One layer of a snapshot: rows sorted by name, and the names it deletes from
+  older layers. A name is never both in rows and deleted in the same layer.
+ */
+struct SegmentLayer {
+    std::vector<char *> names;
+    std::vector<std::vector<float>> rows;
+    std::set<std::string> deleted;
+    size_t live = 0; // rows merge_layers took from this layer
+};
+
+static int read_tombstones(const std::string &path, std::set<std::string> &deleted) {
+    FILE *fp = fopen(path.c_str(), "r");
+    if (!fp) {
+        return -1;
+    }
+    char *line = nullptr;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, fp)) > 0) {
+        if (line[length - 1] == '\n') line[--length] = '\0';
+        if (length > 0) deleted.insert(line);
+    }
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+/*
+  Replays a tail log into the newest state per name. A line without its
+  newline is still being written and is left for the next read.
+ */
+static int read_tail(const std::string &path, std::map<std::string, std::vector<float>> &puts,
+                     std::set<std::string> &deletes) {
+    FILE *fp = fopen(path.c_str(), "r");
+    if (!fp) {
+        return -1;
+    }
+    char *line = nullptr;
+    size_t capacity = 0;
+    ssize_t length;
+    int status = 0;
+    while ((length = getline(&line, &capacity, fp)) > 0) {
+        if (line[length - 1] != '\n') break;
+        line[--length] = '\0';
+        if (line[0] == '-' && length > 1) {
+            puts.erase(line + 1);
+            deletes.insert(line + 1);
+            continue;
+        }
+        char *comma = line[0] == '+' ? strchr(line, ',') : nullptr;
+        if (comma == nullptr || comma == line + 1) {
+            fprintf(stderr, "Malformed tail line in %s\n", path.c_str());
+            status = -1;
+            break;
+        }
+        *comma = '\0';
+        std::vector<float> values;
+        for (char *p = comma + 1; *p;) {
+            char *end;
+            values.push_back(strtof(p, &end));
+            if (end == p || (*end != ',' && *end != '\0')) {
+                status = -1;
+                break;
+            }
+            p = *end == ',' ? end + 1 : end;
+        }
+        if (status != 0) {
+            fprintf(stderr, "Malformed tail line in %s\n", path.c_str());
+            break;
+        }
+        deletes.erase(line + 1);
+        puts[line + 1] = std::move(values);
+    }
+    free(line);
+    fclose(fp);
+    return status;
+}
+
+// Turns the replayed tail into a layer
+static void tail_layer(std::map<std::string, std::vector<float>> &puts, std::set<std::string> &deletes,
+                       SegmentLayer &layer) {
+    NameArena names;
+    for (auto &item : puts) {
+        names.add(item.first.c_str(), item.first.size());
+        layer.rows.push_back(std::move(item.second));
+    }
+    adopt_names(std::move(names), std::vector<uint32_t>(), layer.names);
+    layer.deleted.swap(deletes);
+}
+
+// Reads every layer of one manifest version, oldest first; non-zero if a file is missing or unreadable
+static int read_layers(const char *manifest_path, const SegmentManifest &manifest, bool with_tail,
+                       std::vector<SegmentLayer> &layers) {
+    layers.assign(manifest.segments.size() + (with_tail ? 1 : 0), SegmentLayer());
+    for (size_t s = 0; s < manifest.segments.size(); s++) {
+        const SegmentFiles &segment = manifest.segments[s];
+        // segments are written sorted, so the reader keeps their order
+        if (!segment.store.empty() &&
+            read_feature_store(store_file(manifest_path, segment.store).c_str(), layers[s].names, layers[s].rows) != 0) {
+            return -1;
+        }
+        if (!segment.tombstones.empty() &&
+            read_tombstones(store_file(manifest_path, segment.tombstones), layers[s].deleted) != 0) {
+            return -1;
+        }
+    }
+    if (with_tail) {
+        std::map<std::string, std::vector<float>> puts;
+        std::set<std::string> deletes;
+        if (read_tail(store_file(manifest_path, manifest.tail), puts, deletes) != 0) {
+            return -1;
+        }
+        tail_layer(puts, deletes, layers.back());
+    }
+    return 0;
+}
+
+/*
+  Merges sorted layers, oldest first, into the live rows sorted by name: for
+  each name the row of the newest layer that has it, unless a newer layer
+  deletes it. Rows are moved out of the layers; names keep pointing into
+  the layers' arenas, and each layer counts the rows it gave in live.
+ */
+static void merge_layers(std::vector<SegmentLayer> &layers, std::vector<char *> &filenames,
+                         std::vector<std::vector<float>> &data) {
+    INSTRUMENT_SCOPE("segment_merge");
+    filenames.clear();
+    data.clear();
+    std::vector<size_t> cursor(layers.size(), 0);
+    while (true) {
+        const char *smallest = nullptr;
+        for (size_t l = 0; l < layers.size(); l++) {
+            if (cursor[l] < layers[l].names.size() &&
+                (smallest == nullptr || strcmp(layers[l].names[cursor[l]], smallest) < 0)) {
+                smallest = layers[l].names[cursor[l]];
+            }
+        }
+        if (smallest == nullptr) break;
+
+        // the newest layer with this name wins, older copies are dropped
+        int newest = -1;
+        for (size_t l = 0; l < layers.size(); l++) {
+            if (cursor[l] < layers[l].names.size() && strcmp(layers[l].names[cursor[l]], smallest) == 0) {
+                if (newest >= 0) cursor[newest]++;
+                newest = static_cast<int>(l);
+            }
+        }
+        char *name = layers[newest].names[cursor[newest]];
+        bool deleted = false;
+        for (size_t l = newest + 1; l < layers.size() && !deleted; l++) {
+            deleted = layers[l].deleted.count(name) > 0;
+        }
+        if (!deleted) {
+            filenames.push_back(name);
+            data.push_back(std::move(layers[newest].rows[cursor[newest]]));
+            layers[newest].live++;
+        }
+        cursor[newest]++;
+    }
+}
+
+int read_segment_store(const char *path, std::vector<char *> &filenames, std::vector<std::vector<float>> &data) {
+    INSTRUMENT_SCOPE("segment_read");
+    for (int attempt = 0; attempt < SNAPSHOT_ATTEMPTS; attempt++) {
+        SegmentManifest manifest;
+        if (read_segment_manifest(path, manifest) != 0) {
+            fprintf(stderr, "Can not read segment manifest %s\n", path);
+            return -1;
+        }
+        std::vector<SegmentLayer> layers;
+        if (read_layers(path, manifest, true, layers) == 0) {
+            merge_layers(layers, filenames, data);
+            // the returned names keep the other layers' arenas alive, these are not referenced
+            for (SegmentLayer &layer : layers) {
+                if (layer.live == 0) release_names(layer.names);
+            }
+            printf("Read %zu rows from %zu segments of %s (version %llu)\n", filenames.size(),
+                   manifest.segments.size(), path, (unsigned long long) manifest.version);
+            return 0;
+        }
+        for (SegmentLayer &layer : layers) release_names(layer.names);
+        // a file went missing: fine if a flush or compaction replaced this version meanwhile
+        SegmentManifest current;
+        if (read_segment_manifest(path, current) != 0 || current.version == manifest.version) {
+            fprintf(stderr, "Can not read the files of %s\n", path);
+            return -1;
+        }
+    }
+    fprintf(stderr, "%s keeps changing, giving up\n", path);
+    return -1;
+}
+
+// Takes a file number from the manifest; non-zero failure
+static int reserve_file_number(const char *path, int &number) {
+    ManifestLock lock(path);
+    SegmentManifest manifest;
+    if (!lock.ok() || read_segment_manifest(path, manifest) != 0) {
+        return -1;
+    }
+    number = manifest.next++;
+    manifest.version++;
+    return write_segment_manifest(path, manifest);
+}
+
+// Writes sorted rows as a segment store; non-zero failure
+static int write_segment(const std::string &path, int cols, const std::vector<char *> &names,
+                         const std::vector<std::vector<float>> &rows) {
+    FeatureStoreWriter store;
+    if (store.open(path.c_str(), cols, FEATURE_STORE_SORTED) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < names.size(); i++) {
+        if (static_cast<int>(rows[i].size()) != cols) {
+            fprintf(stderr, "%s has %zu values, the store has %d per row\n", names[i], rows[i].size(), cols);
+            return -1;
+        }
+        if (store.append(names[i], rows[i].data()) != 0) return -1;
+    }
+    return store.close();
+}
+
+static int write_tombstones(const std::string &path, const std::set<std::string> &deleted) {
+    std::string tmp_name = path + ".tmp";
+    FILE *fp = fopen(tmp_name.c_str(), "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to open %s\n", tmp_name.c_str());
+        return -1;
+    }
+    for (const std::string &name : deleted) {
+        fprintf(fp, "%s\n", name.c_str());
+    }
+    if (fsync_and_close(fp) != 0 || rename(tmp_name.c_str(), path.c_str()) != 0) {
+        fprintf(stderr, "Unable to write %s\n", path.c_str());
+        remove(tmp_name.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int compact_segment_store(const char *path, int &merged) {
+    INSTRUMENT_SCOPE("segment_compact");
+    merged = 0;
+    SegmentManifest snapshot;
+    {
+        ManifestLock lock(path);
+        if (!lock.ok() || read_segment_manifest(path, snapshot) != 0) {
+            return -1;
+        }
+    }
+    if (snapshot.segments.size() < 2 &&
+        (snapshot.segments.empty() || snapshot.segments[0].tombstones.empty())) {
+        return 0;
+    }
+
+    // the merged segments start with the oldest, so their tombstones have nothing left to delete
+    std::vector<SegmentLayer> layers;
+    if (read_layers(path, snapshot, false, layers) != 0) {
+        for (SegmentLayer &layer : layers) release_names(layer.names);
+        fprintf(stderr, "Can not read the segments of %s\n", path);
+        return -1;
+    }
+    std::vector<char *> names;
+    std::vector<std::vector<float>> rows;
+    merge_layers(layers, names, rows);
+
+    int number;
+    SegmentFiles compacted;
+    if (reserve_file_number(path, number) != 0) {
+        return -1;
+    }
+    compacted.store = new_file_name(path, "seg", number, ".bin");
+    int status = names.empty() ? 0 : write_segment(store_file(path, compacted.store), snapshot.cols, names, rows);
+    for (SegmentLayer &layer : layers) release_names(layer.names);
+    if (names.empty()) compacted.store.clear();
+    if (status != 0) {
+        return -1;
+    }
+
+    // swap it in for the segments it was made from, if nobody replaced them meanwhile
+    std::vector<std::string> old_files;
+    {
+        ManifestLock lock(path);
+        SegmentManifest current;
+        if (!lock.ok() || read_segment_manifest(path, current) != 0) {
+            return -1;
+        }
+        size_t count = snapshot.segments.size();
+        bool unchanged = current.segments.size() >= count;
+        for (size_t s = 0; unchanged && s < count; s++) {
+            unchanged = current.segments[s].store == snapshot.segments[s].store &&
+                        current.segments[s].tombstones == snapshot.segments[s].tombstones;
+        }
+        if (!unchanged) {
+            if (!compacted.store.empty()) ::remove(store_file(path, compacted.store).c_str());
+            return 0;
+        }
+        for (size_t s = 0; s < count; s++) {
+            old_files.push_back(current.segments[s].store);
+            old_files.push_back(current.segments[s].tombstones);
+        }
+        current.segments.erase(current.segments.begin(), current.segments.begin() + count);
+        if (!compacted.store.empty()) current.segments.insert(current.segments.begin(), compacted);
+        current.version++;
+        if (write_segment_manifest(path, current) != 0) {
+            if (!compacted.store.empty()) ::remove(store_file(path, compacted.store).c_str());
+            return -1;
+        }
+    }
+    remove_files(path, old_files);
+    merged = static_cast<int>(snapshot.segments.size());
+    return 0;
+}
+
+SegmentStoreWriter::~SegmentStoreWriter() {
+    if (tail_fp_) close();
+}
+
+int SegmentStoreWriter::open(const char *path, const SegmentStoreOptions &options) {
+    if (tail_fp_) return -1;
+    path_ = path;
+    options_ = options;
+
+    // one writer at a time; readers and compactors do not take this lock
+    std::string writer_lock = path_ + ".writer";
+    lock_fd_ = ::open(writer_lock.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd_ < 0 || flock(lock_fd_, LOCK_EX | LOCK_NB) != 0) {
+        fprintf(stderr, "%s is open by another writer\n", path);
+        if (lock_fd_ >= 0) ::close(lock_fd_);
+        lock_fd_ = -1;
+        return -1;
+    }
+
+    SegmentManifest manifest;
+    {
+        ManifestLock lock(path);
+        if (!lock.ok()) return -1;
+        int status = read_segment_manifest(path, manifest);
+        if (status < 0) return -1;
+        if (status == 1) {
+            // a new store: no segments and an empty tail
+            manifest.version = 1;
+            manifest.tail = new_file_name(path, "tail", manifest.next++, ".log");
+            FILE *fp = fopen(store_file(path, manifest.tail).c_str(), "w");
+            if (!fp || fsync_and_close(fp) != 0 || write_segment_manifest(path, manifest) != 0) {
+                fprintf(stderr, "Unable to create segment store %s\n", path);
+                return -1;
+            }
+        }
+    }
+    cols_ = manifest.cols;
+    tail_ = manifest.tail;
+    puts_.clear();
+    deletes_.clear();
+    std::string tail_path = store_file(path, tail_);
+    if (read_tail(tail_path, puts_, deletes_) != 0) {
+        return -1;
+    }
+    if (cols_ == 0 && !puts_.empty()) {
+        cols_ = static_cast<int>(puts_.begin()->second.size());
+    }
+    // a partly written last line left by a crash is cut off before appending
+    FILE *fp = fopen(tail_path.c_str(), "r+");
+    if (fp) {
+        long keep = 0;
+        int c;
+        for (long at = 0; (c = fgetc(fp)) != EOF; at++) {
+            if (c == '\n') keep = at + 1;
+        }
+        fclose(fp);
+        if (truncate(tail_path.c_str(), keep) != 0) {
+            fprintf(stderr, "Unable to repair %s\n", tail_path.c_str());
+            return -1;
+        }
+    }
+    tail_fp_ = fopen(tail_path.c_str(), "a");
+    if (!tail_fp_) {
+        fprintf(stderr, "Unable to open %s\n", tail_path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int SegmentStoreWriter::put(const char *name, const std::vector<float> &values) {
+    if (!tail_fp_ || name[0] == '\0' || strchr(name, ',') || strchr(name, '\n')) return -1;
+    if (cols_ == 0) cols_ = static_cast<int>(values.size());
+    if (static_cast<int>(values.size()) != cols_ || cols_ == 0) {
+        fprintf(stderr, "%s has %zu values, %s has %d per row\n", name, values.size(), path_.c_str(), cols_);
+        return -1;
+    }
+    // %.9g keeps every float exactly, unlike the 4 decimals of the CSV files
+    fprintf(tail_fp_, "+%s", name);
+    for (float value : values) {
+        fprintf(tail_fp_, ",%.9g", value);
+    }
+    fputc('\n', tail_fp_);
+    if (ferror(tail_fp_)) return -1;
+    deletes_.erase(name);
+    puts_[name] = values;
+    return 0;
+}
+
+int SegmentStoreWriter::remove(const char *name) {
+    if (!tail_fp_ || name[0] == '\0' || strchr(name, '\n')) return -1;
+    fprintf(tail_fp_, "-%s\n", name);
+    if (ferror(tail_fp_)) return -1;
+    puts_.erase(name);
+    deletes_.insert(name);
+    return 0;
+}
+
+int SegmentStoreWriter::sync() {
+    if (!tail_fp_) return -1;
+    if (fflush(tail_fp_) != 0 || fsync(fileno(tail_fp_)) != 0) {
+        fprintf(stderr, "Unable to write %s\n", tail_.c_str());
+        return -1;
+    }
+    if (puts_.size() + deletes_.size() >= options_.flush_rows && flush() != 0) {
+        return -1;
+    }
+    SegmentManifest manifest;
+    if (read_segment_manifest(path_.c_str(), manifest) != 0) {
+        return -1;
+    }
+    if (static_cast<int>(manifest.segments.size()) >= options_.compact_segments) {
+        return start_compaction();
+    }
+    return 0;
+}
+
+int SegmentStoreWriter::flush() {
+    if (!tail_fp_) return -1;
+    if (puts_.empty() && deletes_.empty()) return 0;
+    INSTRUMENT_SCOPE("segment_flush");
+    if (fflush(tail_fp_) != 0) return -1;
+
+    int number;
+    if (reserve_file_number(path_.c_str(), number) != 0) {
+        return -1;
+    }
+    SegmentFiles segment;
+    std::string new_tail = new_file_name(path_.c_str(), "tail", number, ".log");
+    if (!puts_.empty()) {
+        segment.store = new_file_name(path_.c_str(), "seg", number, ".bin");
+        std::vector<char *> names;
+        std::vector<std::vector<float>> rows;
+        for (auto &item : puts_) {
+            names.push_back(const_cast<char *>(item.first.c_str()));
+            rows.push_back(item.second);
+        }
+        if (write_segment(store_file(path_.c_str(), segment.store), cols_, names, rows) != 0) {
+            return -1;
+        }
+    }
+    if (!deletes_.empty()) {
+        segment.tombstones = new_file_name(path_.c_str(), "seg", number, ".del");
+        if (write_tombstones(store_file(path_.c_str(), segment.tombstones), deletes_) != 0) {
+            return -1;
+        }
+    }
+    FILE *fp = fopen(store_file(path_.c_str(), new_tail).c_str(), "w");
+    if (!fp || fsync_and_close(fp) != 0) {
+        fprintf(stderr, "Unable to create %s\n", new_tail.c_str());
+        return -1;
+    }
+
+    // the segment replaces the tail in one manifest version
+    {
+        ManifestLock lock(path_.c_str());
+        SegmentManifest manifest;
+        if (!lock.ok() || read_segment_manifest(path_.c_str(), manifest) != 0) {
+            return -1;
+        }
+        manifest.segments.push_back(segment);
+        manifest.tail = new_tail;
+        if (manifest.cols == 0) manifest.cols = cols_;
+        manifest.version++;
+        if (write_segment_manifest(path_.c_str(), manifest) != 0) {
+            return -1;
+        }
+    }
+    fclose(tail_fp_);
+    remove_files(path_.c_str(), {tail_});
+    tail_ = new_tail;
+    tail_fp_ = fopen(store_file(path_.c_str(), tail_).c_str(), "a");
+    if (!tail_fp_) {
+        fprintf(stderr, "Unable to open %s\n", tail_.c_str());
+        return -1;
+    }
+    puts_.clear();
+    deletes_.clear();
+    return 0;
+}
+
+int SegmentStoreWriter::start_compaction() {
+    if (compacting_) return 0;
+    join_compaction();
+    if (compaction_status_ != 0) {
+        fprintf(stderr, "The last compaction of %s failed\n", path_.c_str());
+        compaction_status_ = 0;
+    }
+    auto compact = [this]() {
+        int merged;
+        compaction_status_ = compact_segment_store(path_.c_str(), merged);
+        compacting_ = false;
+    };
+    compacting_ = true;
+    if (!options_.background) {
+        compact();
+        return compaction_status_;
+    }
+    compactor_ = std::thread(compact);
+    return 0;
+}
+
+void SegmentStoreWriter::join_compaction() {
+    if (compactor_.joinable()) compactor_.join();
+}
+
+int SegmentStoreWriter::close() {
+    if (!tail_fp_) return -1;
+    int status = sync();
+    join_compaction();
+    if (compaction_status_ != 0) status = -1;
+    if (fsync_and_close(tail_fp_) != 0) status = -1;
+    tail_fp_ = nullptr;
+    if (lock_fd_ >= 0) ::close(lock_fd_);
+    lock_fd_ = -1;
+    return status;
+}
@@ -0,0 +1,149 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 5, 2025
+ * Purpose: Load rows into a segment store, delete images from it, flush its
+ * tail, compact its segments and report what it holds
+ */
+#include "../include/segment_store.h"
+#include "../include/feature_store.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Puts every row of a feature file into the store, replacing rows of the same names
+static int import_feature_file(const char *input, const char *store_path) {
+    auto start = chrono::steady_clock::now();
+    vector<char *> filenames;
+    vector<vector<float>> data;
+    if (read_feature_file(input, filenames, data) != 0) {
+        printf("Can not read the feature file: %s\n", input);
+        return -1;
+    }
+    SegmentStoreWriter store;
+    if (store.open(store_path) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < filenames.size(); i++) {
+        if (store.put(filenames[i], data[i]) != 0) {
+            fprintf(stderr, "Error: Failed to add %s to %s\n", filenames[i], store_path);
+            return -1;
+        }
+    }
+    // a bulk load goes straight to a segment
+    if (store.flush() != 0 || store.close() != 0) {
+        return -1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("Imported %zu rows of %s into %s in %.1f s\n", filenames.size(), input, store_path, seconds);
+    return 0;
+}
+
+// Adds a tombstone for every name
+static int delete_names(const char *store_path, int count, char *names[]) {
+    SegmentStoreWriter store;
+    if (store.open(store_path) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (store.remove(names[i]) != 0) {
+            return -1;
+        }
+    }
+    return store.close();
+}
+
+// Turns the tail into a segment
+static int flush_tail(const char *store_path) {
+    SegmentStoreWriter store;
+    if (store.open(store_path) != 0 || store.flush() != 0) {
+        return -1;
+    }
+    return store.close();
+}
+
+static int compact_store(const char *store_path) {
+    auto start = chrono::steady_clock::now();
+    int merged;
+    if (compact_segment_store(store_path, merged) != 0) {
+        return -1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (merged == 0) {
+        printf("%s has nothing to compact\n", store_path);
+    } else {
+        printf("Compacted %d segments of %s in %.1f s\n", merged, store_path, seconds);
+    }
+    return 0;
+}
+
+// Prints the manifest version, the rows of every segment and the live rows
+static int print_store_info(const char *store_path) {
+    SegmentManifest manifest;
+    if (read_segment_manifest(store_path, manifest) != 0) {
+        printf("Can not read segment manifest %s\n", store_path);
+        return -1;
+    }
+    printf("%s: version %llu, %zu segments, %d values per row\n", store_path,
+           (unsigned long long) manifest.version, manifest.segments.size(), manifest.cols);
+    const char *slash = strrchr(store_path, '/');
+    string dir = slash ? string(store_path, slash + 1) : string();
+    for (size_t s = 0; s < manifest.segments.size(); s++) {
+        const SegmentFiles &segment = manifest.segments[s];
+        FeatureStoreHeader header;
+        unsigned long long rows = 0;
+        if (!segment.store.empty() && read_feature_store_header((dir + segment.store).c_str(), header) == 0) {
+            rows = header.rows;
+        }
+        printf("  %zu %s: %llu rows%s%s\n", s, segment.store.empty() ? "-" : segment.store.c_str(), rows,
+               segment.tombstones.empty() ? "" : ", deletes in ", segment.tombstones.c_str());
+    }
+    vector<char *> filenames;
+    vector<vector<float>> data;
+    if (read_segment_store(store_path, filenames, data) != 0) {
+        return -1;
+    }
+    printf("  tail %s\n  %zu live rows\n", manifest.tail.c_str(), filenames.size());
+    return 0;
+}
+
+static void usage(const char *prog) {
+    printf("usage: %s import <feature_file> <store.lsm>\n", prog);
+    printf("       %s delete <store.lsm> <image_filename>...\n", prog);
+    printf("       %s flush <store.lsm>\n", prog);
+    printf("       %s compact <store.lsm>\n", prog);
+    printf("       %s info <store.lsm>\n", prog);
+}
+
+/**
+ * @brief Entry point.
+ *
+ * A segment store is created by its first import, or by
+ * Proj2-offline_loading <dir> <store.lsm> <feature>, which keeps it up to
+ * date with puts and deletes instead of rewriting it. Compaction runs on its
+ * own while a writer ingests; compact runs it by hand, next to writers and
+ * readers.
+ */
+int main(int argc, char *argv[]) {
+    if (argc >= 4 && strcmp(argv[1], "import") == 0) {
+        return import_feature_file(argv[2], argv[3]) == 0 ? 0 : -1;
+    }
+    if (argc >= 4 && strcmp(argv[1], "delete") == 0) {
+        return delete_names(argv[2], argc - 3, argv + 3) == 0 ? 0 : -1;
+    }
+    if (argc >= 3 && strcmp(argv[1], "flush") == 0) {
+        return flush_tail(argv[2]) == 0 ? 0 : -1;
+    }
+    if (argc >= 3 && strcmp(argv[1], "compact") == 0) {
+        return compact_store(argv[2]) == 0 ? 0 : -1;
+    }
+    if (argc >= 3 && strcmp(argv[1], "info") == 0) {
+        return print_store_info(argv[2]) == 0 ? 0 : -1;
+    }
+    usage(argv[0]);
+    exit(-1);
+}
@@ -0,0 +1,184 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 3, 2025
+ * Purpose: Split a feature file into shards listed in a shard manifest, and
+ * report how the rows of a sharded feature file are spread
+ */
+#include "../include/feature_shards.h"
+#include "../include/feature_store.h"
+#include "../include/csv_util.h"
+#include "../include/manifest.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// File name without its directory, the key rows are assigned to shards by
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+// Writes the given rows, in order, as one shard file in the input's format
+static int write_shard(const string &path, bool binary, const vector<char *> &filenames,
+                       vector<vector<float>> &data, const vector<int> &rows, int cols) {
+    if (binary) {
+        // rows stay in the loaded order, which is sorted by name
+        FeatureStoreWriter store;
+        if (store.open(path.c_str(), cols, FEATURE_STORE_SORTED) != 0) return -1;
+        for (int row : rows) {
+            if (store.append(filenames[row], data[row].data()) != 0) return -1;
+        }
+        return store.close();
+    }
+    string tmp_name = path + ".tmp";
+    FILE *fp = fopen(tmp_name.c_str(), "w");
+    if (!fp) {
+        printf("Unable to open output file %s\n", tmp_name.c_str());
+        return -1;
+    }
+    for (int row : rows) {
+        if (write_image_data_row(fp, filenames[row], data[row]) != 0) {
+            fclose(fp);
+            remove(tmp_name.c_str());
+            return -1;
+        }
+    }
+    if (fsync_and_close(fp) != 0 || rename(tmp_name.c_str(), path.c_str()) != 0) {
+        fprintf(stderr, "Error: Failed to write '%s'\n", path.c_str());
+        remove(tmp_name.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/*
+  Splits a feature file into count shards. The hash scheme spreads the rows
+  evenly whatever their names; the range scheme cuts the rows, ordered by file
+  name, into count runs of about the same size, so a shard covers a contiguous
+  slice of the catalog. The manifest is written after every shard file.
+ */
+static int split_feature_file(const char *input, const char *manifest_path, int count, ShardScheme scheme) {
+    auto start = chrono::steady_clock::now();
+    vector<char *> filenames;
+    vector<vector<float>> data;
+    if (read_feature_file(input, filenames, data) != 0) {
+        printf("Can not read the feature file: %s\n", input);
+        return -1;
+    }
+    bool binary = is_feature_store(input);
+    int cols = data.empty() ? 0 : static_cast<int>(data[0].size());
+
+    ShardManifest manifest;
+    make_hash_manifest(manifest_path, count, binary ? ".bin" : ".csv", manifest);
+    manifest.scheme = scheme;
+    vector<vector<int>> rows(count);
+    if (scheme == ShardScheme::RANGE) {
+        vector<int> order(filenames.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = static_cast<int>(i);
+        stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            return strcmp(base_name(filenames[a]), base_name(filenames[b])) < 0;
+        });
+        size_t begin = 0;
+        for (int s = 0; s < count; s++) {
+            size_t end = s == count - 1 ? order.size() : max(begin, order.size() * (s + 1) / count);
+            // a name never straddles two shards
+            while (end > begin && end < order.size() &&
+                   strcmp(base_name(filenames[order[end]]), base_name(filenames[order[end - 1]])) == 0) {
+                end++;
+            }
+            if (s > 0) {
+                // every shard after the first is bounded by its smallest name
+                if (begin >= order.size()) {
+                    printf("%s has too few distinct names for %d range shards\n", input, count);
+                    return -1;
+                }
+                manifest.firsts[s] = base_name(filenames[order[begin]]);
+            }
+            rows[s].assign(order.begin() + begin, order.begin() + end);
+            sort(rows[s].begin(), rows[s].end());
+            begin = end;
+        }
+    } else {
+        for (size_t i = 0; i < filenames.size(); i++) {
+            rows[shard_of(manifest, filenames[i])].push_back(static_cast<int>(i));
+        }
+    }
+
+    for (int s = 0; s < count; s++) {
+        string path = shard_file(manifest_path, manifest, s);
+        if (write_shard(path, binary, filenames, data, rows[s], cols) != 0) {
+            return -1;
+        }
+        printf("Shard %d: %zu rows -> %s\n", s, rows[s].size(), path.c_str());
+    }
+    if (write_shard_manifest(manifest_path, manifest) != 0) {
+        return -1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("Split %zu rows of %s into %d %s shards in %.1f s\n", filenames.size(), input, count,
+           scheme == ShardScheme::RANGE ? "range" : "hash", seconds);
+    return 0;
+}
+
+// Loads every shard and prints its row count and share of the catalog
+static int print_shard_info(const char *manifest_path) {
+    ShardedStore shards;
+    if (load_shards(manifest_path, shards) != 0) {
+        return -1;
+    }
+    bool range = shards.manifest.scheme == ShardScheme::RANGE;
+    printf("%s: %d %s shards, %zu rows of %d values\n", manifest_path, shards.manifest.count(),
+           range ? "range" : "hash", shards.rows(), shards.cols());
+    for (int s = 0; s < shards.manifest.count(); s++) {
+        double share = shards.rows() ? 100.0 * shards.stores[s].rows / shards.rows() : 0.0;
+        printf("  %d %s: %d rows (%.1f%%)", s, shard_file(manifest_path, shards.manifest, s).c_str(),
+               shards.stores[s].rows, share);
+        if (range && s > 0) printf(" from %s", shards.manifest.firsts[s].c_str());
+        printf("\n");
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    printf("usage: %s split <feature_file> <shard_manifest> <shards> [hash|range]\n", prog);
+    printf("       %s info <shard_manifest>\n", prog);
+}
+
+/**
+ * @brief Entry point.
+ *
+ * split: writes the rows of a feature file (CSV or binary store) into shards
+ * of the same format next to the manifest, e.g. fv4.shards -> fv4.0.csv,
+ * fv4.1.csv, ... A shard can later be rebuilt from the images on its own with
+ * Proj2-offline_loading <dir> <shard_manifest> <feature> --shard <i>/<n>.
+ *
+ * info: prints the rows held by each shard.
+ */
+int main(int argc, char *argv[]) {
+    if (argc >= 5 && strcmp(argv[1], "split") == 0) {
+        int count = atoi(argv[4]);
+        ShardScheme scheme = ShardScheme::HASH;
+        if (argc > 5 && strcmp(argv[5], "range") == 0) {
+            scheme = ShardScheme::RANGE;
+        } else if (argc > 5 && strcmp(argv[5], "hash") != 0) {
+            usage(argv[0]);
+            exit(-1);
+        }
+        if (count <= 0) {
+            printf("Invalid shard count %s\n", argv[4]);
+            exit(-1);
+        }
+        return split_feature_file(argv[2], argv[3], count, scheme) == 0 ? 0 : -1;
+    }
+    if (argc >= 3 && strcmp(argv[1], "info") == 0) {
+        return print_shard_info(argv[2]) == 0 ? 0 : -1;
+    }
+    usage(argv[0]);
+    exit(-1);
+}
@@ -0,0 +1,267 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 4, 2025
+ * Purpose: Top-N search that streams a binary feature store from disk, for
+ * catalogs larger than memory
+ */
+
+#include "../include/stream_scan.h"
+#include "../include/bounded_queue.h"
+#include "../include/feature_store.h"
+#include "../include/instrument.h"
+#include "../include/topn_select.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+
+// Names are streamed in blocks of this size when a store is not sorted
+static const size_t NAME_BLOCK = 1 << 20;
+
+// A store opened for positioned reads
+struct StoreFile {
+    int fd = -1;
+    FeatureStoreHeader header;
+
+    ~StoreFile() {
+        if (fd >= 0) close(fd);
+    }
+    // byte offset of the first file name, after the offsets table
+    uint64_t strings_offset() const { return header.names_offset + (header.rows + 1) * sizeof(uint64_t); }
+};
+
+static int open_store(const char *path, StoreFile &store) {
+    if (read_feature_store_header(path, store.header) != 0) {
+        return -1;
+    }
+    store.fd = open(path, O_RDONLY);
+    if (store.fd < 0) {
+        fprintf(stderr, "Unable to open feature store %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// pread the whole range, retrying short reads
+static int read_all(int fd, void *data, size_t length, uint64_t offset) {
+    char *p = static_cast<char *>(data);
+    while (length > 0) {
+        ssize_t n = pread(fd, p, length, static_cast<off_t>(offset));
+        if (n <= 0) return -1;
+        p += n;
+        length -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return 0;
+}
+
+// Reads the name of one row through the offsets table
+static int read_name(const StoreFile &store, int64_t row, std::string &name) {
+    uint64_t range[2];
+    if (read_all(store.fd, range, sizeof(range), store.header.names_offset + row * sizeof(uint64_t)) != 0 ||
+        range[1] <= range[0] || range[1] > store.header.names_bytes) {
+        return -1;
+    }
+    name.resize(range[1] - range[0]);
+    if (read_all(store.fd, &name[0], name.size(), store.strings_offset() + range[0]) != 0) {
+        return -1;
+    }
+    name.resize(name.size() - 1); // the terminating NUL
+    return 0;
+}
+
+int find_store_row(const char *path, const char *name, int64_t &row) {
+    StoreFile store;
+    if (open_store(path, store) != 0) {
+        return -1;
+    }
+    row = -1;
+    std::string probe;
+    if (store.header.flags & FEATURE_STORE_SORTED) {
+        int64_t low = 0, high = static_cast<int64_t>(store.header.rows);
+        while (low < high) {
+            int64_t mid = low + (high - low) / 2;
+            if (read_name(store, mid, probe) != 0) return -1;
+            int order = strcmp(probe.c_str(), name);
+            if (order == 0) {
+                row = mid;
+                return 0;
+            }
+            if (order < 0) low = mid + 1;
+            else high = mid;
+        }
+        return 1;
+    }
+
+    // names follow each other NUL-terminated in row order, so count them while streaming
+    std::vector<char> block(NAME_BLOCK);
+    int64_t current = 0;
+    probe.clear();
+    for (uint64_t done = 0; done < store.header.names_bytes;) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(block.size(), store.header.names_bytes - done));
+        if (read_all(store.fd, block.data(), length, store.strings_offset() + done) != 0) return -1;
+        for (size_t i = 0; i < length; i++) {
+            if (block[i] != '\0') {
+                probe.push_back(block[i]);
+                continue;
+            }
+            if (probe == name) {
+                row = current;
+                return 0;
+            }
+            probe.clear();
+            current++;
+        }
+        done += length;
+    }
+    return 1;
+}
+
+int read_store_row(const char *path, int64_t row, std::vector<float> &values) {
+    StoreFile store;
+    if (open_store(path, store) != 0) {
+        return -1;
+    }
+    if (row < 0 || static_cast<uint64_t>(row) >= store.header.rows) {
+        return -1;
+    }
+    values.resize(store.header.cols);
+    uint64_t row_bytes = static_cast<uint64_t>(store.header.cols) * sizeof(float);
+    return read_all(store.fd, values.data(), row_bytes, sizeof(FeatureStoreHeader) + row * row_bytes);
+}
+
+int read_store_names(const char *path, const std::vector<int64_t> &rows, std::vector<std::string> &names) {
+    StoreFile store;
+    if (open_store(path, store) != 0) {
+        return -1;
+    }
+    names.assign(rows.size(), std::string());
+    for (size_t i = 0; i < rows.size(); i++) {
+        if (rows[i] < 0 || static_cast<uint64_t>(rows[i]) >= store.header.rows ||
+            read_name(store, rows[i], names[i]) != 0) {
+            fprintf(stderr, "Can not read the name of row %lld of %s\n", (long long) rows[i], path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// A filled chunk buffer, handed from the reader to the scoring threads
+struct StreamChunk {
+    int buffer;
+    int64_t first_row;
+    int rows;
+};
+
+int stream_find_topN(const char *path, const float *target, int dims, int64_t exclude_row, BatchMetric metric,
+                     int segments, int N, const StreamScanOptions &options,
+                     std::vector<std::pair<float, int64_t>> &result, StreamScanStats &stats) {
+    result.clear();
+    stats = StreamScanStats();
+    StoreFile store;
+    if (open_store(path, store) != 0) {
+        return -1;
+    }
+    const FeatureStoreHeader &header = store.header;
+    if (static_cast<int>(header.cols) != dims) {
+        fprintf(stderr, "Error: target has %d values, %s has %u per row\n", dims, path, header.cols);
+        return -1;
+    }
+    if (metric == BatchMetric::HISTOGRAM && (segments < 1 || segments > dims)) {
+        fprintf(stderr, "Error: invalid histogram segment count %d\n", segments);
+        return -1;
+    }
+    if (N <= 0 || header.rows == 0) {
+        return N <= 0 ? -1 : 0;
+    }
+
+    const uint64_t values_bytes = header.rows * header.cols * sizeof(float);
+    posix_fadvise(store.fd, sizeof(header), static_cast<off_t>(values_bytes), POSIX_FADV_SEQUENTIAL);
+
+    const size_t row_bytes = static_cast<size_t>(dims) * sizeof(float);
+    const int chunk_rows = static_cast<int>(std::max<size_t>(1, std::min<size_t>(options.chunk_bytes / row_bytes,
+                                                                                  1 << 30)));
+    const int buffers = std::max(1, options.read_ahead) + 1;
+    int threads = options.threads > 0 ? options.threads : static_cast<int>(std::thread::hardware_concurrency());
+    threads = std::max(1, threads);
+
+    std::vector<std::vector<float>> chunks(buffers, std::vector<float>(static_cast<size_t>(chunk_rows) * dims));
+    BoundedQueue<int> free_buffers(buffers);
+    BoundedQueue<StreamChunk> filled(buffers);
+    for (int b = 0; b < buffers; b++) free_buffers.push(b);
+
+    // the reader runs ahead of the scoring threads by up to read_ahead chunks
+    std::atomic<bool> read_failed(false);
+    auto start = std::chrono::steady_clock::now();
+    std::thread reader([&]() {
+        instrument_thread_name("stream_read");
+        for (uint64_t first = 0; first < header.rows; first += chunk_rows) {
+            int buffer;
+            if (!free_buffers.pop(buffer)) break;
+            int rows = static_cast<int>(std::min<uint64_t>(chunk_rows, header.rows - first));
+            INSTRUMENT_SCOPE("stream_read");
+            if (read_all(store.fd, chunks[buffer].data(), static_cast<size_t>(rows) * row_bytes,
+                         sizeof(header) + first * row_bytes) != 0) {
+                fprintf(stderr, "%s is truncated\n", path);
+                read_failed = true;
+                break;
+            }
+            if (!filled.push({buffer, static_cast<int64_t>(first), rows})) break;
+        }
+        filled.close();
+    });
+
+    // every scoring thread keeps its own selection across chunks
+    std::vector<BasicTopNSelector<int64_t>> selectors(threads, BasicTopNSelector<int64_t>(N));
+    auto score_rows = [&](const StreamChunk &chunk, int t, int begin, int end) {
+        const float *values = chunks[chunk.buffer].data();
+        BasicTopNSelector<int64_t> &selector = selectors[t];
+        for (int r = begin; r < end; r++) {
+            int64_t row = chunk.first_row + r;
+            if (row == exclude_row) continue;
+            selector.push(batch_pair_distance(metric, segments, target, values + static_cast<size_t>(r) * dims,
+                                              dims), row);
+        }
+    };
+    StreamChunk chunk;
+    while (true) {
+        auto wait_start = std::chrono::steady_clock::now();
+        if (!filled.pop(chunk)) break;
+        stats.read_wait_seconds +=
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+        {
+            INSTRUMENT_SCOPE("stream_score");
+            int workers_needed = std::min(threads, chunk.rows);
+            int per_thread = (chunk.rows + workers_needed - 1) / workers_needed;
+            std::vector<std::thread> workers;
+            for (int t = 1; t < workers_needed; t++) {
+                int begin = t * per_thread, end = std::min(chunk.rows, begin + per_thread);
+                if (begin < end) workers.emplace_back(score_rows, chunk, t, begin, end);
+            }
+            score_rows(chunk, 0, 0, std::min(chunk.rows, per_thread));
+            for (std::thread &worker : workers) worker.join();
+        }
+        stats.rows += chunk.rows;
+        stats.bytes += static_cast<uint64_t>(chunk.rows) * row_bytes;
+        free_buffers.push(chunk.buffer);
+    }
+    free_buffers.close();
+    reader.join();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (read_failed) {
+        return -1;
+    }
+
+    BasicTopNSelector<int64_t> best(N);
+    std::vector<std::pair<float, int64_t>> kept;
+    for (const auto &selector : selectors) {
+        selector.sorted(kept);
+        for (const auto &match : kept) best.push(match.first, match.second);
+    }
+    best.sorted(result);
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 28, 2025
+ * Purpose: Generate synthetic catalogs for scale testing: feature stores of any
+ * size (CSV or binary) and directories of synthetic images
+ */
+#include "../include/synthetic.h"
+#include "../include/feature_store.h"
+#include "../include/feature_registry.h"
+#include "../include/csv_util.h"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Rows generated per thread between writes
+static const int CHUNK_ROWS = 4096;
+
+// Fills rows [first, first + count) of a chunk buffer, split over threads
+static void synthesize_chunk(const SyntheticFeature &feature, uint64_t first, int count, int threads,
+                             vector<float> &buffer) {
+    const int cols = feature.cols();
+    buffer.resize(static_cast<size_t>(count) * cols);
+    vector<thread> workers;
+    int per_thread = (count + threads - 1) / threads;
+    for (int t = 0; t < threads; t++) {
+        int begin = t * per_thread, end = min(count, begin + per_thread);
+        if (begin >= end) break;
+        workers.emplace_back([&, begin, end]() {
+            for (int r = begin; r < end; r++) {
+                synthesize_row(feature, first + r, buffer.data() + static_cast<size_t>(r) * cols);
+            }
+        });
+    }
+    for (thread &worker : workers) worker.join();
+}
+
+/*
+  Writes `rows` rows named <prefix>synth.<row>.jpg. The row numbers are zero
+  padded, so the names are already in the order the readers sort them into.
+ */
+static int generate_features(const string &name, uint64_t rows, const char *output, bool binary, int clusters,
+                             uint64_t seed, const string &prefix, int threads) {
+    SyntheticFeature feature;
+    if (init_synthetic_feature(feature, name, clusters, seed) != 0) {
+        printf("Unknown feature %s\n", name.c_str());
+        return -1;
+    }
+    const int cols = feature.cols();
+
+    FeatureStoreWriter store;
+    FILE *csv = nullptr;
+    if (binary) {
+        if (store.open(output, cols, FEATURE_STORE_SORTED) != 0) return -1;
+    } else {
+        csv = fopen(output, "w");
+        if (!csv) {
+            printf("Unable to open output file %s\n", output);
+            return -1;
+        }
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<float> buffer;
+    vector<float> row(cols);
+    char filename[512];
+    uint64_t chunk_rows = static_cast<uint64_t>(CHUNK_ROWS) * threads;
+    for (uint64_t first = 0; first < rows; first += chunk_rows) {
+        int count = static_cast<int>(min<uint64_t>(chunk_rows, rows - first));
+        synthesize_chunk(feature, first, count, threads, buffer);
+        for (int r = 0; r < count; r++) {
+            snprintf(filename, sizeof(filename), "%ssynth.%09llu.jpg", prefix.c_str(),
+                     static_cast<unsigned long long>(first + r));
+            const float *values = buffer.data() + static_cast<size_t>(r) * cols;
+            int status;
+            if (binary) {
+                status = store.append(filename, values);
+            } else {
+                row.assign(values, values + cols);
+                status = write_image_data_row(csv, filename, row);
+            }
+            if (status != 0) {
+                if (csv) fclose(csv);
+                return -1;
+            }
+        }
+        if ((first / chunk_rows) % 64 == 63) {
+            printf("  %llu rows\n", static_cast<unsigned long long>(first + count));
+            fflush(stdout);
+        }
+    }
+    int status = binary ? store.close() : (fclose(csv) == 0 ? 0 : -1);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (status == 0) {
+        printf("Wrote %llu %s rows of %d values to %s in %.1f s\n", static_cast<unsigned long long>(rows),
+               name.c_str(), cols, output, seconds);
+    }
+    return status;
+}
+
+// Writes `count` JPEGs of width x height named synth.<n>.jpg into dir
+static int generate_images(const char *dir, int count, int width, int height, uint64_t seed, int threads) {
+    mkdir(dir, 0755);
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        printf("Cannot create directory %s\n", dir);
+        return -1;
+    }
+    auto start = chrono::steady_clock::now();
+    vector<int> failures(threads, 0);
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            char path[1024];
+            for (int i = t; i < count; i += threads) {
+                snprintf(path, sizeof(path), "%s/synth.%09d.jpg", dir, i);
+                cv::Mat image = synthesize_image(width, height, seed + i);
+                if (!cv::imwrite(path, image)) failures[t]++;
+            }
+        });
+    }
+    for (thread &worker : workers) worker.join();
+    int failed = 0;
+    for (int f : failures) failed += f;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("Wrote %d %dx%d images to %s in %.1f s", count - failed, width, height, dir, seconds);
+    if (failed) printf(", %d failed", failed);
+    printf("\n");
+    return failed ? -1 : 0;
+}
+
+static void usage(const char *prog) {
+    printf("usage: %s features <feature|resnet> <rows> <output> [--format bin|csv] [--clusters K] [--seed S]"
+           " [--prefix P] [--threads T]\n", prog);
+    printf("       %s images <dir> <count> <width>x<height> [--seed S] [--threads T]\n", prog);
+    printf("features:");
+    for (const FeatureInfo *info : list_features()) printf(" %s", info->name.c_str());
+    printf(" resnet\n");
+}
+
+/**
+ * @brief Entry point.
+ *
+ * features: writes a synthetic feature store. The default format is binary
+ * (see feature_store.h), which every loader also accepts; csv matches what
+ * Proj2-offline_loading writes. Rows are named <prefix>synth.<n>.jpg, with
+ * prefix defaulting to ../synthetic/ (empty for resnet, whose rows are bare
+ * names like ResNet18_olym.csv).
+ *
+ * images: writes a directory of synthetic JPEGs for the extraction tools.
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 5) {
+        usage(argv[0]);
+        exit(-1);
+    }
+    string mode = argv[1];
+    uint64_t seed = 1;
+    int clusters = 1000;
+    int threads = max(1u, thread::hardware_concurrency());
+    bool binary = true;
+    string prefix = "../synthetic/";
+    bool prefix_set = false;
+    for (int i = 5; i < argc; i++) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            binary = strcmp(argv[++i], "csv") != 0;
+        } else if (strcmp(argv[i], "--clusters") == 0 && i + 1 < argc) {
+            clusters = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--prefix") == 0 && i + 1 < argc) {
+            prefix = argv[++i];
+            prefix_set = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else {
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+
+    if (mode == "features") {
+        string name = argv[2];
+        long long rows = atoll(argv[3]);
+        if (rows <= 0) {
+            printf("Invalid row count %s\n", argv[3]);
+            exit(-1);
+        }
+        if (name == "resnet" && !prefix_set) prefix = "";
+        // accept feature numbers like the offline tool does
+        if (isdigit(static_cast<unsigned char>(name[0]))) {
+            const FeatureInfo *info = find_feature(atoi(name.c_str()));
+            if (info) name = info->name;
+        }
+        return generate_features(name, static_cast<uint64_t>(rows), argv[4], binary, clusters, seed, prefix,
+                                 threads) == 0 ? 0 : -1;
+    }
+    if (mode == "images") {
+        int count = atoi(argv[3]);
+        int width = 0, height = 0;
+        if (count <= 0 || sscanf(argv[4], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+            usage(argv[0]);
+            exit(-1);
+        }
+        return generate_images(argv[2], count, width, height, seed, threads) == 0 ? 0 : -1;
+    }
+    usage(argv[0]);
+    exit(-1);
+}
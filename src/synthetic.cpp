@@ -0,0 +1,130 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: February 28, 2025
+ * Purpose: Synthetic images and feature rows for scale testing
+ */
+
+#include "../include/synthetic.h"
+#include "../include/feature_registry.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// Spreads consecutive seeds over the whole state space (splitmix64)
+static uint64_t mix_seed(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+cv::Mat synthesize_image(int width, int height, uint64_t seed) {
+    cv::Mat image(height, width, CV_8UC3);
+    cv::RNG rng(mix_seed(seed));
+    rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+    cv::GaussianBlur(image, image, cv::Size(5, 5), 0);
+    for (int i = 0; i < 6; i++) {
+        cv::Point center(rng.uniform(0, width), rng.uniform(0, height));
+        int radius = rng.uniform(width / 40 + 1, width / 10 + 2);
+        cv::Scalar color = i % 2 ? cv::Scalar(0, 220, 230) : cv::Scalar(120, 150, 200);
+        cv::circle(image, center, radius, color, cv::FILLED);
+    }
+    return image;
+}
+
+int SyntheticFeature::cols() const {
+    int total = 0;
+    for (int length : segments) total += length;
+    return total;
+}
+
+// Dirichlet sample over n bins, alpha[i] = scale * base[i] + floor
+static void dirichlet(std::mt19937_64 &rng, const float *base, float scale, float floor, int n, float *out) {
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++) {
+        float alpha = (base ? scale * base[i] : 0.0f) + floor;
+        std::gamma_distribution<float> gamma(alpha, 1.0f);
+        out[i] = gamma(rng);
+        sum += out[i];
+    }
+    if (sum <= 0.0f) {
+        // every draw underflowed; put the mass in one bin
+        std::fill(out, out + n, 0.0f);
+        out[rng() % n] = 1.0f;
+        return;
+    }
+    for (int i = 0; i < n; i++) out[i] /= sum;
+}
+
+int init_synthetic_feature(SyntheticFeature &feature, const std::string &name, int clusters, uint64_t seed) {
+    feature = SyntheticFeature();
+    feature.name = name;
+    feature.clusters = std::max(1, clusters);
+    feature.seed = seed;
+    if (name == "resnet") {
+        feature.segments = {512};
+    } else {
+        const FeatureInfo *info = find_feature(name);
+        if (info == nullptr) return -1;
+        feature.segments = info->segments;
+    }
+
+    std::mt19937_64 rng(mix_seed(seed));
+    std::uniform_real_distribution<float> pixel(0.0f, 255.0f);
+    std::exponential_distribution<float> activation(1.0f);
+    feature.centers.assign(feature.clusters, std::vector<float>(feature.cols()));
+    for (auto &center : feature.centers) {
+        if (name == "7x7-square") {
+            for (float &v : center) v = pixel(rng);
+        } else if (name == "resnet") {
+            for (float &v : center) v = activation(rng);
+        } else {
+            // sparse histograms: a few dominant colors per cluster
+            int offset = 0;
+            for (int length : feature.segments) {
+                if (length > 1) dirichlet(rng, nullptr, 0.0f, 0.05f, length, center.data() + offset);
+                offset += length;
+            }
+        }
+    }
+    return 0;
+}
+
+void synthesize_row(const SyntheticFeature &feature, uint64_t row, float *out) {
+    std::mt19937_64 rng(mix_seed(feature.seed ^ mix_seed(row + 1)));
+    const std::vector<float> &center = feature.centers[rng() % feature.clusters];
+    const int cols = feature.cols();
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    if (feature.name == "7x7-square") {
+        for (int i = 0; i < cols; i++) out[i] = std::min(255.0f, std::max(0.0f, center[i] + 20.0f * noise(rng)));
+        return;
+    }
+    if (feature.name == "resnet") {
+        for (int i = 0; i < cols; i++) {
+            out[i] = std::max(0.0f, center[i] + (0.3f * center[i] + 0.05f) * noise(rng));
+        }
+        return;
+    }
+    if (feature.name == "banana") {
+        // no blob in most images: an all-zero histogram and a zero blob total
+        std::fill(out, out + cols, 0.0f);
+        if (uniform(rng) < 0.1f) {
+            dirichlet(rng, center.data(), 50.0f, 0.02f, cols - 1, out);
+            out[cols - 1] = std::floor(2000.0f + 38000.0f * uniform(rng));
+        }
+        return;
+    }
+
+    // histogram segments, with a leading face flag for the face feature
+    int offset = 0;
+    for (int length : feature.segments) {
+        if (length == 1) {
+            out[offset] = uniform(rng) < 0.2f ? 1.0f : 0.0f;
+        } else {
+            dirichlet(rng, center.data() + offset, 50.0f, 0.02f, length, out + offset);
+        }
+        offset += length;
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ * Authors: Yuyang Tian and Arun Mekkad
+ * Date: March 2, 2025
+ * Purpose: Thumbnails of a whole image directory in one memory-mapped pack,
+ * written by the offline tool and read by the result display
+ */
+
+#include "../include/thumbnail_pack.h"
+#include "../include/content_hash.h"
+#include "../include/pack_file.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+static PackFile thumbnail_pack;
+static bool pack_enabled = false;
+static int pack_width = 0, pack_height = 0;
+
+// Quality of the stored JPEGs; thumbnails are small, so this costs little space
+static const int THUMBNAIL_JPEG_QUALITY = 85;
+// Second seed, so the two key halves are independent hashes of the name
+static const uint64_t NAME_SEED_B = 0x7468756d626e6c73ULL;
+
+// Pack key of an image: its file name without the directory
+static void thumbnailKey(const char *filename, uint64_t &key_a, uint64_t &key_b) {
+    const char *slash = strrchr(filename, '/');
+    const char *name = slash ? slash + 1 : filename;
+    size_t length = strlen(name);
+    key_a = hash_bytes(name, length);
+    key_b = hash_bytes(name, length, NAME_SEED_B);
+}
+
+int setThumbnailPack(const char *path, bool writable, int width, int height) {
+    thumbnail_pack.close();
+    pack_enabled = false;
+    if (path == nullptr) {
+        return 0;
+    }
+    if (thumbnail_pack.open(path, writable) != 0) {
+        fprintf(stderr, "Unable to open thumbnail pack %s\n", path);
+        return -1;
+    }
+
+    // the box size is recorded once, when the pack is created
+    std::vector<unsigned char> meta;
+    int32_t size[2] = {width, height};
+    if (thumbnail_pack.lookup(0, 0, meta) && meta.size() == sizeof(size)) {
+        memcpy(size, meta.data(), sizeof(size));
+    } else if (!writable || width <= 0 || height <= 0 ||
+               thumbnail_pack.append(0, 0, size, sizeof(size)) != 0) {
+        fprintf(stderr, "%s is not a thumbnail pack\n", path);
+        thumbnail_pack.close();
+        return -1;
+    }
+    if (writable && (size[0] != width || size[1] != height)) {
+        printf("Thumbnail pack %s keeps its %dx%d thumbnails\n", path, size[0], size[1]);
+    }
+    pack_width = size[0];
+    pack_height = size[1];
+    pack_enabled = true;
+    printf("Thumbnail pack %s: %zu thumbnails of %dx%d\n", path, thumbnail_pack.size() - 1, pack_width,
+           pack_height);
+    return 0;
+}
+
+bool thumbnailPackEnabled() {
+    return pack_enabled;
+}
+
+void thumbnailPackSize(int &width, int &height) {
+    width = pack_width;
+    height = pack_height;
+}
+
+int makeThumbnail(const cv::Mat &image, int width, int height, std::vector<unsigned char> &jpeg) {
+    if (image.empty() || width <= 0 || height <= 0) {
+        return -1;
+    }
+    cv::Mat thumb = image;
+    double fit = std::min(width / (double) image.cols, height / (double) image.rows);
+    if (fit < 1.0) {
+        cv::Size fitted(std::max(1, cvRound(image.cols * fit)), std::max(1, cvRound(image.rows * fit)));
+        cv::resize(image, thumb, fitted, 0, 0, cv::INTER_AREA);
+    }
+    std::vector<int> params = {cv::IMWRITE_JPEG_QUALITY, THUMBNAIL_JPEG_QUALITY};
+    return cv::imencode(".jpg", thumb, jpeg, params) ? 0 : -1;
+}
+
+bool hasPackedThumbnail(const char *filename) {
+    if (!pack_enabled) return false;
+    uint64_t key_a, key_b;
+    thumbnailKey(filename, key_a, key_b);
+    return thumbnail_pack.contains(key_a, key_b);
+}
+
+bool lookupPackedThumbnailBytes(const char *filename, std::vector<unsigned char> &jpeg) {
+    if (!pack_enabled) return false;
+    uint64_t key_a, key_b;
+    thumbnailKey(filename, key_a, key_b);
+    return thumbnail_pack.lookup(key_a, key_b, jpeg);
+}
+
+bool lookupPackedThumbnail(const char *filename, cv::Mat &thumb) {
+    std::vector<unsigned char> jpeg;
+    if (!lookupPackedThumbnailBytes(filename, jpeg)) return false;
+    thumb = cv::imdecode(jpeg, cv::IMREAD_COLOR);
+    return !thumb.empty();
+}
+
+int storePackedThumbnail(const char *filename, const std::vector<unsigned char> &jpeg) {
+    if (!pack_enabled || jpeg.empty()) return -1;
+    uint64_t key_a, key_b;
+    thumbnailKey(filename, key_a, key_b);
+    return thumbnail_pack.append(key_a, key_b, jpeg.data(), jpeg.size());
+}